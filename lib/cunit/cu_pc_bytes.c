@@ -47,6 +47,7 @@ static PCBYTES initbytes(uint8_t *bytes, size_t size, uint32_t interp)
 	pcb.npoints = pcb.size / pc_interpretation_size(pcb.interpretation);
 	pcb.compression = PC_DIM_NONE;
 	pcb.readonly = PC_TRUE;
+	pcb.zdict = NULL;
 	return pcb;
 }
 
@@ -400,6 +401,451 @@ test_zlib_encoding()
 	pc_bytes_free(pcb2);
 }
 
+/*
+* Train a dictionary on a few columns, and check that
+* it helps compressing a small one.
+*/
+static void
+test_zlib_dictionary()
+{
+	int i, j;
+	int32_t samples[8][128];
+	int32_t small[64];
+	PCBYTES pcbs[8];
+	PCBYTES pcb, epcb, epcb2, pcb2;
+	PCZDICT *zdict;
+
+	for ( i = 0; i < 8; i++ )
+	{
+		for ( j = 0; j < 128; j++ )
+			samples[i][j] = 1000 + (j % 16) * 3 + i;
+		pcbs[i] = initbytes((uint8_t*)samples[i], sizeof(samples[i]), PC_INT32);
+	}
+	for ( j = 0; j < 64; j++ )
+		small[j] = 1000 + (j % 16) * 3 + 2;
+
+	zdict = pc_zdict_train(pcbs, 8, 4096);
+	CU_ASSERT(zdict != NULL);
+	CU_ASSERT(zdict->size <= 4096);
+	CU_ASSERT_EQUAL(zdict->size % 32, 0);
+
+	pcb = initbytes((uint8_t*)small, sizeof(small), PC_INT32);
+	epcb = pc_bytes_zlib_encode(pcb);
+	pcb.zdict = zdict;
+	epcb2 = pc_bytes_zlib_encode(pcb);
+	CU_ASSERT(epcb2.zdict == zdict);
+	CU_ASSERT(epcb2.size < epcb.size);
+
+	pcb2 = pc_bytes_zlib_decode(epcb2);
+	CU_ASSERT_EQUAL(pcb2.size, pcb.size);
+	CU_ASSERT_EQUAL(memcmp(pcb.bytes, pcb2.bytes, pcb.size), 0);
+
+	pc_bytes_free(epcb);
+	pc_bytes_free(epcb2);
+	pc_bytes_free(pcb2);
+	pc_zdict_free(zdict);
+
+	/* Too short to cut a segment */
+	pcbs[0].size = 16;
+	CU_ASSERT(pc_zdict_train(pcbs, 1, 4096) == NULL);
+}
+
+
+/*
+* Patched frame-of-reference round trips every interpretation,
+* and keeps outliers from widening the other values.
+*/
+static void
+check_pfor_encoding(uint8_t *vals, uint32_t nvals, uint32_t interp)
+{
+	int i;
+	uint8_t buf[8];
+	size_t sz = pc_interpretation_size(interp);
+	PCBYTES pcb = initbytes(vals, nvals * sz, interp);
+	PCBYTES epcb, dpcb, fpcb;
+	PCBITMAP *map1, *map2;
+	double min1, max1, avg1, min2, max2, avg2;
+	PCDIMENSION dim;
+	uint8_t *wkb;
+	size_t wkbsize;
+
+	epcb = pc_bytes_pfor_encode(pcb);
+	CU_ASSERT_EQUAL(epcb.compression, PC_DIM_PFOR);
+	CU_ASSERT_EQUAL(epcb.size, pc_bytes_pfor_encoded_size(&pcb));
+	dpcb = pc_bytes_pfor_decode(epcb);
+	CU_ASSERT_EQUAL(dpcb.size, pcb.size);
+	CU_ASSERT_EQUAL(memcmp(dpcb.bytes, pcb.bytes, pcb.size), 0);
+	pc_bytes_free(dpcb);
+
+	for ( i = 0; i < nvals; i++ )
+	{
+		pc_bytes_pfor_to_ptr(buf, &epcb, i);
+		CU_ASSERT_EQUAL(memcmp(buf, vals + i * sz, sz), 0);
+	}
+
+	/* Extremes from the block headers */
+	pc_bytes_minmax(&pcb, &min1, &max1, &avg1);
+	pc_bytes_minmax(&epcb, &min2, &max2, NULL);
+	CU_ASSERT_DOUBLE_EQUAL(min1, min2, 0.000001);
+	CU_ASSERT_DOUBLE_EQUAL(max1, max2, 0.000001);
+	pc_bytes_minmax(&epcb, &min2, &max2, &avg2);
+	CU_ASSERT_DOUBLE_EQUAL(avg1, avg2, 0.000001);
+
+	/* Blocks out of range are skipped */
+	map1 = pc_bytes_bitmap(&pcb, PC_BETWEEN, min1, (min1 + max1) / 2);
+	map2 = pc_bytes_bitmap(&epcb, PC_BETWEEN, min1, (min1 + max1) / 2);
+	CU_ASSERT_EQUAL(map1->nset, map2->nset);
+	CU_ASSERT_EQUAL(memcmp(map1->map, map2->map, nvals), 0);
+	fpcb = pc_bytes_filter(&epcb, map2, NULL);
+	CU_ASSERT_EQUAL(fpcb.compression, PC_DIM_PFOR);
+	CU_ASSERT_EQUAL(fpcb.npoints, map2->nset);
+	pc_bytes_free(fpcb);
+	pc_bitmap_free(map1);
+	pc_bitmap_free(map2);
+
+	/* Reading it byteswapped twice gives the encoding back */
+	memset(&dim, 0, sizeof(PCDIMENSION));
+	dim.interpretation = interp;
+	wkb = pcalloc(pc_bytes_serialized_size(&epcb));
+	for ( i = 0; i < 2; i++ )
+	{
+		pc_bytes_serialize(i ? &dpcb : &epcb, wkb, &wkbsize);
+		pc_flip_endian_strided(wkb + 1, 4, 4, 1);
+		if ( i ) pc_bytes_free(dpcb);
+		pc_bytes_deserialize(wkb, &dim, &dpcb, PC_FALSE, PC_TRUE);
+		dpcb.npoints = nvals;
+	}
+	CU_ASSERT_EQUAL(memcmp(dpcb.bytes, epcb.bytes, epcb.size), 0);
+	pc_bytes_free(dpcb);
+	pcfree(wkb);
+
+	pc_bytes_free(epcb);
+}
+
+static void
+test_pfor_encoding()
+{
+	int i;
+	uint8_t v8[300];
+	int16_t v16[300];
+	int32_t v32[1000];
+	int64_t v64[300];
+	float vf[300];
+	double vd[300];
+	PCBYTES pcb, epcb, spcb;
+
+	for ( i = 0; i < 300; i++ )
+	{
+		v8[i] = 200 + i % 7;
+		v16[i] = -300 + i;
+		v64[i] = ((int64_t)1 << 40) + i * 1000;
+		vf[i] = -1.5f + i * 0.25f;
+		vd[i] = 1000.0 - i * 0.125;
+	}
+	for ( i = 0; i < 1000; i++ )
+		v32[i] = 5000000 + (i % 100);
+
+	/* A few outliers */
+	v8[10] = 0;
+	v16[150] = 32767;
+	v32[0] = -2000000000;
+	v32[500] = 2000000000;
+	v64[299] = INT64_MIN;
+
+	check_pfor_encoding(v8, 300, PC_UINT8);
+	check_pfor_encoding((uint8_t*)v16, 300, PC_INT16);
+	check_pfor_encoding((uint8_t*)v32, 1000, PC_INT32);
+	check_pfor_encoding((uint8_t*)v64, 300, PC_INT64);
+	check_pfor_encoding((uint8_t*)vf, 300, PC_FLOAT);
+	check_pfor_encoding((uint8_t*)vd, 300, PC_DOUBLE);
+
+	/* The outliers make sigbits keep every bit, PFOR only 7 of them */
+	pcb = initbytes((uint8_t*)v32, sizeof(v32), PC_INT32);
+	epcb = pc_bytes_pfor_encode(pcb);
+	spcb = pc_bytes_sigbits_encode(pcb);
+	CU_ASSERT(epcb.size < 1100);
+	CU_ASSERT(epcb.size * 3 < spcb.size);
+	pc_bytes_free(spcb);
+	pc_bytes_free(epcb);
+
+	/* Nothing to encode */
+	pcb = initbytes((uint8_t*)v32, 0, PC_INT32);
+	epcb = pc_bytes_pfor_encode(pcb);
+	CU_ASSERT_EQUAL(epcb.size, 0);
+	pc_bytes_free(epcb);
+}
+
+/*
+* Blocks with a bad header, exception or size are rejected
+* before anything is read from them
+*/
+static void
+test_pfor_invalid()
+{
+	int i;
+	int32_t vals[300];
+	uint8_t buf[4 * 300];
+	PCBYTES pcb, epcb, bad, dpcb;
+	size_t exc;
+
+	for ( i = 0; i < 300; i++ )
+		vals[i] = 5000000 + (i % 100);
+	vals[3] = -2000000000;
+
+	pcb = initbytes((uint8_t*)vals, sizeof(vals), PC_INT32);
+	epcb = pc_bytes_pfor_encode(pcb);
+	CU_ASSERT(pc_bytes_pfor_is_valid(epcb.bytes, epcb.size, PC_INT32, 300));
+	CU_ASSERT_EQUAL(epcb.bytes[0], 128);
+	CU_ASSERT_EQUAL(epcb.bytes[2], 1);
+
+	bad = pc_bytes_clone(epcb);
+
+	/* More values than a block holds */
+	bad.bytes[0] = 255;
+	cu_error_msg_reset();
+	CU_ASSERT(! pc_bytes_pfor_is_valid(bad.bytes, bad.size, PC_INT32, 300));
+	CU_ASSERT_STRING_EQUAL(cu_error_msg, "pc_bytes_pfor_block_check: invalid block of 255 values of 7 bits");
+	cu_error_msg_reset();
+	CU_ASSERT_EQUAL(pc_bytes_decode_into(&bad, buf, sizeof(buf)), PC_FAILURE);
+	CU_ASSERT_STRING_EQUAL(cu_error_msg, "pc_bytes_pfor_block_check: invalid block of 255 values of 7 bits");
+	bad.bytes[0] = epcb.bytes[0];
+
+	/* Offsets wider than the values */
+	bad.bytes[1] = 33;
+	cu_error_msg_reset();
+	CU_ASSERT(! pc_bytes_pfor_is_valid(bad.bytes, bad.size, PC_INT32, 300));
+	CU_ASSERT_STRING_EQUAL(cu_error_msg, "pc_bytes_pfor_block_check: invalid block of 128 values of 33 bits");
+	bad.bytes[1] = epcb.bytes[1];
+
+	/* Exception past the values of the block */
+	exc = 3 + 3*4 + (128 * epcb.bytes[1] + 7) / 8;
+	CU_ASSERT_EQUAL(bad.bytes[exc], 3);
+	bad.bytes[exc] = 128;
+	cu_error_msg_reset();
+	CU_ASSERT(! pc_bytes_pfor_is_valid(bad.bytes, bad.size, PC_INT32, 300));
+	CU_ASSERT_STRING_EQUAL(cu_error_msg, "pc_bytes_pfor_block_check: exception at position 128 of a block of 128 values");
+	cu_error_msg_reset();
+	CU_ASSERT_EQUAL(pc_bytes_decode_into(&bad, buf, sizeof(buf)), PC_FAILURE);
+	cu_error_msg_reset();
+	dpcb = pc_bytes_decode(bad);
+	CU_ASSERT(dpcb.bytes == NULL);
+	CU_ASSERT_EQUAL(dpcb.size, 0);
+	cu_error_msg_reset();
+	pc_bytes_pfor_to_ptr(buf, &bad, 200);
+	CU_ASSERT_STRING_EQUAL(cu_error_msg, "pc_bytes_pfor_block_check: exception at position 128 of a block of 128 values");
+	bad.bytes[exc] = 3;
+
+	/* Truncated blocks, and blocks missing values */
+	cu_error_msg_reset();
+	CU_ASSERT(! pc_bytes_pfor_is_valid(bad.bytes, bad.size - 1, PC_INT32, 300));
+	CU_ASSERT_STRING_EQUAL(cu_error_msg, "pc_bytes_pfor_block_check: block overruns the buffer");
+	cu_error_msg_reset();
+	CU_ASSERT(! pc_bytes_pfor_is_valid(bad.bytes, 2, PC_INT32, 300));
+	CU_ASSERT_STRING_EQUAL(cu_error_msg, "pc_bytes_pfor_block_check: block header overruns the buffer");
+	cu_error_msg_reset();
+	CU_ASSERT(! pc_bytes_pfor_is_valid(bad.bytes, bad.size, PC_INT32, 301));
+	CU_ASSERT_STRING_EQUAL(cu_error_msg, "pc_bytes_pfor_is_valid: blocks hold 300 values instead of 301");
+	cu_error_msg_reset();
+
+	pc_bytes_free(bad);
+	pc_bytes_free(epcb);
+}
+
+static void
+test_serialize_to_sink()
+{
+	int i, c;
+	int32_t vals[1000];
+	int compressions[5] = { PC_DIM_NONE, PC_DIM_RLE, PC_DIM_SIGBITS, PC_DIM_ZLIB, PC_DIM_PFOR };
+	PCBYTES pcb, epcb;
+	PCSINK sink;
+	uint8_t *buf;
+	size_t size;
+
+	for ( i = 0; i < 1000; i++ )
+		vals[i] = 100000 + (i / 7) * 3;
+	pcb = initbytes((uint8_t*)vals, sizeof(vals), PC_INT32);
+
+	for ( c = 0; c < 5; c++ )
+	{
+		/* Start tiny, with something already in, so the sink has to grow */
+		pc_sink_init(&sink, 4);
+		memcpy(pc_sink_reserve(&sink, 3), "abc", 3);
+		sink.size += 3;
+		CU_ASSERT_EQUAL(pc_bytes_serialize_to_sink(&pcb, compressions[c], &sink), PC_SUCCESS);
+
+		epcb = pc_bytes_encode(pcb, compressions[c]);
+		buf = pcalloc(pc_bytes_serialized_size(&epcb));
+		pc_bytes_serialize(&epcb, buf, &size);
+		CU_ASSERT_EQUAL(sink.size, 3 + size);
+		CU_ASSERT(size <= pc_bytes_serialized_size_bound(&pcb, compressions[c]));
+		CU_ASSERT_EQUAL(memcmp(sink.bytes, "abc", 3), 0);
+		CU_ASSERT_EQUAL(memcmp(sink.bytes + 3, buf, size), 0);
+
+		/* Already encoded bytes go through as they are, or get re-encoded */
+		sink.size = 0;
+		pc_bytes_serialize_to_sink(&epcb, compressions[c], &sink);
+		CU_ASSERT_EQUAL(sink.size, size);
+		CU_ASSERT_EQUAL(memcmp(sink.bytes, buf, size), 0);
+		sink.size = 0;
+		pc_bytes_serialize_to_sink(&epcb, PC_DIM_NONE, &sink);
+		CU_ASSERT_EQUAL(sink.size, 5 + pcb.size);
+		CU_ASSERT_EQUAL(memcmp(sink.bytes + 5, vals, pcb.size), 0);
+
+		pcfree(buf);
+		pc_bytes_free(epcb);
+		pcfree(sink.bytes);
+	}
+}
+
+/*
+* Encoding and decoding into caller buffers gives the same bytes
+* as the allocating calls, reusing one scratch buffer throughout.
+*/
+static void
+test_encode_decode_into()
+{
+	int i, c;
+	int32_t vals[1000];
+	int compressions[5] = { PC_DIM_NONE, PC_DIM_RLE, PC_DIM_SIGBITS, PC_DIM_ZLIB, PC_DIM_PFOR };
+	PCBYTES pcb, epcb, ipcb, spcb;
+	PCSINK scratch;
+	uint8_t *ebuf, *dbuf, *sbuf = NULL;
+	size_t bound = 0;
+
+	for ( i = 0; i < 1000; i++ )
+		vals[i] = 100000 + (i / 7) * 3;
+	pcb = initbytes((uint8_t*)vals, sizeof(vals), PC_INT32);
+
+	for ( c = 0; c < 5; c++ )
+		if ( pc_bytes_encoded_size_bound(&pcb, compressions[c]) > bound )
+			bound = pc_bytes_encoded_size_bound(&pcb, compressions[c]);
+	ebuf = pcalloc(bound);
+	dbuf = pcalloc(pcb.size);
+	pc_sink_init(&scratch, 0);
+
+	for ( c = 0; c < 5; c++ )
+	{
+		epcb = pc_bytes_encode(pcb, compressions[c]);
+		ipcb = pcb;
+		ipcb.bytes = ebuf;
+		ipcb.compression = compressions[c];
+		CU_ASSERT_EQUAL(pc_bytes_encode_into(&pcb, compressions[c], ebuf, bound, &(ipcb.size)), PC_SUCCESS);
+		CU_ASSERT_EQUAL(ipcb.size, epcb.size);
+		CU_ASSERT_EQUAL(memcmp(ebuf, epcb.bytes, epcb.size), 0);
+
+		memset(dbuf, 0, pcb.size);
+		CU_ASSERT_EQUAL(pc_bytes_decode_into(&ipcb, dbuf, pcb.size), PC_SUCCESS);
+		CU_ASSERT_EQUAL(memcmp(dbuf, vals, pcb.size), 0);
+
+		/* The scratch buffer is allocated once and reused */
+		CU_ASSERT_EQUAL(pc_bytes_decode_scratch(&ipcb, &scratch, &spcb), PC_SUCCESS);
+		CU_ASSERT_EQUAL(spcb.compression, PC_DIM_NONE);
+		CU_ASSERT_EQUAL(spcb.size, pcb.size);
+		CU_ASSERT_EQUAL(memcmp(spcb.bytes, vals, pcb.size), 0);
+		if ( ! sbuf ) sbuf = scratch.bytes;
+		CU_ASSERT(spcb.bytes == sbuf);
+		pc_bytes_free(epcb);
+	}
+	pcfree(scratch.bytes);
+
+	/* Buffers too small are refused */
+	cu_error_msg_reset();
+	CU_ASSERT_EQUAL(pc_bytes_decode_into(&ipcb, dbuf, pcb.size - 1), PC_FAILURE);
+	CU_ASSERT_STRING_EQUAL(cu_error_msg, "pc_bytes_decode_into: buffer of 3999 bytes cannot hold the 4000 bytes of 1000 values");
+	cu_error_msg_reset();
+	CU_ASSERT_EQUAL(pc_bytes_encode_into(&pcb, PC_DIM_RLE, ebuf, 4999, &(ipcb.size)), PC_FAILURE);
+	CU_ASSERT_STRING_EQUAL(cu_error_msg, "pc_bytes_encode_into: buffer of 4999 bytes is smaller than the 5000 bytes the encoding may take");
+	cu_error_msg_reset();
+
+	/* Only raw values get encoded */
+	CU_ASSERT_EQUAL(pc_bytes_encode_into(&ipcb, PC_DIM_RLE, ebuf, bound, &(ipcb.size)), PC_FAILURE);
+	cu_error_msg_reset();
+
+	pcfree(ebuf);
+	pcfree(dbuf);
+}
+
+/*
+* Appending to encoded bytes gives the same values as encoding
+* the concatenation, whether or not the new values fit.
+*/
+static void
+check_bytes_append(uint8_t *vals, uint32_t nvals, uint32_t nbase, uint32_t interp, int fits)
+{
+	int c;
+	int compressions[5] = { PC_DIM_NONE, PC_DIM_RLE, PC_DIM_SIGBITS, PC_DIM_ZLIB, PC_DIM_PFOR };
+	size_t sz = pc_interpretation_size(interp);
+	PCBYTES all = initbytes(vals, nvals * sz, interp);
+	PCBYTES base = initbytes(vals, nbase * sz, interp);
+	PCBYTES add = initbytes(vals + nbase * sz, (nvals - nbase) * sz, interp);
+
+	for ( c = 0; c < 5; c++ )
+	{
+		PCBYTES epcb = pc_bytes_encode(base, compressions[c]);
+		PCBYTES apcb = pc_bytes_append(&epcb, &add);
+		PCBYTES dpcb = pc_bytes_decode(apcb);
+
+		CU_ASSERT_EQUAL(apcb.compression, compressions[c]);
+		CU_ASSERT_EQUAL(apcb.npoints, nvals);
+		CU_ASSERT_EQUAL(dpcb.size, all.size);
+		CU_ASSERT_EQUAL(memcmp(dpcb.bytes, all.bytes, all.size), 0);
+
+		/* Spliced sigbits keep the common bits of the base */
+		if ( compressions[c] == PC_DIM_SIGBITS )
+			CU_ASSERT_EQUAL(memcmp(apcb.bytes, epcb.bytes, 2 * sz) == 0, fits);
+
+		pc_bytes_free(dpcb);
+		pc_bytes_free(apcb);
+		pc_bytes_free(epcb);
+	}
+}
+
+static void
+test_bytes_append()
+{
+	int i;
+	uint8_t v8[300];
+	uint16_t v16[300];
+	int32_t v32[300];
+	double v64[300];
+	PCBYTES pcb, epcb, apcb;
+
+	for ( i = 0; i < 300; i++ )
+	{
+		v8[i] = 0x40 | (i % 13);
+		v16[i] = 0x1200 + i / 10;
+		v32[i] = 100000 + (i / 7) * 3;
+		v64[i] = 1.5 + (i % 3);
+	}
+
+	/* New values within the common bits */
+	check_bytes_append(v8, 300, 170, PC_UINT8, PC_TRUE);
+	check_bytes_append((uint8_t*)v16, 300, 290, PC_UINT16, PC_TRUE);
+	check_bytes_append((uint8_t*)v32, 300, 250, PC_INT32, PC_TRUE);
+	check_bytes_append((uint8_t*)v64, 300, 299, PC_DOUBLE, PC_TRUE);
+
+	/* And out of them */
+	v8[250] = 0xF0;
+	v16[299] = 0x8000;
+	v32[100] = -1;
+	v64[200] = -1.5;
+	check_bytes_append(v8, 300, 170, PC_UINT8, PC_FALSE);
+	check_bytes_append((uint8_t*)v16, 300, 290, PC_UINT16, PC_FALSE);
+	check_bytes_append((uint8_t*)v32, 300, 1, PC_INT32, PC_FALSE);
+	check_bytes_append((uint8_t*)v64, 300, 150, PC_DOUBLE, PC_FALSE);
+
+	/* Runs on both sides of the splice are joined */
+	pcb = initbytes((uint8_t*)"aaabb", 5, PC_UINT8);
+	epcb = pc_bytes_run_length_encode(pcb);
+	pcb = initbytes((uint8_t*)"bbbc", 4, PC_UINT8);
+	apcb = pc_bytes_append(&epcb, &pcb);
+	CU_ASSERT_EQUAL(apcb.size, 6);
+	CU_ASSERT_EQUAL(apcb.bytes[2], 5);
+	CU_ASSERT_EQUAL(apcb.bytes[3], 'b');
+	pc_bytes_free(apcb);
+	pc_bytes_free(epcb);
+}
 
 static void
 test_rle_filter()
@@ -528,6 +974,12 @@ CU_TestInfo bytes_tests[] = {
 	PC_TEST(test_run_length_encoding),
 	PC_TEST(test_sigbits_encoding),
 	PC_TEST(test_zlib_encoding),
+	PC_TEST(test_zlib_dictionary),
+	PC_TEST(test_pfor_encoding),
+	PC_TEST(test_pfor_invalid),
+	PC_TEST(test_serialize_to_sink),
+	PC_TEST(test_encode_decode_into),
+	PC_TEST(test_bytes_append),
 	PC_TEST(test_rle_filter),
 	PC_TEST(test_uncompressed_filter),
 	CU_TEST_INFO_NULL
@@ -516,6 +516,313 @@ test_patch_wkb()
 	pcfree(wkb1);
 }
 
+static void
+test_patch_wkb_readonly()
+{
+	int i;
+	int npts = 20;
+	PCPOINTLIST *pl;
+	PCPATCH *pa1, *pa2, *pa3, *pa4;
+	size_t z1, z2;
+	uint8_t *wkb1, *wkb2;
+	char *str1, *str2;
+
+	pl = pc_pointlist_make(npts);
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "x", i*2.123);
+		pc_point_set_double_by_name(pt, "y", i*2.9);
+		pc_point_set_double_by_name(pt, "Z", i*0.3099);
+		pc_point_set_double_by_name(pt, "intensity", 13);
+		pc_pointlist_add_point(pl, pt);
+	}
+
+	/* Uncompressed, machine endian data is used in place */
+	pa1 = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl);
+	wkb1 = pc_patch_to_wkb(pa1, &z1);
+	pa2 = pc_patch_from_wkb_readonly(simpleschema, wkb1, z1);
+	CU_ASSERT_EQUAL(pa2->type, PC_NONE);
+	CU_ASSERT(pa2->readonly);
+	CU_ASSERT(((PCPATCH_UNCOMPRESSED*)pa2)->data == wkb1 + 13);
+	str1 = pc_patch_to_string(pa1);
+	str2 = pc_patch_to_string(pa2);
+	CU_ASSERT_STRING_EQUAL(str1, str2);
+	pcfree(str2);
+
+	/* Dimensional, the serialized columns are used in place */
+	pa3 = (PCPATCH*)pc_patch_dimensional_from_pointlist(pl);
+	wkb2 = pc_patch_to_wkb(pa3, &z2);
+	pa4 = pc_patch_from_wkb_readonly(simpleschema, wkb2, z2);
+	CU_ASSERT_EQUAL(pa4->type, PC_DIMENSIONAL);
+	for ( i = 0; i < simpleschema->ndims; i++ )
+	{
+		PCBYTES *pcb = &(((PCPATCH_DIMENSIONAL*)pa4)->bytes[i]);
+		CU_ASSERT(pcb->readonly);
+		CU_ASSERT(pcb->bytes > wkb2 && pcb->bytes < wkb2 + z2);
+	}
+	str2 = pc_patch_to_string(pa4);
+	CU_ASSERT_STRING_EQUAL(str1, str2);
+	pcfree(str2);
+
+	pc_patch_free(pa2);
+	pc_patch_free(pa4);
+	pc_patch_free(pa1);
+	pc_patch_free(pa3);
+	pc_pointlist_free(pl);
+	pcfree(str1);
+	pcfree(wkb1);
+	pcfree(wkb2);
+}
+
+static void
+test_patch_wkb_stats()
+{
+	int i;
+	int npts = 20;
+	PCPOINTLIST *pl;
+	PCPATCH *pa1, *pa2, *pa3;
+	PCPATCH_DIMENSIONAL *pdl;
+	PCBYTES pcb;
+	size_t z1, z2;
+	uint8_t *wkb1, *wkb2;
+	double d;
+
+	pl = pc_pointlist_make(npts);
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "x", i*2.123);
+		pc_point_set_double_by_name(pt, "y", i*2.9);
+		pc_point_set_double_by_name(pt, "Z", i*0.3099);
+		pc_point_set_double_by_name(pt, "intensity", 13);
+		pc_pointlist_add_point(pl, pt);
+	}
+
+	pa1 = (PCPATCH*)pc_patch_dimensional_from_pointlist(pl);
+	pa2 = pc_patch_compress(pa1, NULL);
+	wkb1 = pc_patch_to_wkb(pa2, &z1);
+	CU_ASSERT(pc_patch_wkb_is_valid(simpleschema, wkb1, z1));
+
+	/* Bounds come from the stats, and match the ones from the points */
+	pa3 = pc_patch_from_wkb_stats(simpleschema, wkb1, z1);
+	CU_ASSERT(pa3 != NULL);
+	CU_ASSERT_DOUBLE_EQUAL(pa3->bounds.xmin, pa1->bounds.xmin, 0.000001);
+	CU_ASSERT_DOUBLE_EQUAL(pa3->bounds.xmax, pa1->bounds.xmax, 0.000001);
+	CU_ASSERT_DOUBLE_EQUAL(pa3->bounds.ymin, pa1->bounds.ymin, 0.000001);
+	CU_ASSERT_DOUBLE_EQUAL(pa3->bounds.ymax, pa1->bounds.ymax, 0.000001);
+	pc_point_get_double_by_name(&(pa3->stats->max), "Z", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 19*0.3099, 0.01);
+	pc_patch_free(pa3);
+
+	/* Truncated or padded wkb is refused */
+	cu_error_msg_reset();
+	CU_ASSERT(! pc_patch_wkb_is_valid(simpleschema, wkb1, z1 - 1));
+	CU_ASSERT_STRING_EQUAL(cu_error_msg, "pc_patch_wkb_is_valid: dimension \"Intensity\" overruns the wkb");
+	cu_error_msg_reset();
+	CU_ASSERT(! pc_patch_wkb_is_valid(simpleschema, wkb1, 12));
+	CU_ASSERT(pc_patch_from_wkb_stats(simpleschema, wkb1, z1 - 1) == NULL);
+	wkb1 = pcrealloc(wkb1, z1 + 1);
+	cu_error_msg_reset();
+	CU_ASSERT(! pc_patch_wkb_is_valid(simpleschema, wkb1, z1 + 1));
+	cu_error_msg_reset();
+
+	/* PFOR block headers are checked before any decoder reads them */
+	pdl = (PCPATCH_DIMENSIONAL*)pa1;
+	pcb = pdl->bytes[0];
+	pdl->bytes[0] = pc_bytes_pfor_encode(pcb);
+	wkb2 = pc_patch_to_wkb(pa1, &z2);
+	CU_ASSERT(pc_patch_wkb_is_valid(simpleschema, wkb2, z2));
+	wkb2[13 + 1 + 4] = 255;
+	cu_error_msg_reset();
+	CU_ASSERT(! pc_patch_wkb_is_valid(simpleschema, wkb2, z2));
+	CU_ASSERT_STRING_EQUAL(cu_error_msg, "pc_patch_wkb_is_valid: dimension \"X\" has invalid PFOR blocks");
+	CU_ASSERT(pc_patch_from_wkb_stats(simpleschema, wkb2, z2) == NULL);
+	cu_error_msg_reset();
+	pc_bytes_free(pdl->bytes[0]);
+	pdl->bytes[0] = pcb;
+	pcfree(wkb2);
+
+	pc_patch_free(pa1);
+	pc_patch_free(pa2);
+	pc_pointlist_free(pl);
+	pcfree(wkb1);
+}
+
+/*
+* Columns primed with a preset dictionary are written to wkb without
+* it, and wkb asking for a dictionary the schema lacks is refused.
+*/
+static void
+test_patch_wkb_zdict()
+{
+	int i;
+	int npts = 256;
+	PCPOINTLIST *pl;
+	PCPATCH_UNCOMPRESSED *pu;
+	PCPATCH_DIMENSIONAL *pdl;
+	PCPATCH *pa, *pa2;
+	PCSCHEMA *schema = pc_schema_clone(simpleschema);
+	PCBYTES pcb;
+	char msg[256];
+	uint8_t *wkb1, *wkb2, *buf;
+	size_t z1, z2, bsz;
+	uint32_t dictid, otherid;
+	int zpos = pc_schema_get_dimension_by_name(schema, "Z")->position;
+
+	pl = pc_pointlist_make(npts);
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(schema);
+		pc_point_set_double_by_name(pt, "x", i);
+		pc_point_set_double_by_name(pt, "y", i);
+		pc_point_set_double_by_name(pt, "Z", (i % 16) * 0.03);
+		pc_point_set_double_by_name(pt, "intensity", 7);
+		pc_pointlist_add_point(pl, pt);
+	}
+	pu = pc_patch_uncompressed_from_pointlist(pl);
+	pdl = pc_patch_dimensional_from_uncompressed(pu);
+	pc_schema_set_zdict(schema, zpos, pc_zdict_train(&(pdl->bytes[zpos]), 1, 4096));
+	CU_ASSERT(schema->dims[zpos]->zdict != NULL);
+	pdl->schema = schema;
+	pdl->bytes[zpos].zdict = schema->dims[zpos]->zdict;
+	pcb = pdl->bytes[zpos];
+	pdl->bytes[zpos] = pc_bytes_encode(pcb, PC_DIM_ZLIB);
+	pc_bytes_free(pcb);
+	CU_ASSERT(pc_bytes_zlib_dictid(pdl->bytes[zpos].bytes, pdl->bytes[zpos].size, &dictid));
+	CU_ASSERT_EQUAL(dictid, schema->dims[zpos]->zdict->id);
+
+	/* The wkb column goes without the dictionary, and reads anywhere */
+	wkb1 = pc_patch_to_wkb((PCPATCH*)pdl, &z1);
+	CU_ASSERT(pc_patch_wkb_is_valid(simpleschema, wkb1, z1));
+	pa = pc_patch_from_wkb(simpleschema, wkb1, z1);
+	CU_ASSERT_EQUAL(((PCPATCH_DIMENSIONAL*)pa)->bytes[zpos].compression, PC_DIM_ZLIB);
+	CU_ASSERT(! pc_bytes_zlib_dictid(((PCPATCH_DIMENSIONAL*)pa)->bytes[zpos].bytes, ((PCPATCH_DIMENSIONAL*)pa)->bytes[zpos].size, &otherid));
+	pa2 = pc_patch_uncompress(pa);
+	CU_ASSERT_EQUAL(memcmp(((PCPATCH_UNCOMPRESSED*)pa2)->data, pu->data, pu->datasize), 0);
+	pc_patch_free(pa2);
+
+	/* A primed column, as the dictionary pcid stores it */
+	z2 = 1+4+4+4 + pc_patch_dimensional_serialized_size(pdl);
+	wkb2 = pcalloc(z2);
+	memcpy(wkb2, wkb1, 1+4+4+4);
+	buf = wkb2 + 1+4+4+4;
+	for ( i = 0; i < schema->ndims; i++ )
+	{
+		pc_bytes_serialize(&(pdl->bytes[i]), buf, &bsz);
+		buf += bsz;
+	}
+	CU_ASSERT(pc_patch_wkb_is_valid(schema, wkb2, z2));
+	cu_error_msg_reset();
+	CU_ASSERT(! pc_patch_wkb_is_valid(simpleschema, wkb2, z2));
+	snprintf(msg, sizeof(msg), "pc_patch_wkb_is_valid: dimension \"Z\" needs unknown zlib dictionary %u", dictid);
+	CU_ASSERT_STRING_EQUAL(cu_error_msg, msg);
+	cu_error_msg_reset();
+
+	pcfree(wkb1);
+	pcfree(wkb2);
+	pc_patch_free(pa);
+	pc_patch_free((PCPATCH*)pdl);
+	pc_patch_free((PCPATCH*)pu);
+	pc_pointlist_free(pl);
+	pc_schema_free(schema);
+}
+
+static void
+test_patch_wkb_flags()
+{
+	int i;
+	int npts = 20;
+	PCPOINTLIST *pl;
+	PCPATCH *pa1, *pa2, *pa3, *pa4;
+	size_t z1, z2;
+	uint8_t *wkb1, *wkb2;
+	char *str1, *str2;
+	int32_t zmax = 10000;
+	double d;
+
+	pl = pc_pointlist_make(npts);
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "x", i*2.123);
+		pc_point_set_double_by_name(pt, "y", i*2.9);
+		pc_point_set_double_by_name(pt, "Z", i*0.3099);
+		pc_point_set_double_by_name(pt, "intensity", 13);
+		pc_pointlist_add_point(pl, pt);
+	}
+
+	pa1 = (PCPATCH*)pc_patch_dimensional_from_pointlist(pl);
+	wkb1 = pc_patch_to_wkb(pa1, &z1);
+	wkb2 = pc_patch_to_wkb_flags(pa1, PC_WKB_BOUNDS | PC_WKB_STATS, &z2);
+	CU_ASSERT_EQUAL(z2, z1 + sizeof(PCBOUNDS) + pc_stats_size(simpleschema));
+	CU_ASSERT_EQUAL(wkb_get_compression(wkb2), PC_DIMENSIONAL);
+	CU_ASSERT_EQUAL(wkb_get_flags(wkb2), PC_WKB_BOUNDS | PC_WKB_STATS);
+	CU_ASSERT_EQUAL(wkb_get_flags(wkb1), 0);
+	CU_ASSERT(pc_patch_wkb_is_valid(simpleschema, wkb2, z2));
+
+	/* Same patch, either way */
+	pa2 = pc_patch_from_wkb(simpleschema, wkb1, z1);
+	pa3 = pc_patch_from_wkb(simpleschema, wkb2, z2);
+	str1 = pc_patch_to_string(pa2);
+	str2 = pc_patch_to_string(pa3);
+	CU_ASSERT_STRING_EQUAL(str1, str2);
+	CU_ASSERT_DOUBLE_EQUAL(pa3->bounds.xmax, pa2->bounds.xmax, 0.000001);
+	CU_ASSERT_DOUBLE_EQUAL(pa3->bounds.ymin, pa2->bounds.ymin, 0.000001);
+	CU_ASSERT_EQUAL(memcmp(pa3->stats->max.data, pa2->stats->max.data, simpleschema->size), 0);
+	CU_ASSERT_EQUAL(memcmp(pa3->stats->avg.data, pa2->stats->avg.data, simpleschema->size), 0);
+	pcfree(str1);
+	pcfree(str2);
+	pc_patch_free(pa2);
+	pc_patch_free(pa3);
+
+	/* The stats in the wkb are taken as they are */
+	memcpy(wkb2 + 13 + sizeof(PCBOUNDS) + simpleschema->size + simpleschema->dims[2]->byteoffset, &zmax, 4);
+	pa4 = pc_patch_from_wkb_stats(simpleschema, wkb2, z2);
+	pc_point_get_double_by_name(&(pa4->stats->max), "Z", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 100, 0.000001);
+	CU_ASSERT_DOUBLE_EQUAL(pa4->bounds.xmax, 19*2.123, 0.01);
+	pc_patch_free(pa4);
+
+	/* Blocks cut short */
+	cu_error_msg_reset();
+	CU_ASSERT(! pc_patch_wkb_is_valid(simpleschema, wkb2, 13 + sizeof(PCBOUNDS)));
+	CU_ASSERT_STRING_EQUAL(cu_error_msg, "pc_patch_wkb_is_valid: wkb is too short for its bounds and stats");
+	cu_error_msg_reset();
+
+	pc_patch_free(pa1);
+	pc_pointlist_free(pl);
+	pcfree(wkb1);
+	pcfree(wkb2);
+}
+
+static void
+test_patch_wkb_dimensional_xdr()
+{
+	// 00 endian (big)
+	// 00000000 pcid
+	// 00000002 compression
+	// 00000002 npoints
+	// 00 00000008 0000000200000002 X (no compression)
+	// 00 00000008 0000000300000003 Y
+	// 00 00000008 0000000500000005 Z
+	// 00 00000004 00060008 Intensity
+	char *hexbuf = "00000000000000000200000002000000000800000002000000020000000008000000030000000300000000080000000500000005000000000400060008";
+	char *str;
+	size_t hexsize = strlen(hexbuf);
+	uint8_t *wkb = pc_bytes_from_hexbytes(hexbuf, hexsize);
+	PCPATCH *pa;
+
+	/* Byte swapped input is always copied */
+	pa = pc_patch_from_wkb_readonly(simpleschema, wkb, hexsize/2);
+	CU_ASSERT(! ((PCPATCH_DIMENSIONAL*)pa)->bytes[0].readonly);
+	str = pc_patch_to_string(pa);
+	CU_ASSERT_STRING_EQUAL(str, "{\"pcid\":0,\"pts\":[[0.02,0.03,0.05,6],[0.02,0.03,0.05,8]]}");
+	pcfree(str);
+	pc_patch_free(pa);
+	pcfree(wkb);
+}
+
 
 static void
 test_patch_filter()
@@ -574,6 +881,60 @@ test_patch_filter()
 	return;
 }
 
+static void
+test_patch_filter_box()
+{
+	int i, j;
+	int npts = 20;
+	double d;
+	PCPOINTLIST *pl;
+	PCPATCH *pa[2], *fpa;
+
+	pl = pc_pointlist_make(npts);
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "x", i);
+		pc_point_set_double_by_name(pt, "y", i);
+		pc_point_set_double_by_name(pt, "Z", i*0.1);
+		pc_point_set_double_by_name(pt, "intensity", 100-i);
+		pc_pointlist_add_point(pl, pt);
+	}
+
+	pa[0] = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl);
+	pa[1] = (PCPATCH*)pc_patch_dimensional_from_pointlist(pl);
+
+	for ( j = 0; j < 2; j++ )
+	{
+		/* Boundaries are included, corners in any order */
+		fpa = pc_patch_filter_box(pa[j], 8, 10, 4.5, 4.5);
+		CU_ASSERT_EQUAL(fpa->npoints, 4);
+		CU_ASSERT_DOUBLE_EQUAL(fpa->bounds.xmin, 5, 0.000001);
+		CU_ASSERT_DOUBLE_EQUAL(fpa->bounds.xmax, 8, 0.000001);
+		CU_ASSERT_DOUBLE_EQUAL(fpa->bounds.ymin, 5, 0.000001);
+		CU_ASSERT_DOUBLE_EQUAL(fpa->bounds.ymax, 8, 0.000001);
+		pc_point_get_double_by_name(&(fpa->stats->min), "Z", &d);
+		CU_ASSERT_DOUBLE_EQUAL(d, 0.5, 0.000001);
+		pc_point_get_double_by_name(&(fpa->stats->max), "intensity", &d);
+		CU_ASSERT_DOUBLE_EQUAL(d, 95, 0.000001);
+		pc_patch_free(fpa);
+
+		/* Outside */
+		fpa = pc_patch_filter_box(pa[j], 20.5, 0, 30, 30);
+		CU_ASSERT_EQUAL(fpa->npoints, 0);
+		pc_patch_free(fpa);
+
+		/* Within the bounds, but no point on the diagonal */
+		fpa = pc_patch_filter_box(pa[j], 10.1, 0, 20, 9.9);
+		CU_ASSERT_EQUAL(fpa->npoints, 0);
+		pc_patch_free(fpa);
+
+		pc_patch_free(pa[j]);
+	}
+
+	pc_pointlist_free(pl);
+}
+
 #if defined(HAVE_LIBGHT) && defined(HAVE_LAZPERF)
 static void
 test_patch_compress_from_ght_to_lazperf()
@@ -1034,6 +1395,354 @@ test_patch_range_compression_dimensional_rle()
 	test_patch_range_compression_dimensional(PC_DIM_RLE);
 }
 
+static void
+test_patch_dimensional_append(enum DIMCOMPRESSIONS dimcomp)
+{
+	int i;
+	PCPOINTLIST *pl1, *pl2;
+	PCPATCH *pa1, *pa2, *pa, *palist[2], *pu;
+	PCPATCH_DIMENSIONAL *pad;
+	PCDIMSTATS *stats;
+	char *str1, *str2;
+	double d;
+	int npts = PCDIMSTATS_MIN_SAMPLE+1; // force to keep custom compression
+
+	pl1 = pc_pointlist_make(npts);
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "X", i);
+		pc_point_set_double_by_name(pt, "Y", i % 100);
+		pc_point_set_double_by_name(pt, "Z", 1);
+		pc_point_set_double_by_name(pt, "Intensity", 10);
+		pc_pointlist_add_point(pl1, pt);
+	}
+	pl2 = pc_pointlist_make(3);
+	for ( i = 0; i < 3; i++ )
+	{
+		PCPOINT *pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "X", npts + i);
+		pc_point_set_double_by_name(pt, "Y", -1);
+		pc_point_set_double_by_name(pt, "Z", 1);
+		pc_point_set_double_by_name(pt, "Intensity", 10 + i);
+		pc_pointlist_add_point(pl2, pt);
+	}
+
+	pad = pc_patch_dimensional_from_pointlist(pl1);
+	stats = pc_dimstats_make(simpleschema);
+	pc_dimstats_update(stats, pad);
+	for ( i = 0; i < pad->schema->ndims; i++ )
+		stats->stats[i].recommended_compression = dimcomp;
+	pa1 = (PCPATCH*)pc_patch_dimensional_compress(pad, stats);
+	pa2 = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl2);
+
+	pa = pc_patch_append(pa1, pa2);
+	CU_ASSERT_EQUAL(pa->type, PC_DIMENSIONAL);
+	CU_ASSERT_EQUAL(pa->npoints, npts + 3);
+	for ( i = 0; i < pa->schema->ndims; i++ )
+		CU_ASSERT_EQUAL(((PCPATCH_DIMENSIONAL*)pa)->bytes[i].compression, dimcomp);
+
+	/* Same points as a plain union */
+	palist[0] = pa1;
+	palist[1] = pa2;
+	pu = pc_patch_from_patchlist(palist, 2);
+	str1 = pc_patch_to_string(pa);
+	str2 = pc_patch_to_string(pu);
+	CU_ASSERT_STRING_EQUAL(str1, str2);
+
+	/* Merged bounds and stats */
+	CU_ASSERT_DOUBLE_EQUAL(pa->bounds.xmax, npts + 2, 0.000001);
+	CU_ASSERT_DOUBLE_EQUAL(pa->bounds.ymin, -1, 0.000001);
+	pc_point_get_double_by_name(&(pa->stats->max), "Intensity", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 12, 0.000001);
+	pc_point_get_double_by_name(&(pa->stats->avg), "X", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, (npts + 2) / 2.0, 0.01);
+
+	pcfree(str1);
+	pcfree(str2);
+	pc_patch_free(pu);
+	pc_patch_free(pa);
+	pc_patch_free(pa2);
+	pc_patch_free(pa1);
+	pc_patch_free((PCPATCH*)pad);
+	pc_dimstats_free(stats);
+	pc_pointlist_free(pl1);
+	pc_pointlist_free(pl2);
+}
+
+static void
+test_patch_dimensional_append_none()
+{
+	test_patch_dimensional_append(PC_DIM_NONE);
+}
+
+static void
+test_patch_dimensional_append_zlib()
+{
+	test_patch_dimensional_append(PC_DIM_ZLIB);
+}
+
+static void
+test_patch_dimensional_append_sigbits()
+{
+	test_patch_dimensional_append(PC_DIM_SIGBITS);
+}
+
+static void
+test_patch_dimensional_append_rle()
+{
+	test_patch_dimensional_append(PC_DIM_RLE);
+}
+
+static void
+test_patch_compact()
+{
+	int i, j;
+	int npts = 20;
+	double d;
+	PCPOINTLIST *pl;
+	PCPATCH *pa[2], *pb, *pc, *cpa;
+	PCTOMBSTONES *ts;
+	char *str;
+
+	pl = pc_pointlist_make(npts);
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "x", i);
+		pc_point_set_double_by_name(pt, "y", i);
+		pc_point_set_double_by_name(pt, "Z", i*0.1);
+		pc_point_set_double_by_name(pt, "intensity", i < 10 ? 5 : 7);
+		pc_pointlist_add_point(pl, pt);
+	}
+
+	pa[0] = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl);
+	pa[1] = (PCPATCH*)pc_patch_dimensional_from_pointlist(pl);
+	pb = pc_patch_range(pa[0], 1, 2);
+
+	for ( j = 0; j < 2; j++ )
+	{
+		ts = pc_tombstones_new(npts);
+
+		/* Nothing deleted, nothing to do */
+		CU_ASSERT(pc_patch_compact(pa[j], ts) == pa[j]);
+
+		for ( i = 2; i < npts; i++ )
+			CU_ASSERT_EQUAL(pc_tombstones_set(ts, i), PC_SUCCESS);
+		CU_ASSERT_EQUAL(pc_tombstones_set(ts, 19), PC_SUCCESS);
+		CU_ASSERT_EQUAL(ts->ndeleted, npts - 2);
+		cu_error_msg_reset();
+		CU_ASSERT_EQUAL(pc_tombstones_set(ts, npts), PC_FAILURE);
+		CU_ASSERT_STRING_EQUAL(cu_error_msg, "pc_tombstones_set: point 21 is out of range, patch has 20 points");
+
+		/* Deletions recorded before an append still apply after it */
+		pc = pc_patch_append(pa[j], pb);
+		CU_ASSERT_EQUAL(pc_tombstones_extend(ts, pc->npoints), PC_SUCCESS);
+		CU_ASSERT_EQUAL(pc_tombstones_set(ts, 0), PC_SUCCESS);
+		cpa = pc_patch_compact(pc, ts);
+		CU_ASSERT_EQUAL(cpa->type, pa[j]->type);
+
+		str = pc_patch_to_string(cpa);
+		CU_ASSERT_STRING_EQUAL(str, "{\"pcid\":0,\"pts\":[[1,1,0.1,5],[0,0,0,5],[1,1,0.1,5]]}");
+		CU_ASSERT_DOUBLE_EQUAL(cpa->bounds.xmax, 1, 0.000001);
+		pc_point_get_double_by_name(&(cpa->stats->avg), "x", &d);
+		CU_ASSERT_DOUBLE_EQUAL(d, 2/3.0, 0.01);
+		pc_point_get_double_by_name(&(cpa->stats->max), "intensity", &d);
+		CU_ASSERT_DOUBLE_EQUAL(d, 5, 0.000001);
+		pcfree(str);
+		pc_patch_free(cpa);
+
+		/* Everything deleted */
+		for ( i = 0; i < pc->npoints; i++ )
+			pc_tombstones_set(ts, i);
+		cpa = pc_patch_compact(pc, ts);
+		CU_ASSERT_EQUAL(cpa->npoints, 0);
+		pc_patch_free(cpa);
+
+		pc_patch_free(pc);
+		pc_tombstones_free(ts);
+	}
+
+	pc_patch_free(pb);
+	pc_patch_free(pa[0]);
+	pc_patch_free(pa[1]);
+	pc_pointlist_free(pl);
+}
+
+static void
+test_patch_dimensional_lazy_decoding()
+{
+	int i;
+	PCPOINTLIST *pl;
+	PCPATCH *pa, *pas, *par;
+	PCPATCH_DIMENSIONAL *pad, *paz;
+	PCDIMENSION *zdim;
+	double *vals, d;
+	char *str;
+	const char *xname[] = { "X" };
+	int npts = PCDIMSTATS_MIN_SAMPLE+1; // force to keep custom compression
+
+	// build a zlib compressed dimensional patch, sorted on X descending
+	pl = pc_pointlist_make(npts);
+
+	for ( i = npts; i > 0; i-- )
+	{
+		PCPOINT *pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "X", i);
+		pc_point_set_double_by_name(pt, "Y", i*2);
+		pc_point_set_double_by_name(pt, "Z", i*0.5);
+		pc_point_set_double_by_name(pt, "Intensity", 10);
+		pc_pointlist_add_point(pl, pt);
+	}
+
+	pad = pc_patch_dimensional_from_pointlist(pl);
+
+	PCDIMSTATS *stats = pc_dimstats_make(simpleschema);
+	pc_dimstats_update(stats, pad);
+	for ( i = 0; i<pad->schema->ndims; i++ )
+		stats->stats[i].recommended_compression = PC_DIM_ZLIB;
+	paz = pc_patch_dimensional_compress(pad, stats);
+	pa = (PCPATCH*)paz;
+
+	// reading one dimension only decodes that column
+	zdim = pc_schema_get_dimension_by_name(simpleschema, "Z");
+	vals = pc_patch_dimension_to_double_array(pa, zdim->position);
+	CU_ASSERT_PTR_NOT_NULL(vals);
+	CU_ASSERT_DOUBLE_EQUAL(vals[0], npts*0.5, 0.001);
+	CU_ASSERT_DOUBLE_EQUAL(vals[npts-1], 0.5, 0.001);
+	CU_ASSERT_PTR_NOT_NULL(paz->decoded);
+	for ( i = 0; i<paz->schema->ndims; i++ )
+	{
+		if ( i == zdim->position )
+			CU_ASSERT_PTR_NOT_NULL(paz->decoded[i].bytes);
+		if ( i != zdim->position )
+			CU_ASSERT_PTR_NULL(paz->decoded[i].bytes);
+	}
+	CU_ASSERT_EQUAL(paz->bytes[zdim->position].compression, PC_DIM_ZLIB);
+	pcfree(vals);
+
+	// stats and sort work from the encoded columns
+	CU_ASSERT_EQUAL(pc_patch_compute_stats(pa), PC_SUCCESS);
+	pc_point_get_double_by_name(&(pa->stats->min), "Z", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 0.5, 0.001);
+	pc_point_get_double_by_name(&(pa->stats->max), "Z", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, npts*0.5, 0.001);
+	CU_ASSERT_EQUAL(pc_patch_is_sorted(pa, xname, 1, PC_TRUE), PC_FALSE);
+	pas = pc_patch_sort(pa, xname, 1);
+	CU_ASSERT_EQUAL(pc_patch_is_sorted(pas, xname, 1, PC_TRUE), PC_TRUE);
+	CU_ASSERT_EQUAL(pas->npoints, npts);
+
+	par = pc_patch_range(pas, 1, 2);
+	str = pc_patch_to_string(par);
+	CU_ASSERT_STRING_EQUAL(str,
+		"{\"pcid\":0,\"pts\":[[1,2,0.5,10],[2,4,1,10]]}");
+
+	pcfree(str);
+	pc_patch_free(par);
+	pc_patch_free(pas);
+	pc_patch_free((PCPATCH *)pad);
+	pc_dimstats_free(stats);
+	pc_patch_free(pa);
+	pc_pointlist_free(pl);
+}
+
+static void
+test_patch_builder(uint32_t compression)
+{
+	int i, j, rv;
+	PCSCHEMA *s;
+	PCPOINTLIST *pl;
+	PCPATCH_BUILDER *pb;
+	PCPATCH *pa1, *pa2;
+	char *str1, *str2;
+	double vals[4], v1, v2;
+	int npts = 100;
+
+	s = pc_schema_clone(simpleschema);
+	s->compression = compression;
+
+	// start small to check that the buffers grow
+	pb = pc_patch_builder_make(s, 10);
+	pl = pc_pointlist_make(npts);
+
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt;
+		vals[0] = i*2.0;
+		vals[1] = i*1.9;
+		vals[2] = i*0.34;
+		vals[3] = 10 + i%3;
+		pt = pc_point_from_double_array(s, vals, 4);
+		pc_pointlist_add_point(pl, pt);
+		if ( i % 2 )
+			rv = pc_patch_builder_add_double_array(pb, vals, 4);
+		else
+			rv = pc_patch_builder_add_point(pb, pt);
+		CU_ASSERT_EQUAL(rv, PC_SUCCESS);
+	}
+	CU_ASSERT_EQUAL(pb->npoints, npts);
+
+	pa1 = pc_patch_builder_finish(pb);
+	pa2 = pc_patch_from_pointlist(pl);
+	CU_ASSERT_EQUAL(pa1->type, compression == PC_DIMENSIONAL ? PC_DIMENSIONAL : PC_NONE);
+	CU_ASSERT_EQUAL(pa1->npoints, npts);
+
+	str1 = pc_patch_to_string(pa1);
+	str2 = pc_patch_to_string(pa2);
+	CU_ASSERT_STRING_EQUAL(str1, str2);
+	pcfree(str1);
+	pcfree(str2);
+
+	// bounds and stats are kept up to date while adding points
+	CU_ASSERT_DOUBLE_EQUAL(pa1->bounds.xmin, pa2->bounds.xmin, 0.000001);
+	CU_ASSERT_DOUBLE_EQUAL(pa1->bounds.xmax, pa2->bounds.xmax, 0.000001);
+	CU_ASSERT_DOUBLE_EQUAL(pa1->bounds.ymin, pa2->bounds.ymin, 0.000001);
+	CU_ASSERT_DOUBLE_EQUAL(pa1->bounds.ymax, pa2->bounds.ymax, 0.000001);
+	for ( j = 0; j < s->ndims; j++ )
+	{
+		pc_point_get_double_by_index(&(pa1->stats->min), j, &v1);
+		pc_point_get_double_by_index(&(pa2->stats->min), j, &v2);
+		CU_ASSERT_DOUBLE_EQUAL(v1, v2, 0.000001);
+		pc_point_get_double_by_index(&(pa1->stats->max), j, &v1);
+		pc_point_get_double_by_index(&(pa2->stats->max), j, &v2);
+		CU_ASSERT_DOUBLE_EQUAL(v1, v2, 0.000001);
+		pc_point_get_double_by_index(&(pa1->stats->avg), j, &v1);
+		pc_point_get_double_by_index(&(pa2->stats->avg), j, &v2);
+		CU_ASSERT_DOUBLE_EQUAL(v1, v2, 0.000001);
+	}
+
+	// dimensions are compressed the way pc_patch_compress does it
+	if ( compression == PC_DIMENSIONAL )
+	{
+		PCPATCH_DIMENSIONAL *pdl = (PCPATCH_DIMENSIONAL*)pc_patch_compress(pa2, NULL);
+		for ( j = 0; j < s->ndims; j++ )
+			CU_ASSERT_EQUAL(((PCPATCH_DIMENSIONAL*)pa1)->bytes[j].compression, pdl->bytes[j].compression);
+		CU_ASSERT_NOT_EQUAL(((PCPATCH_DIMENSIONAL*)pa1)->bytes[0].compression, PC_DIM_NONE);
+		pc_patch_free((PCPATCH*)pdl);
+	}
+
+	// empty builders give no patch
+	pb = pc_patch_builder_make(s, 0);
+	CU_ASSERT_PTR_NULL(pc_patch_builder_finish(pb));
+
+	pc_patch_free(pa1);
+	pc_patch_free(pa2);
+	pc_pointlist_free(pl);
+	pc_schema_free(s);
+}
+
+static void
+test_patch_builder_uncompressed()
+{
+	test_patch_builder(PC_NONE);
+}
+
+static void
+test_patch_builder_dimensional()
+{
+	test_patch_builder(PC_DIMENSIONAL);
+}
+
 static void
 test_patch_set_schema_compression_none()
 {
@@ -1385,6 +2094,603 @@ test_patch_transform_compression_none()
 }
 
 
+static void
+test_patch_to_geometry_wkb_multipoint()
+{
+	int i;
+	int npts = 20;
+	size_t wkbsize, ptwkbsize;
+	uint8_t *wkb, *ptwkb;
+	uint32_t n;
+	PCPOINTLIST *pl;
+	PCPATCH *pau, *pad;
+	PCPOINT *pt;
+
+	pl = pc_pointlist_make(npts);
+	for ( i = 0; i < npts; i++ )
+	{
+		pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "x", i*2.0);
+		pc_point_set_double_by_name(pt, "y", -i*1.9);
+		pc_point_set_double_by_name(pt, "Z", i*0.34);
+		pc_point_set_double_by_name(pt, "intensity", 10);
+		pc_pointlist_add_point(pl, pt);
+	}
+	pau = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl);
+	pad = pc_patch_compress(pau, NULL);
+
+	/* MultiPoint Z header, then the WKB of every point */
+	wkb = pc_patch_to_geometry_wkb_multipoint(pau, &wkbsize);
+	CU_ASSERT_EQUAL(wkbsize, 9 + npts * (5 + 3 * 8));
+	CU_ASSERT_EQUAL(wkb[0], machine_endian());
+	memcpy(&n, wkb + 1, 4);
+	CU_ASSERT_EQUAL(n, 0x80000004);
+	memcpy(&n, wkb + 5, 4);
+	CU_ASSERT_EQUAL(n, npts);
+	for ( i = 0; i < npts; i++ )
+	{
+		pt = pc_patch_pointn(pau, i + 1);
+		ptwkb = pc_point_to_geometry_wkb(pt, &ptwkbsize);
+		CU_ASSERT_EQUAL(ptwkbsize, 5 + 3 * 8);
+		CU_ASSERT_EQUAL(memcmp(wkb + 9 + i * ptwkbsize, ptwkb, ptwkbsize), 0);
+		pcfree(ptwkb);
+		pc_point_free(pt);
+	}
+	pcfree(wkb);
+
+	/* Dimensional patches give the same */
+	CU_ASSERT_EQUAL(pad->type, PC_DIMENSIONAL);
+	wkb = pc_patch_to_geometry_wkb_multipoint(pad, &wkbsize);
+	ptwkb = pc_patch_to_geometry_wkb_multipoint(pau, &ptwkbsize);
+	CU_ASSERT_EQUAL(wkbsize, ptwkbsize);
+	CU_ASSERT_EQUAL(memcmp(wkb, ptwkb, wkbsize), 0);
+	pcfree(wkb);
+	pcfree(ptwkb);
+
+	pc_patch_free(pad);
+	pc_patch_free(pau);
+	pc_pointlist_free(pl);
+}
+
+static uint8_t *
+wkb_put_uint32(uint8_t *ptr, uint32_t val, int flip)
+{
+	memcpy(ptr, &val, 4);
+	if ( flip ) pc_flip_endian_strided(ptr, 4, 4, 1);
+	return ptr + 4;
+}
+
+static uint8_t *
+wkb_put_double(uint8_t *ptr, double val, int flip)
+{
+	memcpy(ptr, &val, 8);
+	if ( flip ) pc_flip_endian_strided(ptr, 8, 8, 1);
+	return ptr + 8;
+}
+
+/* Write a WKB polygon of nrings axis-aligned square rings, given as xmin, ymin, xmax, ymax */
+static uint8_t *
+wkb_put_squares(uint8_t *ptr, const double *rings, int nrings, int flip)
+{
+	int i;
+	*ptr++ = flip ? ! machine_endian() : machine_endian();
+	ptr = wkb_put_uint32(ptr, 3, flip);
+	ptr = wkb_put_uint32(ptr, nrings, flip);
+	for ( i = 0; i < nrings; i++ )
+	{
+		const double *r = rings + 4 * i;
+		ptr = wkb_put_uint32(ptr, 5, flip);
+		ptr = wkb_put_double(ptr, r[0], flip); ptr = wkb_put_double(ptr, r[1], flip);
+		ptr = wkb_put_double(ptr, r[2], flip); ptr = wkb_put_double(ptr, r[1], flip);
+		ptr = wkb_put_double(ptr, r[2], flip); ptr = wkb_put_double(ptr, r[3], flip);
+		ptr = wkb_put_double(ptr, r[0], flip); ptr = wkb_put_double(ptr, r[3], flip);
+		ptr = wkb_put_double(ptr, r[0], flip); ptr = wkb_put_double(ptr, r[1], flip);
+	}
+	return ptr;
+}
+
+static void
+test_patch_polygon_classify()
+{
+	/* A square with a hole, a multipolygon, nothing, and a square overlapping the first */
+	static const double a[] = { 0, 0, 10, 10, 4, 4, 6, 6 };
+	static const double b1[] = { 20, 0, 30, 10 };
+	static const double b2[] = { 0, 20, 10, 30 };
+	static const double d[] = { 5, 5, 15, 15 };
+	uint8_t bufa[256], bufb[256], bufd[256], *ptr;
+	const uint8_t *wkbs[4];
+	size_t wkbsizes[4];
+	PCPOLYINDEX *idx;
+	PCPOINTLIST *pl;
+	PCPATCH *pa, *pd, *pt, **split;
+	int32_t *classes;
+	double v;
+	int i, npts = 0;
+
+	wkbs[0] = bufa;
+	wkbsizes[0] = wkb_put_squares(bufa, a, 2, 0) - bufa;
+
+	/* Big endian, the other way around from the machine */
+	ptr = bufb;
+	*ptr++ = ! machine_endian();
+	ptr = wkb_put_uint32(ptr, 6, 1);
+	ptr = wkb_put_uint32(ptr, 2, 1);
+	ptr = wkb_put_squares(ptr, b1, 1, 1);
+	ptr = wkb_put_squares(ptr, b2, 1, 0);
+	wkbs[1] = bufb;
+	wkbsizes[1] = ptr - bufb;
+
+	wkbs[2] = NULL;
+	wkbsizes[2] = 0;
+
+	wkbs[3] = bufd;
+	wkbsizes[3] = wkb_put_squares(bufd, d, 1, 0) - bufd;
+
+	idx = pc_polyindex_from_wkb(wkbs, wkbsizes, 4);
+	CU_ASSERT(idx != NULL);
+	CU_ASSERT_EQUAL(idx->npolys, 4);
+
+	CU_ASSERT_EQUAL(pc_polyindex_locate(idx, 1, 1), 0);
+	CU_ASSERT_EQUAL(pc_polyindex_locate(idx, 10, 10), 0);  /* corner */
+	CU_ASSERT_EQUAL(pc_polyindex_locate(idx, 0, 5), 0);    /* edge */
+	CU_ASSERT_EQUAL(pc_polyindex_locate(idx, 4.5, 5), -1); /* hole */
+	CU_ASSERT_EQUAL(pc_polyindex_locate(idx, 5.5, 5.5), 3); /* hole, in the overlapping square */
+	CU_ASSERT_EQUAL(pc_polyindex_locate(idx, 7, 7), 0);    /* overlap, first wins */
+	CU_ASSERT_EQUAL(pc_polyindex_locate(idx, 12, 12), 3);
+	CU_ASSERT_EQUAL(pc_polyindex_locate(idx, 25, 5), 1);
+	CU_ASSERT_EQUAL(pc_polyindex_locate(idx, 5, 25), 1);
+	CU_ASSERT_EQUAL(pc_polyindex_locate(idx, 15, 25), -1);
+	CU_ASSERT_EQUAL(pc_polyindex_locate(idx, -50, 50), -1);
+
+	/* Points along the diagonal, and one in the multipolygon */
+	pl = pc_pointlist_make(40);
+	for ( i = 0; i < 40; i++ )
+	{
+		PCPOINT *p = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(p, "x", i < 39 ? i * 0.5 : 25);
+		pc_point_set_double_by_name(p, "y", i < 39 ? i * 0.5 : 5);
+		pc_point_set_double_by_name(p, "Z", i);
+		pc_point_set_double_by_name(p, "intensity", 7);
+		pc_pointlist_add_point(pl, p);
+	}
+	pa = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl);
+	pd = pc_patch_compress(pa, NULL);
+
+	classes = pc_patch_polygon_classify(pd, idx);
+	CU_ASSERT_EQUAL(classes[0], 0);
+	CU_ASSERT_EQUAL(classes[9], -1);  /* 4.5, 4.5 */
+	CU_ASSERT_EQUAL(classes[10], 3);  /* 5, 5 */
+	CU_ASSERT_EQUAL(classes[20], 0);  /* 10, 10 */
+	CU_ASSERT_EQUAL(classes[30], 3);  /* 15, 15 */
+	CU_ASSERT_EQUAL(classes[31], -1);
+	CU_ASSERT_EQUAL(classes[39], 1);
+
+	split = pc_patch_polygon_split(pd, idx);
+	for ( i = 0; i < 4; i++ )
+		if ( split[i] ) npts += split[i]->npoints;
+	CU_ASSERT_EQUAL(npts, 40 - 9); /* hole at 4.5, and 15.5 to 19 */
+	CU_ASSERT_EQUAL(split[1]->npoints, 1);
+	CU_ASSERT(split[2] == NULL);
+	CU_ASSERT_EQUAL(split[3]->npoints, 12); /* 5 and 5.5 in the hole, 10.5 to 15 */
+	CU_ASSERT_DOUBLE_EQUAL(split[3]->bounds.xmax, 15, 0.000001);
+	for ( i = 0; i < 4; i++ )
+		if ( split[i] ) pc_patch_free(split[i]);
+	pcfree(split);
+
+	/* Tag the intensity with the polygon numbers */
+	pt = pc_patch_polygon_tag(pa, idx, simpleschema, "intensity");
+	CU_ASSERT_EQUAL(pt->npoints, 40);
+	for ( i = 0; i < 40; i++ )
+	{
+		PCPOINT *p = pc_patch_pointn(pt, i + 1);
+		pc_point_get_double_by_name(p, "intensity", &v);
+		CU_ASSERT_DOUBLE_EQUAL(v, classes[i] + 1, 0.000001);
+		pc_point_free(p);
+	}
+	pc_point_get_double_by_name(&(pt->stats->max), "intensity", &v);
+	CU_ASSERT_DOUBLE_EQUAL(v, 4, 0.000001);
+	CU_ASSERT(pc_patch_polygon_tag(pa, idx, simpleschema, "x") == NULL);
+	pc_patch_free(pt);
+
+	pcfree(classes);
+	pc_patch_free(pd);
+	pc_patch_free(pa);
+	pc_pointlist_free(pl);
+	pc_polyindex_free(idx);
+}
+
+static void
+test_patch_polygon_classify_many()
+{
+	/* A 100x100 grid of unit squares, enough for a tree of several levels */
+	int n = 100, i, j;
+	const uint8_t **wkbs = pcalloc(n * n * sizeof(uint8_t*));
+	size_t *wkbsizes = pcalloc(n * n * sizeof(size_t));
+	PCPOLYINDEX *idx;
+
+	for ( i = 0; i < n * n; i++ )
+	{
+		double sq[4];
+		uint8_t *buf = pcalloc(128);
+		sq[0] = i % n;
+		sq[1] = i / n;
+		sq[2] = sq[0] + 1;
+		sq[3] = sq[1] + 1;
+		wkbsizes[i] = wkb_put_squares(buf, sq, 1, 0) - buf;
+		wkbs[i] = buf;
+	}
+	idx = pc_polyindex_from_wkb(wkbs, wkbsizes, n * n);
+	CU_ASSERT(idx->nnodes > 1 + n * n / 8);
+
+	for ( i = 0; i < n; i++ )
+		for ( j = 0; j < n; j++ )
+			CU_ASSERT_EQUAL(pc_polyindex_locate(idx, i + 0.3, j + 0.7), j * n + i);
+	CU_ASSERT_EQUAL(pc_polyindex_locate(idx, n + 0.5, 0.5), -1);
+
+	/* Not a polygon */
+	((uint8_t*)wkbs[5])[1] = 2;
+	CU_ASSERT(pc_polyindex_from_wkb(wkbs, wkbsizes, n * n) == NULL);
+
+	pc_polyindex_free(idx);
+	for ( i = 0; i < n * n; i++ )
+		pcfree((uint8_t*)wkbs[i]);
+	pcfree(wkbs);
+	pcfree(wkbsizes);
+}
+
+static void
+test_patch_sample_grid()
+{
+	/* A 3x3 grid over 0,0 3,3, north up, with a NaN cell */
+	static const double grid[] = { 10, 20, 30, 40, 50, 60, 70, 80, NAN };
+	static const double gt[] = { 0, 1, 0, 3, 0, -1 };
+	static const double x[] = { 0.5, 1, 1.5, 2.5, 5 };
+	static const double y[] = { 2.5, 2, 1.5, 0.5, 5 };
+	static const double nearest[] = { 10, 50, 50, 7, 7 };
+	static const double bilinear[] = { 10, 30, 50, 7, 7 };
+	static const double singular[] = { 0, 1, 1, 3, 0, 0 };
+	PCPOINTLIST *pl;
+	PCPATCH *pa, *pd, *pu, *ps;
+	double v;
+	int i;
+
+	pl = pc_pointlist_make(5);
+	for ( i = 0; i < 5; i++ )
+	{
+		PCPOINT *p = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(p, "x", x[i]);
+		pc_point_set_double_by_name(p, "y", y[i]);
+		pc_point_set_double_by_name(p, "Z", i);
+		pc_point_set_double_by_name(p, "intensity", 7);
+		pc_pointlist_add_point(pl, p);
+	}
+	pa = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl);
+	pd = pc_patch_compress(pa, NULL);
+	CU_ASSERT_EQUAL(pd->type, PC_DIMENSIONAL);
+
+	pu = pc_patch_sample_grid(pa, grid, 3, 3, gt, "intensity", PC_SAMPLE_NEAREST);
+	ps = pc_patch_sample_grid(pd, grid, 3, 3, gt, "intensity", PC_SAMPLE_NEAREST);
+	CU_ASSERT_EQUAL(pu->type, PC_NONE);
+	CU_ASSERT_EQUAL(ps->type, PC_DIMENSIONAL);
+	/* The sampled column keeps its compression */
+	i = pc_schema_get_dimension_by_name(simpleschema, "intensity")->position;
+	CU_ASSERT_NOT_EQUAL(((PCPATCH_DIMENSIONAL*)pd)->bytes[i].compression, PC_DIM_NONE);
+	CU_ASSERT_EQUAL(((PCPATCH_DIMENSIONAL*)ps)->bytes[i].compression, ((PCPATCH_DIMENSIONAL*)pd)->bytes[i].compression);
+	for ( i = 0; i < 5; i++ )
+	{
+		PCPOINT *p = pc_patch_pointn(pu, i + 1);
+		pc_point_get_double_by_name(p, "intensity", &v);
+		CU_ASSERT_DOUBLE_EQUAL(v, nearest[i], 0.000001);
+		pc_point_get_double_by_name(p, "Z", &v);
+		CU_ASSERT_DOUBLE_EQUAL(v, i, 0.000001);
+		pc_point_free(p);
+		p = pc_patch_pointn(ps, i + 1);
+		pc_point_get_double_by_name(p, "intensity", &v);
+		CU_ASSERT_DOUBLE_EQUAL(v, nearest[i], 0.000001);
+		pc_point_free(p);
+	}
+	pc_point_get_double_by_name(&(ps->stats->max), "intensity", &v);
+	CU_ASSERT_DOUBLE_EQUAL(v, 50, 0.000001);
+	pc_point_get_double_by_name(&(ps->stats->avg), "intensity", &v);
+	CU_ASSERT_DOUBLE_EQUAL(v, 25, 0.000001); /* 124 / 5, rounded to the uint16 */
+	pc_point_get_double_by_name(&(ps->stats->max), "Z", &v);
+	CU_ASSERT_DOUBLE_EQUAL(v, 4, 0.000001);
+	CU_ASSERT_DOUBLE_EQUAL(ps->bounds.xmax, 5, 0.000001);
+	pc_patch_free(pu);
+	pc_patch_free(ps);
+
+	ps = pc_patch_sample_grid(pd, grid, 3, 3, gt, "intensity", PC_SAMPLE_BILINEAR);
+	for ( i = 0; i < 5; i++ )
+	{
+		PCPOINT *p = pc_patch_pointn(ps, i + 1);
+		pc_point_get_double_by_name(p, "intensity", &v);
+		CU_ASSERT_DOUBLE_EQUAL(v, bilinear[i], 0.000001);
+		pc_point_free(p);
+	}
+	pc_point_get_double_by_name(&(ps->stats->min), "intensity", &v);
+	CU_ASSERT_DOUBLE_EQUAL(v, 7, 0.000001);
+	pc_patch_free(ps);
+
+	CU_ASSERT(pc_patch_sample_grid(pa, grid, 3, 3, gt, "x", PC_SAMPLE_NEAREST) == NULL);
+	CU_ASSERT(pc_patch_sample_grid(pa, grid, 3, 3, gt, "nothere", PC_SAMPLE_NEAREST) == NULL);
+	CU_ASSERT(pc_patch_sample_grid(pa, grid, 3, 3, singular, "intensity", PC_SAMPLE_NEAREST) == NULL);
+
+	pc_patch_free(pd);
+	pc_patch_free(pa);
+	pc_pointlist_free(pl);
+}
+
+static void
+test_patch_affine()
+{
+	/* A quarter turn around Z, then a translation */
+	static const double m[] = { 0, -1, 0, 10, 1, 0, 0, 20, 0, 0, 1, 1, 0, 0, 0, 1 };
+	static const double overflow[] = { 1, 0, 0, 1e8, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+	static const double projective[] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 1, 1 };
+	PCPOINTLIST *pl;
+	PCPATCH *pa, *pd, *pu, *ps;
+	const PCPATCH_DIMENSIONAL *pdl, *psl;
+	int ipos = pc_schema_get_dimension_by_name(simpleschema, "intensity")->position;
+	char *str, *str2;
+	double v;
+	int i;
+
+	pl = pc_pointlist_make(10);
+	for ( i = 0; i < 10; i++ )
+	{
+		PCPOINT *p = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(p, "x", i);
+		pc_point_set_double_by_name(p, "y", 2 * i);
+		pc_point_set_double_by_name(p, "Z", 0.5 * i);
+		pc_point_set_double_by_name(p, "intensity", 7);
+		pc_pointlist_add_point(pl, p);
+	}
+	pa = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl);
+	pd = pc_patch_compress(pa, NULL);
+	CU_ASSERT_EQUAL(pd->type, PC_DIMENSIONAL);
+
+	pu = pc_patch_affine(pa, m);
+	ps = pc_patch_affine(pd, m);
+	CU_ASSERT_EQUAL(pu->type, PC_NONE);
+	CU_ASSERT_EQUAL(ps->type, PC_DIMENSIONAL);
+	for ( i = 0; i < 10; i++ )
+	{
+		PCPOINT *p = pc_patch_pointn(ps, i + 1);
+		pc_point_get_double_by_name(p, "x", &v);
+		CU_ASSERT_DOUBLE_EQUAL(v, 10 - 2 * i, 0.000001);
+		pc_point_get_double_by_name(p, "y", &v);
+		CU_ASSERT_DOUBLE_EQUAL(v, 20 + i, 0.000001);
+		pc_point_get_double_by_name(p, "Z", &v);
+		CU_ASSERT_DOUBLE_EQUAL(v, 1 + 0.5 * i, 0.000001);
+		pc_point_get_double_by_name(p, "intensity", &v);
+		CU_ASSERT_DOUBLE_EQUAL(v, 7, 0.000001);
+		pc_point_free(p);
+	}
+	str = pc_patch_to_string(pu);
+	str2 = pc_patch_to_string(ps);
+	CU_ASSERT_STRING_EQUAL(str, str2);
+	pcfree(str);
+	pcfree(str2);
+
+	CU_ASSERT_DOUBLE_EQUAL(ps->bounds.xmin, -8, 0.000001);
+	CU_ASSERT_DOUBLE_EQUAL(ps->bounds.xmax, 10, 0.000001);
+	CU_ASSERT_DOUBLE_EQUAL(ps->bounds.ymin, 20, 0.000001);
+	CU_ASSERT_DOUBLE_EQUAL(ps->bounds.ymax, 29, 0.000001);
+	CU_ASSERT_DOUBLE_EQUAL(pu->bounds.ymax, 29, 0.000001);
+	pc_point_get_double_by_name(&(ps->stats->max), "Z", &v);
+	CU_ASSERT_DOUBLE_EQUAL(v, 5.5, 0.000001);
+	pc_point_get_double_by_name(&(ps->stats->avg), "x", &v);
+	CU_ASSERT_DOUBLE_EQUAL(v, 1, 0.000001);
+	pc_point_get_double_by_name(&(pu->stats->min), "y", &v);
+	CU_ASSERT_DOUBLE_EQUAL(v, 20, 0.000001);
+
+	/* The intensity column is carried over encoded */
+	pdl = (const PCPATCH_DIMENSIONAL*)pd;
+	psl = (const PCPATCH_DIMENSIONAL*)ps;
+	CU_ASSERT_EQUAL(psl->bytes[ipos].compression, pdl->bytes[ipos].compression);
+	CU_ASSERT_EQUAL(psl->bytes[ipos].size, pdl->bytes[ipos].size);
+	CU_ASSERT(memcmp(psl->bytes[ipos].bytes, pdl->bytes[ipos].bytes, pdl->bytes[ipos].size) == 0);
+	CU_ASSERT_EQUAL(psl->bytes[0].compression, pdl->bytes[0].compression);
+
+	pc_patch_free(pu);
+	pc_patch_free(ps);
+
+	CU_ASSERT(pc_patch_affine(pd, overflow) == NULL);
+	CU_ASSERT(pc_patch_affine(pa, overflow) == NULL);
+	CU_ASSERT(pc_patch_affine(pa, projective) == NULL);
+
+	pc_patch_free(pd);
+	pc_patch_free(pa);
+	pc_pointlist_free(pl);
+}
+
+static PCPATCH *
+surface_patch(const double *xyz, int npoints)
+{
+	PCPOINTLIST *pl = pc_pointlist_make(npoints);
+	PCPATCH *pa;
+	int i;
+
+	for ( i = 0; i < npoints; i++ )
+	{
+		PCPOINT *p = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(p, "x", xyz[3*i]);
+		pc_point_set_double_by_name(p, "y", xyz[3*i+1]);
+		pc_point_set_double_by_name(p, "Z", xyz[3*i+2]);
+		pc_pointlist_add_point(pl, p);
+	}
+	pa = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl);
+	pc_pointlist_free(pl);
+	return pa;
+}
+
+static void
+test_surface()
+{
+	/* Two points in the north-west cell, one in the south-east one */
+	static const double xyz1[] = { 0.5, 2.5, 1, 0.25, 2.25, 3, 2.5, 0.5, 5 };
+	/* One in the north-east cell, one east of the grid, one far away */
+	static const double xyz2[] = { 3.5, 2.5, 9, 4.5, 1.5, 21, 100, 100, 0 };
+	PCPATCH *pa1 = surface_patch(xyz1, 3);
+	PCPATCH *pa2u = surface_patch(xyz2, 3);
+	PCPATCH *pa2 = pc_patch_compress(pa2u, NULL);
+	PCSURFACE *s;
+	double *out;
+
+	CU_ASSERT_EQUAL(pa2->type, PC_DIMENSIONAL);
+
+	/* 4 x 3 grid of 1 x 1 cells, no hole filling */
+	s = pc_surface_new(0, 3, 1, 4, 3, 0, PC_SURFACE_MIN);
+	CU_ASSERT_EQUAL(pc_surface_add_patch(s, pa1), PC_SUCCESS);
+	CU_ASSERT_EQUAL(pc_surface_add_patch(s, pa2), PC_SUCCESS);
+	out = pc_surface_finish(s, PC_FILL_NEAREST);
+	CU_ASSERT_DOUBLE_EQUAL(out[0], 1, 0.000001);
+	CU_ASSERT_DOUBLE_EQUAL(out[3], 9, 0.000001);
+	CU_ASSERT_DOUBLE_EQUAL(out[2*4+2], 5, 0.000001);
+	CU_ASSERT(isnan(out[1]));
+	CU_ASSERT(isnan(out[1*4+3]));
+	pcfree(out);
+	pc_surface_free(s);
+
+	s = pc_surface_new(0, 3, 1, 4, 3, 0, PC_SURFACE_MAX);
+	pc_surface_add_patch(s, pa1);
+	out = pc_surface_finish(s, PC_FILL_NONE);
+	CU_ASSERT_DOUBLE_EQUAL(out[0], 3, 0.000001);
+	pcfree(out);
+	pc_surface_free(s);
+
+	/* The point on the cell center outweighs the other one */
+	s = pc_surface_new(0, 3, 1, 4, 3, 0, PC_SURFACE_IDW);
+	pc_surface_add_patch(s, pa1);
+	out = pc_surface_finish(s, PC_FILL_NONE);
+	CU_ASSERT_DOUBLE_EQUAL(out[0], 1, 0.0001);
+	pcfree(out);
+	pc_surface_free(s);
+
+	/* Holes next to a cell with data get filled, from the margin too */
+	s = pc_surface_new(0, 3, 1, 4, 3, 1, PC_SURFACE_MEAN);
+	CU_ASSERT_EQUAL(s->margin, 1);
+	pc_surface_add_patch(s, pa1);
+	pc_surface_add_patch(s, pa2);
+	out = pc_surface_finish(s, PC_FILL_NONE);
+	CU_ASSERT_DOUBLE_EQUAL(out[0], 2, 0.000001);
+	CU_ASSERT(isnan(out[1]));
+	pcfree(out);
+	out = pc_surface_finish(s, PC_FILL_NEAREST);
+	CU_ASSERT_DOUBLE_EQUAL(out[1], 2, 0.000001);
+	CU_ASSERT(isnan(out[1*4+1]));
+	pcfree(out);
+	out = pc_surface_finish(s, PC_FILL_IDW);
+	CU_ASSERT_DOUBLE_EQUAL(out[1*4+3], 15, 0.000001);
+	pcfree(out);
+	pc_surface_free(s);
+
+	/* Diagonal neighbours are in reach of a wider radius */
+	s = pc_surface_new(0, 3, 1, 4, 3, 1.5, PC_SURFACE_MEAN);
+	CU_ASSERT_EQUAL(s->margin, 2);
+	pc_surface_add_patch(s, pa1);
+	out = pc_surface_finish(s, PC_FILL_IDW);
+	CU_ASSERT_DOUBLE_EQUAL(out[1*4+1], 3.5, 0.000001);
+	pcfree(out);
+	pc_surface_free(s);
+
+	CU_ASSERT(pc_surface_new(0, 3, 0, 4, 3, 0, PC_SURFACE_MEAN) == NULL);
+	CU_ASSERT(pc_surface_new(0, 3, 1, 0, 3, 0, PC_SURFACE_MEAN) == NULL);
+	CU_ASSERT(pc_surface_new(0, 3, 1, 4, 3, -1, PC_SURFACE_MEAN) == NULL);
+	CU_ASSERT(pc_surface_new(0, 3, 1, 100000, 100000, 0, PC_SURFACE_MEAN) == NULL);
+
+	pc_patch_free(pa1);
+	pc_patch_free(pa2);
+	pc_patch_free(pa2u);
+}
+
+static void
+test_patch_zip()
+{
+	const char *hotdims[] = {"Z"};
+	const char *colddims[] = {"Intensity"};
+	char *xmlstr = file_to_str(simplexmlfile);
+	char *hotxml = pc_schema_xml_subset(xmlstr, hotdims, 1);
+	char *coldxml = pc_schema_xml_subset(xmlstr, colddims, 1);
+	PCSCHEMA *hot = pc_schema_from_xml(hotxml);
+	PCSCHEMA *cold = pc_schema_from_xml(coldxml);
+	PCPOINTLIST *pl = pc_pointlist_make(20);
+	PCPATCH_DIMENSIONAL *pdl;
+	PCPATCH *pa, *pad, *groups[2], *zipped;
+	char *str1, *str2;
+	int i;
+
+	for ( i = 0; i < 20; i++ )
+	{
+		PCPOINT *pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "x", i);
+		pc_point_set_double_by_name(pt, "y", 2 * i);
+		pc_point_set_double_by_name(pt, "Z", 100 + i % 3);
+		pc_point_set_double_by_name(pt, "intensity", 7 * i);
+		pc_pointlist_add_point(pl, pt);
+	}
+	pa = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl);
+	pdl = pc_patch_dimensional_from_pointlist(pl);
+	pad = (PCPATCH*)pc_patch_dimensional_compress(pdl, NULL);
+	str1 = pc_patch_to_string(pa);
+
+	/* Split into groups and zip them back, uncompressed */
+	groups[0] = pc_patch_zip(&pa, 1, hot);
+	groups[1] = pc_patch_zip(&pa, 1, cold);
+	CU_ASSERT_EQUAL(groups[0]->schema->ndims, 3);
+	CU_ASSERT_EQUAL(groups[1]->npoints, 20);
+	zipped = pc_patch_zip(groups, 2, simpleschema);
+	str2 = pc_patch_to_string(zipped);
+	CU_ASSERT_STRING_EQUAL(str1, str2);
+	pcfree(str2);
+	pc_patch_free(zipped);
+	pc_patch_free(groups[0]);
+	pc_patch_free(groups[1]);
+
+	/* Same on dimensional patches, with the columns left encoded */
+	groups[0] = pc_patch_zip(&pad, 1, hot);
+	groups[1] = pc_patch_zip(&pad, 1, cold);
+	CU_ASSERT_EQUAL(groups[0]->type, PC_DIMENSIONAL);
+	CU_ASSERT_EQUAL(((PCPATCH_DIMENSIONAL*)groups[0])->bytes[2].compression,
+	                ((PCPATCH_DIMENSIONAL*)pad)->bytes[2].compression);
+	zipped = pc_patch_zip(groups, 2, simpleschema);
+	CU_ASSERT_EQUAL(zipped->type, PC_DIMENSIONAL);
+	CU_ASSERT_EQUAL(((PCPATCH_DIMENSIONAL*)zipped)->bytes[3].compression,
+	                ((PCPATCH_DIMENSIONAL*)pad)->bytes[3].compression);
+	CU_ASSERT_DOUBLE_EQUAL(zipped->bounds.ymax, 38, 0.000001);
+	CU_ASSERT(memcmp(zipped->stats->max.data, pad->stats->max.data, simpleschema->size) == 0);
+	str2 = pc_patch_to_string(zipped);
+	CU_ASSERT_STRING_EQUAL(str1, str2);
+	pcfree(str2);
+	pc_patch_free(zipped);
+
+	/* Mixed patch types, then missing dimensions and mismatched points */
+	pc_patch_free(groups[0]);
+	groups[0] = pc_patch_zip(&pa, 1, hot);
+	zipped = pc_patch_zip(groups, 2, simpleschema);
+	str2 = pc_patch_to_string(zipped);
+	CU_ASSERT_STRING_EQUAL(str1, str2);
+	pcfree(str2);
+	pc_patch_free(zipped);
+	CU_ASSERT_PTR_NULL(pc_patch_zip(&groups[1], 1, simpleschema));
+	pc_patch_free(groups[0]);
+	groups[0] = pc_patch_range(pa, 1, 10);
+	CU_ASSERT_PTR_NULL(pc_patch_zip(groups, 2, simpleschema));
+
+	pc_patch_free(groups[0]);
+	pc_patch_free(groups[1]);
+	pc_patch_free(pa);
+	pc_patch_free(pad);
+	pc_patch_free((PCPATCH*)pdl);
+	pc_pointlist_free(pl);
+	pc_schema_free(hot);
+	pc_schema_free(cold);
+	pcfree(str1);
+	pcfree(hotxml);
+	pcfree(coldxml);
+	pcfree(xmlstr);
+}
+
 /* REGISTER ***********************************************************/
 
 CU_TestInfo patch_tests[] = {
@@ -1397,7 +2703,13 @@ CU_TestInfo patch_tests[] = {
 	PC_TEST(test_patch_dimensional_extent),
 	PC_TEST(test_patch_union),
 	PC_TEST(test_patch_wkb),
+	PC_TEST(test_patch_wkb_readonly),
+	PC_TEST(test_patch_wkb_stats),
+	PC_TEST(test_patch_wkb_zdict),
+	PC_TEST(test_patch_wkb_flags),
+	PC_TEST(test_patch_wkb_dimensional_xdr),
 	PC_TEST(test_patch_filter),
+	PC_TEST(test_patch_filter_box),
 #if defined(HAVE_LIBGHT) && defined(HAVE_LAZPERF)
 	PC_TEST(test_patch_compress_from_ght_to_lazperf),
 #endif
@@ -1423,6 +2735,14 @@ CU_TestInfo patch_tests[] = {
 #ifdef HAVE_LAZPERF
 	PC_TEST(test_patch_range_compression_lazperf),
 #endif
+	PC_TEST(test_patch_dimensional_append_none),
+	PC_TEST(test_patch_dimensional_append_zlib),
+	PC_TEST(test_patch_dimensional_append_sigbits),
+	PC_TEST(test_patch_dimensional_append_rle),
+	PC_TEST(test_patch_compact),
+	PC_TEST(test_patch_dimensional_lazy_decoding),
+	PC_TEST(test_patch_builder_uncompressed),
+	PC_TEST(test_patch_builder_dimensional),
 	PC_TEST(test_patch_set_schema_compression_none),
 	PC_TEST(test_patch_set_schema_compression_none_offset),
 #ifdef HAVE_LIBGHT
@@ -1436,6 +2756,13 @@ CU_TestInfo patch_tests[] = {
 	PC_TEST(test_patch_set_schema_compression_lazperf),
 #endif
 	PC_TEST(test_patch_transform_compression_none),
+	PC_TEST(test_patch_to_geometry_wkb_multipoint),
+	PC_TEST(test_patch_polygon_classify),
+	PC_TEST(test_patch_polygon_classify_many),
+	PC_TEST(test_patch_sample_grid),
+	PC_TEST(test_patch_affine),
+	PC_TEST(test_surface),
+	PC_TEST(test_patch_zip),
 	CU_TEST_INFO_NULL
 };
 
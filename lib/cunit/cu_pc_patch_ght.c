@@ -96,6 +96,8 @@ test_patch_ght_filtering()
 	static int npts = 100;
 	PCPOINTLIST *pl;
 	PCPATCH_GHT *pag, *pag_filtered;
+	PCPATCH *pa_box;
+	double d;
 
 	pl = pc_pointlist_make(npts);
 
@@ -126,11 +128,64 @@ test_patch_ght_filtering()
 
 	pag_filtered = pc_patch_ght_filter(pag, dimnum, PC_BETWEEN, 11, 16);
 	CU_ASSERT_EQUAL(pag_filtered->npoints, 15);
-	pc_patch_ght_free(pag_filtered);
+	/* Stats are those of the points left */
+	pc_point_get_double_by_name(&(pag_filtered->stats->min), "Z", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 11.02, 0.001);
+	pc_point_get_double_by_name(&(pag_filtered->stats->max), "Z", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 15.78, 0.001);
+	pc_patch_free((PCPATCH*)pag_filtered);
+
+	/* Points 10 to 49 are within the box */
+	pa_box = pc_patch_filter_box((PCPATCH*)pag, 45.0000398, 44, 45.0001998, 46);
+	CU_ASSERT_EQUAL(pa_box->npoints, 40);
+	pc_point_get_double_by_name(&(pa_box->stats->min), "Z", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 13.4, 0.001);
+	pc_point_get_double_by_name(&(pa_box->stats->max), "Z", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 26.66, 0.001);
+	pc_patch_free(pa_box);
+
+	pa_box = pc_patch_filter_box((PCPATCH*)pag, 46, 44, 47, 46);
+	CU_ASSERT_EQUAL(pa_box->npoints, 0);
+	pc_patch_free(pa_box);
 
 	pc_patch_ght_free(pag);
 }
 
+static void
+test_patch_ght_keylength()
+{
+	PCPOINT *pt;
+	int i;
+	static int npts = 100;
+	PCPOINTLIST *pl;
+	PCPATCH_GHT *pag;
+	PCPATCH_UNCOMPRESSED *pu;
+	PCSCHEMA *schema = pc_schema_clone(simpleschema);
+
+	/* A coarser hash than the default */
+	schema->ghtkeylength = 12;
+
+	pl = pc_pointlist_make(npts);
+	for ( i = 0; i < npts; i++ )
+	{
+		pt = pc_point_make(schema);
+		pc_point_set_double_by_name(pt, "x", 45 + i*0.004);
+		pc_point_set_double_by_name(pt, "y", 45 + i*0.001666);
+		pc_point_set_double_by_name(pt, "Z", 10 + i*0.34);
+		pc_point_set_double_by_name(pt, "intensity", 10);
+		pc_pointlist_add_point(pl, pt);
+	}
+
+	pag = pc_patch_ght_from_pointlist(pl);
+	CU_ASSERT_EQUAL(pag->npoints, npts);
+	pu = pc_patch_uncompressed_from_ght(pag);
+	CU_ASSERT_EQUAL(pu->npoints, npts);
+
+	pc_patch_uncompressed_free(pu);
+	pc_patch_ght_free(pag);
+	pc_pointlist_free(pl);
+	pc_schema_free(schema);
+}
 
 #endif /* HAVE_LIBGHT */
 
@@ -140,6 +195,7 @@ CU_TestInfo ght_tests[] = {
 #ifdef HAVE_LIBGHT
 	PC_TEST(test_patch_ght),
 	PC_TEST(test_patch_ght_filtering),
+	PC_TEST(test_patch_ght_keylength),
 #endif
 	CU_TEST_INFO_NULL
 };
@@ -9,6 +9,7 @@
 
 #include "CUnit/Basic.h"
 #include "cu_tester.h"
+#include "lazperf_adapter.h"
 
 /* GLOBALS ************************************************************/
 
@@ -330,6 +331,179 @@ test_patch_compression_with_multiple_dimension()
 	pcfree(str1);
 	pcfree(str2);
 }
+
+static void
+test_patch_lazperf_las_format()
+{
+	PCPOINT *pt;
+	int i;
+	int npts = 400;
+	PCPOINTLIST *pl;
+	PCPATCH_LAZPERF *pal;
+	PCPATCH_UNCOMPRESSED *pau, *paul;
+	PCSCHEMA *lasschema;
+	uint8_t *wkb;
+	size_t wkbsize;
+	char *xmlstr = file_to_str("data/las-schema.xml");
+
+	lasschema = pc_schema_from_xml(xmlstr);
+	pcfree(xmlstr);
+
+	pl = pc_pointlist_make(npts);
+	for ( i = 0; i < npts; i++ )
+	{
+		pt = pc_point_make(lasschema);
+		pc_point_set_double_by_name(pt, "X", -127 + i*0.0001);
+		pc_point_set_double_by_name(pt, "Y", 45 + i*0.0001);
+		pc_point_set_double_by_name(pt, "Z", i*0.34);
+		pc_point_set_double_by_name(pt, "Intensity", i % 50);
+		pc_point_set_double_by_name(pt, "ReturnNumber", 1 + i % 3);
+		pc_point_set_double_by_name(pt, "NumberOfReturns", 3);
+		pc_point_set_double_by_name(pt, "EdgeOfFlightLine", i == 0);
+		pc_point_set_double_by_name(pt, "Classification", 2);
+		pc_point_set_double_by_name(pt, "Time", 1000 + i*0.001);
+		pc_point_set_double_by_name(pt, "Red", i);
+		pc_point_set_double_by_name(pt, "PointID", i);
+		pc_pointlist_add_point(pl, pt);
+	}
+
+	/* LAS point format 3 records, then the other dimensions */
+	pau = pc_patch_uncompressed_from_pointlist(pl);
+	pal = pc_patch_lazperf_from_uncompressed(pau);
+	CU_ASSERT_EQUAL(pal->lazperf[0], LAZPERF_LAS_POINT3);
+	paul = pc_patch_uncompressed_from_lazperf(pal);
+	CU_ASSERT_EQUAL(memcmp(paul->data, pau->data, pau->datasize), 0);
+	pc_patch_free((PCPATCH*) paul);
+
+	/* The wkb keeps the format byte and flags it */
+	wkb = pc_patch_lazperf_to_wkb(pal, &wkbsize);
+	CU_ASSERT_EQUAL(wkb_get_flags(wkb), PC_WKB_LAZHEADER);
+	pc_patch_free((PCPATCH*) pal);
+	pal = (PCPATCH_LAZPERF*) pc_patch_lazperf_from_wkb(lasschema, wkb, wkbsize);
+	CU_ASSERT_EQUAL(pal->lazperf[0], LAZPERF_LAS_POINT3);
+	paul = pc_patch_uncompressed_from_lazperf(pal);
+	CU_ASSERT_EQUAL(memcmp(paul->data, pau->data, pau->datasize), 0);
+	pc_patch_free((PCPATCH*) paul);
+	pc_patch_free((PCPATCH*) pal);
+	pcfree(wkb);
+
+	/* Values that do not fit the LAS bit fields */
+	pau->data[lasschema->size * 10 + pc_schema_get_dimension_by_name(lasschema, "ReturnNumber")->byteoffset] = 9;
+	pal = pc_patch_lazperf_from_uncompressed(pau);
+	CU_ASSERT_EQUAL(pal->lazperf[0], LAZPERF_DYNAMIC);
+	paul = pc_patch_uncompressed_from_lazperf(pal);
+	CU_ASSERT_EQUAL(memcmp(paul->data, pau->data, pau->datasize), 0);
+	pc_patch_free((PCPATCH*) paul);
+	pc_patch_free((PCPATCH*) pal);
+
+	pc_patch_free((PCPATCH*) pau);
+	pc_pointlist_free(pl);
+	pc_schema_free(lasschema);
+}
+
+static void
+test_patch_lazperf_chunks()
+{
+	PCPOINT *pt;
+	int i;
+	int npts = 100;
+	uint32_t chunksize;
+	PCPOINTLIST *pl;
+	PCPATCH_LAZPERF *pal;
+	PCPATCH_UNCOMPRESSED *pau, *paul;
+	PCPATCH *pa;
+	PCBOUNDS b;
+	PCSCHEMA *schema = pc_schema_clone(simpleschema);
+
+	schema->lazchunksize = 16;
+	pl = pc_pointlist_make(npts);
+	for ( i = 0; i < npts; i++ )
+	{
+		pt = pc_point_make(schema);
+		pc_point_set_double_by_name(pt, "x", i*2.0);
+		pc_point_set_double_by_name(pt, "y", i*1.9);
+		pc_point_set_double_by_name(pt, "Z", i*0.34);
+		pc_point_set_double_by_name(pt, "intensity", i % 7);
+		pc_pointlist_add_point(pl, pt);
+	}
+	pau = pc_patch_uncompressed_from_pointlist(pl);
+	pal = pc_patch_lazperf_from_uncompressed(pau);
+
+	/* 6 chunks of 16 points and one of 4 */
+	CU_ASSERT(pal->lazperf[0] & LAZPERF_CHUNKED);
+	CU_ASSERT(pal->lazperf[0] & LAZPERF_CHUNK_BOUNDS);
+	CU_ASSERT_EQUAL(pc_patch_lazperf_nchunks(pal, &chunksize), 7);
+	CU_ASSERT_EQUAL(chunksize, 16);
+	CU_ASSERT_EQUAL(pc_patch_lazperf_chunk_bounds(pal, 6, &b), PC_SUCCESS);
+	CU_ASSERT_DOUBLE_EQUAL(b.xmin, 192, 0.001);
+	CU_ASSERT_DOUBLE_EQUAL(b.xmax, 198, 0.001);
+	CU_ASSERT_DOUBLE_EQUAL(b.ymax, 188.1, 0.001);
+
+	paul = pc_patch_uncompressed_from_lazperf(pal);
+	CU_ASSERT_EQUAL(memcmp(paul->data, pau->data, pau->datasize), 0);
+	pc_patch_free((PCPATCH*) paul);
+
+	/* Ranges across chunk boundaries */
+	pa = pc_patch_range((PCPATCH*) pal, 10, 30);
+	CU_ASSERT_EQUAL(pa->npoints, 30);
+	CU_ASSERT_EQUAL(memcmp(((PCPATCH_UNCOMPRESSED*)pa)->data, pau->data + 9 * schema->size, 30 * schema->size), 0);
+	pc_patch_free(pa);
+
+	pt = pc_patch_pointn((PCPATCH*) pal, 50);
+	CU_ASSERT_EQUAL(memcmp(pt->data, pau->data + 49 * schema->size, schema->size), 0);
+	pc_point_free(pt);
+
+	/* Only the chunks intersecting the box are decoded */
+	paul = pc_patch_uncompressed_from_lazperf_box(pal, &b);
+	CU_ASSERT_EQUAL(paul->npoints, 4);
+	pc_patch_free((PCPATCH*) paul);
+	pa = pc_patch_filter_box((PCPATCH*) pal, 10, 0, 40, 1000);
+	CU_ASSERT_EQUAL(pa->npoints, 16);
+	pc_patch_free(pa);
+
+	pc_patch_free((PCPATCH*) pal);
+	pc_patch_free((PCPATCH*) pau);
+	pc_pointlist_free(pl);
+	pc_schema_free(schema);
+}
+
+static void
+test_patch_lazperf_old_layout()
+{
+	/* A single dynamic stream without format byte, as LAZ patches used to be */
+	const char *hexwkb = "01050000000300000004000000210000000000000000000000000000000a004417593a34c1c5f74f83179fc2448960000000";
+	size_t wkbsize = strlen(hexwkb) / 2;
+	uint8_t *wkb = pc_bytes_from_hexbytes(hexwkb, strlen(hexwkb));
+	uint8_t *wkb2;
+	size_t wkbsize2;
+	PCPATCH_LAZPERF *pal;
+	PCPOINT *pt;
+	double d;
+
+	pal = (PCPATCH_LAZPERF*) pc_patch_lazperf_from_wkb(simpleschema, wkb, wkbsize);
+	CU_ASSERT_EQUAL(pal->npoints, 4);
+	CU_ASSERT_EQUAL(pal->lazperf[0], LAZPERF_DYNAMIC);
+
+	pt = pc_patch_pointn((PCPATCH*) pal, 4);
+	pc_point_get_double_by_name(pt, "x", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 6, 0.001);
+	pc_point_get_double_by_name(pt, "y", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 5.7, 0.001);
+	pc_point_get_double_by_name(pt, "Z", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 1.02, 0.001);
+	pc_point_get_double_by_name(pt, "intensity", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 10, 0.001);
+	pc_point_free(pt);
+
+	/* and it is written back unchanged */
+	wkb2 = pc_patch_lazperf_to_wkb(pal, &wkbsize2);
+	CU_ASSERT_EQUAL(wkbsize2, wkbsize);
+	CU_ASSERT_EQUAL(memcmp(wkb2, wkb, wkbsize), 0);
+
+	pcfree(wkb2);
+	pcfree(wkb);
+	pc_patch_free((PCPATCH*) pal);
+}
 #endif
 
 /* REGISTER ***********************************************************/
@@ -343,6 +517,9 @@ CU_TestInfo lazperf_tests[] = {
 	PC_TEST(test_wkb_lazperf),
 	PC_TEST(test_patch_filter_lazperf_zero_point),
 	PC_TEST(test_patch_compression_with_multiple_dimension),
+	PC_TEST(test_patch_lazperf_las_format),
+	PC_TEST(test_patch_lazperf_chunks),
+	PC_TEST(test_patch_lazperf_old_layout),
 #endif
 	CU_TEST_INFO_NULL
 };
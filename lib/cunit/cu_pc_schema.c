@@ -206,6 +206,8 @@ test_schema_clone(void)
 	CU_ASSERT_EQUAL(clone->zdim->position, schema->zdim->position);
 	CU_ASSERT_EQUAL(clone->mdim->position, schema->mdim->position);
 	CU_ASSERT_EQUAL(clone->compression, schema->compression);
+	CU_ASSERT_EQUAL(clone->lazchunksize, schema->lazchunksize);
+	CU_ASSERT_EQUAL(clone->ghtkeylength, schema->ghtkeylength);
 	CU_ASSERT_NOT_EQUAL(clone->xdim, schema->xdim); /* deep clone */
 	CU_ASSERT_NOT_EQUAL(clone->ydim, schema->ydim); /* deep clone */
 	CU_ASSERT_NOT_EQUAL(clone->zdim, schema->zdim); /* deep clone */
@@ -433,6 +435,36 @@ test_schema_same_interpretations(void)
 	pc_schema_free(s2);
 }
 
+static void
+test_schema_xml_subset(void)
+{
+	const char *names[] = {"Classification", "Intensity", "Z"};
+	const char *bad[] = {"Intensity", "Nope"};
+	char *xmlstr = file_to_str(xmlfile);
+	char *subxml;
+	PCSCHEMA *sub;
+
+	/* X and Y are kept, the dimensions keep their schema order */
+	subxml = pc_schema_xml_subset(xmlstr, names, 3);
+	CU_ASSERT_PTR_NOT_NULL(subxml);
+	sub = pc_schema_from_xml(subxml);
+	CU_ASSERT_PTR_NOT_NULL(sub);
+	CU_ASSERT_EQUAL(sub->ndims, 5);
+	CU_ASSERT_STRING_EQUAL(sub->dims[0]->name, "X");
+	CU_ASSERT_STRING_EQUAL(sub->dims[1]->name, "Y");
+	CU_ASSERT_STRING_EQUAL(sub->dims[2]->name, "Z");
+	CU_ASSERT_STRING_EQUAL(sub->dims[3]->name, "Intensity");
+	CU_ASSERT_STRING_EQUAL(sub->dims[4]->name, "Classification");
+	CU_ASSERT_EQUAL(sub->dims[4]->interpretation, pc_schema_get_dimension_by_name(schema, "Classification")->interpretation);
+	CU_ASSERT_EQUAL(sub->dims[4]->byteoffset, 4 + 4 + 4 + 2);
+	CU_ASSERT_EQUAL(sub->compression, schema->compression);
+	pc_schema_free(sub);
+	pcfree(subxml);
+
+	CU_ASSERT_PTR_NULL(pc_schema_xml_subset(xmlstr, bad, 2));
+	pcfree(xmlstr);
+}
+
 /* REGISTER ***********************************************************/
 
 CU_TestInfo schema_tests[] = {
@@ -453,6 +485,7 @@ CU_TestInfo schema_tests[] = {
 	PC_TEST(test_schema_clone_empty_name),
 	PC_TEST(test_schema_same_dimensions),
 	PC_TEST(test_schema_same_interpretations),
+	PC_TEST(test_schema_xml_subset),
 	CU_TEST_INFO_NULL
 };
 
@@ -371,6 +371,96 @@ test_sort_patch_ndims()
 	pc_patch_free(pa);
 }
 
+static PCPOINTLIST *
+make_time_pointlist(const int *times, int npts, int patchno)
+{
+	PCPOINTLIST *pl = pc_pointlist_make(npts);
+	int i;
+
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(schema);
+		pc_point_set_double_by_name(pt, "x", 100 * patchno + times[i]);
+		pc_point_set_double_by_name(pt, "y", 0);
+		pc_point_set_double_by_name(pt, "Z", 0);
+		pc_point_set_double_by_name(pt, "intensity", times[i]);
+		pc_pointlist_add_point(pl, pt);
+	}
+	return pl;
+}
+
+static void
+test_sort_slice_merge()
+{
+	static const int t1[] = { 1, 3, 5, 7, 9 };
+	static const int t2[] = { 2, 4, 6, 8, 10 };
+	static const int t3[] = { 6, 1, 11, 4 };
+	static const double x[] = { 103, 204, 304, 105, 206, 306, 107, 208 };
+	PCPOINTLIST *pl1 = make_time_pointlist(t1, 5, 1);
+	PCPOINTLIST *pl2 = make_time_pointlist(t2, 5, 2);
+	PCPOINTLIST *pl3 = make_time_pointlist(t3, 4, 3);
+	PCPATCH_DIMENSIONAL *pdl2 = pc_patch_dimensional_from_pointlist(pl2);
+	PCPATCH *pa[3], *slices[3], *pm;
+	const char *I[] = {"Intensity"};
+	double d;
+	int i;
+
+	pa[0] = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl1);
+	pa[1] = (PCPATCH*)pc_patch_dimensional_compress(pdl2, NULL);
+	pa[2] = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl3);
+
+	// sorted patches are cut, the unsorted one is filtered and sorted
+	for ( i = 0; i < 3; i++ )
+	{
+		slices[i] = pc_patch_slice_sorted(pa[i], "Intensity", 2, 9);
+		CU_ASSERT_EQUAL(slices[i]->type, PC_NONE);
+		CU_ASSERT_EQUAL(pc_patch_is_sorted(slices[i], I, 1, PC_FALSE), PC_TRUE);
+	}
+	CU_ASSERT_EQUAL(slices[0]->npoints, 3);
+	CU_ASSERT_EQUAL(slices[1]->npoints, 3);
+	CU_ASSERT_EQUAL(slices[2]->npoints, 2);
+	CU_ASSERT_DOUBLE_EQUAL(slices[1]->bounds.xmin, 204, precision);
+	CU_ASSERT_DOUBLE_EQUAL(slices[1]->bounds.xmax, 208, precision);
+
+	// merged in time order, ties to the first patch
+	pm = pc_patch_merge_sorted(slices, 3, "Intensity");
+	CU_ASSERT_EQUAL(pm->npoints, 8);
+	for ( i = 0; i < 8; i++ )
+	{
+		PCPOINT *pt = pc_patch_pointn(pm, i + 1);
+		pc_point_get_double_by_name(pt, "x", &d);
+		CU_ASSERT_DOUBLE_EQUAL(d, x[i], precision);
+		pc_point_free(pt);
+	}
+	pc_point_get_double_by_name(&(pm->stats->max), "intensity", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 8, precision);
+	pc_patch_free(pm);
+
+	// windows out of the patch, or empty
+	pm = pc_patch_slice_sorted(pa[1], "Intensity", 10, 20);
+	CU_ASSERT_EQUAL(pm->npoints, 0);
+	pc_patch_free(pm);
+	pm = pc_patch_slice_sorted(pa[0], "Intensity", 5, 5);
+	CU_ASSERT_EQUAL(pm->npoints, 0);
+	pc_patch_free(pm);
+	pm = pc_patch_slice_sorted(pa[0], "Intensity", 0, 100);
+	CU_ASSERT_EQUAL(pm->npoints, 5);
+	pc_patch_free(pm);
+
+	CU_ASSERT(pc_patch_slice_sorted(pa[0], "GpsTime", 0, 1) == NULL);
+	CU_ASSERT(pc_patch_merge_sorted(slices, 3, "GpsTime") == NULL);
+
+	for ( i = 0; i < 3; i++ )
+	{
+		pc_patch_free(pa[i]);
+		pc_patch_free(slices[i]);
+	}
+	pc_patch_free((PCPATCH*)pdl2);
+	pc_pointlist_free(pl1);
+	pc_pointlist_free(pl2);
+	pc_pointlist_free(pl3);
+}
+
 /* REGISTER ***********************************************************/
 
 CU_TestInfo sort_tests[] = {
@@ -384,6 +474,7 @@ CU_TestInfo sort_tests[] = {
 	PC_TEST(test_sort_patch_is_sorted_compression_dimensional_sigbits),
 	PC_TEST(test_sort_patch_is_sorted_compression_dimensional_rle),
 	PC_TEST(test_sort_patch_ndims),
+	PC_TEST(test_sort_slice_merge),
 	CU_TEST_INFO_NULL
 };
 
@@ -93,11 +93,100 @@ test_bounding_diagonal_wkb_from_stats()
 	pcfree(wkbhex);
 }
 
+static void
+test_double_to_string()
+{
+	char buf[PC_VALUE_STRLEN];
+
+	CU_ASSERT_EQUAL(pc_double_to_string(buf, 0), 1);
+	CU_ASSERT_STRING_EQUAL(buf, "0");
+	pc_double_to_string(buf, 4862413);
+	CU_ASSERT_STRING_EQUAL(buf, "4862413");
+	pc_double_to_string(buf, -126.99);
+	CU_ASSERT_STRING_EQUAL(buf, "-126.99");
+	pc_double_to_string(buf, 0.001);
+	CU_ASSERT_STRING_EQUAL(buf, "0.001");
+	pc_double_to_string(buf, 0.1 + 0.2);
+	CU_ASSERT_STRING_EQUAL(buf, "0.30000000000000004");
+	pc_double_to_string(buf, 1.0 / 3);
+	CU_ASSERT_STRING_EQUAL(buf, "0.3333333333333333");
+	pc_double_to_string(buf, 1e300);
+	CU_ASSERT_STRING_EQUAL(buf, "1e+300");
+	pc_double_to_string(buf, -2.5e-20);
+	CU_ASSERT_STRING_EQUAL(buf, "-2.5e-20");
+}
+
+static void
+test_value_to_string()
+{
+	char buf[PC_VALUE_STRLEN];
+	uint8_t data[8];
+	PCDIMENSION dim;
+
+	memset(&dim, 0, sizeof(PCDIMENSION));
+	dim.interpretation = PC_INT32;
+	dim.size = 4;
+	dim.scale = 0.01;
+
+	// scaled integers are written without double formatting
+	pc_double_to_ptr(data, PC_INT32, -12699);
+	CU_ASSERT_EQUAL(pc_value_to_string(buf, data, &dim), 7);
+	CU_ASSERT_STRING_EQUAL(buf, "-126.99");
+	pc_double_to_ptr(data, PC_INT32, 5);
+	pc_value_to_string(buf, data, &dim);
+	CU_ASSERT_STRING_EQUAL(buf, "0.05");
+	pc_double_to_ptr(data, PC_INT32, -500);
+	pc_value_to_string(buf, data, &dim);
+	CU_ASSERT_STRING_EQUAL(buf, "-5");
+	pc_double_to_ptr(data, PC_INT32, 0);
+	pc_value_to_string(buf, data, &dim);
+	CU_ASSERT_STRING_EQUAL(buf, "0");
+
+	dim.interpretation = PC_UINT64;
+	dim.size = 8;
+	dim.scale = 1;
+	memset(data, 0xFF, 8);
+	pc_value_to_string(buf, data, &dim);
+	CU_ASSERT_STRING_EQUAL(buf, "18446744073709551615");
+
+	// offsets go through double formatting
+	dim.interpretation = PC_INT32;
+	dim.size = 4;
+	dim.scale = 0.01;
+	dim.offset = 100;
+	pc_double_to_ptr(data, PC_INT32, 25);
+	pc_value_to_string(buf, data, &dim);
+	CU_ASSERT_STRING_EQUAL(buf, "100.25");
+}
+
+static void
+test_bounds_morton()
+{
+	// xmin, xmax, ymin, ymax
+	PCBOUNDS a = { 0, 1, 0, 1 };
+	PCBOUNDS b = { 1, 2, 0, 1 };
+	PCBOUNDS c = { 0, 1, 1, 2 };
+	PCBOUNDS d = { 1, 2, 1, 2 };
+	PCBOUNDS e = { -2, -1, -2, -1 };
+	PCBOUNDS f = { 100, 101, 100, 101 };
+
+	// z-order within a quadrant, and across signs and scales
+	CU_ASSERT(pc_bounds_morton(&a) < pc_bounds_morton(&b));
+	CU_ASSERT(pc_bounds_morton(&b) < pc_bounds_morton(&c));
+	CU_ASSERT(pc_bounds_morton(&c) < pc_bounds_morton(&d));
+	CU_ASSERT(pc_bounds_morton(&e) < pc_bounds_morton(&a));
+	CU_ASSERT(pc_bounds_morton(&d) < pc_bounds_morton(&f));
+	CU_ASSERT_EQUAL(pc_bounds_morton(&a), pc_bounds_morton(&a));
+}
+
 /* REGISTER ***********************************************************/
 
 CU_TestInfo util_tests[] = {
 	PC_TEST(test_bounding_diagonal_wkb_from_bounds),
 	PC_TEST(test_bounding_diagonal_wkb_from_stats),
+	PC_TEST(test_double_to_string),
+	PC_TEST(test_value_to_string),
+	PC_TEST(test_bounds_morton),
 	CU_TEST_INFO_NULL
 };
 
@@ -8,54 +8,59 @@
 ***********************************************************************/
 
 #include "lazperf_adapter.hpp"
+#include <algorithm>
+#include <strings.h>
 
 #ifdef HAVE_LAZPERF
 
 /**********************************************************************
 * C API
 */
-size_t
-lazperf_compress_from_uncompressed(const PCPATCH_UNCOMPRESSED *pa, uint8_t **compressed)
+// record format the points can be compressed with
+int
+lazperf_format(const PCSCHEMA *schema, const uint8_t *data, uint32_t npoints)
 {
-	size_t size = 1;
+	LazPerfLasDims dims;
+	int format = lazperf_las_format(schema, dims);
+
+	// return numbers and flags go into bit fields of LAS records
+	if (format != LAZPERF_DYNAMIC && ! lazperf_las_fits(schema, data, npoints, dims))
+		format = LAZPERF_DYNAMIC;
+
+	return format;
+}
 
+// compress points into a single stream, malloc'ed
+size_t
+lazperf_compress(const PCSCHEMA *schema, int format, const uint8_t *data, uint32_t npoints, uint8_t **compressed)
+{
+	size_t size = -1;
 	LazPerfBuf buf;
-	LazPerfCompressor engine(pa->schema, buf);
+	LazPerfCompressor engine(schema, buf, format);
 
-	if (engine.compress(pa->data, pa->datasize) == pa->npoints)
+	if (engine.compress(data, schema->size * npoints) == npoints)
 	{
 		size = buf.buf.size();
 		*compressed = (uint8_t*) malloc(size);
 		*compressed = (uint8_t*) memcpy(*compressed, buf.data(), size);
 	}
 
-	// log
-	// lazperf_dump(pa);
-	// lazperf_dump(*compressed, size);
-
 	return size;
 }
 
+// decompress the first npoints points of a stream. The decoding
+// state is all local, so streams can be decoded concurrently
 size_t
-lazperf_uncompress_from_compressed(const PCPATCH_LAZPERF *pa, uint8_t **decompressed)
+lazperf_uncompress(const PCSCHEMA *schema, int format, const uint8_t *compressed, size_t size, uint8_t *data, uint32_t npoints)
 {
-	size_t size = -1;
-	size_t datasize = pa->schema->size * pa->npoints;
-
 	LazPerfBuf buf;
-	buf.putBytes(pa->lazperf, pa->lazperfsize);
-	LazPerfDecompressor engine(pa->schema, buf);
+	buf.putBytes(compressed, size);
+	LazPerfDecompressor engine(schema, buf, format);
 
-	*decompressed = (uint8_t*) malloc(datasize);
+	if (engine.decompress(data, schema->size * npoints) != npoints)
+		return -1;
 
-	if (engine.decompress(*decompressed, datasize) == pa->npoints)
-		size = buf.buf.size();
-
-	// log
-	// lazperf_dump(pa);
-	// lazperf_dump(*decompressed, datasize);
-
-	return size;
+	return npoints;
 }
 
 /**********************************************************************
@@ -106,12 +111,89 @@ lazperf_dump(const PCPATCH_LAZPERF* p)
 	std::cout << std::endl;
 }
 
+// LAS point record fields, and the names and interpretations
+// of the dimensions they are taken from
+static const struct {
+	const char *name;
+	const char *alias;
+	uint32_t interpretation;
+} las_fields[LAS_NFIELDS] = {
+	{ "X", NULL, PC_INT32 },
+	{ "Y", NULL, PC_INT32 },
+	{ "Z", NULL, PC_INT32 },
+	{ "Intensity", NULL, PC_UINT16 },
+	{ "ReturnNumber", NULL, PC_UINT8 },
+	{ "NumberOfReturns", NULL, PC_UINT8 },
+	{ "ScanDirectionFlag", NULL, PC_UINT8 },
+	{ "EdgeOfFlightLine", NULL, PC_UINT8 },
+	{ "Classification", NULL, PC_UINT8 },
+	{ "ScanAngleRank", NULL, PC_INT8 },
+	{ "UserData", NULL, PC_UINT8 },
+	{ "PointSourceId", NULL, PC_UINT16 },
+	{ "GpsTime", "Time", PC_DOUBLE },
+	{ "Red", NULL, PC_UINT16 },
+	{ "Green", NULL, PC_UINT16 },
+	{ "Blue", NULL, PC_UINT16 }
+};
+
+int
+lazperf_las_format(const PCSCHEMA *pcschema, LazPerfLasDims dims)
+{
+	for (int f = 0; f < LAS_NFIELDS; f++)
+	{
+		dims[f] = NULL;
+		for (int i = 0; i < pcschema->ndims && ! dims[f]; i++)
+		{
+			const PCDIMENSION *dim = pcschema->dims[i];
+			if (dim->interpretation != las_fields[f].interpretation)
+				continue;
+			if (strcasecmp(dim->name, las_fields[f].name) == 0 ||
+				(las_fields[f].alias && strcasecmp(dim->name, las_fields[f].alias) == 0))
+				dims[f] = dim;
+		}
+	}
+
+	// point format 0 fields are all required
+	for (int f = LAS_X; f <= LAS_POINT_SOURCE_ID; f++)
+	{
+		if (! dims[f])
+			return LAZPERF_DYNAMIC;
+	}
+
+	// colors only come all three together
+	if (! dims[LAS_RED] || ! dims[LAS_GREEN] || ! dims[LAS_BLUE])
+		dims[LAS_RED] = dims[LAS_GREEN] = dims[LAS_BLUE] = NULL;
+
+	return LAZPERF_LAS_POINT0
+		+ (dims[LAS_GPS_TIME] ? 1 : 0)
+		+ (dims[LAS_RED] ? 2 : 0);
+}
+
+bool
+lazperf_las_fits(const PCSCHEMA *pcschema, const uint8_t *data, uint32_t npoints, const LazPerfLasDims dims)
+{
+	const uint8_t *point = data;
+
+	for (uint32_t i = 0; i < npoints; i++, point += pcschema->size)
+	{
+		if (point[dims[LAS_RETURN_NUMBER]->byteoffset] > 7 ||
+			point[dims[LAS_NUMBER_OF_RETURNS]->byteoffset] > 7 ||
+			point[dims[LAS_SCAN_DIRECTION_FLAG]->byteoffset] > 1 ||
+			point[dims[LAS_EDGE_OF_FLIGHT_LINE]->byteoffset] > 1)
+			return false;
+	}
+
+	return true;
+}
+
 // LazPerf class
 template<typename LazPerfEngine, typename LazPerfCoder>
-LazPerf<LazPerfEngine, LazPerfCoder>::LazPerf(const PCSCHEMA *pcschema, LazPerfBuf &buf)
+LazPerf<LazPerfEngine, LazPerfCoder>::LazPerf(const PCSCHEMA *pcschema, LazPerfBuf &buf, int format)
 	: _pcschema(pcschema)
 	, _coder(buf)
 	, _pointsize(0)
+	, _format(format)
+	, _valid(false)
 {
 }
 
@@ -121,11 +203,109 @@ LazPerf<LazPerfEngine, LazPerfCoder>::~LazPerf()
 }
 
 template<typename LazPerfEngine, typename LazPerfCoder>
-void
+bool
 LazPerf<LazPerfEngine, LazPerfCoder>::initSchema()
 {
+	if (_format == LAZPERF_DYNAMIC)
+	{
+		for (int i = 0; i < _pcschema->ndims; i++)
+			addField(_pcschema->dims[i]);
+		return true;
+	}
+
+	// the schema must still match the recorded point format
+	if (_format > LAZPERF_LAS_POINT3 || lazperf_las_format(_pcschema, _las) != _format)
+		return false;
+
+	_engine->template add_field<laszip::formats::las::point10>();
+	if (_las[LAS_GPS_TIME])
+		_engine->template add_field<laszip::formats::las::gpstime>();
+	if (_las[LAS_RED])
+		_engine->template add_field<laszip::formats::las::rgb>();
+
+	for (int f = 0; f < LAS_NFIELDS; f++)
+	{
+		if (_las[f])
+			_pointsize += _las[f]->size;
+	}
+
+	// the other dimensions follow as generic fields
 	for (int i = 0; i < _pcschema->ndims; i++)
-		addField(_pcschema->dims[i]);
+	{
+		const PCDIMENSION *dim = _pcschema->dims[i];
+		if (std::find(_las, _las + LAS_NFIELDS, dim) != _las + LAS_NFIELDS)
+			continue;
+		if (addField(dim))
+			_others.push_back(dim);
+	}
+
+	// the bit fields byte stands for four dimensions
+	_record.resize(_pointsize - 3);
+	return true;
+}
+
+// LAS records are the values of the LAS dimensions in field order,
+// with return numbers and flags packed in a single byte, followed by
+// the values of the other dimensions
+template<typename LazPerfEngine, typename LazPerfCoder>
+void
+LazPerf<LazPerfEngine, LazPerfCoder>::packRecord(const uint8_t *point, char *record) const
+{
+	for (int f = LAS_X; f <= LAS_INTENSITY; f++)
+	{
+		memcpy(record, point + _las[f]->byteoffset, _las[f]->size);
+		record += _las[f]->size;
+	}
+
+	*record++ = (point[_las[LAS_RETURN_NUMBER]->byteoffset] & 0x7)
+		| (point[_las[LAS_NUMBER_OF_RETURNS]->byteoffset] & 0x7) << 3
+		| (point[_las[LAS_SCAN_DIRECTION_FLAG]->byteoffset] & 0x1) << 6
+		| (point[_las[LAS_EDGE_OF_FLIGHT_LINE]->byteoffset] & 0x1) << 7;
+
+	for (int f = LAS_CLASSIFICATION; f < LAS_NFIELDS; f++)
+	{
+		if (! _las[f])
+			continue;
+		memcpy(record, point + _las[f]->byteoffset, _las[f]->size);
+		record += _las[f]->size;
+	}
+
+	for (size_t i = 0; i < _others.size(); i++)
+	{
+		memcpy(record, point + _others[i]->byteoffset, _others[i]->size);
+		record += _others[i]->size;
+	}
+}
+
+template<typename LazPerfEngine, typename LazPerfCoder>
+void
+LazPerf<LazPerfEngine, LazPerfCoder>::unpackRecord(const char *record, uint8_t *point) const
+{
+	for (int f = LAS_X; f <= LAS_INTENSITY; f++)
+	{
+		memcpy(point + _las[f]->byteoffset, record, _las[f]->size);
+		record += _las[f]->size;
+	}
+
+	uint8_t bits = *record++;
+	point[_las[LAS_RETURN_NUMBER]->byteoffset] = bits & 0x7;
+	point[_las[LAS_NUMBER_OF_RETURNS]->byteoffset] = (bits >> 3) & 0x7;
+	point[_las[LAS_SCAN_DIRECTION_FLAG]->byteoffset] = (bits >> 6) & 0x1;
+	point[_las[LAS_EDGE_OF_FLIGHT_LINE]->byteoffset] = (bits >> 7) & 0x1;
+
+	for (int f = LAS_CLASSIFICATION; f < LAS_NFIELDS; f++)
+	{
+		if (! _las[f])
+			continue;
+		memcpy(point + _las[f]->byteoffset, record, _las[f]->size);
+		record += _las[f]->size;
+	}
+
+	for (size_t i = 0; i < _others.size(); i++)
+	{
+		memcpy(point + _others[i]->byteoffset, record, _others[i]->size);
+		record += _others[i]->size;
+	}
 }
 
 template<typename LazPerfEngine, typename LazPerfCoder>
@@ -201,11 +381,11 @@ LazPerf<LazPerfEngine, LazPerfCoder>::addField(const PCDIMENSION *dim)
 }
 
 // LazPerf Compressor
-LazPerfCompressor::LazPerfCompressor(const PCSCHEMA *pcschema, LazPerfBuf &output)
-	: LazPerf(pcschema, output)
+LazPerfCompressor::LazPerfCompressor(const PCSCHEMA *pcschema, LazPerfBuf &output, int format)
+	: LazPerf(pcschema, output, format)
 {
 	_engine = laszip::formats::make_dynamic_compressor(_coder);
-	initSchema();
+	_valid = initSchema();
 }
 
 LazPerfCompressor::~LazPerfCompressor()
@@ -219,9 +399,18 @@ LazPerfCompressor::compress(const uint8_t *input, const size_t inputsize)
 
 	const uint8_t *end = input + inputsize;
 
+	if (! _valid)
+		return size;
+
 	while (input + _pointsize <= end)
 	{
-		_engine->compress((const char*) input);
+		if (_format == LAZPERF_DYNAMIC)
+			_engine->compress((const char*) input);
+		else
+		{
+			packRecord(input, _record.data());
+			_engine->compress(_record.data());
+		}
 		input += _pointsize;
 		size++;
 	}
@@ -232,11 +421,11 @@ LazPerfCompressor::compress(const uint8_t *input, const size_t inputsize)
 }
 
 // LazPerf Decompressor
-LazPerfDecompressor::LazPerfDecompressor(const PCSCHEMA *pcschema, LazPerfBuf &input)
-	: LazPerf(pcschema, input)
+LazPerfDecompressor::LazPerfDecompressor(const PCSCHEMA *pcschema, LazPerfBuf &input, int format)
+	: LazPerf(pcschema, input, format)
 {
 	_engine = laszip::formats::make_dynamic_decompressor(_coder);
-	initSchema();
+	_valid = initSchema();
 }
 
 LazPerfDecompressor::~LazPerfDecompressor()
@@ -250,9 +439,18 @@ LazPerfDecompressor::decompress(uint8_t *output, const size_t outputsize)
 
 	const uint8_t *end = output + outputsize;
 
+	if (! _valid)
+		return size;
+
 	while (output + _pointsize <= end)
 	{
-		_engine->decompress((char*) output);
+		if (_format == LAZPERF_DYNAMIC)
+			_engine->decompress((char*) output);
+		else
+		{
+			_engine->decompress(_record.data());
+			unpackRecord(_record.data(), output);
+		}
 		output += _pointsize;
 		size++;
 	}
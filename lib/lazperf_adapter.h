@@ -13,11 +13,36 @@
 #ifndef _LAZPERF_ADAPTER_H
 #define _LAZPERF_ADAPTER_H
 
+/**
+* Layout of the records handed to laz-perf. It is recorded in the
+* first byte of the compressed data, so decompression never depends
+* on how the schema was matched when compressing. Stored data only
+* keeps that byte when flagged with PC_WKB_LAZHEADER.
+*/
+enum LAZPERF_FORMATS
+{
+	LAZPERF_DYNAMIC = 0,     /* one generic field per dimension */
+	LAZPERF_LAS_POINT0 = 1,  /* LAS point format 0 record, then generic fields */
+	LAZPERF_LAS_POINT1 = 2,  /* LAS point format 1, with GPS time */
+	LAZPERF_LAS_POINT2 = 3,  /* LAS point format 2, with RGB */
+	LAZPERF_LAS_POINT3 = 4   /* LAS point format 3, with GPS time and RGB */
+};
+
+/**
+* Flags of the format byte. Chunked data holds a chunk table and
+* one independent stream per chunk of points instead of a single
+* stream, see README.
+*/
+#define LAZPERF_CHUNKED 0x80       /* a chunk table follows */
+#define LAZPERF_CHUNK_BOUNDS 0x40  /* the chunk table has X/Y bounds */
+#define LAZPERF_FORMAT_MASK 0x0F
+
 #ifdef __cplusplus
 extern "C" {
 #endif
-size_t lazperf_compress_from_uncompressed(const PCPATCH_UNCOMPRESSED *pa, uint8_t **compressed);
-size_t lazperf_uncompress_from_compressed(const PCPATCH_LAZPERF *pa, uint8_t **decompressed);
+int lazperf_format(const PCSCHEMA *schema, const uint8_t *data, uint32_t npoints);
+size_t lazperf_compress(const PCSCHEMA *schema, int format, const uint8_t *data, uint32_t npoints, uint8_t **compressed);
+size_t lazperf_uncompress(const PCSCHEMA *schema, int format, const uint8_t *compressed, size_t size, uint8_t *data, uint32_t npoints);
 #ifdef __cplusplus
 }
 #endif
@@ -33,6 +33,23 @@ void lazperf_dump( uint8_t* data, const size_t size );
 void lazperf_dump( const PCPATCH_UNCOMPRESSED *p );
 void lazperf_dump( const PCPATCH_LAZPERF *p );
 
+// dimensions going into the LAS point record fields, in record order
+enum LazPerfLasField {
+	LAS_X, LAS_Y, LAS_Z, LAS_INTENSITY,
+	LAS_RETURN_NUMBER, LAS_NUMBER_OF_RETURNS,
+	LAS_SCAN_DIRECTION_FLAG, LAS_EDGE_OF_FLIGHT_LINE,
+	LAS_CLASSIFICATION, LAS_SCAN_ANGLE_RANK, LAS_USER_DATA,
+	LAS_POINT_SOURCE_ID, LAS_GPS_TIME, LAS_RED, LAS_GREEN, LAS_BLUE,
+	LAS_NFIELDS
+};
+
+typedef const PCDIMENSION *LazPerfLasDims[LAS_NFIELDS];
+
+// LAS point format matching the schema, or LAZPERF_DYNAMIC
+int lazperf_las_format( const PCSCHEMA *pcschema, LazPerfLasDims dims );
+// whether the values of the points fit in the LAS record bit fields
+bool lazperf_las_fits( const PCSCHEMA *pcschema, const uint8_t *data, uint32_t npoints, const LazPerfLasDims dims );
+
 // struct which capture data coming from the compressor
 struct LazPerfBuf {
 	LazPerfBuf() : buf(), idx(0) {}
@@ -77,26 +94,33 @@ template<typename LazPerfEngine, typename LazPerfCoder>
 class LazPerf {
 
 	public:
-		LazPerf( const PCSCHEMA *pcschema, LazPerfBuf &buf );
+		LazPerf( const PCSCHEMA *pcschema, LazPerfBuf &buf, int format );
 		~LazPerf();
 
 		size_t pointsize() const { return _pointsize; }
 
 	protected:
-		void initSchema();
+		bool initSchema();
 		bool addField(const PCDIMENSION *dim);
+		void packRecord(const uint8_t *point, char *record) const;
+		void unpackRecord(const char *record, uint8_t *point) const;
 
 		const PCSCHEMA *_pcschema;
 		LazPerfCoder _coder;
 		LazPerfEngine _engine;
 		size_t _pointsize;
+		int _format;
+		bool _valid;
+		LazPerfLasDims _las;
+		std::vector<const PCDIMENSION*> _others;
+		std::vector<char> _record;
 };
 
 // compressor
 class LazPerfCompressor : public LazPerf<Compressor, Encoder> {
 
 	public:
-		LazPerfCompressor( const PCSCHEMA *pcschema, LazPerfBuf &output);
+		LazPerfCompressor( const PCSCHEMA *pcschema, LazPerfBuf &output, int format );
 		~LazPerfCompressor();
 
 		size_t compress( const uint8_t *input, const size_t inputsize );
@@ -106,7 +130,7 @@ class LazPerfCompressor : public LazPerf<Compressor, Encoder> {
 class LazPerfDecompressor : public LazPerf<Decompressor, Decoder> {
 
 	public:
-		LazPerfDecompressor( const PCSCHEMA *pcschema, LazPerfBuf &input );
+		LazPerfDecompressor( const PCSCHEMA *pcschema, LazPerfBuf &input, int format );
 		~LazPerfDecompressor();
 
 		size_t decompress( uint8_t *data, const size_t datasize );
@@ -0,0 +1,226 @@
+/***********************************************************************
+* pc_affine.c
+*
+*  Affine transform of the X/Y/Z coordinates of a patch, to align a
+*  scan to control points. The coordinate columns are decoded once,
+*  the matrix is applied column-wise, and the results are quantized
+*  back with the scale and offset of the dimensions, with bounds and
+*  stats gathered on the way. The other dimensions are left as they
+*  are, down to their encoded bytes in dimensional patches.
+*
+*  PgSQL Pointcloud is free and open source software provided
+*  by the Government of Canada
+*  Copyright (c) 2013 Natural Resources Canada
+*
+***********************************************************************/
+
+#include "pc_api_internal.h"
+#include <math.h>
+#include <float.h>
+
+/**
+* Whether a value, once scaled and offset, can be stored
+* in the interpretation without being truncated.
+*/
+static int
+pc_affine_fits(uint32_t interpretation, double v)
+{
+	switch( interpretation )
+	{
+	case PC_UINT8:  return v >= 0 && v <= UINT8_MAX;
+	case PC_UINT16: return v >= 0 && v <= UINT16_MAX;
+	case PC_UINT32: return v >= 0 && v <= UINT32_MAX;
+	case PC_UINT64: return v >= 0 && v <= UINT64_MAX;
+	case PC_INT8:   return v >= INT8_MIN && v <= INT8_MAX;
+	case PC_INT16:  return v >= INT16_MIN && v <= INT16_MAX;
+	case PC_INT32:  return v >= INT32_MIN && v <= INT32_MAX;
+	case PC_INT64:  return v >= INT64_MIN && v <= INT64_MAX;
+	case PC_FLOAT:  return fabs(v) <= FLT_MAX;
+	case PC_DOUBLE: return isfinite(v);
+	}
+	return PC_FALSE;
+}
+
+/**
+* Apply the 4x4 row-major matrix to the coordinate columns. The
+* loop works on plain arrays with no branches, so that the compiler
+* can vectorize it.
+*/
+static void
+pc_affine_apply(const double *m, double *x, double *y, double *z, uint32_t npoints)
+{
+	uint32_t i;
+
+	for ( i = 0; i < npoints; i++ )
+	{
+		double xi = x[i], yi = y[i], zi = z[i];
+		x[i] = m[0] * xi + m[1] * yi + m[2] * zi + m[3];
+		y[i] = m[4] * xi + m[5] * yi + m[6] * zi + m[7];
+		z[i] = m[8] * xi + m[9] * yi + m[10] * zi + m[11];
+	}
+}
+
+/**
+* Quantize the values into a column of the dimension, with the
+* given stride, and read them back as stored for the bounds and
+* stats. Fails without writing anything if a value overflows.
+*/
+static int
+pc_affine_write(uint8_t *ptr, size_t stride, const PCDIMENSION *dim, double *vals, uint32_t npoints, double *min, double *max, double *sum)
+{
+	uint32_t i;
+
+	for ( i = 0; i < npoints; i++ )
+	{
+		vals[i] = pc_value_unscale_unoffset(vals[i], dim);
+		if ( ! pc_affine_fits(dim->interpretation, vals[i]) )
+		{
+			pcerror("%s: transformed value %g of dimension \"%s\" overflows its %s storage",
+			        __func__, pc_value_scale_offset(vals[i], dim), dim->name,
+			        pc_interpretation_string(dim->interpretation));
+			return PC_FAILURE;
+		}
+	}
+
+	*min = DBL_MAX;
+	*max = -1 * DBL_MAX;
+	*sum = 0;
+	for ( i = 0; i < npoints; i++, ptr += stride )
+	{
+		pc_double_to_ptr(ptr, dim->interpretation, vals[i]);
+		vals[i] = pc_value_scale_offset(pc_double_from_ptr(ptr, dim->interpretation), dim);
+		if ( vals[i] < *min ) *min = vals[i];
+		if ( vals[i] > *max ) *max = vals[i];
+		*sum += vals[i];
+	}
+	return PC_SUCCESS;
+}
+
+PCPATCH *
+pc_patch_affine(const PCPATCH *pa, const double *matrix)
+{
+	const PCSCHEMA *s = pa->schema;
+	const PCDIMENSION *dims[3];
+	const PCPATCH *pu;
+	PCPATCH *paout;
+	PCPATCH_DIMENSIONAL *pdlout = NULL;
+	PCPATCH_UNCOMPRESSED *puout = NULL;
+	double *vals[3];
+	double min[3], max[3], sum[3];
+	int i, j, ncoords;
+
+	if ( ! s->xdim || ! s->ydim )
+	{
+		pcerror("%s: schema has no X/Y dimensions", __func__);
+		return NULL;
+	}
+	if ( matrix[12] != 0 || matrix[13] != 0 || matrix[14] != 0 || matrix[15] != 1 )
+	{
+		pcerror("%s: last row of the matrix must be 0 0 0 1", __func__);
+		return NULL;
+	}
+
+	dims[0] = s->xdim;
+	dims[1] = s->ydim;
+	dims[2] = s->zdim;
+	ncoords = s->zdim ? 3 : 2;
+
+	/* Only the coordinate columns of dimensional patches are decoded */
+	pu = pa->type == PC_DIMENSIONAL ? pa : pc_patch_uncompress(pa);
+	for ( j = 0; j < ncoords; j++ )
+		vals[j] = pc_patch_dimension_to_double_array(pu, dims[j]->position);
+	if ( ncoords < 3 )
+		vals[2] = pcalloc(pa->npoints * sizeof(double));
+
+	pc_affine_apply(matrix, vals[0], vals[1], vals[2], pa->npoints);
+
+	if ( pu->type == PC_DIMENSIONAL )
+	{
+		const PCPATCH_DIMENSIONAL *pdl = (const PCPATCH_DIMENSIONAL*)pu;
+		pdlout = pc_patch_dimensional_clone(pdl);
+		pdlout->readonly = PC_FALSE;
+		pdlout->npoints = pdl->npoints;
+		for ( i = 0; i < s->ndims; i++ )
+		{
+			if ( i == s->xdim->position || i == s->ydim->position || (s->zdim && i == s->zdim->position) )
+				pdlout->bytes[i] = pc_bytes_make(s->dims[i], pdl->npoints);
+			else
+				pdlout->bytes[i] = pc_bytes_clone(pdl->bytes[i]);
+		}
+		paout = (PCPATCH*)pdlout;
+	}
+	else
+	{
+		const PCPATCH_UNCOMPRESSED *pul = (const PCPATCH_UNCOMPRESSED*)pu;
+		puout = pc_patch_uncompressed_make(s, pul->npoints);
+		puout->npoints = pul->npoints;
+		puout->bounds = pul->bounds;
+		memcpy(puout->data, pul->data, (size_t)s->size * pul->npoints);
+		paout = (PCPATCH*)puout;
+	}
+
+	for ( j = 0; j < ncoords; j++ )
+	{
+		const PCDIMENSION *dim = dims[j];
+		int rv;
+
+		if ( pdlout )
+			rv = pc_affine_write(pdlout->bytes[dim->position].bytes, dim->size, dim, vals[j], pa->npoints, &min[j], &max[j], &sum[j]);
+		else
+			rv = pc_affine_write(puout->data + dim->byteoffset, s->size, dim, vals[j], pa->npoints, &min[j], &max[j], &sum[j]);
+
+		if ( PC_FAILURE == rv )
+		{
+			pc_patch_free(paout);
+			paout = NULL;
+			break;
+		}
+	}
+
+	/* Coordinate columns go back to the compression they had */
+	if ( paout && pdlout )
+	{
+		const PCPATCH_DIMENSIONAL *pdl = (const PCPATCH_DIMENSIONAL*)pu;
+		for ( j = 0; j < ncoords; j++ )
+		{
+			int pos = dims[j]->position;
+			if ( pdl->bytes[pos].compression != PC_DIM_NONE )
+			{
+				PCBYTES pcb = pdlout->bytes[pos];
+				pdlout->bytes[pos] = pc_bytes_encode(pcb, pdl->bytes[pos].compression);
+				pc_bytes_free(pcb);
+			}
+		}
+	}
+
+	if ( paout && pa->npoints )
+	{
+		paout->bounds.xmin = min[0];
+		paout->bounds.xmax = max[0];
+		paout->bounds.ymin = min[1];
+		paout->bounds.ymax = max[1];
+
+		if ( pa->stats )
+		{
+			paout->stats = pc_stats_clone(pa->stats);
+			for ( j = 0; j < ncoords; j++ )
+			{
+				pc_point_set_double(&(paout->stats->min), dims[j], min[j]);
+				pc_point_set_double(&(paout->stats->max), dims[j], max[j]);
+				pc_point_set_double(&(paout->stats->avg), dims[j], sum[j] / pa->npoints);
+			}
+		}
+		else if ( PC_FAILURE == pc_patch_compute_stats(paout) )
+		{
+			pcerror("%s: failed to compute patch stats", __func__);
+			pc_patch_free(paout);
+			paout = NULL;
+		}
+	}
+
+	if ( pu != pa )
+		pc_patch_free((PCPATCH*)pu);
+	for ( j = 0; j < 3; j++ )
+		pcfree(vals[j]);
+	return paout;
+}
@@ -44,6 +44,19 @@ enum COMPRESSIONS
 	PC_LAZPERF = 3
 };
 
+/**
+* Flags or-ed into the compression of a patch WKB, for the
+* optional blocks written between its header and its data:
+* the PCBOUNDS, then the min, max and avg stats points.
+* Readers use them instead of going over the points.
+* PC_WKB_LAZHEADER marks LAZ data that starts with its record
+* format byte, LAZ data without it is a single dynamic stream.
+*/
+#define PC_WKB_BOUNDS    0x100
+#define PC_WKB_STATS     0x200
+#define PC_WKB_LAZHEADER 0x400
+#define PC_WKB_FLAGS     (PC_WKB_BOUNDS | PC_WKB_STATS | PC_WKB_LAZHEADER)
+
 /**
 * Flags of endianness for inter-architecture
 * data transfers.
@@ -62,8 +75,41 @@ typedef enum
 	PC_BETWEEN
 } PC_FILTERTYPE;
 
+typedef enum
+{
+	PC_SAMPLE_NEAREST,
+	PC_SAMPLE_BILINEAR
+} PC_SAMPLEMETHOD;
+
+typedef enum
+{
+	PC_SURFACE_MIN,
+	PC_SURFACE_MAX,
+	PC_SURFACE_MEAN,
+	PC_SURFACE_IDW
+} PC_SURFACEMETHOD;
+
+typedef enum
+{
+	PC_FILL_NONE,
+	PC_FILL_NEAREST,
+	PC_FILL_IDW
+} PC_FILLMETHOD;
+
 
 
+/**
+* A zlib preset dictionary. Streams compressed with a dictionary
+* carry its id in their header, so decoders can check they were
+* given the right one.
+*/
+typedef struct
+{
+	uint32_t id;    /* Adler-32 checksum of the bytes */
+	uint32_t size;
+	uint8_t *bytes;
+} PCZDICT;
+
 /**
 * We need to hold a cached in-memory version of the format's
 * XML structure for speed, and this is it.
@@ -79,6 +125,7 @@ typedef struct
 	double scale;
 	double offset;
 	uint8_t active;
+	PCZDICT *zdict; /* zlib preset dictionary, or NULL */
 } PCDIMENSION;
 
 typedef struct
@@ -93,6 +140,8 @@ typedef struct
 	PCDIMENSION *zdim;    /* pointer to the z dimension within dims */
 	PCDIMENSION *mdim;    /* pointer to the m dimension within dims */
 	uint32_t compression; /* Compression type applied to the data */
+	uint32_t lazchunksize; /* Points per LAZ chunk, 0 for a single stream */
+	uint32_t ghtkeylength; /* GHT hash resolution, 0 for the maximum */
 	hashtable *namehash;  /* Look-up from dimension name to pointer */
 } PCSCHEMA;
 
@@ -101,6 +150,7 @@ typedef struct
 {
 	uint32_t total_runs;
 	uint32_t total_commonbits;
+	uint32_t total_pforsize;
 	uint32_t recommended_compression;
 } PCDIMSTAT;
 
@@ -142,8 +192,20 @@ typedef struct
 	uint32_t compression;
 	uint32_t readonly;
 	uint8_t *bytes;
+	const PCZDICT *zdict; /* Borrowed from the dimension */
 } PCBYTES;
 
+/**
+* Growable output buffer. Encoders append to it directly,
+* so a serialization can be built without intermediate copies.
+*/
+typedef struct
+{
+	uint8_t *bytes;
+	size_t size;     /* Bytes written so far */
+	size_t capacity; /* Bytes allocated */
+} PCSINK;
+
 typedef struct
 {
 	double xmin;
@@ -152,6 +214,18 @@ typedef struct
 	double ymax;
 } PCBOUNDS;
 
+/**
+* Points deleted from a patch, one bit per point. Marking a
+* point is cheap, it is only dropped from the patch data by
+* pc_patch_compact, once for any number of deletions.
+*/
+typedef struct
+{
+	uint32_t npoints;
+	uint32_t ndeleted;
+	uint8_t *bits;
+} PCTOMBSTONES;
+
 /* Used for generic patch statistics */
 typedef struct
 {
@@ -194,6 +268,7 @@ typedef struct
 {
 	PCPATCH_COMMON
 	PCBYTES *bytes;
+	PCBYTES *decoded; /* Columns decoded on first access, see pc_patch_dimensional_get_bytes */
 } PCPATCH_DIMENSIONAL;
 
 typedef struct
@@ -207,9 +282,75 @@ typedef struct
 {
 	PCPATCH_COMMON
 	size_t lazperfsize;
-	uint8_t *lazperf;
+	uint8_t *lazperf; /* always starts with the record format byte */
 } PCPATCH_LAZPERF;
 
+/* Grows the buffers of a patch one point at a time, see pc_patch_builder.c */
+typedef struct
+{
+	const PCSCHEMA *schema;
+	uint32_t type;      /* PC_NONE fills a row buffer, PC_DIMENSIONAL column buffers */
+	uint32_t npoints;
+	uint32_t maxpoints;
+	uint8_t *data;      /* Row buffer, for PC_NONE */
+	PCBYTES *bytes;     /* Column buffers, for PC_DIMENSIONAL */
+	PCBOUNDS bounds;
+	double *min;        /* Running min/max/sum of each dimension */
+	double *max;
+	double *sum;
+} PCPATCH_BUILDER;
+
+/* The edges of one polygon, bucketed by rows of its bounds */
+typedef struct
+{
+	PCBOUNDS bounds;
+	uint32_t nedges;
+	double *edges;      /* x0, y0, x1, y1 of every edge, all rings together */
+	uint32_t nrows;
+	double rowheight;
+	uint32_t *rowstart; /* nrows + 1 offsets into rowedges */
+	uint32_t *rowedges; /* Edges crossing each row */
+} PCPOLYGON;
+
+/* A node of the STR-tree of polygon bounds */
+typedef struct
+{
+	PCBOUNDS bounds;
+	uint32_t first;     /* Offset of the first child in children */
+	uint32_t count;
+	uint32_t leaf;      /* Children are polygons rather than nodes */
+} PCPOLYNODE;
+
+/* Polygons indexed for point location, see pc_polygon.c */
+typedef struct
+{
+	uint32_t npolys;
+	PCPOLYGON *polys;
+	uint32_t nnodes;
+	PCPOLYNODE *nodes;  /* Root last */
+	uint32_t *children;
+} PCPOLYINDEX;
+
+/**
+* Elevation grid gathered from the points of many patches, see
+* pc_surface.c. The grid extends margin cells past each side of
+* the window asked for, so that holes near its edges get filled
+* from points on the other side.
+*/
+typedef struct
+{
+	double xmin;        /* West edge of the window */
+	double ymax;        /* North edge of the window */
+	double cellsize;
+	uint32_t ncols;     /* Window size, in cells */
+	uint32_t nrows;
+	uint32_t margin;
+	double radius;      /* Search radius when filling holes */
+	PC_SURFACEMETHOD method;
+	double *value;      /* Min, max, or (weighted) sum of Z, margin included */
+	double *weight;     /* Number of points, or sum of weights */
+} PCSURFACE;
+
 
 /* Global function signatures for memory/logging handlers. */
 typedef void* (*pc_allocator)(size_t size);
@@ -237,6 +378,11 @@ void  pcinfo(const char *fmt, ...);
 /** Emit a warning message using the appropriate means (system/db) */
 void  pcwarn(const char *fmt, ...);
 
+/** Allocate an empty sink with room for capacity bytes */
+void pc_sink_init(PCSINK *sink, size_t capacity);
+/** Make room for size more bytes in the sink, returns where to write them */
+uint8_t* pc_sink_reserve(PCSINK *sink, size_t size);
+
 /** Set custom memory allocators and messaging (used by PgSQL module) */
 void pc_set_handlers(
 	pc_allocator allocator, pc_reallocator reallocator,
@@ -275,6 +421,8 @@ void pc_schema_free(PCSCHEMA *pcs);
 PCSCHEMA *pc_schema_from_xml(const char *xmlstr);
 /** Print out JSON readable format of schema */
 char* pc_schema_to_json(const PCSCHEMA *pcs);
+/** XML of the schema reduced to the named dimensions, plus X and Y */
+char* pc_schema_xml_subset(const char *xmlstr, const char **names, int nnames);
 /** Extract dimension information by position */
 PCDIMENSION* pc_schema_get_dimension(const PCSCHEMA *s, uint32_t dim);
 /** Extract dimension information by name */
@@ -293,6 +441,22 @@ size_t pc_schema_get_size(const PCSCHEMA *s);
 uint32_t pc_schema_same_dimensions(const PCSCHEMA *s1, const PCSCHEMA *s2);
 /** Check whether the schemas have compatible dimension interpretations */
 uint32_t pc_schema_same_interpretations(const PCSCHEMA *s1, const PCSCHEMA *s2);
+/** Set the zlib dictionary of a dimension, the schema takes ownership of it */
+int pc_schema_set_zdict(PCSCHEMA *s, uint32_t dim, PCZDICT *zdict);
+
+
+/**********************************************************************
+* ZLIB DICTIONARIES
+*/
+
+/** Make a zlib preset dictionary from a copy of the bytes */
+PCZDICT* pc_zdict_make(const uint8_t *bytes, uint32_t size);
+/** Make a full copy of a dictionary */
+PCZDICT* pc_zdict_clone(const PCZDICT *zdict);
+/** Release the memory behind a dictionary */
+void pc_zdict_free(PCZDICT *zdict);
+/** Build a dictionary of at most maxsize bytes from sample columns of a dimension */
+PCZDICT* pc_zdict_train(const PCBYTES *samples, uint32_t nsamples, uint32_t maxsize);
 
 
 /**********************************************************************
@@ -396,6 +560,27 @@ uint8_t* pc_point_to_geometry_wkb(const PCPOINT *pt, size_t *wkbsize);
 /** Create new PCPATCH from a PCPOINT set. Copies data, doesn't take ownership of points */
 PCPATCH* pc_patch_from_pointlist(const PCPOINTLIST *ptl);
 
+/** Start building a patch, with room for maxpoints points. Dimensional schemas are built column-wise */
+PCPATCH_BUILDER* pc_patch_builder_make(const PCSCHEMA *s, uint32_t maxpoints);
+
+/** Make room for maxpoints points in the builder */
+int pc_patch_builder_reserve(PCPATCH_BUILDER *pb, uint32_t maxpoints);
+
+/** Append a point from its raw bytes */
+int pc_patch_builder_add_data(PCPATCH_BUILDER *pb, const uint8_t *data);
+
+/** Append a point, which must share the builder pcid */
+int pc_patch_builder_add_point(PCPATCH_BUILDER *pb, const PCPOINT *pt);
+
+/** Append a point from one double per dimension */
+int pc_patch_builder_add_double_array(PCPATCH_BUILDER *pb, const double *vals, uint32_t nvals);
+
+/** Turn the builder into a patch with bounds and stats, and free it. NULL if empty */
+PCPATCH* pc_patch_builder_finish(PCPATCH_BUILDER *pb);
+
+/** Free a builder and the points added so far */
+void pc_patch_builder_free(PCPATCH_BUILDER *pb);
+
 /** Returns a list of points extracted from patch */
 PCPOINTLIST* pc_pointlist_from_patch(const PCPATCH *patch);
 
@@ -414,9 +599,21 @@ PCPATCH * pc_patch_uncompress(const PCPATCH *patch);
 /** Create a new readwrite PCPOINT from a byte array */
 PCPATCH* pc_patch_from_wkb(const PCSCHEMA *s, uint8_t *wkb, size_t wkbsize);
 
+/** Create a new PCPATCH from a byte array, referencing the array instead of copying it when possible */
+PCPATCH* pc_patch_from_wkb_readonly(const PCSCHEMA *s, uint8_t *wkb, size_t wkbsize);
+
+/** Check that the sizes declared in a patch wkb are consistent with the schema and wkbsize */
+int pc_patch_wkb_is_valid(const PCSCHEMA *s, const uint8_t *wkb, size_t wkbsize);
+
+/** Reference a checked patch wkb, with stats read or computed and bounds taken from them if missing */
+PCPATCH* pc_patch_from_wkb_stats(const PCSCHEMA *s, uint8_t *wkb, size_t wkbsize);
+
 /** Returns serialized form of point */
 uint8_t* pc_patch_to_wkb(const PCPATCH *patch, size_t *wkbsize);
 
+/** Returns serialized form of patch, with the optional blocks asked for in flags */
+uint8_t* pc_patch_to_wkb_flags(const PCPATCH *patch, uint32_t flags, size_t *wkbsize);
+
 /** Returns text form of patch */
 char* pc_patch_to_string(const PCPATCH *patch);
 
@@ -429,6 +626,12 @@ size_t pc_bytes_serialized_size(const PCBYTES *pcb);
 /** Write the representation down to a buffer */
 int pc_bytes_serialize(const PCBYTES *pcb, uint8_t *buf, size_t *size);
 
+/** How big can the serialization get once encoded with compression? */
+size_t pc_bytes_serialized_size_bound(const PCBYTES *pcb, int compression);
+
+/** Encode with compression, writing the representation straight to the end of the sink */
+int pc_bytes_serialize_to_sink(const PCBYTES *pcb, int compression, PCSINK *sink);
+
 /** Read a buffer up into a bytes structure */
 int pc_bytes_deserialize(const uint8_t *buf, const PCDIMENSION *dim, PCBYTES *pcb, int readonly, int flip_endian);
 
@@ -453,6 +656,9 @@ int pc_patch_compute_extent(PCPATCH *patch);
 /** True/false if bounds intersect */
 int pc_bounds_intersects(const PCBOUNDS *b1, const PCBOUNDS *b2);
 
+/** Z-order (Morton) key of the center of the bounds, to sort patches by location */
+uint64_t pc_bounds_morton(const PCBOUNDS *b);
+
 /** Returns OGC WKB of the bounding diagonal of XY bounds */
 uint8_t* pc_bounding_diagonal_wkb_from_bounds(const PCBOUNDS *bounds, const PCSCHEMA *schema, size_t *wkbsize);
 
@@ -471,15 +677,54 @@ PCPATCH* pc_patch_filter_equal_by_name(const PCPATCH *pa, const char *name, doub
 /** Subset batch based on range condition on dimension */
 PCPATCH* pc_patch_filter_between_by_name(const PCPATCH *pa, const char *name, double val1, double val2);
 
+/** Subset batch to the points within an X/Y box, boundaries included */
+PCPATCH* pc_patch_filter_box(const PCPATCH *pa, double xmin, double ymin, double xmax, double ymax);
+
+/** Copy of the patch with the points of another patch appended */
+PCPATCH* pc_patch_append(const PCPATCH *pa, const PCPATCH *pb);
+
+/** Allocate tombstones for a patch of npoints points, none deleted */
+PCTOMBSTONES* pc_tombstones_new(uint32_t npoints);
+
+/** Free tombstones */
+void pc_tombstones_free(PCTOMBSTONES *ts);
+
+/** Grow tombstones to cover points appended to their patch */
+int pc_tombstones_extend(PCTOMBSTONES *ts, uint32_t npoints);
+
+/** Mark point n, 0-based, as deleted */
+int pc_tombstones_set(PCTOMBSTONES *ts, uint32_t n);
+
+/** True/false if point n, 0-based, is marked deleted */
+#define pc_tombstones_get(ts, n) (((ts)->bits[(n) / 8] >> ((n) % 8)) & 1)
+
+/** Drop the points marked in the tombstones, returns the patch itself if none are */
+PCPATCH* pc_patch_compact(const PCPATCH *pa, const PCTOMBSTONES *ts);
+
 /** get point n */
 PCPOINT *pc_patch_pointn(const PCPATCH *patch, int n);
 
+/** get the values of dimension dimnum for all the points, as a newly allocated array */
+double *pc_patch_dimension_to_double_array(const PCPATCH *patch, uint32_t dimnum);
+
+/** Return the OGC WKB MultiPoint of the points of the patch */
+uint8_t* pc_patch_to_geometry_wkb_multipoint(const PCPATCH *patch, size_t *wkbsize);
+
 /** Sorted patch after reordering points on dimensions */
 PCPATCH *pc_patch_sort(const PCPATCH *pa, const char **name, int ndims);
 
 /** True/false if the patch is sorted on dimension */
 uint32_t pc_patch_is_sorted(const PCPATCH *pa, const char **name, int ndims, char strict);
 
+/** Uncompressed patch of the points with dimension strictly between t1 and t2, ordered on it */
+PCPATCH* pc_patch_slice_sorted(const PCPATCH *pa, const char *name, double t1, double t2);
+
+/** Merge of patches sorted on a dimension into one uncompressed patch sorted on it */
+PCPATCH* pc_patch_merge_sorted(PCPATCH * const *pas, uint32_t npatches, const char *name);
+
+/** Patch of the schema with its dimensions taken by name from patches of the same points, encoded columns copied as they are */
+PCPATCH* pc_patch_zip(PCPATCH * const *pas, uint32_t npatches, const PCSCHEMA *schema);
+
 /** Subset batch based on index */
 PCPATCH* pc_patch_range(const PCPATCH *pa, int first, int count);
 
@@ -489,4 +734,40 @@ PCPATCH *pc_patch_set_schema(PCPATCH *patch, const PCSCHEMA *schema, double def)
 /** transform the patch based on the passed schema */
 PCPATCH *pc_patch_transform(const PCPATCH *patch, const PCSCHEMA *schema, double def);
 
+/** Index an array of OGC WKB polygons and multipolygons, NULL entries never match */
+PCPOLYINDEX* pc_polyindex_from_wkb(const uint8_t **wkbs, const size_t *wkbsizes, uint32_t npolys);
+
+/** Free a polygon index */
+void pc_polyindex_free(PCPOLYINDEX *idx);
+
+/** Number of the first polygon containing the point, boundaries included, -1 if none */
+int32_t pc_polyindex_locate(const PCPOLYINDEX *idx, double x, double y);
+
+/** Polygon number of every point of the patch, -1 for points in none, as a newly allocated array */
+int32_t* pc_patch_polygon_classify(const PCPATCH *pa, const PCPOLYINDEX *idx);
+
+/** Split the patch by polygon, one uncompressed patch per polygon, NULL where no point falls */
+PCPATCH** pc_patch_polygon_split(const PCPATCH *pa, const PCPOLYINDEX *idx);
+
+/** Transform the patch to schema, and store the 1-based polygon number of every point in dimension name */
+PCPATCH* pc_patch_polygon_tag(const PCPATCH *pa, const PCPOLYINDEX *idx, const PCSCHEMA *schema, const char *name);
+
+/** Copy of the patch with dimension name set from a row-major grid of nrows x ncols values, placed by a GDAL geotransform */
+PCPATCH* pc_patch_sample_grid(const PCPATCH *pa, const double *grid, uint32_t nrows, uint32_t ncols, const double *geotransform, const char *name, PC_SAMPLEMETHOD method);
+
+/** Copy of the patch with X/Y/Z transformed by a row-major 4x4 affine matrix, NULL if a coordinate overflows its storage */
+PCPATCH* pc_patch_affine(const PCPATCH *pa, const double *matrix);
+
+/** Grid of ncols x nrows cells from the north-west corner xmin/ymax, holes filled within radius */
+PCSURFACE* pc_surface_new(double xmin, double ymax, double cellsize, uint32_t ncols, uint32_t nrows, double radius, PC_SURFACEMETHOD method);
+
+/** Free a surface */
+void pc_surface_free(PCSURFACE *s);
+
+/** Add the points of a patch to the cells they fall in */
+int pc_surface_add_patch(PCSURFACE *s, const PCPATCH *pa);
+
+/** Row-major values of the window, north row first, holes filled, NaN where there is no data */
+double* pc_surface_finish(const PCSURFACE *s, PC_FILLMETHOD fill);
+
 #endif /* _PC_API_H */
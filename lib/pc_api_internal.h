@@ -61,7 +61,8 @@ enum DIMCOMPRESSIONS
 	PC_DIM_NONE = 0,
 	PC_DIM_RLE = 1,
 	PC_DIM_SIGBITS = 2,
-	PC_DIM_ZLIB = 3
+	PC_DIM_ZLIB = 3,
+	PC_DIM_PFOR = 4
 };
 
 /* PCDOUBLESTAT are members of PCDOUBLESTATS */
@@ -103,6 +104,12 @@ int32_t wkb_get_int32(const uint8_t *wkb, int flip_endian);
 /** Read an int16 from a byte array, flipping if requested */
 int16_t wkb_get_int16(const uint8_t *wkb, int flip_endian);
 
+/** Read the optional block flags of a patch wkb */
+uint32_t wkb_get_flags(const uint8_t *wkb);
+
+/** Size of the header of a patch wkb, optional blocks included */
+size_t pc_patch_wkb_header_size(const PCSCHEMA *s, const uint8_t *wkb);
+
 /** Read the number of points from a wkb */
 uint32_t wkb_get_npoints(const uint8_t *wkb);
 
@@ -118,6 +125,9 @@ uint8_t *wkb_set_char(uint8_t *wkb, char c);
 /** Force a byte array into the machine endianness */
 uint8_t* uncompressed_bytes_flip_endian(const uint8_t *bytebuf, const PCSCHEMA *schema, uint32_t npoints);
 
+/** Flip in place the endianness of npoints values of size bytes, stride bytes apart */
+void pc_flip_endian_strided(uint8_t *ptr, size_t size, size_t stride, uint32_t npoints);
+
 /** Update a value using the scale/offset info from a dimension */
 double pc_value_scale_offset(double val, const PCDIMENSION *dim);
 
@@ -133,6 +143,15 @@ int pc_double_to_ptr(uint8_t *ptr, uint32_t interpretation, double val);
 /** Return number of bytes in a given interpretation */
 size_t pc_interpretation_size(uint32_t interp);
 
+/** Large enough for any string written by pc_double_to_string and pc_value_to_string */
+#define PC_VALUE_STRLEN 48
+
+/** Write the shortest string reading back as the same double, returns its length */
+int pc_double_to_string(char *buf, double d);
+
+/** Write the scaled value of a dimension read from a buffer, returns its length */
+int pc_value_to_string(char *buf, const uint8_t *ptr, const PCDIMENSION *dim);
+
 /** Convert XML string token to type interpretation number */
 const char * pc_interpretation_string(uint32_t interp);
 
@@ -175,16 +194,20 @@ PCPATCH_DIMENSIONAL* pc_patch_dimensional_decompress(const PCPATCH_DIMENSIONAL *
 void pc_patch_dimensional_free(PCPATCH_DIMENSIONAL *pdl);
 int pc_patch_dimensional_compute_extent(PCPATCH_DIMENSIONAL *pdl);
 uint8_t* pc_patch_dimensional_to_wkb(const PCPATCH_DIMENSIONAL *patch, size_t *wkbsize);
-PCPATCH* pc_patch_dimensional_from_wkb(const PCSCHEMA *schema, const uint8_t *wkb, size_t wkbsize);
+PCPATCH* pc_patch_dimensional_from_wkb(const PCSCHEMA *schema, const uint8_t *wkb, size_t wkbsize, int readonly);
 PCPATCH_DIMENSIONAL* pc_patch_dimensional_from_pointlist(const PCPOINTLIST *pdl);
 PCPOINTLIST* pc_pointlist_from_dimensional(const PCPATCH_DIMENSIONAL *pdl);
 PCPATCH_DIMENSIONAL* pc_patch_dimensional_clone(const PCPATCH_DIMENSIONAL *patch);
 PCPOINT *pc_patch_dimensional_pointn(const PCPATCH_DIMENSIONAL *pdl, int n);
+const PCBYTES* pc_patch_dimensional_get_bytes(const PCPATCH_DIMENSIONAL *pdl, uint32_t dimnum);
+int pc_patch_dimensional_compute_stats(PCPATCH_DIMENSIONAL *pdl);
+PCPATCH_DIMENSIONAL* pc_patch_dimensional_append(const PCPATCH_DIMENSIONAL *pdl, const PCPATCH *pa);
 
 /* UNCOMPRESSED PATCHES */
 char* pc_patch_uncompressed_to_string(const PCPATCH_UNCOMPRESSED *patch);
+char* pc_patch_columns_to_string(const PCSCHEMA *s, uint32_t npoints, const uint8_t **cols, const size_t *strides);
 uint8_t* pc_patch_uncompressed_to_wkb(const PCPATCH_UNCOMPRESSED *patch, size_t *wkbsize);
-PCPATCH* pc_patch_uncompressed_from_wkb(const PCSCHEMA *s, const uint8_t *wkb, size_t wkbsize);
+PCPATCH* pc_patch_uncompressed_from_wkb(const PCSCHEMA *s, const uint8_t *wkb, size_t wkbsize, int readonly);
 PCPATCH_UNCOMPRESSED* pc_patch_uncompressed_make(const PCSCHEMA *s, uint32_t maxpoints);
 int pc_patch_uncompressed_compute_extent(PCPATCH_UNCOMPRESSED *patch);
 int pc_patch_uncompressed_compute_stats(PCPATCH_UNCOMPRESSED *patch);
@@ -218,8 +241,14 @@ int pc_patch_lazperf_compute_extent(PCPATCH_LAZPERF *patch);
 char* pc_patch_lazperf_to_string(const PCPATCH_LAZPERF *pa);
 void pc_patch_lazperf_free(PCPATCH_LAZPERF *palaz);
 uint8_t* pc_patch_lazperf_to_wkb(const PCPATCH_LAZPERF *patch, size_t *wkbsize);
+const uint8_t* pc_patch_lazperf_stored(const PCPATCH_LAZPERF *pal, size_t *size, uint32_t *flags);
+void pc_patch_lazperf_set_stored(PCPATCH_LAZPERF *pal, const uint8_t *buf, size_t size, uint32_t flags);
 PCPATCH* pc_patch_lazperf_from_wkb(const PCSCHEMA *schema, const uint8_t *wkb, size_t wkbsize);
 PCPOINT *pc_patch_lazperf_pointn(const PCPATCH_LAZPERF *patch, int n);
+int pc_patch_lazperf_decode_range(const PCPATCH_LAZPERF *pal, uint32_t first, uint32_t count, uint8_t *data);
+uint32_t pc_patch_lazperf_nchunks(const PCPATCH_LAZPERF *pal, uint32_t *chunksize);
+int pc_patch_lazperf_chunk_bounds(const PCPATCH_LAZPERF *pal, uint32_t chunk, PCBOUNDS *bounds);
+PCPATCH_UNCOMPRESSED* pc_patch_uncompressed_from_lazperf_box(const PCPATCH_LAZPERF *pal, const PCBOUNDS *box);
 
 /****************************************************************************
 * BYTES
@@ -229,10 +258,20 @@ PCPOINT *pc_patch_lazperf_pointn(const PCPATCH_LAZPERF *patch, int n);
 PCBYTES pc_bytes_make(const PCDIMENSION *dim, uint32_t npoints);
 /** Empty the byte array (free the byte buffer) */
 void pc_bytes_free(PCBYTES bytes);
+/** Copy of the byte array, with a buffer of its own */
+PCBYTES pc_bytes_clone(PCBYTES pcb);
 /** Apply the compresstion to the byte array in place, freeing the original byte buffer */
 PCBYTES pc_bytes_encode(PCBYTES pcb, int compression);
 /** Convert the bytes in #PCBYTES to PC_DIM_NONE compression */
 PCBYTES pc_bytes_decode(PCBYTES epcb);
+/** Upper bound of the size of uncompressed bytes once encoded with compression */
+size_t pc_bytes_encoded_size_bound(const PCBYTES *pcb, int compression);
+/** Encode uncompressed bytes into buf, which must hold pc_bytes_encoded_size_bound() bytes, setting the encoded size */
+int pc_bytes_encode_into(const PCBYTES *pcb, int compression, uint8_t *buf, size_t bufsize, size_t *size);
+/** Decode the bytes into buf, which must hold the npoints values uncompressed */
+int pc_bytes_decode_into(const PCBYTES *epcb, uint8_t *buf, size_t bufsize);
+/** Decode the bytes into the scratch sink, as read-only bytes valid until the sink is used again */
+int pc_bytes_decode_scratch(const PCBYTES *epcb, PCSINK *scratch, PCBYTES *dpcb);
 
 /** Convert value bytes to RLE bytes */
 PCBYTES pc_bytes_run_length_encode(const PCBYTES pcb);
@@ -246,6 +285,16 @@ PCBYTES pc_bytes_sigbits_decode(const PCBYTES pcb);
 PCBYTES pc_bytes_zlib_encode(const PCBYTES pcb);
 /** De-compress bytes using zlib */
 PCBYTES pc_bytes_zlib_decode(const PCBYTES pcb);
+/** Does the zlib stream need a preset dictionary, and which one? */
+int pc_bytes_zlib_dictid(const uint8_t *bytes, size_t size, uint32_t *dictid);
+/** Convert value bytes to patched frame-of-reference blocks */
+PCBYTES pc_bytes_pfor_encode(const PCBYTES pcb);
+/** Convert patched frame-of-reference blocks to value bytes */
+PCBYTES pc_bytes_pfor_decode(const PCBYTES pcb);
+/** Size of value bytes once PFOR encoded, without encoding them */
+size_t pc_bytes_pfor_encoded_size(const PCBYTES *pcb);
+/** Check the PFOR blocks stay within the bytes and hold npoints values */
+int pc_bytes_pfor_is_valid(const uint8_t *bytes, size_t bytesize, uint32_t interpretation, uint32_t npoints);
 
 /** How many runs are there in a value array? */
 uint32_t pc_bytes_run_count(const PCBYTES *pcb);
@@ -262,17 +311,26 @@ uint64_t pc_bytes_sigbits_count_64(const PCBYTES *pcb, uint32_t *nsigbits);
 
 /* NOTE: stats are gathered without applying scale and offset */
 PCBYTES pc_bytes_filter(const PCBYTES *pcb, const PCBITMAP *map, PCDOUBLESTAT *stats);
+/** Same as pc_bytes_filter, decoding into the scratch sink */
+PCBYTES pc_bytes_filter_scratch(const PCBYTES *pcb, const PCBITMAP *map, PCDOUBLESTAT *stats, PCSINK *scratch);
+
+/** Append uncompressed values to bytes, keeping their compression */
+PCBYTES pc_bytes_append(const PCBYTES *pcb, const PCBYTES *add);
 
 PCBITMAP* pc_bytes_bitmap(const PCBYTES *pcb, PC_FILTERTYPE filter, double val1, double val2);
+/** Extremes and average of the values, avg may be NULL */
 int pc_bytes_minmax(const PCBYTES *pcb, double *min, double *max, double *avg);
+/** Same as pc_bytes_minmax, decoding into a caller owned buffer */
+int pc_bytes_minmax_scratch(const PCBYTES *pcb, double *min, double *max, double *avg, PCSINK *scratch);
 
 /** getting the n-th point out of a PCBYTE into a buffer */
-void pc_bytes_uncompressed_to_ptr(uint8_t *buf, PCBYTES pcb, int n);
-void pc_bytes_run_length_to_ptr(uint8_t *buf, PCBYTES pcb, int n);
-void pc_bytes_sigbits_to_ptr_32(uint8_t *buf, PCBYTES pcb, int n);
-void pc_bytes_sigbits_to_ptr(uint8_t *buf, PCBYTES pcb, int n);
-void pc_bytes_zlib_to_ptr(uint8_t *buf, PCBYTES pcb, int n);
-void pc_bytes_to_ptr(uint8_t *buf, PCBYTES pcb, int n);
+void pc_bytes_uncompressed_to_ptr(uint8_t *buf, const PCBYTES *pcb, int n);
+void pc_bytes_run_length_to_ptr(uint8_t *buf, const PCBYTES *pcb, int n);
+void pc_bytes_sigbits_to_ptr_32(uint8_t *buf, const PCBYTES *pcb, int n);
+void pc_bytes_sigbits_to_ptr(uint8_t *buf, const PCBYTES *pcb, int n);
+void pc_bytes_zlib_to_ptr(uint8_t *buf, const PCBYTES *pcb, int n);
+void pc_bytes_pfor_to_ptr(uint8_t *buf, const PCBYTES *pcb, int n);
+void pc_bytes_to_ptr(uint8_t *buf, const PCBYTES *pcb, int n);
 
 /****************************************************************************
 * BOUNDS
@@ -282,6 +340,8 @@ void pc_bytes_to_ptr(uint8_t *buf, PCBYTES pcb, int n);
 void pc_bounds_init(PCBOUNDS *b);
 /** Copy a bounds */
 PCSTATS* pc_stats_clone(const PCSTATS *stats);
+/** Fold the stats of n2 points into those of n1 points */
+void pc_stats_merge(PCSTATS *s1, uint32_t n1, const PCSTATS *s2, uint32_t n2);
 /** Expand extents of b1 to encompass b2 */
 void pc_bounds_merge(PCBOUNDS *b1, const PCBOUNDS *b2);
 
@@ -11,6 +11,7 @@
 *  - run-length encoding
 *  - significant-bit removal
 *  - deflate
+*  - patched frame-of-reference
 *
 *  PgSQL Pointcloud is free and open source software provided
 *  by the Government of Canada
@@ -46,10 +47,11 @@ pc_bytes_make(const PCDIMENSION *dim, uint32_t npoints)
 	pcb.interpretation = dim->interpretation;
 	pcb.compression = PC_DIM_NONE;
 	pcb.readonly = PC_FALSE;
+	pcb.zdict = dim->zdict;
 	return pcb;
 }
 
-static PCBYTES
+PCBYTES
 pc_bytes_clone(PCBYTES pcb)
 {
 	PCBYTES pcbnew = pcb;
@@ -62,74 +64,78 @@ pc_bytes_clone(PCBYTES pcb)
 	return pcbnew;
 }
 
+/**
+* Encode into a buffer sized from the bound, shrunk to the
+* encoded size once done. When encoding fails the bytes come
+* back NULL and empty.
+*/
 PCBYTES
 pc_bytes_encode(PCBYTES pcb, int compression)
 {
-	PCBYTES epcb;
-	switch ( compression )
-	{
-	case PC_DIM_RLE:
-	{
-		epcb = pc_bytes_run_length_encode(pcb);
-		break;
-	}
-	case PC_DIM_SIGBITS:
-	{
-		epcb = pc_bytes_sigbits_encode(pcb);
-		break;
-	}
-	case PC_DIM_ZLIB:
-	{
-		epcb = pc_bytes_zlib_encode(pcb);
-		break;
-	}
-	case PC_DIM_NONE:
-	{
-		epcb = pc_bytes_clone(pcb);
-		break;
-	}
-	default:
-	{
-		pcerror("%s: Uh oh", __func__);
-	}
-	}
+	PCBYTES epcb = pcb;
+	size_t bound;
+
+	if ( compression == PC_DIM_NONE )
+		return pc_bytes_clone(pcb);
+
+	bound = pc_bytes_encoded_size_bound(&pcb, compression);
+	epcb.bytes = pcalloc(bound + 1);
+	epcb.size = 0;
+	epcb.compression = compression;
+	epcb.readonly = PC_FALSE;
+	if ( PC_FAILURE == pc_bytes_encode_into(&pcb, compression, epcb.bytes, bound, &epcb.size) )
+	{
+		pcfree(epcb.bytes);
+		epcb.bytes = NULL;
+		epcb.size = 0;
+		return epcb;
+	}
+	/* Give back what the bound over-estimated */
+	epcb.bytes = pcrealloc(epcb.bytes, epcb.size ? epcb.size : 1);
 	return epcb;
 }
 
+/**
+* Decode into a buffer of its own. When decoding fails the bytes
+* come back NULL and empty.
+*/
 PCBYTES
 pc_bytes_decode(PCBYTES epcb)
 {
-	PCBYTES pcb;
-	switch ( epcb.compression )
-	{
-	case PC_DIM_RLE:
-	{
-		pcb = pc_bytes_run_length_decode(epcb);
-		break;
-	}
-	case PC_DIM_SIGBITS:
-	{
-		pcb = pc_bytes_sigbits_decode(epcb);
-		break;
-	}
-	case PC_DIM_ZLIB:
-	{
-		pcb = pc_bytes_zlib_decode(epcb);
-		break;
-	}
-	case PC_DIM_NONE:
-	{
-		pcb = pc_bytes_clone(epcb);
-		break;
-	}
-	default:
+	PCBYTES pcb = epcb;
+
+	pcb.size = pc_interpretation_size(epcb.interpretation) * epcb.npoints;
+	pcb.bytes = pcalloc(pcb.size);
+	pcb.compression = PC_DIM_NONE;
+	pcb.readonly = PC_FALSE;
+	if ( PC_FAILURE == pc_bytes_decode_into(&epcb, pcb.bytes, pcb.size) )
 	{
-		pcerror("%s: Uh oh", __func__);
-	}
+		pcfree(pcb.bytes);
+		pcb.bytes = NULL;
+		pcb.size = 0;
 	}
 	return pcb;
 }
 
+/**
+* Decode into the scratch sink, written over from its start, as
+* read-only bytes pointing into it. Callers going over many columns
+* or patches pass the same sink, which then stops allocating once it
+* fits the largest column. The bytes are only valid until the next
+* use of the sink.
+*/
+int
+pc_bytes_decode_scratch(const PCBYTES *epcb, PCSINK *scratch, PCBYTES *dpcb)
+{
+	*dpcb = *epcb;
+	dpcb->size = pc_interpretation_size(epcb->interpretation) * epcb->npoints;
+	dpcb->compression = PC_DIM_NONE;
+	dpcb->readonly = PC_TRUE;
+	scratch->size = 0;
+	dpcb->bytes = pc_sink_reserve(scratch, dpcb->size);
+	return pc_bytes_decode_into(epcb, dpcb->bytes, dpcb->size);
+}
+
 
 /**
 * How many distinct runs of values are there in this array?
@@ -158,36 +164,32 @@ pc_bytes_run_count(const PCBYTES *pcb)
 }
 
 /**
-* Take the uncompressed bytes and run-length encode (RLE) them.
+* Run-length encode (RLE) the uncompressed bytes into buf, which
+* must hold npoints * (1 + size) bytes, the worst case of one run
+* per element. Returns the encoded size.
 * Structure of RLE array as:
 * <uint8> number of elements
 * <val> value
 * ...
 */
-PCBYTES
-pc_bytes_run_length_encode(const PCBYTES pcb)
+static size_t
+pc_bytes_run_length_encode_ptr(uint8_t *buf, const PCBYTES *pcb)
 {
 	int i;
-	uint8_t *buf, *bufptr;
+	uint8_t *bufptr = buf;
 	const uint8_t *bytesptr;
 	const uint8_t *runstart;
-	uint8_t *bytes_rle;
-	size_t size = pc_interpretation_size(pcb.interpretation);
+	size_t size = pc_interpretation_size(pcb->interpretation);
 	uint8_t runlength = 1;
-	PCBYTES pcbout = pcb;
-
-	/* Allocate more size than we need (worst case: n elements, n runs) */
-	buf = pcalloc(pcb.npoints*size + sizeof(uint8_t)*pcb.npoints);
-	bufptr = buf;
 
 	/* First run starts at the start! */
-	runstart = pcb.bytes;
+	runstart = pcb->bytes;
 
-	for ( i = 1; i <= pcb.npoints; i++ )
+	for ( i = 1; i <= pcb->npoints; i++ )
 	{
-		bytesptr = pcb.bytes + i*size;
+		bytesptr = pcb->bytes + i*size;
 		/* Run continues... */
-		if ( i < pcb.npoints && runlength < 255 && memcmp(runstart, bytesptr, size) == 0  )
+		if ( i < pcb->npoints && runlength < 255 && memcmp(runstart, bytesptr, size) == 0  )
 		{
 			runlength++;
 		}
@@ -205,59 +207,49 @@ pc_bytes_run_length_encode(const PCBYTES pcb)
 		}
 	}
 	/* Length of buffer */
-	pcbout.size = (bufptr - buf);
-	/* Write out shortest buffer possible */
-	bytes_rle = pcalloc(pcbout.size);
-	memcpy(bytes_rle, buf, pcbout.size);
-	pcfree(buf);
-	/* We're going to replace the current buffer */
-	pcbout.bytes = bytes_rle;
-	pcbout.compression = PC_DIM_RLE;
-	pcbout.readonly = PC_FALSE;
-	return pcbout;
+	return bufptr - buf;
 }
 
 /**
-* Take the compressed bytes and run-length dencode (RLE) them.
+* Take the uncompressed bytes and run-length encode (RLE) them.
+*/
+PCBYTES
+pc_bytes_run_length_encode(const PCBYTES pcb)
+{
+	return pc_bytes_encode(pcb, PC_DIM_RLE);
+}
+
+/**
+* Run-length decode (RLE) the compressed bytes into buf, which
+* must hold npoints values.
 * Structure of RLE array is:
 * <uint8> number of elements
 * <val> value
 * ...
 */
-PCBYTES
-pc_bytes_run_length_decode(const PCBYTES pcb)
+static int
+pc_bytes_run_length_decode_ptr(uint8_t *buf, const PCBYTES *pcb)
 {
 	int i, n;
-	uint8_t *bytes;
-	uint8_t *bytes_ptr;
-	const uint8_t *bytes_rle_ptr = pcb.bytes;
-	const uint8_t *bytes_rle_end = pcb.bytes + pcb.size;
-
-	size_t size = pc_interpretation_size(pcb.interpretation);
-	size_t size_out;
+	uint8_t *bytes_ptr = buf;
+	const uint8_t *bytes_rle_ptr = pcb->bytes;
+	const uint8_t *bytes_rle_end = pcb->bytes + pcb->size;
+	size_t size = pc_interpretation_size(pcb->interpretation);
 	uint32_t npoints = 0;
-	PCBYTES pcbout = pcb;
-
-	assert(pcb.compression == PC_DIM_RLE);
-
-	/* Count up how big our output is. */
-	while( bytes_rle_ptr < bytes_rle_end )
-	{
-		npoints += *bytes_rle_ptr;
-		bytes_rle_ptr += 1 + size;
-	}
 
-	assert(npoints == pcb.npoints);
+	assert(pcb->compression == PC_DIM_RLE);
 
-	/* Alocate output and fill it up */
-	size_out = size * npoints;
-	bytes = pcalloc(size_out);
-	bytes_ptr = bytes;
-	bytes_rle_ptr = pcb.bytes;
 	while ( bytes_rle_ptr < bytes_rle_end )
 	{
 		n = *bytes_rle_ptr;
 		bytes_rle_ptr += 1;
+		npoints += n;
+		/* Do not write past the end of the caller buffer */
+		if ( npoints > pcb->npoints )
+		{
+			pcerror("%s: more values than the %u points", __func__, pcb->npoints);
+			return PC_FAILURE;
+		}
 		for ( i = 0; i < n; i++ )
 		{
 			memcpy(bytes_ptr, bytes_rle_ptr, size);
@@ -265,11 +257,19 @@ pc_bytes_run_length_decode(const PCBYTES pcb)
 		}
 		bytes_rle_ptr += size;
 	}
-	pcbout.compression = PC_DIM_NONE;
-	pcbout.size = size_out;
-	pcbout.bytes = bytes;
-	pcbout.readonly = PC_FALSE;
-	return pcbout;
+
+	assert(npoints == pcb->npoints);
+	return PC_SUCCESS;
+}
+
+/**
+* Take the compressed bytes and run-length dencode (RLE) them.
+*/
+PCBYTES
+pc_bytes_run_length_decode(const PCBYTES pcb)
+{
+	assert(pcb.compression == PC_DIM_RLE);
+	return pc_bytes_decode(pcb);
 }
 
 
@@ -464,15 +464,40 @@ pc_bytes_sigbits_count(const PCBYTES *pcb)
 }
 
 
+/**
+* Size of the sigbits encoding of npoints words of wordsize
+* bytes sharing commonbits bits. The output is padded to a
+* whole number of words.
+*/
+static size_t
+pc_bytes_sigbits_encoded_size(size_t wordsize, uint32_t commonbits, uint32_t npoints)
+{
+	int nbits = 8 * wordsize - commonbits;
+	/* #bits/8+1remainder+2words of metadata */
+	size_t size_out_raw = (nbits * npoints / 8) + 1 + 2 * wordsize;
+
+	switch ( wordsize )
+	{
+	case 1:
+		/* Remainder byte is already a whole word */
+		return size_out_raw;
+	case 2:
+		return size_out_raw + (size_out_raw % 2);
+	default:
+		return size_out_raw + (wordsize - (size_out_raw % wordsize));
+	}
+}
+
 /**
 * Encoded array:
 * <uint8> number of bits per unique section
 * <uint8> common bits for the array
 * [n_bits]... unique bits packed in
-* Size of encoded array comes out in ebytes_size.
+* Writes into bytes_out, which must hold size_out bytes,
+* and returns size_out.
 */
-PCBYTES
-pc_bytes_sigbits_encode_8(const PCBYTES pcb, uint8_t commonvalue, uint8_t commonbits)
+static size_t
+pc_bytes_sigbits_encode_8_ptr(uint8_t *bytes_out, const PCBYTES pcb, uint8_t commonvalue, uint8_t commonbits)
 {
 	int i;
 	int shift;
@@ -482,16 +507,16 @@ pc_bytes_sigbits_encode_8(const PCBYTES pcb, uint8_t commonvalue, uint8_t common
 	/* How wide are our unique values? */
 	int nbits = bitwidth - commonbits;
 	/* Size of output buffer (#bits/8+1remainder+2metadata) */
-	size_t size_out = (nbits * pcb.npoints / 8) + 3;
-	uint8_t *bytes_out = pcalloc(size_out);
+	size_t size_out = pc_bytes_sigbits_encoded_size(1, commonbits, pcb.npoints);
 	/* Use this to zero out the parts that are common */
 	uint8_t mask = (0xFF >> commonbits);
 	/* Write head */
 	uint8_t *byte_ptr = bytes_out;
 	/* What bit are we writing to now? */
 	int bit = bitwidth;
-	/* Write to... */
-	PCBYTES pcbout = pcb;
+
+	/* Bits are or-ed in, so start from zeroes */
+	memset(bytes_out, 0, size_out);
 
 	/* Number of unique bits goes up front */
 	*byte_ptr = nbits;
@@ -503,11 +528,7 @@ pc_bytes_sigbits_encode_8(const PCBYTES pcb, uint8_t commonvalue, uint8_t common
 	/* All the values are the same... */
 	if ( bitwidth == commonbits )
 	{
-		pcbout.size = size_out;
-		pcbout.bytes = bytes_out;
-		pcbout.compression = PC_DIM_SIGBITS;
-		pcbout.readonly = PC_FALSE;
-		return pcbout;
+		return size_out;
 	}
 
 	for ( i = 0; i < pcb.npoints; i++ )
@@ -549,11 +570,7 @@ pc_bytes_sigbits_encode_8(const PCBYTES pcb, uint8_t commonvalue, uint8_t common
 		}
 	}
 
-	pcbout.size = size_out;
-	pcbout.bytes = bytes_out;
-	pcbout.compression = PC_DIM_SIGBITS;
-	pcbout.readonly = PC_FALSE;
-	return pcbout;
+	return size_out;
 }
 
 /**
@@ -561,10 +578,11 @@ pc_bytes_sigbits_encode_8(const PCBYTES pcb, uint8_t commonvalue, uint8_t common
 * <uint16> number of bits per unique section
 * <uint16> common bits for the array
 * [n_bits]... unique bits packed in
-* Size of encoded array comes out in ebytes_size.
+* Writes into bytes_out, which must hold size_out bytes,
+* and returns size_out.
 */
-PCBYTES
-pc_bytes_sigbits_encode_16(const PCBYTES pcb, uint16_t commonvalue, uint8_t commonbits)
+static size_t
+pc_bytes_sigbits_encode_16_ptr(uint8_t *bytes_out, const PCBYTES pcb, uint16_t commonvalue, uint8_t commonbits)
 {
 	int i;
 	int shift;
@@ -575,18 +593,16 @@ pc_bytes_sigbits_encode_16(const PCBYTES pcb, uint16_t commonvalue, uint8_t comm
 	/* How wide are our unique values? */
 	int nbits = bitwidth - commonbits;
 	/* Size of output buffer (#bits/8+1remainder+4metadata)  */
-	size_t size_out_raw = (nbits * pcb.npoints / 8) + 1 + 4;
-	/* Make sure buffer is size to hold all our words */
-	size_t size_out = size_out_raw + (size_out_raw % 2);
-	uint8_t *bytes_out = pcalloc(size_out);
+	size_t size_out = pc_bytes_sigbits_encoded_size(2, commonbits, pcb.npoints);
 	/* Use this to zero out the parts that are common */
 	uint16_t mask = (0xFFFF >> commonbits);
 	/* Write head */
 	uint16_t *byte_ptr = (uint16_t*)(bytes_out);
 	/* What bit are we writing to now? */
 	int bit = bitwidth;
-	/* Write to... */
-	PCBYTES pcbout = pcb;
+
+	/* Bits are or-ed in, so start from zeroes */
+	memset(bytes_out, 0, size_out);
 
 	/* Number of unique bits goes up front */
 	*byte_ptr = nbits;
@@ -598,11 +614,7 @@ pc_bytes_sigbits_encode_16(const PCBYTES pcb, uint16_t commonvalue, uint8_t comm
 	/* All the values are the same... */
 	if ( bitwidth == commonbits )
 	{
-		pcbout.size = size_out;
-		pcbout.bytes = bytes_out;
-		pcbout.compression = PC_DIM_SIGBITS;
-		pcbout.readonly = PC_FALSE;
-		return pcbout;
+		return size_out;
 	}
 
 	for ( i = 0; i < pcb.npoints; i++ )
@@ -644,11 +656,7 @@ pc_bytes_sigbits_encode_16(const PCBYTES pcb, uint16_t commonvalue, uint8_t comm
 		}
 	}
 
-	pcbout.size = size_out;
-	pcbout.bytes = bytes_out;
-	pcbout.compression = PC_DIM_SIGBITS;
-	pcbout.readonly = PC_FALSE;
-	return pcbout;
+	return size_out;
 }
 
 /**
@@ -656,10 +664,11 @@ pc_bytes_sigbits_encode_16(const PCBYTES pcb, uint16_t commonvalue, uint8_t comm
 * <uint32> number of bits per unique section
 * <uint32> common bits for the array
 * [n_bits]... unique bits packed in
-* Size of encoded array comes out in ebytes_size.
+* Writes into bytes_out, which must hold size_out bytes,
+* and returns size_out.
 */
-PCBYTES
-pc_bytes_sigbits_encode_32(const PCBYTES pcb, uint32_t commonvalue, uint8_t commonbits)
+static size_t
+pc_bytes_sigbits_encode_32_ptr(uint8_t *bytes_out, const PCBYTES pcb, uint32_t commonvalue, uint8_t commonbits)
 {
 	int i;
 	int shift;
@@ -670,17 +679,16 @@ pc_bytes_sigbits_encode_32(const PCBYTES pcb, uint32_t commonvalue, uint8_t comm
 	/* How wide are our unique values? */
 	int nbits = bitwidth - commonbits;
 	/* Size of output buffer (#bits/8+1remainder+8metadata) */
-	size_t size_out_raw = (nbits * pcb.npoints / 8) + 1 + 8;
-	size_t size_out = size_out_raw + (4 - (size_out_raw % 4));
-	uint8_t *bytes_out = pcalloc(size_out);
+	size_t size_out = pc_bytes_sigbits_encoded_size(4, commonbits, pcb.npoints);
 	/* Use this to zero out the parts that are common */
 	uint32_t mask = (0xFFFFFFFF >> commonbits);
 	/* Write head */
 	uint32_t *byte_ptr = (uint32_t*)bytes_out;
 	/* What bit are we writing to now? */
 	int bit = bitwidth;
-	/* Write to... */
-	PCBYTES pcbout = pcb;
+
+	/* Bits are or-ed in, so start from zeroes */
+	memset(bytes_out, 0, size_out);
 
 	/* Number of unique bits goes up front */
 	*byte_ptr = nbits;
@@ -692,11 +700,7 @@ pc_bytes_sigbits_encode_32(const PCBYTES pcb, uint32_t commonvalue, uint8_t comm
 	/* All the values are the same... */
 	if ( bitwidth == commonbits )
 	{
-		pcbout.size = size_out;
-		pcbout.bytes = bytes_out;
-		pcbout.compression = PC_DIM_SIGBITS;
-		pcbout.readonly = PC_FALSE;
-		return pcbout;
+		return size_out;
 	}
 
 	for ( i = 0; i < pcb.npoints; i++ )
@@ -738,11 +742,7 @@ pc_bytes_sigbits_encode_32(const PCBYTES pcb, uint32_t commonvalue, uint8_t comm
 		}
 	}
 
-	pcbout.size = size_out;
-	pcbout.bytes = bytes_out;
-	pcbout.compression = PC_DIM_SIGBITS;
-	pcbout.readonly = PC_FALSE;
-	return pcbout;
+	return size_out;
 }
 
 /**
@@ -750,10 +750,11 @@ pc_bytes_sigbits_encode_32(const PCBYTES pcb, uint32_t commonvalue, uint8_t comm
 * <uint64> number of bits per unique section
 * <uint64> common bits for the array
 * [n_bits]... unique bits packed in
-* Size of encoded array comes out in ebytes_size.
+* Writes into bytes_out, which must hold size_out bytes,
+* and returns size_out.
 */
-PCBYTES
-pc_bytes_sigbits_encode_64(const PCBYTES pcb, uint64_t commonvalue, uint8_t commonbits)
+static size_t
+pc_bytes_sigbits_encode_64_ptr(uint8_t *bytes_out, const PCBYTES pcb, uint64_t commonvalue, uint8_t commonbits)
 {
 	int i;
 	int shift;
@@ -764,17 +765,16 @@ pc_bytes_sigbits_encode_64(const PCBYTES pcb, uint64_t commonvalue, uint8_t comm
 	/* How wide are our unique values? */
 	int nbits = bitwidth - commonbits;
 	/* Size of output buffer (#bits/8+1remainder+16metadata) */
-	size_t size_out_raw = (nbits * pcb.npoints / 8) + 1 + 16;
-	size_t size_out = size_out_raw + (8 - (size_out_raw % 8));
-	uint8_t *bytes_out = pcalloc(size_out);
+	size_t size_out = pc_bytes_sigbits_encoded_size(8, commonbits, pcb.npoints);
 	/* Use this to zero out the parts that are common */
 	uint64_t mask = (0xFFFFFFFFFFFFFFFF >> commonbits);
 	/* Write head */
 	uint64_t *byte_ptr = (uint64_t*)bytes_out;
 	/* What bit are we writing to now? */
 	int bit = bitwidth;
-	/* Write to... */
-	PCBYTES pcbout = pcb;
+
+	/* Bits are or-ed in, so start from zeroes */
+	memset(bytes_out, 0, size_out);
 
 	/* Number of unique bits goes up front */
 	*byte_ptr = nbits;
@@ -786,11 +786,7 @@ pc_bytes_sigbits_encode_64(const PCBYTES pcb, uint64_t commonvalue, uint8_t comm
 	/* All the values are the same... */
 	if ( bitwidth == commonbits )
 	{
-		pcbout.size = size_out;
-		pcbout.bytes = bytes_out;
-		pcbout.compression = PC_DIM_SIGBITS;
-		pcbout.readonly = PC_FALSE;
-		return pcbout;
+		return size_out;
 	}
 
 	for ( i = 0; i < pcb.npoints; i++ )
@@ -832,55 +828,59 @@ pc_bytes_sigbits_encode_64(const PCBYTES pcb, uint64_t commonvalue, uint8_t comm
 		}
 	}
 
-	pcbout.size = size_out;
-	pcbout.bytes = bytes_out;
-	pcbout.compression = PC_DIM_SIGBITS;
-	pcbout.readonly = PC_FALSE;
-	return pcbout;
+	return size_out;
 }
 
 /**
-* Convert a raw byte array into with common bits stripped and the
-* remaining bits packed in.
-* <uint8|uint16|uint32> number of bits per unique section
-* <uint8|uint16|uint32> common bits for the array
-* [n_bits]... unique bits packed in
-* Size of encoded array comes out in ebytes_size.
+* Strip the common bits of the uncompressed bytes and pack the
+* remaining bits into buf, which must hold the encoding with no
+* bits in common. Returns the encoded size.
 */
-PCBYTES
-pc_bytes_sigbits_encode(const PCBYTES pcb)
+static size_t
+pc_bytes_sigbits_encode_ptr(uint8_t *buf, const PCBYTES *pcb)
 {
-	size_t size = pc_interpretation_size(pcb.interpretation);
 	uint32_t nbits;
-	switch ( size )
+	switch ( pc_interpretation_size(pcb->interpretation) )
 	{
 	case 1:
 	{
-		uint8_t commonvalue = pc_bytes_sigbits_count_8(&pcb, &nbits);
-		return pc_bytes_sigbits_encode_8(pcb, commonvalue, nbits);
+		uint8_t commonvalue = pc_bytes_sigbits_count_8(pcb, &nbits);
+		return pc_bytes_sigbits_encode_8_ptr(buf, *pcb, commonvalue, nbits);
 	}
 	case 2:
 	{
-		uint16_t commonvalue = pc_bytes_sigbits_count_16(&pcb, &nbits);
-		return pc_bytes_sigbits_encode_16(pcb, commonvalue, nbits);
+		uint16_t commonvalue = pc_bytes_sigbits_count_16(pcb, &nbits);
+		return pc_bytes_sigbits_encode_16_ptr(buf, *pcb, commonvalue, nbits);
 	}
 	case 4:
 	{
-		uint32_t commonvalue = pc_bytes_sigbits_count_32(&pcb, &nbits);
-		return pc_bytes_sigbits_encode_32(pcb, commonvalue, nbits);
+		uint32_t commonvalue = pc_bytes_sigbits_count_32(pcb, &nbits);
+		return pc_bytes_sigbits_encode_32_ptr(buf, *pcb, commonvalue, nbits);
 	}
 	case 8:
 	{
-		uint64_t commonvalue = pc_bytes_sigbits_count_64(&pcb, &nbits);
-		return pc_bytes_sigbits_encode_64(pcb, commonvalue, nbits);
+		uint64_t commonvalue = pc_bytes_sigbits_count_64(pcb, &nbits);
+		return pc_bytes_sigbits_encode_64_ptr(buf, *pcb, commonvalue, nbits);
 	}
 	default:
 	{
-		pcerror("%s: bits_encode cannot handle interpretation %d", __func__, pcb.interpretation);
+		pcerror("%s: bits_encode cannot handle interpretation %d", __func__, pcb->interpretation);
 	}
 	}
-	pcerror("Uh Oh");
-	return pcb;
+	return 0;
+}
+
+/**
+* Convert a raw byte array into with common bits stripped and the
+* remaining bits packed in.
+* <uint8|uint16|uint32> number of bits per unique section
+* <uint8|uint16|uint32> common bits for the array
+* [n_bits]... unique bits packed in
+*/
+PCBYTES
+pc_bytes_sigbits_encode(const PCBYTES pcb)
+{
+	return pc_bytes_encode(pcb, PC_DIM_SIGBITS);
 }
 
 static PCBYTES
@@ -914,19 +914,16 @@ pc_bytes_sigbits_flip_endian(const PCBYTES pcb)
 }
 
 
-PCBYTES
-pc_bytes_sigbits_decode_8(const PCBYTES pcb)
+static void
+pc_bytes_sigbits_decode_8_ptr(uint8_t *outbytes, const PCBYTES *pcb)
 {
 	int i;
-	const uint8_t *bytes_ptr = (const uint8_t*)(pcb.bytes);
+	const uint8_t *bytes_ptr = (const uint8_t*)(pcb->bytes);
 	uint8_t nbits;
 	uint8_t commonvalue;
 	uint8_t mask;
 	int bit = 8;
-	size_t outbytes_size = sizeof(uint8_t) * pcb.npoints;
-	uint8_t *outbytes = pcalloc(outbytes_size);
 	uint8_t *obytes = (uint8_t*)outbytes;
-	PCBYTES pcbout = pcb;
 
 	/* How many unique bits? */
 	nbits = *bytes_ptr;
@@ -937,7 +934,7 @@ pc_bytes_sigbits_decode_8(const PCBYTES pcb)
 	/* Mask for just the unique parts */
 	mask = (0xFF >> (bit-nbits));
 
-	for ( i = 0; i < pcb.npoints; i++ )
+	for ( i = 0; i < pcb->npoints; i++ )
 	{
 		int shift = bit - nbits;
 		uint8_t val = *bytes_ptr;
@@ -973,27 +970,19 @@ pc_bytes_sigbits_decode_8(const PCBYTES pcb)
 			bit -= s;
 		}
 	}
-	pcbout.size = outbytes_size;
-	pcbout.compression = PC_DIM_NONE;
-	pcbout.bytes = outbytes;
-	pcbout.readonly = PC_FALSE;
-	return pcbout;
 }
 
-PCBYTES
-pc_bytes_sigbits_decode_16(const PCBYTES pcb)
+static void
+pc_bytes_sigbits_decode_16_ptr(uint8_t *outbytes, const PCBYTES *pcb)
 {
 	int i;
-	const uint16_t *bytes_ptr = (const uint16_t *)(pcb.bytes);
+	const uint16_t *bytes_ptr = (const uint16_t *)(pcb->bytes);
 	uint16_t nbits;
 	uint16_t commonvalue;
 	uint16_t mask;
 	static const int bitwidth = 16;
 	int bit = bitwidth;
-	size_t outbytes_size = sizeof(uint16_t) * pcb.npoints;
-	uint8_t *outbytes = pcalloc(outbytes_size);
 	uint16_t *obytes = (uint16_t*)outbytes;
-	PCBYTES pcbout = pcb;
 
 	/* How many unique bits? */
 	nbits = *bytes_ptr;
@@ -1004,7 +993,7 @@ pc_bytes_sigbits_decode_16(const PCBYTES pcb)
 	/* Calculate mask */
 	mask = (0xFFFF >> (bit-nbits));
 
-	for ( i = 0; i < pcb.npoints; i++ )
+	for ( i = 0; i < pcb->npoints; i++ )
 	{
 		int shift = bit - nbits;
 		uint16_t val = *bytes_ptr;
@@ -1038,27 +1027,19 @@ pc_bytes_sigbits_decode_16(const PCBYTES pcb)
 			bit -= s;
 		}
 	}
-	pcbout.size = outbytes_size;
-	pcbout.compression = PC_DIM_NONE;
-	pcbout.bytes = outbytes;
-	pcbout.readonly = PC_FALSE;
-	return pcbout;
 }
 
-PCBYTES
-pc_bytes_sigbits_decode_32(const PCBYTES pcb)
+static void
+pc_bytes_sigbits_decode_32_ptr(uint8_t *outbytes, const PCBYTES *pcb)
 {
 	int i;
-	const uint32_t *bytes_ptr = (const uint32_t *)(pcb.bytes);
+	const uint32_t *bytes_ptr = (const uint32_t *)(pcb->bytes);
 	uint32_t nbits;
 	uint32_t commonvalue;
 	uint32_t mask;
 	static const int bitwidth = 32;
 	int bit = bitwidth;
-	size_t outbytes_size = sizeof(uint32_t) * pcb.npoints;
-	uint8_t *outbytes = pcalloc(outbytes_size);
 	uint32_t *obytes = (uint32_t*)outbytes;
-	PCBYTES pcbout = pcb;
 
 	/* How many unique bits? */
 	nbits = *bytes_ptr;
@@ -1069,7 +1050,7 @@ pc_bytes_sigbits_decode_32(const PCBYTES pcb)
 	/* Calculate mask */
 	mask = (0xFFFFFFFF >> (bit-nbits));
 
-	for ( i = 0; i < pcb.npoints; i++ )
+	for ( i = 0; i < pcb->npoints; i++ )
 	{
 		int shift = bit - nbits;
 		uint32_t val = *bytes_ptr;
@@ -1103,28 +1084,19 @@ pc_bytes_sigbits_decode_32(const PCBYTES pcb)
 			obytes[i] |= val;
 		}
 	}
-
-	pcbout.size = outbytes_size;
-	pcbout.compression = PC_DIM_NONE;
-	pcbout.bytes = outbytes;
-	pcbout.readonly = PC_FALSE;
-	return pcbout;
 }
 
-PCBYTES
-pc_bytes_sigbits_decode_64(const PCBYTES pcb)
+static void
+pc_bytes_sigbits_decode_64_ptr(uint8_t *outbytes, const PCBYTES *pcb)
 {
 	int i;
-	const uint64_t *bytes_ptr = (const uint64_t *)(pcb.bytes);
+	const uint64_t *bytes_ptr = (const uint64_t *)(pcb->bytes);
 	uint64_t nbits;
 	uint64_t commonvalue;
 	uint64_t mask;
 	static const int bitwidth = 64;
 	int bit = bitwidth;
-	size_t outbytes_size = sizeof(uint64_t) * pcb.npoints;
-	uint8_t *outbytes = pcalloc(outbytes_size);
 	uint64_t *obytes = (uint64_t*)outbytes;
-	PCBYTES pcbout = pcb;
 
 	/* How many unique bits? */
 	nbits = *bytes_ptr;
@@ -1135,7 +1107,7 @@ pc_bytes_sigbits_decode_64(const PCBYTES pcb)
 	/* Calculate mask */
 	mask = (0xFFFFFFFFFFFFFFFF >> (bit-nbits));
 
-	for ( i = 0; i < pcb.npoints; i++ )
+	for ( i = 0; i < pcb->npoints; i++ )
 	{
 		int shift = bit - nbits;
 		uint64_t val = *bytes_ptr;
@@ -1169,44 +1141,37 @@ pc_bytes_sigbits_decode_64(const PCBYTES pcb)
 			obytes[i] |= val;
 		}
 	}
-
-	pcbout.size = outbytes_size;
-	pcbout.compression = PC_DIM_NONE;
-	pcbout.bytes = outbytes;
-	pcbout.readonly = PC_FALSE;
-	return pcbout;
 }
 
 
-PCBYTES
-pc_bytes_sigbits_decode(const PCBYTES pcb)
+static int
+pc_bytes_sigbits_decode_ptr(uint8_t *buf, const PCBYTES *pcb)
 {
-	size_t size = pc_interpretation_size(pcb.interpretation);
-	switch ( size )
+	switch ( pc_interpretation_size(pcb->interpretation) )
 	{
 	case 1:
-	{
-		return pc_bytes_sigbits_decode_8(pcb);
-	}
+		pc_bytes_sigbits_decode_8_ptr(buf, pcb);
+		return PC_SUCCESS;
 	case 2:
-	{
-		return pc_bytes_sigbits_decode_16(pcb);
-	}
+		pc_bytes_sigbits_decode_16_ptr(buf, pcb);
+		return PC_SUCCESS;
 	case 4:
-	{
-		return pc_bytes_sigbits_decode_32(pcb);
-	}
+		pc_bytes_sigbits_decode_32_ptr(buf, pcb);
+		return PC_SUCCESS;
 	case 8:
-	{
-		return pc_bytes_sigbits_decode_64(pcb);
-	}
+		pc_bytes_sigbits_decode_64_ptr(buf, pcb);
+		return PC_SUCCESS;
 	default:
-	{
-		pcerror("%s: cannot handle interpretation %d", __func__, pcb.interpretation);
-	}
+		pcerror("%s: cannot handle interpretation %d", __func__, pcb->interpretation);
 	}
-	pcerror("%s: got an unhandled errror", __func__);
-	return pcb;
+	return PC_FAILURE;
+}
+
+PCBYTES
+pc_bytes_sigbits_decode(const PCBYTES pcb)
+{
+	assert(pcb.compression == PC_DIM_SIGBITS);
+	return pc_bytes_decode(pcb);
 }
 
 static voidpf
@@ -1222,85 +1187,771 @@ pc_zlib_free(voidpf opaque, voidpf ptr)
 }
 
 
-/* TO DO look for Z_STREAM_END on the write */
-
 /**
-* Returns compressed byte array with
-* <size_t> size of compressed portion
-* <size_t> size of original data
-* <.....> compresssed bytes
+* Deflate the bytes into buf, of bufsize bytes, setting the
+* compressed size. Fails if buf is too small for the stream.
+* When the dimension has a preset dictionary the stream is primed
+* with it, and zlib records the dictionary id in the stream header.
 */
-PCBYTES
-pc_bytes_zlib_encode(const PCBYTES pcb)
+static int
+pc_bytes_zlib_encode_ptr(uint8_t *buf, size_t bufsize, const PCBYTES *pcb, size_t *size)
 {
 	z_stream strm;
 	int ret;
-	size_t have;
-	size_t bufsize = 4*pcb.size;
-	uint8_t *buf = pcalloc(bufsize);
-	PCBYTES pcbout = pcb;
 
 	/* Use our own allocators */
 	strm.zalloc = pc_zlib_alloc;
 	strm.zfree = pc_zlib_free;
 	strm.opaque = Z_NULL;
 	ret = deflateInit(&strm, 9);
-	/* Set up input buffer */
-	strm.avail_in = pcb.size;
-	strm.next_in = pcb.bytes;
-	/* Set up output buffer */
+	if ( ret != Z_OK )
+	{
+		pcerror("%s: deflateInit failed (%d)", __func__, ret);
+		return PC_FAILURE;
+	}
+	if ( pcb->zdict )
+	{
+		ret = deflateSetDictionary(&strm, pcb->zdict->bytes, pcb->zdict->size);
+		if ( ret != Z_OK )
+		{
+			deflateEnd(&strm);
+			pcerror("%s: deflateSetDictionary failed (%d)", __func__, ret);
+			return PC_FAILURE;
+		}
+	}
+	/* Set up input and output buffers */
+	strm.avail_in = pcb->size;
+	strm.next_in = pcb->bytes;
 	strm.avail_out = bufsize;
 	strm.next_out = buf;
-	/* Compress */
 	ret = deflate(&strm, Z_FINISH);
-	assert(ret != Z_STREAM_ERROR);
-	have = strm.total_out;
-	pcbout.size = have;
-	pcbout.bytes = pcalloc(pcbout.size);
-	pcbout.compression = PC_DIM_ZLIB;
-	pcbout.readonly = PC_FALSE;
-	memcpy(pcbout.bytes, buf, have);
-	pcfree(buf);
+	*size = bufsize - strm.avail_out;
 	deflateEnd(&strm);
-	return pcbout;
+
+	if ( ret != Z_STREAM_END )
+	{
+		pcerror("%s: deflate failed (%d)", __func__, ret);
+		return PC_FAILURE;
+	}
+	return PC_SUCCESS;
 }
 
 /**
-* Returns uncompressed byte array from input with
+* Returns compressed byte array with
 * <size_t> size of compressed portion
 * <size_t> size of original data
 * <.....> compresssed bytes
 */
 PCBYTES
-pc_bytes_zlib_decode(const PCBYTES pcb)
+pc_bytes_zlib_encode(const PCBYTES pcb)
+{
+	return pc_bytes_encode(pcb, PC_DIM_ZLIB);
+}
+
+/**
+* Inflate the compressed bytes into buf, which must hold npoints
+* values. Streams compressed with a preset dictionary are primed
+* with the dictionary of the dimension.
+*/
+static int
+pc_bytes_zlib_decode_ptr(uint8_t *buf, const PCBYTES *pcb)
 {
 	z_stream strm;
 	int ret;
-	PCBYTES pcbout = pcb;
-
-	pcbout.size = pc_interpretation_size(pcb.interpretation) * pcb.npoints;
-
-	/* Set up output memory */
-	pcbout.bytes = pcalloc(pcbout.size);
-	pcbout.readonly = PC_FALSE;
 
 	/* Use our own allocators */
 	strm.zalloc = pc_zlib_alloc;
 	strm.zfree = pc_zlib_free;
 	strm.opaque = Z_NULL;
 	ret = inflateInit(&strm);
+	if ( ret != Z_OK )
+	{
+		pcerror("%s: inflateInit failed (%d)", __func__, ret);
+		return PC_FAILURE;
+	}
 	/* Set up input buffer */
-	strm.avail_in = pcb.size;
-	strm.next_in = pcb.bytes;
+	strm.avail_in = pcb->size;
+	strm.next_in = pcb->bytes;
 
-	strm.avail_out = pcbout.size;
-	strm.next_out = pcbout.bytes;
+	strm.avail_out = pc_interpretation_size(pcb->interpretation) * pcb->npoints;
+	strm.next_out = buf;
 	ret = inflate(&strm, Z_FINISH);
-	assert(ret != Z_STREAM_ERROR);
-	inflateEnd(&strm);
-
-	pcbout.compression = PC_DIM_NONE;
-	return pcbout;
+	if ( ret == Z_NEED_DICT )
+	{
+		/* strm.adler now holds the id of the dictionary asked for */
+		if ( ! pcb->zdict || pcb->zdict->id != strm.adler )
+		{
+			inflateEnd(&strm);
+			pcerror("%s: zlib dictionary %u is not available", __func__, (uint32_t)strm.adler);
+			return PC_FAILURE;
+		}
+		inflateSetDictionary(&strm, pcb->zdict->bytes, pcb->zdict->size);
+		ret = inflate(&strm, Z_FINISH);
+	}
+	assert(ret != Z_STREAM_ERROR);
+	inflateEnd(&strm);
+	return PC_SUCCESS;
+}
+
+/**
+* Whether a zlib stream was compressed with a preset dictionary,
+* read from the FDICT flag of its header, and the id of that
+* dictionary, which follows the header.
+*/
+int
+pc_bytes_zlib_dictid(const uint8_t *bytes, size_t size, uint32_t *dictid)
+{
+	if ( size < 6 || ! (bytes[1] & 0x20) )
+		return PC_FALSE;
+	*dictid = (uint32_t)bytes[2] << 24 | (uint32_t)bytes[3] << 16 | (uint32_t)bytes[4] << 8 | bytes[5];
+	return PC_TRUE;
+}
+
+/**
+* Returns uncompressed byte array from input with
+* <size_t> size of compressed portion
+* <size_t> size of original data
+* <.....> compresssed bytes
+*/
+PCBYTES
+pc_bytes_zlib_decode(const PCBYTES pcb)
+{
+	assert(pcb.compression == PC_DIM_ZLIB);
+	return pc_bytes_decode(pcb);
+}
+
+/**
+* Patched frame-of-reference (PFOR) encoding. Values are cut into
+* blocks, and each block stores its values as offsets from a block
+* reference, packed with the bit width that gives the smallest block.
+* Offsets that do not fit that width, on either side of the reference,
+* are kept whole in an exception list at the end of the block, so a
+* few outliers only cost their own size instead of widening every
+* value, as they do with sigbits.
+*
+* Values are turned into unsigned keys that sort like the values
+* (sign bit flipped for signed integers, and the usual bit twiddle
+* for floats) so every interpretation goes through the same code,
+* losslessly, and block minimum and maximum are real extremes.
+*
+* Encoded array, for each block:
+* <uint8> number of values in the block
+* <uint8> number of bits per packed offset
+* <uint8> number of exceptions
+* <word> minimum key of the block
+* <word> maximum key of the block
+* <word> reference key of the block
+* [n_bits]... offsets packed in, least significant bit first
+* (<uint8> position, <word> offset)... exceptions
+*/
+#define PC_PFOR_BLOCK 128
+
+/** Number of significant bits of v */
+static inline int
+pc_bytes_pfor_width(uint64_t v)
+{
+	int w = 0;
+	if ( v >> 32 ) { w += 32; v >>= 32; }
+	if ( v >> 16 ) { w += 16; v >>= 16; }
+	if ( v >> 8 ) { w += 8; v >>= 8; }
+	if ( v >> 4 ) { w += 4; v >>= 4; }
+	if ( v >> 2 ) { w += 2; v >>= 2; }
+	if ( v >> 1 ) { w += 1; v >>= 1; }
+	return w + (int)v;
+}
+
+static inline uint64_t
+pc_bytes_pfor_get_word(const uint8_t *ptr, size_t size)
+{
+	switch ( size )
+	{
+	case 1:
+		return *ptr;
+	case 2:
+	{
+		uint16_t v;
+		memcpy(&v, ptr, 2);
+		return v;
+	}
+	case 4:
+	{
+		uint32_t v;
+		memcpy(&v, ptr, 4);
+		return v;
+	}
+	default:
+	{
+		uint64_t v;
+		memcpy(&v, ptr, 8);
+		return v;
+	}
+	}
+}
+
+static inline void
+pc_bytes_pfor_put_word(uint8_t *ptr, uint64_t v, size_t size)
+{
+	switch ( size )
+	{
+	case 1:
+		*ptr = (uint8_t)v;
+		break;
+	case 2:
+	{
+		uint16_t w = (uint16_t)v;
+		memcpy(ptr, &w, 2);
+		break;
+	}
+	case 4:
+	{
+		uint32_t w = (uint32_t)v;
+		memcpy(ptr, &w, 4);
+		break;
+	}
+	default:
+		memcpy(ptr, &v, 8);
+	}
+}
+
+/** Keys wrap around at the word size */
+static inline uint64_t
+pc_bytes_pfor_wordmask(size_t size)
+{
+	return size < 8 ? ((uint64_t)1 << (8*size)) - 1 : ~(uint64_t)0;
+}
+
+/** Order preserving mapping of a raw value to an unsigned key */
+static inline uint64_t
+pc_bytes_pfor_key(uint64_t v, uint32_t interpretation, size_t size)
+{
+	uint64_t sign = (uint64_t)1 << (8*size - 1);
+	switch ( interpretation )
+	{
+	case PC_INT8: case PC_INT16: case PC_INT32: case PC_INT64:
+		return v ^ sign;
+	case PC_FLOAT: case PC_DOUBLE:
+		return ( v & sign ) ? ~v & (sign | (sign - 1)) : v | sign;
+	default:
+		return v;
+	}
+}
+
+/** Inverse of pc_bytes_pfor_key() */
+static inline uint64_t
+pc_bytes_pfor_unkey(uint64_t k, uint32_t interpretation, size_t size)
+{
+	uint64_t sign = (uint64_t)1 << (8*size - 1);
+	switch ( interpretation )
+	{
+	case PC_INT8: case PC_INT16: case PC_INT32: case PC_INT64:
+		return k ^ sign;
+	case PC_FLOAT: case PC_DOUBLE:
+		return ( k & sign ) ? k ^ sign : ~k & (sign | (sign - 1));
+	default:
+		return k;
+	}
+}
+
+/** Value of a key as a double, without scale and offset */
+static double
+pc_bytes_pfor_key_double(uint64_t k, uint32_t interpretation, size_t size)
+{
+	uint8_t buf[8];
+	pc_bytes_pfor_put_word(buf, pc_bytes_pfor_unkey(k, interpretation, size), size);
+	return pc_double_from_ptr(buf, interpretation);
+}
+
+/** Write the low nbits (at most 32) of v to the bit stream */
+static inline void
+pc_bytes_pfor_put_bits(uint8_t **ptr, uint64_t *acc, int *nacc, uint64_t v, int nbits)
+{
+	*acc |= v << *nacc;
+	*nacc += nbits;
+	while ( *nacc >= 8 )
+	{
+		*(*ptr)++ = (uint8_t)*acc;
+		*acc >>= 8;
+		*nacc -= 8;
+	}
+}
+
+/** Read nbits (at most 32) from the bit stream */
+static inline uint64_t
+pc_bytes_pfor_get_bits(const uint8_t **ptr, uint64_t *acc, int *nacc, int nbits)
+{
+	uint64_t v;
+	while ( *nacc < nbits )
+	{
+		*acc |= (uint64_t)(*(*ptr)++) << *nacc;
+		*nacc += 8;
+	}
+	v = *acc & (((uint64_t)1 << nbits) - 1);
+	*acc >>= nbits;
+	*nacc -= nbits;
+	return v;
+}
+
+/**
+* Unpack n offsets of nbits each into vals, returns the first
+* byte after the packed offsets. Offsets wider than 32 bits are
+* read in two goes so the bit buffer never overflows.
+*/
+static const uint8_t *
+pc_bytes_pfor_unpack(const uint8_t *ptr, uint64_t *vals, uint32_t n, int nbits)
+{
+	uint64_t acc = 0;
+	int nacc = 0;
+	uint32_t i;
+
+	if ( ! nbits )
+	{
+		memset(vals, 0, n * sizeof(uint64_t));
+		return ptr;
+	}
+
+	if ( nbits <= 32 )
+	{
+		for ( i = 0; i < n; i++ )
+			vals[i] = pc_bytes_pfor_get_bits(&ptr, &acc, &nacc, nbits);
+	}
+	else
+	{
+		for ( i = 0; i < n; i++ )
+		{
+			vals[i] = pc_bytes_pfor_get_bits(&ptr, &acc, &nacc, 32);
+			vals[i] |= pc_bytes_pfor_get_bits(&ptr, &acc, &nacc, nbits - 32) << 32;
+		}
+	}
+	return ptr;
+}
+
+/** Read the offset at position i of the packed offsets */
+static uint64_t
+pc_bytes_pfor_unpack_one(const uint8_t *ptr, uint32_t i, int nbits)
+{
+	uint64_t bitpos = (uint64_t)i * nbits;
+	uint64_t acc = 0, v;
+	int nacc = 0;
+
+	if ( ! nbits )
+		return 0;
+
+	ptr += bitpos / 8;
+	if ( bitpos % 8 )
+		pc_bytes_pfor_get_bits(&ptr, &acc, &nacc, bitpos % 8);
+	if ( nbits <= 32 )
+		return pc_bytes_pfor_get_bits(&ptr, &acc, &nacc, nbits);
+	v = pc_bytes_pfor_get_bits(&ptr, &acc, &nacc, 32);
+	return v | pc_bytes_pfor_get_bits(&ptr, &acc, &nacc, nbits - 32) << 32;
+}
+
+/** Size of a block with n values, nbits per offset and nexc exceptions */
+static inline size_t
+pc_bytes_pfor_block_size(size_t size, uint32_t n, int nbits, uint32_t nexc)
+{
+	return 3 + 3*size + ((size_t)n * nbits + 7) / 8 + nexc * (1 + size);
+}
+
+/**
+* Check the block at ptr before it is read, its header and
+* exceptions come from stored or wkb input: at most PC_PFOR_BLOCK
+* values of at most the word width, exceptions within the block,
+* and all of it before ptr_end. Returns the block size, or 0 once
+* what is wrong is reported.
+*/
+static size_t
+pc_bytes_pfor_block_check(const uint8_t *ptr, const uint8_t *ptr_end, size_t size)
+{
+	uint32_t j, n, nexc;
+	int nbits;
+	size_t blocksize;
+	const uint8_t *exc;
+
+	if ( ptr_end - ptr < 3 )
+	{
+		pcerror("%s: block header overruns the buffer", __func__);
+		return 0;
+	}
+
+	n = ptr[0];
+	nbits = ptr[1];
+	nexc = ptr[2];
+	if ( n > PC_PFOR_BLOCK || nbits > 8 * size )
+	{
+		pcerror("%s: invalid block of %u values of %d bits", __func__, n, nbits);
+		return 0;
+	}
+
+	blocksize = pc_bytes_pfor_block_size(size, n, nbits, nexc);
+	if ( blocksize > (size_t)(ptr_end - ptr) )
+	{
+		pcerror("%s: block overruns the buffer", __func__);
+		return 0;
+	}
+
+	exc = ptr + pc_bytes_pfor_block_size(size, n, nbits, 0);
+	for ( j = 0; j < nexc; j++, exc += 1 + size )
+	{
+		if ( *exc >= n )
+		{
+			pcerror("%s: exception at position %u of a block of %u values", __func__, *exc, n);
+			return 0;
+		}
+	}
+	return blocksize;
+}
+
+/**
+* Check every block of a PFOR column, so that the decoders can
+* trust them, and that they hold npoints values in all.
+*/
+int
+pc_bytes_pfor_is_valid(const uint8_t *bytes, size_t bytesize, uint32_t interpretation, uint32_t npoints)
+{
+	size_t size = pc_interpretation_size(interpretation);
+	const uint8_t *ptr = bytes;
+	const uint8_t *ptr_end = bytes + bytesize;
+	uint64_t nvals = 0;
+
+	while ( ptr < ptr_end )
+	{
+		size_t blocksize = pc_bytes_pfor_block_check(ptr, ptr_end, size);
+		if ( ! blocksize )
+			return PC_FALSE;
+		nvals += ptr[0];
+		ptr += blocksize;
+	}
+
+	if ( nvals != npoints )
+	{
+		pcerror("%s: blocks hold %llu values instead of %u", __func__, (unsigned long long)nvals, npoints);
+		return PC_FALSE;
+	}
+	return PC_TRUE;
+}
+
+static int
+pc_bytes_pfor_key_cmp(const void *a, const void *b)
+{
+	uint64_t ka = *((const uint64_t*)a);
+	uint64_t kb = *((const uint64_t*)b);
+	return ka < kb ? -1 : ka > kb;
+}
+
+/**
+* Pick the bit width and reference of a block of n keys: start from
+* the width of the full range, which needs no exceptions, and for
+* each narrower width slide a window of that width over the sorted
+* keys to find the reference that leaves the fewest exceptions.
+*/
+static int
+pc_bytes_pfor_plan(const uint64_t *keys, uint32_t n, size_t size, uint64_t *ref, uint32_t *nexc)
+{
+	uint64_t sorted[PC_PFOR_BLOCK];
+	uint32_t i, j, e;
+	size_t cost, best_cost;
+	int b, best_b;
+
+	memcpy(sorted, keys, n * sizeof(uint64_t));
+	qsort(sorted, n, sizeof(uint64_t), pc_bytes_pfor_key_cmp);
+
+	best_b = pc_bytes_pfor_width(sorted[n-1] - sorted[0]);
+	best_cost = pc_bytes_pfor_block_size(size, n, best_b, 0);
+	*ref = sorted[0];
+	*nexc = 0;
+
+	for ( b = best_b - 1; b >= 0; b-- )
+	{
+		uint64_t mask = ((uint64_t)1 << b) - 1;
+		uint32_t best_i = 0, best_count = 0;
+
+		/* Widest run of keys within mask of each other */
+		for ( i = 0, j = 0; j < n; j++ )
+		{
+			while ( sorted[j] - sorted[i] > mask )
+				i++;
+			if ( j - i + 1 > best_count )
+			{
+				best_count = j - i + 1;
+				best_i = i;
+			}
+		}
+
+		e = n - best_count;
+		/* Narrower widths only leave more exceptions */
+		if ( pc_bytes_pfor_block_size(size, n, 0, e) >= best_cost )
+			break;
+
+		cost = pc_bytes_pfor_block_size(size, n, b, e);
+		if ( cost < best_cost )
+		{
+			best_cost = cost;
+			best_b = b;
+			*ref = sorted[best_i];
+			*nexc = e;
+		}
+	}
+	return best_b;
+}
+
+/** Read up to a block of values from pcb, starting at value i, as keys */
+static uint32_t
+pc_bytes_pfor_load(const PCBYTES *pcb, uint32_t i, uint64_t *keys)
+{
+	size_t size = pc_interpretation_size(pcb->interpretation);
+	uint32_t j, n = pcb->npoints - i;
+	const uint8_t *ptr = pcb->bytes + i * size;
+
+	if ( n > PC_PFOR_BLOCK )
+		n = PC_PFOR_BLOCK;
+	for ( j = 0; j < n; j++, ptr += size )
+		keys[j] = pc_bytes_pfor_key(pc_bytes_pfor_get_word(ptr, size), pcb->interpretation, size);
+	return n;
+}
+
+/**
+* Upper bound of the PFOR encoding of npoints words of size bytes,
+* every block packed at full width.
+*/
+static size_t
+pc_bytes_pfor_encoded_size_bound(size_t size, uint32_t npoints)
+{
+	uint32_t nblocks = (npoints + PC_PFOR_BLOCK - 1) / PC_PFOR_BLOCK;
+	return nblocks * (3 + 3*size) + (size_t)npoints * size;
+}
+
+/**
+* Size the uncompressed bytes would have once PFOR encoded,
+* without encoding them.
+*/
+size_t
+pc_bytes_pfor_encoded_size(const PCBYTES *pcb)
+{
+	size_t size = pc_interpretation_size(pcb->interpretation);
+	size_t size_out = 0;
+	uint64_t keys[PC_PFOR_BLOCK];
+	uint64_t ref;
+	uint32_t i, n, nexc;
+	int nbits;
+
+	assert(pcb->compression == PC_DIM_NONE);
+	for ( i = 0; i < pcb->npoints; i += n )
+	{
+		n = pc_bytes_pfor_load(pcb, i, keys);
+		nbits = pc_bytes_pfor_plan(keys, n, size, &ref, &nexc);
+		size_out += pc_bytes_pfor_block_size(size, n, nbits, nexc);
+	}
+	return size_out;
+}
+
+/**
+* PFOR encode the uncompressed bytes into buf, which must hold
+* pc_bytes_pfor_encoded_size_bound() bytes. Returns the encoded size.
+*/
+static size_t
+pc_bytes_pfor_encode_ptr(uint8_t *buf, const PCBYTES *pcb)
+{
+	size_t size = pc_interpretation_size(pcb->interpretation);
+	uint64_t keys[PC_PFOR_BLOCK];
+	uint64_t wordmask = pc_bytes_pfor_wordmask(size);
+	uint8_t *ptr = buf;
+	uint32_t i, j, n, nexc;
+
+	for ( i = 0; i < pcb->npoints; i += n )
+	{
+		uint64_t ref, mask, min, max, acc = 0;
+		int nbits, nacc = 0;
+
+		n = pc_bytes_pfor_load(pcb, i, keys);
+		nbits = pc_bytes_pfor_plan(keys, n, size, &ref, &nexc);
+		mask = nbits < 64 ? ((uint64_t)1 << nbits) - 1 : ~(uint64_t)0;
+		min = max = keys[0];
+		for ( j = 1; j < n; j++ )
+		{
+			if ( keys[j] < min ) min = keys[j];
+			if ( keys[j] > max ) max = keys[j];
+		}
+
+		/* Block header */
+		ptr[0] = n;
+		ptr[1] = nbits;
+		ptr[2] = nexc;
+		ptr += 3;
+		pc_bytes_pfor_put_word(ptr, min, size);
+		ptr += size;
+		pc_bytes_pfor_put_word(ptr, max, size);
+		ptr += size;
+		pc_bytes_pfor_put_word(ptr, ref, size);
+		ptr += size;
+
+		/* Offsets, exceptions get a zero slot */
+		for ( j = 0; nbits && j < n; j++ )
+		{
+			uint64_t d = (keys[j] - ref) & wordmask;
+			if ( d & ~mask )
+				d = 0;
+			if ( nbits <= 32 )
+			{
+				pc_bytes_pfor_put_bits(&ptr, &acc, &nacc, d, nbits);
+			}
+			else
+			{
+				pc_bytes_pfor_put_bits(&ptr, &acc, &nacc, d & 0xFFFFFFFF, 32);
+				pc_bytes_pfor_put_bits(&ptr, &acc, &nacc, d >> 32, nbits - 32);
+			}
+		}
+		if ( nacc )
+			*ptr++ = (uint8_t)acc;
+
+		/* Exceptions */
+		for ( j = 0; nexc && j < n; j++ )
+		{
+			uint64_t d = (keys[j] - ref) & wordmask;
+			if ( d & ~mask )
+			{
+				*ptr = j;
+				pc_bytes_pfor_put_word(ptr + 1, d, size);
+				ptr += 1 + size;
+			}
+		}
+	}
+	return ptr - buf;
+}
+
+PCBYTES
+pc_bytes_pfor_encode(const PCBYTES pcb)
+{
+	return pc_bytes_encode(pcb, PC_DIM_PFOR);
+}
+
+/**
+* PFOR decode the blocks into buf, which must hold npoints values.
+*/
+static int
+pc_bytes_pfor_decode_ptr(uint8_t *buf, const PCBYTES *pcb)
+{
+	size_t size = pc_interpretation_size(pcb->interpretation);
+	uint64_t vals[PC_PFOR_BLOCK];
+	const uint8_t *ptr = pcb->bytes;
+	const uint8_t *ptr_end = pcb->bytes + pcb->size;
+	uint64_t wordmask = pc_bytes_pfor_wordmask(size);
+	uint8_t *out = buf;
+	uint8_t *out_end = buf + size * pcb->npoints;
+	uint32_t j, n, nexc;
+
+	while ( ptr < ptr_end )
+	{
+		uint64_t ref;
+		int nbits;
+
+		if ( ! pc_bytes_pfor_block_check(ptr, ptr_end, size) )
+			return PC_FAILURE;
+
+		n = ptr[0];
+		nbits = ptr[1];
+		nexc = ptr[2];
+		ptr += 3;
+		if ( out + n * size > out_end )
+		{
+			pcerror("%s: more values than the %u points", __func__, pcb->npoints);
+			return PC_FAILURE;
+		}
+		ref = pc_bytes_pfor_get_word(ptr + 2*size, size);
+		ptr += 3*size;
+
+		ptr = pc_bytes_pfor_unpack(ptr, vals, n, nbits);
+		for ( j = 0; j < nexc; j++, ptr += 1 + size )
+			vals[*ptr] = pc_bytes_pfor_get_word(ptr + 1, size);
+
+		for ( j = 0; j < n; j++, out += size )
+			pc_bytes_pfor_put_word(out, pc_bytes_pfor_unkey((ref + vals[j]) & wordmask, pcb->interpretation, size), size);
+	}
+	return PC_SUCCESS;
+}
+
+PCBYTES
+pc_bytes_pfor_decode(const PCBYTES pcb)
+{
+	assert(pcb.compression == PC_DIM_PFOR);
+	return pc_bytes_decode(pcb);
+}
+
+/**
+* Only the block minima, maxima and references and the exception
+* offsets are multi-byte words, the packed offsets are a byte stream.
+*/
+static PCBYTES
+pc_bytes_pfor_flip_endian(PCBYTES pcb)
+{
+	size_t size = pc_interpretation_size(pcb.interpretation);
+	uint8_t *ptr = pcb.bytes;
+	uint8_t *ptr_end = pcb.bytes + pcb.size;
+
+	if ( size < 2 )
+		return pcb;
+
+	while ( ptr < ptr_end )
+	{
+		uint32_t n, nexc;
+		int nbits;
+
+		if ( ! pc_bytes_pfor_block_check(ptr, ptr_end, size) )
+			return pcb;
+
+		n = ptr[0];
+		nbits = ptr[1];
+		nexc = ptr[2];
+		ptr += 3;
+		pc_flip_endian_strided(ptr, size, size, 3);
+		ptr += 3*size + ((size_t)n * nbits + 7) / 8;
+		pc_flip_endian_strided(ptr + 1, size, 1 + size, nexc);
+		ptr += nexc * (1 + size);
+	}
+	return pcb;
+}
+
+void
+pc_bytes_pfor_to_ptr(uint8_t *buf, const PCBYTES *pcb, int n)
+{
+	size_t size = pc_interpretation_size(pcb->interpretation);
+	uint64_t wordmask = pc_bytes_pfor_wordmask(size);
+	const uint8_t *ptr = pcb->bytes;
+	const uint8_t *ptr_end = pcb->bytes + pcb->size;
+
+	/* Hop from block header to block header */
+	while ( ptr < ptr_end )
+	{
+		uint32_t j, count, nexc;
+		int nbits;
+		const uint8_t *exc;
+
+		if ( ! pc_bytes_pfor_block_check(ptr, ptr_end, size) )
+			return;
+
+		count = ptr[0];
+		nbits = ptr[1];
+		nexc = ptr[2];
+		exc = ptr + pc_bytes_pfor_block_size(size, count, nbits, 0);
+
+		if ( n < count )
+		{
+			uint64_t ref = pc_bytes_pfor_get_word(ptr + 3 + 2*size, size);
+			uint64_t d = pc_bytes_pfor_unpack_one(ptr + 3 + 3*size, n, nbits);
+			for ( j = 0; j < nexc; j++, exc += 1 + size )
+			{
+				if ( *exc == n )
+				{
+					d = pc_bytes_pfor_get_word(exc + 1, size);
+					break;
+				}
+			}
+			pc_bytes_pfor_put_word(buf, pc_bytes_pfor_unkey((ref + d) & wordmask, pcb->interpretation, size), size);
+			return;
+		}
+		n -= count;
+		ptr = exc + nexc * (1 + size);
+	}
+	pcerror("%s: out of bound", __func__);
 }
 
 /**
@@ -1315,13 +1966,20 @@ pc_bytes_flip_endian(PCBYTES pcb)
 	switch(pcb.compression)
 	{
 	case PC_DIM_NONE:
+	{
+		/* npoints may not be set yet, see pc_bytes_deserialize */
+		size_t size = pc_interpretation_size(pcb.interpretation);
+		pc_flip_endian_strided(pcb.bytes, size, size, pcb.size / size);
 		return pcb;
+	}
 	case PC_DIM_SIGBITS:
 		return pc_bytes_sigbits_flip_endian(pcb);
 	case PC_DIM_ZLIB:
 		return pcb;
 	case PC_DIM_RLE:
 		return pc_bytes_run_length_flip_endian(pcb);
+	case PC_DIM_PFOR:
+		return pc_bytes_pfor_flip_endian(pcb);
 	default:
 		pcerror("%s: unknown compression", __func__);
 	}
@@ -1356,12 +2014,182 @@ pc_bytes_serialize(const PCBYTES *pcb, uint8_t *buf, size_t *size)
 	return PC_SUCCESS;
 }
 
+/**
+* Upper bound of the encoding of the uncompressed values with
+* compression, for sizing buffers.
+*/
+size_t
+pc_bytes_encoded_size_bound(const PCBYTES *pcb, int compression)
+{
+	size_t size = pc_interpretation_size(pcb->interpretation);
+	size_t rawsize = size * pcb->npoints;
+
+	switch ( compression )
+	{
+	case PC_DIM_NONE:
+		return rawsize;
+	case PC_DIM_RLE:
+		/* Worst case: one run per element */
+		return rawsize + pcb->npoints;
+	case PC_DIM_SIGBITS:
+		/* Worst case: no bits in common */
+		return pc_bytes_sigbits_encoded_size(size, 0, pcb->npoints);
+	case PC_DIM_ZLIB:
+		/* As deflateBound() for the default settings, plus a dictionary id */
+		return compressBound(rawsize) + 4;
+	case PC_DIM_PFOR:
+		return pc_bytes_pfor_encoded_size_bound(size, pcb->npoints);
+	default:
+		pcerror("%s: unknown compression %d", __func__, compression);
+	}
+	return 0;
+}
+
+/**
+* Upper bound of pc_bytes_serialized_size() once the bytes are
+* encoded with compression, for sizing a sink.
+*/
+size_t
+pc_bytes_serialized_size_bound(const PCBYTES *pcb, int compression)
+{
+	if ( pcb->compression == compression )
+		return 1 + 4 + pcb->size;
+	return 1 + 4 + pc_bytes_encoded_size_bound(pcb, compression);
+}
+
+int
+pc_bytes_encode_into(const PCBYTES *pcb, int compression, uint8_t *buf, size_t bufsize, size_t *size)
+{
+	size_t bound;
+
+	if ( pcb->compression != PC_DIM_NONE )
+	{
+		pcerror("%s: cannot encode compressed bytes", __func__);
+		return PC_FAILURE;
+	}
+
+	bound = pc_bytes_encoded_size_bound(pcb, compression);
+	if ( bufsize < bound )
+	{
+		pcerror("%s: buffer of %zu bytes is smaller than the %zu bytes the encoding may take", __func__, bufsize, bound);
+		return PC_FAILURE;
+	}
+
+	switch ( compression )
+	{
+	case PC_DIM_NONE:
+		memcpy(buf, pcb->bytes, bound);
+		*size = bound;
+		return PC_SUCCESS;
+	case PC_DIM_RLE:
+		*size = pc_bytes_run_length_encode_ptr(buf, pcb);
+		return PC_SUCCESS;
+	case PC_DIM_SIGBITS:
+		*size = pc_bytes_sigbits_encode_ptr(buf, pcb);
+		return PC_SUCCESS;
+	case PC_DIM_ZLIB:
+		return pc_bytes_zlib_encode_ptr(buf, bufsize, pcb, size);
+	case PC_DIM_PFOR:
+		*size = pc_bytes_pfor_encode_ptr(buf, pcb);
+		return PC_SUCCESS;
+	default:
+		pcerror("%s: unknown compression %d", __func__, compression);
+	}
+	return PC_FAILURE;
+}
+
+int
+pc_bytes_decode_into(const PCBYTES *epcb, uint8_t *buf, size_t bufsize)
+{
+	size_t size = pc_interpretation_size(epcb->interpretation) * epcb->npoints;
+
+	if ( bufsize < size )
+	{
+		pcerror("%s: buffer of %zu bytes cannot hold the %zu bytes of %u values", __func__, bufsize, size, epcb->npoints);
+		return PC_FAILURE;
+	}
+
+	switch ( epcb->compression )
+	{
+	case PC_DIM_NONE:
+		memcpy(buf, epcb->bytes, size);
+		return PC_SUCCESS;
+	case PC_DIM_RLE:
+		return pc_bytes_run_length_decode_ptr(buf, epcb);
+	case PC_DIM_SIGBITS:
+		return pc_bytes_sigbits_decode_ptr(buf, epcb);
+	case PC_DIM_ZLIB:
+		return pc_bytes_zlib_decode_ptr(buf, epcb);
+	case PC_DIM_PFOR:
+		return pc_bytes_pfor_decode_ptr(buf, epcb);
+	default:
+		pcerror("%s: unknown compression %d", __func__, epcb->compression);
+	}
+	return PC_FAILURE;
+}
+
+/**
+* Same layout as pc_bytes_serialize(), but the encoder writes
+* straight into the sink instead of into a buffer of its own
+* that then gets copied. Bytes already in the requested
+* compression are copied as they are.
+*/
+int
+pc_bytes_serialize_to_sink(const PCBYTES *pcb, int compression, PCSINK *sink)
+{
+	size_t start = sink->size;
+	size_t bound, size;
+	int32_t pcbsize;
+	uint8_t *buf;
+
+	/* Other encodings have to go through the raw values */
+	if ( pcb->compression != compression && pcb->compression != PC_DIM_NONE )
+	{
+		PCBYTES pcbraw;
+		PCSINK scratch;
+		int ret;
+
+		pc_sink_init(&scratch, 0);
+		ret = pc_bytes_decode_scratch(pcb, &scratch, &pcbraw);
+		if ( PC_SUCCESS == ret )
+			ret = pc_bytes_serialize_to_sink(&pcbraw, compression, sink);
+		if ( scratch.bytes )
+			pcfree(scratch.bytes);
+		return ret;
+	}
+
+	bound = pc_bytes_serialized_size_bound(pcb, compression) - 1 - 4;
+	buf = pc_sink_reserve(sink, 1 + 4 + bound);
+	/* Compression type number, the size is filled in at the end */
+	*buf = compression;
+	buf += 1 + 4;
+
+	if ( pcb->compression == compression )
+	{
+		memcpy(buf, pcb->bytes, pcb->size);
+		size = pcb->size;
+	}
+	else if ( PC_FAILURE == pc_bytes_encode_into(pcb, compression, buf, bound, &size) )
+	{
+		return PC_FAILURE;
+	}
+
+	/* Buffer size */
+	pcbsize = size;
+	memcpy(sink->bytes + start + 1, &pcbsize, 4);
+	sink->size += 1 + 4 + size;
+	return PC_SUCCESS;
+}
+
 int
 pc_bytes_deserialize(const uint8_t *buf, const PCDIMENSION *dim, PCBYTES *pcb, int readonly, int flip_endian)
 {
 	pcb->compression = buf[0];
 	pcb->size = wkb_get_int32(buf+1, flip_endian);
 	pcb->readonly = readonly;
+	/* Needed by pc_bytes_flip_endian */
+	pcb->interpretation = dim->interpretation;
+	pcb->zdict = dim->zdict;
 	if ( readonly && flip_endian )
 		pcerror("pc_bytes_deserialize: cannot create a read-only buffer on byteswapped input");
 	if ( readonly )
@@ -1377,7 +2205,6 @@ pc_bytes_deserialize(const uint8_t *buf, const PCDIMENSION *dim, PCBYTES *pcb, i
 			*pcb = pc_bytes_flip_endian(*pcb);
 		}
 	}
-	pcb->interpretation = dim->interpretation;
 	/* WARNING, still need to set externally */
 	/*   pcb.npoints */
 	return PC_SUCCESS;
@@ -1404,7 +2231,8 @@ pc_bytes_uncompressed_minmax(const PCBYTES *pcb, double *min, double *max, doubl
 	}
 	*min = mn;
 	*max = mx;
-	*avg = sm / pcb->npoints;
+	if ( avg )
+		*avg = sm / pcb->npoints;
 	return PC_SUCCESS;
 }
 
@@ -1444,48 +2272,100 @@ pc_bytes_run_length_minmax(const PCBYTES *pcb, double *min, double *max, double
 
 	*min = mn;
 	*max = mx;
-	*avg = sm / pcb->npoints;
+	if ( avg )
+		*avg = sm / pcb->npoints;
 	return PC_SUCCESS;
 }
 
 
 static int
-pc_bytes_zlib_minmax(const PCBYTES *pcb, double *min, double *max, double *avg)
+pc_bytes_decoded_minmax(const PCBYTES *pcb, double *min, double *max, double *avg, PCSINK *scratch)
 {
-	PCBYTES zcb = pc_bytes_zlib_decode(*pcb);
-	int rv = pc_bytes_uncompressed_minmax(&zcb, min, max, avg);
-	pc_bytes_free(zcb);
-	return rv;
+	PCBYTES zcb;
+	if ( PC_FAILURE == pc_bytes_decode_scratch(pcb, scratch, &zcb) )
+		return PC_FAILURE;
+	return pc_bytes_uncompressed_minmax(&zcb, min, max, avg);
 }
 
+/**
+* Minimum and maximum come straight from the block headers, only
+* the average needs the values to be decoded.
+*/
 static int
-pc_bytes_sigbits_minmax(const PCBYTES *pcb, double *min, double *max, double *avg)
+pc_bytes_pfor_minmax(const PCBYTES *pcb, double *min, double *max, double *avg, PCSINK *scratch)
 {
-	PCBYTES zcb = pc_bytes_sigbits_decode(*pcb);
-	int rv = pc_bytes_uncompressed_minmax(&zcb, min, max, avg);
-	pc_bytes_free(zcb);
-	return rv;
+	size_t size = pc_interpretation_size(pcb->interpretation);
+	const uint8_t *ptr = pcb->bytes;
+	const uint8_t *ptr_end = pcb->bytes + pcb->size;
+	uint64_t mn = ~(uint64_t)0, mx = 0;
+
+	if ( avg )
+		return pc_bytes_decoded_minmax(pcb, min, max, avg, scratch);
+
+	if ( ptr == ptr_end )
+	{
+		*min = FLT_MAX;
+		*max = -1*FLT_MAX;
+		return PC_SUCCESS;
+	}
+
+	while ( ptr < ptr_end )
+	{
+		uint64_t bmin, bmax;
+		size_t blocksize = pc_bytes_pfor_block_check(ptr, ptr_end, size);
+		if ( ! blocksize )
+			return PC_FAILURE;
+
+		bmin = pc_bytes_pfor_get_word(ptr + 3, size);
+		bmax = pc_bytes_pfor_get_word(ptr + 3 + size, size);
+		if ( bmin < mn ) mn = bmin;
+		if ( bmax > mx ) mx = bmax;
+		ptr += blocksize;
+	}
+
+	*min = pc_bytes_pfor_key_double(mn, pcb->interpretation, size);
+	*max = pc_bytes_pfor_key_double(mx, pcb->interpretation, size);
+	return PC_SUCCESS;
 }
 
+/**
+* Average is optional, pass NULL when only the extremes are
+* needed, some encodings can then skip decoding the values.
+* Values that have to be decoded go through the scratch buffer.
+*/
 int
-pc_bytes_minmax(const PCBYTES *pcb, double *min, double *max, double *avg)
+pc_bytes_minmax_scratch(const PCBYTES *pcb, double *min, double *max, double *avg, PCSINK *scratch)
 {
 	switch(pcb->compression)
 	{
 	case PC_DIM_NONE:
 		return pc_bytes_uncompressed_minmax(pcb, min, max, avg);
 	case PC_DIM_SIGBITS:
-		return pc_bytes_sigbits_minmax(pcb, min, max, avg);
 	case PC_DIM_ZLIB:
-		return pc_bytes_zlib_minmax(pcb, min, max, avg);
+		return pc_bytes_decoded_minmax(pcb, min, max, avg, scratch);
 	case PC_DIM_RLE:
 		return pc_bytes_run_length_minmax(pcb, min, max, avg);
+	case PC_DIM_PFOR:
+		return pc_bytes_pfor_minmax(pcb, min, max, avg, scratch);
 	default:
 		pcerror("%s: unknown compression", __func__);
 	}
 	return PC_FAILURE;
 }
 
+int
+pc_bytes_minmax(const PCBYTES *pcb, double *min, double *max, double *avg)
+{
+	PCSINK scratch;
+	int rv;
+
+	pc_sink_init(&scratch, 0);
+	rv = pc_bytes_minmax_scratch(pcb, min, max, avg, &scratch);
+	if ( scratch.bytes )
+		pcfree(scratch.bytes);
+	return rv;
+}
+
 /* NOTE: stats are gathered without applying scale and offset */
 static PCBYTES
 pc_bytes_uncompressed_filter(const PCBYTES *pcb, const PCBITMAP *map, PCDOUBLESTAT *stats)
@@ -1574,7 +2454,7 @@ pc_bytes_run_length_filter(const PCBYTES *pcb, const PCBITMAP *map, PCDOUBLESTAT
 				d = pc_double_from_ptr(ptr+1, pcb->interpretation);
 				if ( d < stats->min ) stats->min = d;
 				if ( d > stats->max ) stats->max = d;
-				stats->sum += d;
+				stats->sum += d * fcount;
 			}
 		}
 
@@ -1588,6 +2468,32 @@ pc_bytes_run_length_filter(const PCBYTES *pcb, const PCBITMAP *map, PCDOUBLESTAT
 	return fpcb;
 }
 
+/**
+* Filter encoded bytes through their raw values, decoded into the
+* scratch sink, and encode the kept values back.
+* NOTE: stats are gathered without applying scale and offset
+*/
+PCBYTES
+pc_bytes_filter_scratch(const PCBYTES *pcb, const PCBITMAP *map, PCDOUBLESTAT *stats, PCSINK *scratch)
+{
+	PCBYTES dpcb, fpcb, efpcb;
+
+	if ( pcb->compression == PC_DIM_NONE || pcb->compression == PC_DIM_RLE )
+		return pc_bytes_filter(pcb, map, stats);
+
+	if ( PC_FAILURE == pc_bytes_decode_scratch(pcb, scratch, &dpcb) )
+	{
+		efpcb = *pcb;
+		efpcb.bytes = NULL;
+		efpcb.size = 0;
+		return efpcb;
+	}
+	fpcb = pc_bytes_uncompressed_filter(&dpcb, map, stats);
+	efpcb = pc_bytes_encode(fpcb, pcb->compression);
+	pc_bytes_free(fpcb);
+	return efpcb;
+}
+
 /* NOTE: stats are gathered without applying scale and offset */
 PCBYTES
 pc_bytes_filter(const PCBYTES *pcb, const PCBITMAP *map, PCDOUBLESTAT *stats)
@@ -1602,12 +2508,14 @@ pc_bytes_filter(const PCBYTES *pcb, const PCBITMAP *map, PCDOUBLESTAT *stats)
 
 	case PC_DIM_SIGBITS:
 	case PC_DIM_ZLIB:
-	{
-		PCBYTES dpcb = pc_bytes_decode(*pcb);
-		PCBYTES fpcb = pc_bytes_uncompressed_filter(&dpcb, map, stats);
-		PCBYTES efpcb = pc_bytes_encode(fpcb, pcb->compression);
-		pc_bytes_free(fpcb);
-		pc_bytes_free(dpcb);
+	case PC_DIM_PFOR:
+	{
+		PCSINK scratch;
+		PCBYTES efpcb;
+		pc_sink_init(&scratch, 0);
+		efpcb = pc_bytes_filter_scratch(pcb, map, stats, &scratch);
+		if ( scratch.bytes )
+			pcfree(scratch.bytes);
 		return efpcb;
 	}
 
@@ -1617,6 +2525,214 @@ pc_bytes_filter(const PCBYTES *pcb, const PCBITMAP *map, PCDOUBLESTAT *stats)
 	return *pcb;
 }
 
+/**
+* Concatenate the uncompressed bytes of add after those of pcb,
+* as new uncompressed bytes.
+*/
+static PCBYTES
+pc_bytes_uncompressed_append(const PCBYTES *pcb, const PCBYTES *add)
+{
+	PCBYTES pcbout = *pcb;
+	pcbout.size = pcb->size + add->size;
+	pcbout.bytes = pcalloc(pcbout.size);
+	memcpy(pcbout.bytes, pcb->bytes, pcb->size);
+	memcpy(pcbout.bytes + pcb->size, add->bytes, add->size);
+	pcbout.npoints = pcb->npoints + add->npoints;
+	pcbout.compression = PC_DIM_NONE;
+	pcbout.readonly = PC_FALSE;
+	return pcbout;
+}
+
+/**
+* Run-length encode the new values after the existing runs,
+* joining the last run with the first new one when they hold
+* the same value.
+*/
+static PCBYTES
+pc_bytes_run_length_append(const PCBYTES *pcb, const PCBYTES *add)
+{
+	size_t size = pc_interpretation_size(pcb->interpretation);
+	size_t addsize;
+	uint8_t *last = NULL, *first, *ptr;
+	PCBYTES pcbout = *pcb;
+
+	/* Worst case, one new run per new value */
+	pcbout.bytes = pcalloc(pcb->size + add->npoints * (1 + size));
+	memcpy(pcbout.bytes, pcb->bytes, pcb->size);
+	for ( ptr = pcbout.bytes; ptr < pcbout.bytes + pcb->size; ptr += 1 + size )
+		last = ptr;
+
+	first = pcbout.bytes + pcb->size;
+	addsize = pc_bytes_run_length_encode_ptr(first, add);
+
+	if ( last && addsize && memcmp(last+1, first+1, size) == 0 && *last + *first <= 255 )
+	{
+		*last += *first;
+		addsize -= 1 + size;
+		memmove(first, first + 1 + size, addsize);
+	}
+
+	pcbout.size = pcb->size + addsize;
+	pcbout.bytes = pcrealloc(pcbout.bytes, pcbout.size);
+	pcbout.npoints = pcb->npoints + add->npoints;
+	pcbout.readonly = PC_FALSE;
+	return pcbout;
+}
+
+/**
+* Pack the new values after the existing ones, if they all
+* share the common bits of the encoding. Returns PC_FAILURE
+* and leaves pcbout alone otherwise.
+*/
+#define PC_BYTES_SIGBITS_APPEND(N) \
+static int \
+pc_bytes_sigbits_append_##N(const PCBYTES *pcb, const PCBYTES *add, PCBYTES *pcbout) \
+{ \
+	int i, shift, bit; \
+	uint##N##_t nbits, commonvalue, mask; \
+	uint##N##_t *bytes = (uint##N##_t*)(add->bytes); \
+	uint##N##_t *byte_ptr; \
+	uint64_t nbitsin; \
+	size_t size_out; \
+	uint8_t *bytes_out; \
+	\
+	memcpy(&nbits, pcb->bytes, N/8); \
+	memcpy(&commonvalue, pcb->bytes + N/8, N/8); \
+	mask = nbits ? ((uint##N##_t)~0) >> (N - nbits) : 0; \
+	\
+	for ( i = 0; i < add->npoints; i++ ) \
+	{ \
+		if ( (bytes[i] & ~mask) != commonvalue ) \
+			return PC_FAILURE; \
+	} \
+	\
+	size_out = pc_bytes_sigbits_encoded_size(N/8, N - nbits, pcb->npoints + add->npoints); \
+	bytes_out = pcalloc(size_out); \
+	memcpy(bytes_out, pcb->bytes, pcb->size); \
+	\
+	/* Resume writing right after the last existing value */ \
+	nbitsin = (uint64_t)nbits * pcb->npoints; \
+	byte_ptr = (uint##N##_t*)bytes_out + 2 + nbitsin / N; \
+	bit = N - nbitsin % N; \
+	\
+	for ( i = 0; nbits && i < add->npoints; i++ ) \
+	{ \
+		uint##N##_t val = bytes[i] & mask; \
+		shift = bit - nbits; \
+		if ( shift >= 0 ) \
+		{ \
+			val <<= shift; \
+			*byte_ptr |= val; \
+			bit -= nbits; \
+			if ( bit <= 0 ) \
+			{ \
+				bit = N; \
+				byte_ptr++; \
+			} \
+		} \
+		else \
+		{ \
+			int s = abs(shift); \
+			*byte_ptr |= (uint##N##_t)(val >> s); \
+			bit = N; \
+			byte_ptr++; \
+			*byte_ptr |= (uint##N##_t)(val << (bit - s)); \
+			bit -= s; \
+		} \
+	} \
+	\
+	*pcbout = *pcb; \
+	pcbout->bytes = bytes_out; \
+	pcbout->size = size_out; \
+	pcbout->npoints = pcb->npoints + add->npoints; \
+	pcbout->readonly = PC_FALSE; \
+	return PC_SUCCESS; \
+}
+
+PC_BYTES_SIGBITS_APPEND(8)
+PC_BYTES_SIGBITS_APPEND(16)
+PC_BYTES_SIGBITS_APPEND(32)
+PC_BYTES_SIGBITS_APPEND(64)
+
+static int
+pc_bytes_sigbits_append(const PCBYTES *pcb, const PCBYTES *add, PCBYTES *pcbout)
+{
+	switch ( pc_interpretation_size(pcb->interpretation) )
+	{
+	case 1:
+		return pc_bytes_sigbits_append_8(pcb, add, pcbout);
+	case 2:
+		return pc_bytes_sigbits_append_16(pcb, add, pcbout);
+	case 4:
+		return pc_bytes_sigbits_append_32(pcb, add, pcbout);
+	case 8:
+		return pc_bytes_sigbits_append_64(pcb, add, pcbout);
+	}
+	return PC_FAILURE;
+}
+
+/**
+* Append the uncompressed values of add to pcb, keeping the
+* compression of pcb. Run-length and sigbits encodings are
+* extended in place of the existing data, which is not decoded,
+* unless the new values do not share the common bits. Deflated
+* data has to go through a full decode and encode.
+*/
+PCBYTES
+pc_bytes_append(const PCBYTES *pcb, const PCBYTES *add)
+{
+	PCBYTES pcbout;
+
+	assert(add->compression == PC_DIM_NONE);
+	assert(add->interpretation == pcb->interpretation);
+
+	if ( ! add->npoints )
+		return pc_bytes_clone(*pcb);
+
+	switch ( pcb->compression )
+	{
+	case PC_DIM_NONE:
+		return pc_bytes_uncompressed_append(pcb, add);
+
+	case PC_DIM_RLE:
+		return pc_bytes_run_length_append(pcb, add);
+
+	case PC_DIM_SIGBITS:
+		if ( PC_SUCCESS == pc_bytes_sigbits_append(pcb, add, &pcbout) )
+			return pcbout;
+		/* The new values do not share the common bits, re-encode them all */
+		/* fall through */
+	case PC_DIM_ZLIB:
+	case PC_DIM_PFOR:
+	{
+		/* Decode straight in front of the new values */
+		PCBYTES apcb = *pcb;
+		size_t size = pc_interpretation_size(pcb->interpretation) * pcb->npoints;
+		apcb.compression = PC_DIM_NONE;
+		apcb.npoints = pcb->npoints + add->npoints;
+		apcb.size = size + add->size;
+		apcb.bytes = pcalloc(apcb.size);
+		apcb.readonly = PC_FALSE;
+		if ( PC_FAILURE == pc_bytes_decode_into(pcb, apcb.bytes, size) )
+		{
+			pcfree(apcb.bytes);
+			pcbout = *pcb;
+			pcbout.bytes = NULL;
+			pcbout.size = 0;
+			return pcbout;
+		}
+		memcpy(apcb.bytes + size, add->bytes, add->size);
+		pcbout = pc_bytes_encode(apcb, pcb->compression);
+		pc_bytes_free(apcb);
+		return pcbout;
+	}
+
+	default:
+		pcerror("%s: unknown compression", __func__);
+	}
+	return *pcb;
+}
+
 
 
 static PCBITMAP *
@@ -1673,6 +2789,81 @@ pc_bytes_uncompressed_bitmap(const PCBYTES *pcb, PC_FILTERTYPE filter, double va
 	return map;
 }
 
+/**
+* Blocks whose minimum and maximum rule out a match are skipped
+* without unpacking them, their points are left unset.
+*/
+static PCBITMAP *
+pc_bytes_pfor_bitmap(const PCBYTES *pcb, PC_FILTERTYPE filter, double val1, double val2)
+{
+	size_t size = pc_interpretation_size(pcb->interpretation);
+	uint64_t wordmask = pc_bytes_pfor_wordmask(size);
+	PCBITMAP *map = pc_bitmap_new(pcb->npoints);
+	uint64_t vals[PC_PFOR_BLOCK];
+	const uint8_t *ptr = pcb->bytes;
+	const uint8_t *ptr_end = pcb->bytes + pcb->size;
+	uint32_t i = 0, j;
+
+	while ( ptr < ptr_end )
+	{
+		uint32_t n, nexc;
+		int nbits, skip = 0;
+		uint64_t ref;
+		double dmin, dmax;
+
+		if ( ! pc_bytes_pfor_block_check(ptr, ptr_end, size) )
+			return map;
+
+		n = ptr[0];
+		nbits = ptr[1];
+		nexc = ptr[2];
+		ref = pc_bytes_pfor_get_word(ptr + 3 + 2*size, size);
+		dmin = pc_bytes_pfor_key_double(pc_bytes_pfor_get_word(ptr + 3, size), pcb->interpretation, size);
+		dmax = pc_bytes_pfor_key_double(pc_bytes_pfor_get_word(ptr + 3 + size, size), pcb->interpretation, size);
+
+		switch ( filter )
+		{
+		case PC_GT:
+			skip = dmax <= val1;
+			break;
+		case PC_LT:
+			skip = dmin >= val1;
+			break;
+		case PC_EQUAL:
+			skip = val1 < dmin || val1 > dmax;
+			break;
+		case PC_BETWEEN:
+			skip = dmax <= val1 || dmin >= val2;
+			break;
+		}
+
+		if ( i + n > pcb->npoints )
+		{
+			pcerror("%s: more values than the %u points", __func__, pcb->npoints);
+			return map;
+		}
+
+		if ( skip )
+		{
+			ptr += pc_bytes_pfor_block_size(size, n, nbits, nexc);
+			i += n;
+			continue;
+		}
+
+		ptr = pc_bytes_pfor_unpack(ptr + 3 + 3*size, vals, n, nbits);
+		for ( j = 0; j < nexc; j++, ptr += 1 + size )
+			vals[*ptr] = pc_bytes_pfor_get_word(ptr + 1, size);
+
+		for ( j = 0; j < n; j++, i++ )
+		{
+			uint8_t buf[8];
+			pc_bytes_pfor_put_word(buf, pc_bytes_pfor_unkey((ref + vals[j]) & wordmask, pcb->interpretation, size), size);
+			pc_bitmap_filter(map, filter, i, pc_double_from_ptr(buf, pcb->interpretation), val1, val2);
+		}
+	}
+	return map;
+}
+
 PCBITMAP *
 pc_bytes_bitmap(const PCBYTES *pcb, PC_FILTERTYPE filter, double val1, double val2)
 {
@@ -1683,13 +2874,20 @@ pc_bytes_bitmap(const PCBYTES *pcb, PC_FILTERTYPE filter, double val1, double va
 	case PC_DIM_SIGBITS:
 	case PC_DIM_ZLIB:
 	{
-		PCBYTES dpcb = pc_bytes_decode(*pcb);
-		PCBITMAP *map = pc_bytes_uncompressed_bitmap(&dpcb, filter, val1, val2);
-		pc_bytes_free(dpcb);
+		PCBYTES dpcb;
+		PCBITMAP *map = NULL;
+		PCSINK scratch;
+		pc_sink_init(&scratch, 0);
+		if ( PC_SUCCESS == pc_bytes_decode_scratch(pcb, &scratch, &dpcb) )
+			map = pc_bytes_uncompressed_bitmap(&dpcb, filter, val1, val2);
+		if ( scratch.bytes )
+			pcfree(scratch.bytes);
 		return map;
 	}
 	case PC_DIM_RLE:
 		return pc_bytes_run_length_bitmap(pcb, filter, val1, val2);
+	case PC_DIM_PFOR:
+		return pc_bytes_pfor_bitmap(pcb, filter, val1, val2);
 	default:
 		pcerror("%s: unknown compression", __func__);
 	}
@@ -1699,21 +2897,21 @@ pc_bytes_bitmap(const PCBYTES *pcb, PC_FILTERTYPE filter, double val1, double va
 
 /** get n-th value, 0-based, positive */
 void
-pc_bytes_uncompressed_to_ptr(uint8_t *buf, PCBYTES pcb, int n)
+pc_bytes_uncompressed_to_ptr(uint8_t *buf, const PCBYTES *pcb, int n)
 {
-	size_t size = pc_interpretation_size(pcb.interpretation);
-	memcpy(buf,pcb.bytes+n*size,size);
+	size_t size = pc_interpretation_size(pcb->interpretation);
+	memcpy(buf,pcb->bytes+n*size,size);
 }
 
 void
-pc_bytes_run_length_to_ptr(uint8_t *buf, PCBYTES pcb, int n)
+pc_bytes_run_length_to_ptr(uint8_t *buf, const PCBYTES *pcb, int n)
 {
-	const uint8_t *bytes_rle_ptr = pcb.bytes;
-	const uint8_t *bytes_rle_end = pcb.bytes + pcb.size;
+	const uint8_t *bytes_rle_ptr = pcb->bytes;
+	const uint8_t *bytes_rle_end = pcb->bytes + pcb->size;
 	uint8_t run;
 
-	size_t size = pc_interpretation_size(pcb.interpretation);
-	assert(pcb.compression == PC_DIM_RLE);
+	size_t size = pc_interpretation_size(pcb->interpretation);
+	assert(pcb->compression == PC_DIM_RLE);
 
 	while( bytes_rle_ptr < bytes_rle_end )
 	{
@@ -1730,9 +2928,9 @@ pc_bytes_run_length_to_ptr(uint8_t *buf, PCBYTES pcb, int n)
 
 #define PC_BYTES_SIGBITS_TO_PTR(N) \
 void \
-pc_bytes_sigbits_to_ptr_##N(uint8_t *buf, PCBYTES pcb, int n) \
+pc_bytes_sigbits_to_ptr_##N(uint8_t *buf, const PCBYTES *pcb, int n) \
 { \
-	const uint##N##_t *bytes_ptr = (const uint##N##_t*)(pcb.bytes); \
+	const uint##N##_t *bytes_ptr = (const uint##N##_t*)(pcb->bytes); \
 	/* How many unique bits? */ \
 	uint##N##_t nbits = *bytes_ptr++; \
 	/* What is the shared bit value? */ \
@@ -1771,9 +2969,9 @@ PC_BYTES_SIGBITS_TO_PTR(32)
 PC_BYTES_SIGBITS_TO_PTR(64)
 
 void
-pc_bytes_sigbits_to_ptr(uint8_t *buf, PCBYTES pcb, int n)
+pc_bytes_sigbits_to_ptr(uint8_t *buf, const PCBYTES *pcb, int n)
 {
-	size_t size = pc_interpretation_size(pcb.interpretation);
+	size_t size = pc_interpretation_size(pcb->interpretation);
 	switch ( size )
 	{
 	case 1:
@@ -1794,24 +2992,28 @@ pc_bytes_sigbits_to_ptr(uint8_t *buf, PCBYTES pcb, int n)
 	}
 	default:
 	{
-		pcerror("%s: cannot handle interpretation %d", __func__, pcb.interpretation);
+		pcerror("%s: cannot handle interpretation %d", __func__, pcb->interpretation);
 	}
 	}
 }
 
 
 void
-pc_bytes_zlib_to_ptr(uint8_t *buf, PCBYTES pcb, int n)
+pc_bytes_zlib_to_ptr(uint8_t *buf, const PCBYTES *pcb, int n)
 {
-	PCBYTES dpcb = pc_bytes_decode(pcb);
-	pc_bytes_uncompressed_to_ptr(buf,dpcb,n);
-	pc_bytes_free(dpcb);
+	PCBYTES dpcb;
+	PCSINK scratch;
+	pc_sink_init(&scratch, 0);
+	if ( PC_SUCCESS == pc_bytes_decode_scratch(pcb, &scratch, &dpcb) )
+		pc_bytes_uncompressed_to_ptr(buf, &dpcb, n);
+	if ( scratch.bytes )
+		pcfree(scratch.bytes);
 }
 
 void
-pc_bytes_to_ptr(uint8_t *buf, PCBYTES pcb, int n)
+pc_bytes_to_ptr(uint8_t *buf, const PCBYTES *pcb, int n)
 {
-	switch ( pcb.compression )
+	switch ( pcb->compression )
 	{
 	case PC_DIM_RLE:
 	{
@@ -1828,6 +3030,11 @@ pc_bytes_to_ptr(uint8_t *buf, PCBYTES pcb, int n)
 		pc_bytes_zlib_to_ptr(buf,pcb,n);
 		break;
 	}
+	case PC_DIM_PFOR:
+	{
+		pc_bytes_pfor_to_ptr(buf,pcb,n);
+		break;
+	}
 	case PC_DIM_NONE:
 	{
 		pc_bytes_uncompressed_to_ptr(buf,pcb,n);
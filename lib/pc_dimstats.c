@@ -11,6 +11,7 @@
 *  - run-length encoding
 *  - significant-bit removal
 *  - deflate
+*  - patched frame-of-reference
 *
 *  PgSQL Pointcloud is free and open source software provided
 *  by the Government of Canada
@@ -46,6 +47,7 @@ typedef struct
 {
 	uint32_t total_runs;
 	uint32_t total_commonbits;
+	uint32_t total_pforsize;
 	uint32_t recommended_compression;
 } PCDIMSTAT;
 
@@ -105,6 +107,7 @@ pc_dimstats_update(PCDIMSTATS *pds, const PCPATCH_DIMENSIONAL *pdl)
 		PCBYTES pcb = pdl->bytes[i];
 		pds->stats[i].total_runs += pc_bytes_run_count(&pcb);
 		pds->stats[i].total_commonbits += pc_bytes_sigbits_count(&pcb);
+		pds->stats[i].total_pforsize += pc_bytes_pfor_encoded_size(&pcb);
 	}
 
 	/* Update recommended compression schema */
@@ -119,6 +122,8 @@ pc_dimstats_update(PCDIMSTATS *pds, const PCPATCH_DIMENSIONAL *pdl)
 		double avg_commonbits_per_patch = pds->stats[i].total_commonbits / pds->total_patches;
 		double avg_uniquebits_per_patch = 8*dim->size - avg_commonbits_per_patch;
 		double sigbits_size = pds->total_patches * 2 * dim->size + pds->total_points * avg_uniquebits_per_patch / 8;
+		/* PFOR size, as measured on the samples */
+		double pfor_size = pds->stats[i].total_pforsize;
 		/* Default to ZLib */
 		pds->stats[i].recommended_compression = PC_DIM_ZLIB;
 		/* Only use rle and sigbits compression on integer values */
@@ -130,6 +135,12 @@ pc_dimstats_update(PCDIMSTATS *pds, const PCPATCH_DIMENSIONAL *pdl)
 			{
 				pds->stats[i].recommended_compression = PC_DIM_SIGBITS;
 			}
+			/* Outliers blow up sigbits, but not PFOR, which is worth */
+			/* its slower decoding only when it clearly does better */
+			if ( raw_size/pfor_size > 1.6 && pfor_size < 0.8 * sigbits_size )
+			{
+				pds->stats[i].recommended_compression = PC_DIM_PFOR;
+			}
 			/* If RLE size is even better, use that. */
 			if ( raw_size/rle_size > 4.0 )
 			{
@@ -136,19 +136,30 @@ pc_patch_dimensional_bitmap(const PCPATCH_DIMENSIONAL *pdl, uint32_t dimnum, PC_
 	assert(dimnum < pdl->schema->ndims);
 	double unscaled1 = pc_value_unscale_unoffset(val1, pdl->schema->dims[dimnum]);
 	double unscaled2 = pc_value_unscale_unoffset(val2, pdl->schema->dims[dimnum]);
+	const PCBYTES *pcb = &(pdl->bytes[dimnum]);
 
-	return pc_bytes_bitmap(&(pdl->bytes[dimnum]), filter, unscaled1, unscaled2);
+	/* Run-length encoded bytes are tested in place, others are decoded once */
+	if ( pcb->compression != PC_DIM_RLE )
+		pcb = pc_patch_dimensional_get_bytes(pdl, dimnum);
+	if ( ! pcb )
+		return NULL;
+
+	return pc_bytes_bitmap(pcb, filter, unscaled1, unscaled2);
 }
 
 static PCPATCH_DIMENSIONAL *
 pc_patch_dimensional_filter(const PCPATCH_DIMENSIONAL *pdl, const PCBITMAP *map)
 {
 	int i = 0;
+	PCSINK scratch;
 	PCPATCH_DIMENSIONAL *fpdl = pc_patch_dimensional_clone(pdl);
 
 	fpdl->stats = pc_stats_clone(pdl->stats);
 	fpdl->npoints = map->nset;
 
+	/* Columns that have to be decoded share one scratch buffer */
+	pc_sink_init(&scratch, 0);
+
 	for ( i = 0; i < pdl->schema->ndims; i++ )
 	{
 		PCDIMENSION *dim;
@@ -156,7 +167,18 @@ pc_patch_dimensional_filter(const PCPATCH_DIMENSIONAL *pdl, const PCBITMAP *map)
 		stats.min = FLT_MAX;
 		stats.max = -1*FLT_MAX;
 		stats.sum = 0;
-		fpdl->bytes[i] = pc_bytes_filter(&(pdl->bytes[i]), map, &stats);
+
+		/* Re-use the decoded bytes of the filtered dimension, if any */
+		if ( pdl->decoded && pdl->decoded[i].bytes )
+		{
+			PCBYTES fpcb = pc_bytes_filter(&(pdl->decoded[i]), map, &stats);
+			fpdl->bytes[i] = pc_bytes_encode(fpcb, pdl->bytes[i].compression);
+			pc_bytes_free(fpcb);
+		}
+		else
+		{
+			fpdl->bytes[i] = pc_bytes_filter_scratch(&(pdl->bytes[i]), map, &stats, &scratch);
+		}
 
 
 		/* Apply scale and offset */
@@ -182,6 +204,8 @@ pc_patch_dimensional_filter(const PCPATCH_DIMENSIONAL *pdl, const PCBITMAP *map)
 		pc_point_set_double_by_index(&(fpdl->stats->avg), i, stats.sum/fpdl->npoints);
 	}
 
+	if ( scratch.bytes )
+		pcfree(scratch.bytes);
 	return fpdl;
 }
 
@@ -254,9 +278,7 @@ pc_patch_filter(const PCPATCH *pa, uint32_t dimnum, PC_FILTERTYPE filter, double
 	case PC_GHT:
 	{
 		PCPATCH_GHT *pgh = pc_patch_ght_filter((PCPATCH_GHT*)pa, dimnum, filter, val1, val2);
-		/* pc_patch_ght_filter computes the bounds itself */
-		/* TODO: add stats computation to pc_patch_ght_filter */
-		/* pc_patch_ght_filter is just re-using the input stats, which is wrong */
+		/* pc_patch_ght_filter computes both stats and bounds */
 		paout = (PCPATCH*)pgh;
 		break;
 	}
@@ -264,6 +286,8 @@ pc_patch_filter(const PCPATCH *pa, uint32_t dimnum, PC_FILTERTYPE filter, double
 	{
 		PCBITMAP *map = pc_patch_dimensional_bitmap((PCPATCH_DIMENSIONAL*)pa, dimnum, filter, val1, val2);
 		PCPATCH_DIMENSIONAL *pdl;
+		if ( ! map )
+			return NULL;
 		if ( map->nset == 0 )
 		{
 			pc_bitmap_free(map);
@@ -307,6 +331,257 @@ pc_patch_filter(const PCPATCH *pa, uint32_t dimnum, PC_FILTERTYPE filter, double
 	return paout;
 }
 
+static inline int
+pc_bounds_contains(const PCBOUNDS *box, double x, double y)
+{
+	return x >= box->xmin && x <= box->xmax && y >= box->ymin && y <= box->ymax;
+}
+
+static PCBITMAP *
+pc_patch_uncompressed_box_bitmap(const PCPATCH_UNCOMPRESSED *pa, const PCBOUNDS *box)
+{
+	PCPOINT pt;
+	uint32_t i;
+	double x, y;
+	PCBITMAP *map = pc_bitmap_new(pa->npoints);
+
+	pt.readonly = PC_TRUE;
+	pt.schema = pa->schema;
+
+	for ( i = 0; i < pa->npoints; i++ )
+	{
+		pt.data = pa->data + i * pa->schema->size;
+		pc_point_get_x(&pt, &x);
+		pc_point_get_y(&pt, &y);
+		pc_bitmap_set(map, i, pc_bounds_contains(box, x, y));
+	}
+
+	return map;
+}
+
+static PCBITMAP *
+pc_patch_dimensional_box_bitmap(const PCPATCH_DIMENSIONAL *pdl, const PCBOUNDS *box)
+{
+	uint32_t i;
+	const PCDIMENSION *xdim = pdl->schema->xdim;
+	const PCDIMENSION *ydim = pdl->schema->ydim;
+	const PCBYTES *xpcb = pc_patch_dimensional_get_bytes(pdl, xdim->position);
+	const PCBYTES *ypcb = pc_patch_dimensional_get_bytes(pdl, ydim->position);
+	PCBITMAP *map;
+
+	if ( ! xpcb || ! ypcb )
+		return NULL;
+
+	map = pc_bitmap_new(pdl->npoints);
+
+	for ( i = 0; i < pdl->npoints; i++ )
+	{
+		double x = pc_double_from_ptr(xpcb->bytes + i * xdim->size, xdim->interpretation);
+		double y = pc_double_from_ptr(ypcb->bytes + i * ydim->size, ydim->interpretation);
+		x = pc_value_scale_offset(x, xdim);
+		y = pc_value_scale_offset(y, ydim);
+		pc_bitmap_set(map, i, pc_bounds_contains(box, x, y));
+	}
+
+	return map;
+}
+
+/**
+* Subset a patch to the points within a box, boundaries included.
+* Patches entirely outside the box are rejected from their bounds
+* without visiting the points.
+*/
+PCPATCH *
+pc_patch_filter_box(const PCPATCH *pa, double xmin, double ymin, double xmax, double ymax)
+{
+	PCBOUNDS box;
+	PCBITMAP *map = NULL;
+	PCPATCH *paout = NULL;
+
+	if ( ! pa ) return NULL;
+
+	if ( ! pa->schema->xdim || ! pa->schema->ydim )
+	{
+		pcerror("%s: schema has no X/Y dimensions", __func__);
+		return NULL;
+	}
+
+	box.xmin = xmin < xmax ? xmin : xmax;
+	box.xmax = xmin < xmax ? xmax : xmin;
+	box.ymin = ymin < ymax ? ymin : ymax;
+	box.ymax = ymin < ymax ? ymax : ymin;
+
+	if ( ! pa->npoints || ! pc_bounds_intersects(&(pa->bounds), &box) )
+		return (PCPATCH*)pc_patch_uncompressed_make(pa->schema, 0);
+
+	switch ( pa->type )
+	{
+	case PC_NONE:
+	{
+		map = pc_patch_uncompressed_box_bitmap((PCPATCH_UNCOMPRESSED*)pa, &box);
+		if ( map->nset )
+			paout = (PCPATCH*)pc_patch_uncompressed_filter((PCPATCH_UNCOMPRESSED*)pa, map);
+		break;
+	}
+	case PC_GHT:
+	{
+		/* The whole tree gets decoded, no subtree is pruned from its hash */
+		PCPATCH_UNCOMPRESSED *pau = pc_patch_uncompressed_from_ght((PCPATCH_GHT*)pa);
+		if ( ! pau ) return NULL;
+		map = pc_patch_uncompressed_box_bitmap(pau, &box);
+		if ( map->nset )
+			paout = (PCPATCH*)pc_patch_uncompressed_filter(pau, map);
+		pc_patch_free((PCPATCH*)pau);
+		break;
+	}
+	case PC_DIMENSIONAL:
+	{
+		map = pc_patch_dimensional_box_bitmap((PCPATCH_DIMENSIONAL*)pa, &box);
+		if ( ! map ) return NULL;
+		if ( map->nset )
+			paout = (PCPATCH*)pc_patch_dimensional_filter((PCPATCH_DIMENSIONAL*)pa, map);
+		break;
+	}
+	case PC_LAZPERF:
+	{
+		/* Chunks outside the box are not decoded */
+		PCPATCH_UNCOMPRESSED *pau = pc_patch_uncompressed_from_lazperf_box((PCPATCH_LAZPERF*)pa, &box);
+		if ( ! pau ) return NULL;
+		map = pc_patch_uncompressed_box_bitmap(pau, &box);
+		if ( map->nset )
+			paout = (PCPATCH*)pc_patch_uncompressed_filter(pau, map);
+		pc_patch_free((PCPATCH*)pau);
+		break;
+	}
+	default:
+		pcerror("%s: failure", __func__);
+		return NULL;
+	}
+
+	if ( map )
+		pc_bitmap_free(map);
+
+	if ( ! paout )
+		paout = (PCPATCH*)pc_patch_uncompressed_make(pa->schema, 0);
+
+	return paout;
+}
+
+PCTOMBSTONES *
+pc_tombstones_new(uint32_t npoints)
+{
+	PCTOMBSTONES *ts = pcalloc(sizeof(PCTOMBSTONES));
+	ts->npoints = npoints;
+	ts->ndeleted = 0;
+	ts->bits = pcalloc(npoints / 8 + 1);
+	return ts;
+}
+
+void
+pc_tombstones_free(PCTOMBSTONES *ts)
+{
+	if ( ! ts ) return;
+	if ( ts->bits ) pcfree(ts->bits);
+	pcfree(ts);
+}
+
+/**
+* Cover the points appended to the patch since the tombstones
+* were made, they start out alive.
+*/
+int
+pc_tombstones_extend(PCTOMBSTONES *ts, uint32_t npoints)
+{
+	size_t oldsize = ts->npoints / 8 + 1;
+	size_t newsize = npoints / 8 + 1;
+
+	if ( npoints < ts->npoints )
+	{
+		pcerror("%s: cannot shrink tombstones from %u to %u points", __func__, ts->npoints, npoints);
+		return PC_FAILURE;
+	}
+
+	if ( newsize > oldsize )
+	{
+		ts->bits = pcrealloc(ts->bits, newsize);
+		memset(ts->bits + oldsize, 0, newsize - oldsize);
+	}
+	ts->npoints = npoints;
+	return PC_SUCCESS;
+}
+
+/** Mark point n, 0-based, as deleted */
+int
+pc_tombstones_set(PCTOMBSTONES *ts, uint32_t n)
+{
+	if ( n >= ts->npoints )
+	{
+		pcerror("%s: point %u is out of range, patch has %u points", __func__, n + 1, ts->npoints);
+		return PC_FAILURE;
+	}
+
+	if ( ! pc_tombstones_get(ts, n) )
+	{
+		ts->bits[n / 8] |= 1 << (n % 8);
+		ts->ndeleted++;
+	}
+	return PC_SUCCESS;
+}
+
+/**
+* Drop the points marked in the tombstones, filtering the patch
+* columns in their encoding where possible, and gathering the
+* new bounds and stats on the way. Returns the patch itself if
+* nothing is marked, and an empty patch if everything is.
+*/
+PCPATCH *
+pc_patch_compact(const PCPATCH *pa, const PCTOMBSTONES *ts)
+{
+	uint32_t i;
+	PCBITMAP *map;
+	PCPATCH *paout;
+
+	if ( ! pa ) return NULL;
+
+	if ( ts->npoints != pa->npoints )
+	{
+		pcerror("%s: tombstones cover %u points, patch has %u", __func__, ts->npoints, pa->npoints);
+		return NULL;
+	}
+
+	if ( ! ts->ndeleted )
+		return (PCPATCH*)pa;
+
+	if ( ts->ndeleted == pa->npoints )
+		return (PCPATCH*)pc_patch_uncompressed_make(pa->schema, 0);
+
+	/* Filters keep the points set in the map */
+	map = pc_bitmap_new(pa->npoints);
+	for ( i = 0; i < pa->npoints; i++ )
+		map->map[i] = ! pc_tombstones_get(ts, i);
+	map->nset = pa->npoints - ts->ndeleted;
+
+	switch ( pa->type )
+	{
+	case PC_NONE:
+		paout = (PCPATCH*)pc_patch_uncompressed_filter((PCPATCH_UNCOMPRESSED*)pa, map);
+		break;
+	case PC_DIMENSIONAL:
+		paout = (PCPATCH*)pc_patch_dimensional_filter((PCPATCH_DIMENSIONAL*)pa, map);
+		break;
+	default:
+	{
+		PCPATCH_UNCOMPRESSED *pu = (PCPATCH_UNCOMPRESSED*)pc_patch_uncompress(pa);
+		paout = (PCPATCH*)pc_patch_uncompressed_filter(pu, map);
+		pc_patch_free((PCPATCH*)pu);
+		break;
+	}
+	}
+
+	pc_bitmap_free(map);
+	return paout;
+}
+
 PCPATCH *
 pc_patch_filter_lt_by_name(const PCPATCH *pa, const char *name, double val)
 {
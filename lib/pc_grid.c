@@ -0,0 +1,285 @@
+/***********************************************************************
+* pc_grid.c
+*
+*  Raster overlay: sample a grid of values, an orthophoto band or
+*  a DEM, at the X/Y of every point of a patch and store the result
+*  in one of its dimensions. The points are handled in batches, a
+*  loop working out the pixel coordinates and another one reading
+*  the grid, and for dimensional patches only the X, Y and target
+*  columns are touched.
+*
+*  PgSQL Pointcloud is free and open source software provided
+*  by the Government of Canada
+*  Copyright (c) 2013 Natural Resources Canada
+*
+***********************************************************************/
+
+#include "pc_api_internal.h"
+#include <math.h>
+#include <float.h>
+
+/* Points per sampling batch */
+#define PC_GRID_BATCH 256
+
+typedef struct
+{
+	const double *values;
+	uint32_t nrows;
+	uint32_t ncols;
+	double inv[6]; /* Inverse geotransform, from x/y to col/row */
+	PC_SAMPLEMETHOD method;
+} PCGRID;
+
+/**
+* Invert a GDAL geotransform, where
+* x = gt[0] + col * gt[1] + row * gt[2]
+* y = gt[3] + col * gt[4] + row * gt[5]
+*/
+static int
+pc_grid_invert(const double *gt, double *inv)
+{
+	double det = gt[1] * gt[5] - gt[2] * gt[4];
+
+	if ( det == 0 || ! isfinite(det) )
+		return PC_FAILURE;
+
+	inv[1] = gt[5] / det;
+	inv[2] = -gt[2] / det;
+	inv[4] = -gt[4] / det;
+	inv[5] = gt[1] / det;
+	inv[0] = -(inv[1] * gt[0] + inv[2] * gt[3]);
+	inv[3] = -(inv[4] * gt[0] + inv[5] * gt[3]);
+	return PC_SUCCESS;
+}
+
+static inline double
+pc_grid_value(const PCGRID *g, int64_t col, int64_t row)
+{
+	if ( col < 0 ) col = 0;
+	if ( row < 0 ) row = 0;
+	if ( col >= g->ncols ) col = g->ncols - 1;
+	if ( row >= g->nrows ) row = g->nrows - 1;
+	return g->values[row * g->ncols + col];
+}
+
+/**
+* Sample the grid at n points. Points outside the grid, or on
+* NaN cells, get NaN. Bilinear sampling weighs the four nearest
+* cell centers, falls back to the nearest cell when one of them
+* is NaN, and extends the edge cells up to the grid border.
+*/
+static void
+pc_grid_sample(const PCGRID *g, const double *x, const double *y, uint32_t n, double *out)
+{
+	double col[PC_GRID_BATCH], row[PC_GRID_BATCH];
+	uint32_t i;
+
+	for ( i = 0; i < n; i++ )
+	{
+		col[i] = g->inv[0] + g->inv[1] * x[i] + g->inv[2] * y[i];
+		row[i] = g->inv[3] + g->inv[4] * x[i] + g->inv[5] * y[i];
+	}
+
+	for ( i = 0; i < n; i++ )
+	{
+		double fc, fr, tx, ty, v00, v01, v10, v11;
+		int64_t c0, r0;
+
+		if ( ! ( col[i] >= 0 && col[i] < g->ncols && row[i] >= 0 && row[i] < g->nrows ) )
+		{
+			out[i] = NAN;
+			continue;
+		}
+
+		if ( g->method == PC_SAMPLE_NEAREST )
+		{
+			out[i] = pc_grid_value(g, (int64_t)col[i], (int64_t)row[i]);
+			continue;
+		}
+
+		fc = col[i] - 0.5;
+		fr = row[i] - 0.5;
+		c0 = (int64_t)floor(fc);
+		r0 = (int64_t)floor(fr);
+		tx = fc - c0;
+		ty = fr - r0;
+		v00 = pc_grid_value(g, c0, r0);
+		v01 = pc_grid_value(g, c0 + 1, r0);
+		v10 = pc_grid_value(g, c0, r0 + 1);
+		v11 = pc_grid_value(g, c0 + 1, r0 + 1);
+
+		if ( isnan(v00) || isnan(v01) || isnan(v10) || isnan(v11) )
+			out[i] = pc_grid_value(g, (int64_t)col[i], (int64_t)row[i]);
+		else
+			out[i] = (v00 * (1 - tx) + v01 * tx) * (1 - ty) + (v10 * (1 - tx) + v11 * tx) * ty;
+	}
+}
+
+/**
+* Set the sampled values in vals, leaving the points sampled
+* as NaN with the value they had.
+*/
+static void
+pc_grid_sample_all(const PCGRID *g, const double *x, const double *y, uint32_t npoints, double *vals)
+{
+	double out[PC_GRID_BATCH];
+	uint32_t i, j, n;
+
+	for ( i = 0; i < npoints; i += n )
+	{
+		n = npoints - i < PC_GRID_BATCH ? npoints - i : PC_GRID_BATCH;
+		pc_grid_sample(g, x + i, y + i, n, out);
+		for ( j = 0; j < n; j++ )
+			if ( ! isnan(out[j]) )
+				vals[i + j] = out[j];
+	}
+}
+
+/**
+* Write the values into a column of the dimension, with the
+* given stride, and read them back as stored for the stats.
+*/
+static void
+pc_grid_write(uint8_t *ptr, size_t stride, const PCDIMENSION *dim, double *vals, uint32_t npoints)
+{
+	uint32_t i;
+
+	for ( i = 0; i < npoints; i++, ptr += stride )
+	{
+		pc_double_to_ptr(ptr, dim->interpretation, pc_value_unscale_unoffset(vals[i], dim));
+		vals[i] = pc_value_scale_offset(pc_double_from_ptr(ptr, dim->interpretation), dim);
+	}
+}
+
+/**
+* Only the target dimension changes, so the stats of the other
+* dimensions are carried over when the patch has some.
+*/
+static int
+pc_grid_stats(PCPATCH *pa, const PCSTATS *stats, const PCDIMENSION *dim, const double *vals)
+{
+	double min = DBL_MAX, max = -1 * DBL_MAX, sum = 0;
+	uint32_t i;
+
+	if ( ! pa->npoints )
+		return PC_SUCCESS;
+
+	if ( ! stats )
+		return pc_patch_compute_stats(pa);
+
+	for ( i = 0; i < pa->npoints; i++ )
+	{
+		if ( vals[i] < min ) min = vals[i];
+		if ( vals[i] > max ) max = vals[i];
+		sum += vals[i];
+	}
+
+	pa->stats = pc_stats_clone(stats);
+	pc_point_set_double(&(pa->stats->min), dim, min);
+	pc_point_set_double(&(pa->stats->max), dim, max);
+	pc_point_set_double(&(pa->stats->avg), dim, sum / pa->npoints);
+	return PC_SUCCESS;
+}
+
+PCPATCH *
+pc_patch_sample_grid(const PCPATCH *pa, const double *grid, uint32_t nrows, uint32_t ncols, const double *geotransform, const char *name, PC_SAMPLEMETHOD method)
+{
+	const PCSCHEMA *s = pa->schema;
+	PCDIMENSION *dim = pc_schema_get_dimension_by_name(s, name);
+	const PCPATCH *pu;
+	PCPATCH *paout;
+	PCGRID g;
+	double *x, *y, *vals;
+
+	if ( ! dim )
+	{
+		pcerror("%s: dimension \"%s\" does not exist", __func__, name);
+		return NULL;
+	}
+	if ( ! s->xdim || ! s->ydim )
+	{
+		pcerror("%s: schema has no X/Y dimensions", __func__);
+		return NULL;
+	}
+	if ( dim == s->xdim || dim == s->ydim )
+	{
+		pcerror("%s: dimension \"%s\" holds the point coordinates", __func__, name);
+		return NULL;
+	}
+	if ( ! nrows || ! ncols )
+	{
+		pcerror("%s: empty grid", __func__);
+		return NULL;
+	}
+
+	g.values = grid;
+	g.nrows = nrows;
+	g.ncols = ncols;
+	g.method = method;
+	if ( PC_FAILURE == pc_grid_invert(geotransform, g.inv) )
+	{
+		pcerror("%s: geotransform is not invertible", __func__);
+		return NULL;
+	}
+
+	/* Only the X, Y and target columns of dimensional patches are decoded */
+	pu = pa->type == PC_DIMENSIONAL ? pa : pc_patch_uncompress(pa);
+	x = pc_patch_dimension_to_double_array(pu, s->xdim->position);
+	y = pc_patch_dimension_to_double_array(pu, s->ydim->position);
+	vals = pc_patch_dimension_to_double_array(pu, dim->position);
+
+	pc_grid_sample_all(&g, x, y, pa->npoints, vals);
+
+	if ( pu->type == PC_DIMENSIONAL )
+	{
+		const PCPATCH_DIMENSIONAL *pdl = (const PCPATCH_DIMENSIONAL*)pu;
+		PCPATCH_DIMENSIONAL *pdlout = pc_patch_dimensional_clone(pdl);
+		int i;
+
+		pdlout->readonly = PC_FALSE;
+		pdlout->npoints = pdl->npoints;
+		for ( i = 0; i < s->ndims; i++ )
+		{
+			if ( i == dim->position )
+				pdlout->bytes[i] = pc_bytes_make(dim, pdl->npoints);
+			else
+				pdlout->bytes[i] = pc_bytes_clone(pdl->bytes[i]);
+		}
+		pc_grid_write(pdlout->bytes[dim->position].bytes, dim->size, dim, vals, pdl->npoints);
+
+		/* The target column goes back to the compression it had */
+		if ( pdl->bytes[dim->position].compression != PC_DIM_NONE )
+		{
+			PCBYTES pcb = pdlout->bytes[dim->position];
+			pdlout->bytes[dim->position] = pc_bytes_encode(pcb, pdl->bytes[dim->position].compression);
+			pc_bytes_free(pcb);
+		}
+		paout = (PCPATCH*)pdlout;
+	}
+	else
+	{
+		const PCPATCH_UNCOMPRESSED *pul = (const PCPATCH_UNCOMPRESSED*)pu;
+		PCPATCH_UNCOMPRESSED *puout = pc_patch_uncompressed_make(s, pul->npoints);
+
+		puout->npoints = pul->npoints;
+		puout->bounds = pul->bounds;
+		memcpy(puout->data, pul->data, (size_t)s->size * pul->npoints);
+		pc_grid_write(puout->data + dim->byteoffset, s->size, dim, vals, pul->npoints);
+		paout = (PCPATCH*)puout;
+	}
+
+	paout->bounds = pa->bounds;
+	if ( PC_FAILURE == pc_grid_stats(paout, pa->stats, dim, vals) )
+	{
+		pcerror("%s: failed to compute patch stats", __func__);
+		pc_patch_free(paout);
+		paout = NULL;
+	}
+
+	if ( pu != pa )
+		pc_patch_free((PCPATCH*)pu);
+	pcfree(x);
+	pcfree(y);
+	pcfree(vals);
+	return paout;
+}
@@ -158,6 +158,40 @@ pcrealloc(void * mem, size_t size)
 	return pc_context.realloc(mem, size);
 }
 
+/**
+* Allocate the sink buffer. Unlike pcalloc() the memory is not
+* zeroed, everything handed out by pc_sink_reserve() is expected
+* to be written.
+*/
+void
+pc_sink_init(PCSINK *sink, size_t capacity)
+{
+	sink->bytes = capacity ? pc_context.alloc(capacity) : NULL;
+	sink->size = 0;
+	sink->capacity = capacity;
+}
+
+/**
+* Make room for size more bytes past what was written so far,
+* at least doubling the buffer when it has to grow, and return
+* where to write them. Growing moves the buffer, so pointers into
+* it do not survive a call.
+*/
+uint8_t *
+pc_sink_reserve(PCSINK *sink, size_t size)
+{
+	if ( sink->size + size > sink->capacity )
+	{
+		size_t capacity = 2 * sink->capacity;
+		if ( capacity < sink->size + size )
+			capacity = sink->size + size;
+		/* repalloc() cannot take a NULL pointer */
+		sink->bytes = sink->bytes ? pcrealloc(sink->bytes, capacity) : pc_context.alloc(capacity);
+		sink->capacity = capacity;
+	}
+	return sink->bytes + sink->size;
+}
+
 void
 pcfree(void * mem)
 {
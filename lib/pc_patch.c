@@ -46,13 +46,8 @@ pc_patch_compute_stats(PCPATCH *pa)
 		return pc_patch_uncompressed_compute_stats((PCPATCH_UNCOMPRESSED*)pa);
 
 	case PC_DIMENSIONAL:
-	{
-		PCPATCH_UNCOMPRESSED *pu = pc_patch_uncompressed_from_dimensional((PCPATCH_DIMENSIONAL*)pa);
-		pc_patch_uncompressed_compute_stats(pu);
-		pa->stats = pu->stats; pu->stats = NULL;
-		pc_patch_uncompressed_free(pu);
-		return PC_SUCCESS;
-	}
+		return pc_patch_dimensional_compute_stats((PCPATCH_DIMENSIONAL*)pa);
+
 	case PC_GHT:
 	{
 		PCPATCH_UNCOMPRESSED *pu = pc_patch_uncompressed_from_ght((PCPATCH_GHT*)pa);
@@ -302,8 +297,69 @@ pc_patch_uncompress(const PCPATCH *patch)
 
 
 
-PCPATCH *
-pc_patch_from_wkb(const PCSCHEMA *s, uint8_t *wkb, size_t wkbsize)
+/**
+* The header of a patch wkb is followed by the optional blocks
+* flagged in its compression, the data starts after them.
+*/
+size_t
+pc_patch_wkb_header_size(const PCSCHEMA *s, const uint8_t *wkb)
+{
+	uint32_t flags = wkb_get_flags(wkb);
+	size_t size = 1+4+4+4; /* endian + pcid + compression + npoints */
+
+	if ( flags & PC_WKB_BOUNDS )
+		size += sizeof(PCBOUNDS);
+	if ( flags & PC_WKB_STATS )
+		size += pc_stats_size(s);
+	return size;
+}
+
+/**
+* Set the bounds and stats of a patch from the optional
+* blocks of its wkb, when it has them.
+*/
+static int
+pc_patch_wkb_read_blocks(PCPATCH *patch, const uint8_t *wkb)
+{
+	uint32_t flags = wkb_get_flags(wkb);
+	uint8_t swap_endian = (wkb[0] != machine_endian());
+	const uint8_t *buf = wkb + 1+4+4+4;
+
+	if ( flags & PC_WKB_BOUNDS )
+	{
+		memcpy(&(patch->bounds), buf, sizeof(PCBOUNDS));
+		if ( swap_endian )
+			pc_flip_endian_strided((uint8_t*)&(patch->bounds), sizeof(double), sizeof(double), 4);
+		buf += sizeof(PCBOUNDS);
+
+		if ( patch->bounds.xmin > patch->bounds.xmax || patch->bounds.ymin > patch->bounds.ymax )
+		{
+			pcerror("%s: wkb bounds are inverted", __func__);
+			return PC_FAILURE;
+		}
+	}
+
+	if ( flags & PC_WKB_STATS )
+	{
+		size_t sz = patch->schema->size;
+		/* Stats are three points in a row, min, max, avg */
+		uint8_t *data = swap_endian ? uncompressed_bytes_flip_endian(buf, patch->schema, 3) : (uint8_t*)buf;
+
+		if ( patch->stats )
+			pc_stats_free(patch->stats);
+		patch->stats = pc_stats_new(patch->schema);
+		memcpy(patch->stats->min.data, data, sz);
+		memcpy(patch->stats->max.data, data + sz, sz);
+		memcpy(patch->stats->avg.data, data + 2*sz, sz);
+		if ( swap_endian )
+			pcfree(data);
+	}
+
+	return PC_SUCCESS;
+}
+
+static PCPATCH *
+pc_patch_from_wkb_internal(const PCSCHEMA *s, uint8_t *wkb, size_t wkbsize, int readonly)
 {
 	/*
 	byte:	  endianness (1 = NDR, 0 = XDR)
@@ -336,12 +392,12 @@ pc_patch_from_wkb(const PCSCHEMA *s, uint8_t *wkb, size_t wkbsize)
 	{
 	case PC_NONE:
 	{
-		patch = pc_patch_uncompressed_from_wkb(s, wkb, wkbsize);
+		patch = pc_patch_uncompressed_from_wkb(s, wkb, wkbsize, readonly);
 		break;
 	}
 	case PC_DIMENSIONAL:
 	{
-		patch = pc_patch_dimensional_from_wkb(s, wkb, wkbsize);
+		patch = pc_patch_dimensional_from_wkb(s, wkb, wkbsize, readonly);
 		break;
 	}
 	case PC_GHT:
@@ -362,16 +418,223 @@ pc_patch_from_wkb(const PCSCHEMA *s, uint8_t *wkb, size_t wkbsize)
 	}
 	}
 
-	if ( PC_FAILURE == pc_patch_compute_extent(patch) )
+	/* Bounds and stats the wkb carries are trusted */
+	if ( PC_FAILURE == pc_patch_wkb_read_blocks(patch, wkb) )
+		pcerror("%s: pc_patch_wkb_read_blocks failed", __func__);
+
+	if ( ! (wkb_get_flags(wkb) & PC_WKB_BOUNDS) && PC_FAILURE == pc_patch_compute_extent(patch) )
 		pcerror("%s: pc_patch_compute_extent failed", __func__);
 
-	if ( PC_FAILURE == pc_patch_compute_stats(patch) )
+	if ( ! patch->stats && PC_FAILURE == pc_patch_compute_stats(patch) )
 		pcerror("%s: pc_patch_compute_stats failed", __func__);
 
 	return patch;
 
 }
 
+/**
+* Check that the sizes declared in the wkb stay within wkbsize
+* and account for all of it, so the payload can be used without
+* parsing it. Reports what is wrong through pcerror() otherwise.
+*/
+int
+pc_patch_wkb_is_valid(const PCSCHEMA *s, const uint8_t *wkb, size_t wkbsize)
+{
+	static size_t hdrsz = 1+4+4+4; /* endian + pcid + compression + npoints */
+	uint8_t swap_endian;
+	uint32_t npoints;
+	size_t size;
+	int i;
+
+	if ( wkbsize < hdrsz )
+	{
+		pcerror("%s: wkb is too short for a patch header", __func__);
+		return PC_FALSE;
+	}
+
+	swap_endian = (wkb[0] != machine_endian());
+	npoints = wkb_get_npoints(wkb);
+
+	size = pc_patch_wkb_header_size(s, wkb);
+	if ( size > wkbsize )
+	{
+		pcerror("%s: wkb is too short for its bounds and stats", __func__);
+		return PC_FALSE;
+	}
+
+	if ( pc_wkb_get_pcid(wkb) != s->pcid )
+	{
+		pcerror("%s: wkb pcid (%d) not consistent with schema pcid (%d)", __func__, pc_wkb_get_pcid(wkb), s->pcid);
+		return PC_FALSE;
+	}
+
+	if ( (wkb_get_flags(wkb) & PC_WKB_LAZHEADER) && wkb_get_compression(wkb) != PC_LAZPERF )
+	{
+		pcerror("%s: LAZ header flag on a patch that is not LAZ", __func__);
+		return PC_FALSE;
+	}
+
+	switch ( wkb_get_compression(wkb) )
+	{
+	case PC_NONE:
+	{
+		size += (size_t)s->size * npoints;
+		break;
+	}
+	case PC_DIMENSIONAL:
+	{
+		for ( i = 0; i < s->ndims; i++ )
+		{
+			const PCDIMENSION *dim = s->dims[i];
+			uint8_t compression;
+			size_t pcbsize;
+			uint32_t dictid;
+
+			if ( size + 1 + 4 > wkbsize )
+			{
+				pcerror("%s: dimension \"%s\" is missing", __func__, dim->name);
+				return PC_FALSE;
+			}
+			compression = wkb[size];
+			pcbsize = (uint32_t)wkb_get_int32(wkb + size + 1, swap_endian);
+			size += 1 + 4;
+
+			if ( compression > PC_DIM_PFOR )
+			{
+				pcerror("%s: dimension \"%s\" has unknown compression %d", __func__, dim->name, compression);
+				return PC_FALSE;
+			}
+			if ( pcbsize > wkbsize - size )
+			{
+				pcerror("%s: dimension \"%s\" overruns the wkb", __func__, dim->name);
+				return PC_FALSE;
+			}
+			if ( compression == PC_DIM_NONE && pcbsize != (size_t)dim->size * npoints )
+			{
+				pcerror("%s: dimension \"%s\" does not hold %u values", __func__, dim->name, npoints);
+				return PC_FALSE;
+			}
+			if ( compression == PC_DIM_ZLIB && pc_bytes_zlib_dictid(wkb + size, pcbsize, &dictid) &&
+			     ! ( dim->zdict && dim->zdict->id == dictid ) )
+			{
+				pcerror("%s: dimension \"%s\" needs unknown zlib dictionary %u", __func__, dim->name, dictid);
+				return PC_FALSE;
+			}
+			/* PFOR block headers are read without further checks */
+			if ( compression == PC_DIM_PFOR && ! pc_bytes_pfor_is_valid(wkb + size, pcbsize, dim->interpretation, npoints) )
+			{
+				pcerror("%s: dimension \"%s\" has invalid PFOR blocks", __func__, dim->name);
+				return PC_FALSE;
+			}
+			size += pcbsize;
+		}
+		break;
+	}
+	case PC_GHT:
+	case PC_LAZPERF:
+	{
+		/* Both are a buffer size and the buffer */
+		if ( size + 4 > wkbsize )
+		{
+			pcerror("%s: wkb is too short for a buffer size", __func__);
+			return PC_FALSE;
+		}
+		size += 4 + (uint32_t)wkb_get_int32(wkb + size, swap_endian);
+		break;
+	}
+	default:
+	{
+		pcerror("%s: unknown compression '%d' requested", __func__, wkb_get_compression(wkb));
+		return PC_FALSE;
+	}
+	}
+
+	if ( size != wkbsize )
+	{
+		pcerror("%s: wkb size (%zu) does not match its content (%zu)", __func__, wkbsize, size);
+		return PC_FALSE;
+	}
+	return PC_TRUE;
+}
+
+/**
+* Reference a checked wkb in a patch, and compute the stats of
+* the points unless the wkb carries them. Missing bounds are taken
+* from the X and Y stats rather than from another pass over the
+* points. For callers that only need the stats and bounds of a
+* payload they keep as it is, the wkb must outlive the patch.
+*/
+PCPATCH *
+pc_patch_from_wkb_stats(const PCSCHEMA *s, uint8_t *wkb, size_t wkbsize)
+{
+	PCPATCH *patch;
+	double x, y;
+
+	if ( ! pc_patch_wkb_is_valid(s, wkb, wkbsize) )
+		return NULL;
+
+	switch ( wkb_get_compression(wkb) )
+	{
+	case PC_NONE:
+		patch = pc_patch_uncompressed_from_wkb(s, wkb, wkbsize, PC_TRUE);
+		break;
+	case PC_DIMENSIONAL:
+		patch = pc_patch_dimensional_from_wkb(s, wkb, wkbsize, PC_TRUE);
+		break;
+	case PC_GHT:
+		patch = pc_patch_ght_from_wkb(s, wkb, wkbsize);
+		break;
+	case PC_LAZPERF:
+		patch = pc_patch_lazperf_from_wkb(s, wkb, wkbsize);
+		break;
+	default:
+		return NULL;
+	}
+
+	if ( ! patch )
+		return NULL;
+
+	if ( PC_FAILURE == pc_patch_wkb_read_blocks(patch, wkb) )
+	{
+		pc_patch_free(patch);
+		return NULL;
+	}
+
+	if ( ! patch->stats && PC_FAILURE == pc_patch_compute_stats(patch) )
+		pcerror("%s: pc_patch_compute_stats failed", __func__);
+
+	if ( ! (wkb_get_flags(wkb) & PC_WKB_BOUNDS) )
+	{
+		pc_point_get_x(&(patch->stats->min), &x);
+		patch->bounds.xmin = x;
+		pc_point_get_x(&(patch->stats->max), &x);
+		patch->bounds.xmax = x;
+		pc_point_get_y(&(patch->stats->min), &y);
+		patch->bounds.ymin = y;
+		pc_point_get_y(&(patch->stats->max), &y);
+		patch->bounds.ymax = y;
+	}
+
+	return patch;
+}
+
+PCPATCH *
+pc_patch_from_wkb(const PCSCHEMA *s, uint8_t *wkb, size_t wkbsize)
+{
+	return pc_patch_from_wkb_internal(s, wkb, wkbsize, PC_FALSE);
+}
+
+/**
+* Same as pc_patch_from_wkb, but uncompressed and dimensional data in
+* the machine endianness is used in place rather than copied, so the
+* wkb must outlive the patch.
+*/
+PCPATCH *
+pc_patch_from_wkb_readonly(const PCSCHEMA *s, uint8_t *wkb, size_t wkbsize)
+{
+	return pc_patch_from_wkb_internal(s, wkb, wkbsize, PC_TRUE);
+}
+
 
 
 uint8_t *
@@ -406,6 +669,71 @@ pc_patch_to_wkb(const PCPATCH *patch, size_t *wkbsize)
 	return NULL;
 }
 
+/**
+* Same as pc_patch_to_wkb, with the blocks asked for in flags
+* written between the header and the data:
+* PCBOUNDS:  bounds (PC_WKB_BOUNDS)
+* pcpoint[3]: min, max, avg stats (PC_WKB_STATS)
+* The flags are or-ed into the compression, which readers
+* that do not know about them refuse.
+*/
+uint8_t *
+pc_patch_to_wkb_flags(const PCPATCH *patch, uint32_t flags, size_t *wkbsize)
+{
+	static size_t hdrsz = 1+4+4+4; /* endian + pcid + compression + npoints */
+	size_t size, blocksize = 0;
+	uint32_t compression;
+	uint8_t *wkb, *buf;
+
+	if ( flags & ~(PC_WKB_BOUNDS | PC_WKB_STATS) )
+	{
+		pcerror("%s: unknown wkb flags %#x", __func__, flags);
+		return NULL;
+	}
+
+	if ( (flags & PC_WKB_STATS) && ! patch->stats )
+	{
+		pcerror("%s: patch is missing stats", __func__);
+		return NULL;
+	}
+
+	wkb = pc_patch_to_wkb(patch, &size);
+	if ( ! wkb || ! flags )
+	{
+		if ( wkbsize ) *wkbsize = size;
+		return wkb;
+	}
+
+	if ( flags & PC_WKB_BOUNDS )
+		blocksize += sizeof(PCBOUNDS);
+	if ( flags & PC_WKB_STATS )
+		blocksize += pc_stats_size(patch->schema);
+
+	/* Make room for the blocks after the header */
+	wkb = pcrealloc(wkb, size + blocksize);
+	memmove(wkb + hdrsz + blocksize, wkb + hdrsz, size - hdrsz);
+
+	compression = patch->type | wkb_get_flags(wkb) | flags;
+	memcpy(wkb + 5, &compression, 4); /* Write compression and flags */
+
+	buf = wkb + hdrsz;
+	if ( flags & PC_WKB_BOUNDS )
+	{
+		memcpy(buf, &(patch->bounds), sizeof(PCBOUNDS));
+		buf += sizeof(PCBOUNDS);
+	}
+	if ( flags & PC_WKB_STATS )
+	{
+		size_t sz = patch->schema->size;
+		memcpy(buf, patch->stats->min.data, sz);
+		memcpy(buf + sz, patch->stats->max.data, sz);
+		memcpy(buf + 2*sz, patch->stats->avg.data, sz);
+	}
+
+	if ( wkbsize ) *wkbsize = size + blocksize;
+	return wkb;
+}
+
 char *
 pc_patch_to_string(const PCPATCH *patch)
 {
@@ -522,6 +850,27 @@ pc_patch_from_patchlist(PCPATCH **palist, int numpatches)
 	return (PCPATCH*)paout;
 }
 
+/**
+* Append the points of pb after those of pa. Dimensional patches
+* get the new points spliced onto their encoded columns, others
+* are merged as uncompressed.
+*/
+PCPATCH *
+pc_patch_append(const PCPATCH *pa, const PCPATCH *pb)
+{
+	PCPATCH *palist[2];
+
+	assert(pa);
+	assert(pb);
+
+	if ( pa->type == PC_DIMENSIONAL && pa->npoints )
+		return (PCPATCH*)pc_patch_dimensional_append((const PCPATCH_DIMENSIONAL*)pa, pb);
+
+	palist[0] = (PCPATCH*)pa;
+	palist[1] = (PCPATCH*)pb;
+	return pc_patch_from_patchlist(palist, 2);
+}
+
 // first: the first element to select (1-based indexing)
 // count: the number of points to select
 PCPATCH *
@@ -552,21 +901,33 @@ pc_patch_range(const PCPATCH *pa, int first, int count)
 		return NULL;
 	paout->npoints = count;
 
-	pu = (PCPATCH_UNCOMPRESSED *) pc_patch_uncompress(pa);
-	if ( !pu )
+	if ( pa->type == PC_LAZPERF )
 	{
-		pc_patch_free((PCPATCH *) paout);
-		return NULL;
+		/* Only the chunks holding the range are decoded */
+		if ( PC_FAILURE == pc_patch_lazperf_decode_range((PCPATCH_LAZPERF *) pa, first, count, paout->data) )
+		{
+			pc_patch_free((PCPATCH *) paout);
+			return NULL;
+		}
 	}
+	else
+	{
+		pu = (PCPATCH_UNCOMPRESSED *) pc_patch_uncompress(pa);
+		if ( !pu )
+		{
+			pc_patch_free((PCPATCH *) paout);
+			return NULL;
+		}
 
-	buf = paout->data;
-	start = pa->schema->size * first;
-	size = pa->schema->size * count;
+		buf = paout->data;
+		start = pa->schema->size * first;
+		size = pa->schema->size * count;
 
-	memcpy(buf, pu->data + start, size);
+		memcpy(buf, pu->data + start, size);
 
-	if ( ((PCPATCH *) pu) != pa )
-		pc_patch_free((PCPATCH *) pu);
+		if ( ((PCPATCH *) pu) != pa )
+			pc_patch_free((PCPATCH *) pu);
+	}
 
 	if ( PC_FAILURE == pc_patch_uncompressed_compute_extent(paout) )
 	{
@@ -609,6 +970,163 @@ PCPOINT *pc_patch_pointn(const PCPATCH *patch, int n)
 	return NULL;
 }
 
+/** all the values of a dimension, as npoints doubles */
+double *pc_patch_dimension_to_double_array(const PCPATCH *patch, uint32_t dimnum)
+{
+	const PCDIMENSION *dim;
+	double *a;
+	uint32_t i;
+
+	if ( ! patch || dimnum >= patch->schema->ndims ) return NULL;
+
+	dim = patch->schema->dims[dimnum];
+	a = pcalloc(patch->npoints * sizeof(double));
+
+	if ( patch->type == PC_DIMENSIONAL )
+	{
+		/* Only decode the requested dimension */
+		const PCBYTES *pcb = pc_patch_dimensional_get_bytes((PCPATCH_DIMENSIONAL*)patch, dimnum);
+		for ( i = 0; i < patch->npoints; i++ )
+		{
+			double d = pc_double_from_ptr(pcb->bytes + i * dim->size, dim->interpretation);
+			a[i] = pc_value_scale_offset(d, dim);
+		}
+	}
+	else
+	{
+		PCPATCH_UNCOMPRESSED *pu = (PCPATCH_UNCOMPRESSED*)pc_patch_uncompress(patch);
+		PCPOINT pt;
+		pt.readonly = PC_TRUE;
+		pt.schema = patch->schema;
+		pt.data = pu->data;
+		for ( i = 0; i < patch->npoints; i++ )
+		{
+			pc_point_get_double(&pt, dim, &(a[i]));
+			pt.data += patch->schema->size;
+		}
+		if ( (PCPATCH*)pu != patch )
+			pc_patch_free((PCPATCH*)pu);
+	}
+
+	return a;
+}
+
+
+/**
+* Write the scaled values of a column as doubles into the points of
+* a WKB buffer, wkbstride bytes apart. Values are read in a first
+* loop and scaled in a second one, which the compiler can vectorize.
+*/
+static void
+pc_patch_column_to_wkb(const uint8_t *data, size_t stride, const PCDIMENSION *dim, uint32_t npoints, double *vals, uint8_t *wkb, size_t wkbstride)
+{
+	uint32_t i;
+	double scale = dim->scale;
+	double offset = dim->offset;
+
+	for ( i = 0; i < npoints; i++, data += stride )
+		vals[i] = pc_double_from_ptr(data, dim->interpretation);
+
+	for ( i = 0; i < npoints; i++ )
+		vals[i] = vals[i] * scale + offset;
+
+	for ( i = 0; i < npoints; i++, wkb += wkbstride )
+		memcpy(wkb, &(vals[i]), 8);
+}
+
+/**
+* Return the OGC (E)WKB MultiPoint of all the points of the patch,
+* with Z and M when the schema has them. The buffer is sized up front
+* and filled column by column, only the X/Y/Z/M columns of
+* dimensional patches are decoded.
+*/
+uint8_t *
+pc_patch_to_geometry_wkb_multipoint(const PCPATCH *patch, size_t *wkbsize)
+{
+	static uint32_t srid_mask = 0x20000000;
+	static uint32_t m_mask = 0x40000000;
+	static uint32_t z_mask = 0x80000000;
+	const PCSCHEMA *s = patch->schema;
+	const PCDIMENSION *dims[4];
+	PCPATCH_UNCOMPRESSED *pu = NULL;
+	uint32_t wkbtype = 4; /* WKB MULTIPOINT */
+	uint32_t pttype = 1; /* WKB POINT */
+	uint32_t srid = s->srid;
+	uint32_t npoints = patch->npoints;
+	uint32_t i;
+	int ndims = 2;
+	size_t ptsize, hdrsize = 1 + 4 + 4; /* endian + type + npoints */
+	uint8_t *wkb, *ptr;
+	double *vals;
+
+	if ( ! ( s->xdim && s->ydim ) )
+		return NULL;
+
+	dims[0] = s->xdim;
+	dims[1] = s->ydim;
+	if ( s->zdim )
+	{
+		dims[ndims++] = s->zdim;
+		pttype |= z_mask;
+	}
+	if ( s->mdim )
+	{
+		dims[ndims++] = s->mdim;
+		pttype |= m_mask;
+	}
+	wkbtype |= pttype & (z_mask | m_mask);
+
+	if ( srid )
+	{
+		wkbtype |= srid_mask;
+		hdrsize += 4;
+	}
+
+	ptsize = 1 + 4 + 8 * ndims; /* endian + type + coordinates */
+	wkb = pcalloc(hdrsize + ptsize * npoints);
+
+	ptr = wkb;
+	ptr[0] = machine_endian(); /* Endian flag */
+	memcpy(ptr + 1, &wkbtype, 4); /* WKB type */
+	ptr += 5;
+	if ( srid )
+	{
+		memcpy(ptr, &srid, 4); /* SRID */
+		ptr += 4;
+	}
+	memcpy(ptr, &npoints, 4); /* Number of points */
+	ptr += 4;
+
+	/* Point headers */
+	for ( i = 0; i < npoints; i++ )
+	{
+		ptr[ptsize * i] = machine_endian();
+		memcpy(ptr + ptsize * i + 1, &pttype, 4);
+	}
+
+	if ( patch->type != PC_DIMENSIONAL )
+		pu = (PCPATCH_UNCOMPRESSED*)pc_patch_uncompress(patch);
+
+	/* Coordinates */
+	vals = pcalloc((npoints ? npoints : 1) * sizeof(double));
+	for ( i = 0; i < ndims; i++ )
+	{
+		const PCDIMENSION *dim = dims[i];
+		uint8_t *coord = ptr + 5 + 8 * i;
+		if ( pu )
+			pc_patch_column_to_wkb(pu->data + dim->byteoffset, s->size, dim, npoints, vals, coord, ptsize);
+		else
+			pc_patch_column_to_wkb(pc_patch_dimensional_get_bytes((PCPATCH_DIMENSIONAL*)patch, dim->position)->bytes,
+			                       dim->size, dim, npoints, vals, coord, ptsize);
+	}
+	pcfree(vals);
+
+	if ( pu && (PCPATCH*)pu != patch )
+		pc_patch_free((PCPATCH*)pu);
+
+	if ( wkbsize ) *wkbsize = hdrsize + ptsize * npoints;
+	return wkb;
+}
 
 static void
 pc_patch_point_set(
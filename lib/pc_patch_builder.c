@@ -0,0 +1,341 @@
+/***********************************************************************
+* pc_patch_builder.c
+*
+*  Incremental patch construction. Points are appended straight
+*  into the row (uncompressed) or column (dimensional) buffers of
+*  the patch under construction, and bounds and stats are kept up
+*  to date as points come in, so no intermediate PCPOINTLIST or
+*  final pass over the data is needed.
+*
+*  PgSQL Pointcloud is free and open source software provided
+*  by the Government of Canada
+*  Copyright (c) 2013 Natural Resources Canada
+*
+***********************************************************************/
+
+#include "pc_api_internal.h"
+#include <assert.h>
+#include <float.h>
+
+PCPATCH_BUILDER *
+pc_patch_builder_make(const PCSCHEMA *s, uint32_t maxpoints)
+{
+	uint32_t i;
+	PCPATCH_BUILDER *pb;
+
+	if ( ! s )
+	{
+		pcerror("%s: null schema passed in", __func__);
+		return NULL;
+	}
+
+	if ( ! s->size )
+	{
+		pcerror("%s: invalid point size", __func__);
+		return NULL;
+	}
+
+	pb = pcalloc(sizeof(PCPATCH_BUILDER));
+	pb->schema = s;
+	pb->npoints = 0;
+	pb->maxpoints = 0;
+
+	/* Dimensional schemas get their columns built directly */
+	pb->type = ( s->compression == PC_DIMENSIONAL ) ? PC_DIMENSIONAL : PC_NONE;
+	if ( pb->type == PC_DIMENSIONAL )
+		pb->bytes = pcalloc(s->ndims * sizeof(PCBYTES));
+
+	pc_bounds_init(&(pb->bounds));
+	pb->min = pcalloc(s->ndims * sizeof(double));
+	pb->max = pcalloc(s->ndims * sizeof(double));
+	pb->sum = pcalloc(s->ndims * sizeof(double));
+	for ( i = 0; i < s->ndims; i++ )
+	{
+		pb->min[i] = DBL_MAX;
+		pb->max[i] = -1 * DBL_MAX;
+		pb->sum[i] = 0;
+	}
+
+	if ( maxpoints && PC_FAILURE == pc_patch_builder_reserve(pb, maxpoints) )
+	{
+		pc_patch_builder_free(pb);
+		return NULL;
+	}
+
+	return pb;
+}
+
+void
+pc_patch_builder_free(PCPATCH_BUILDER *pb)
+{
+	uint32_t i;
+
+	if ( ! pb ) return;
+
+	if ( pb->data )
+		pcfree(pb->data);
+
+	if ( pb->bytes )
+	{
+		for ( i = 0; i < pb->schema->ndims; i++ )
+			if ( pb->bytes[i].bytes )
+				pcfree(pb->bytes[i].bytes);
+		pcfree(pb->bytes);
+	}
+
+	pcfree(pb->min);
+	pcfree(pb->max);
+	pcfree(pb->sum);
+	pcfree(pb);
+}
+
+/**
+* Make sure the builder can hold maxpoints points without
+* reallocating its buffers.
+*/
+int
+pc_patch_builder_reserve(PCPATCH_BUILDER *pb, uint32_t maxpoints)
+{
+	uint32_t i;
+	const PCSCHEMA *s = pb->schema;
+
+	if ( maxpoints <= pb->maxpoints )
+		return PC_SUCCESS;
+
+	if ( pb->type == PC_DIMENSIONAL )
+	{
+		for ( i = 0; i < s->ndims; i++ )
+		{
+			PCDIMENSION *dim = s->dims[i];
+			PCBYTES *pcb = &(pb->bytes[i]);
+			size_t sz = (size_t)dim->size * maxpoints;
+			/* repalloc() cannot take a NULL pointer */
+			pcb->bytes = pcb->bytes ? pcrealloc(pcb->bytes, sz) : pcalloc(sz);
+			pcb->interpretation = dim->interpretation;
+			pcb->zdict = dim->zdict;
+			pcb->compression = PC_DIM_NONE;
+			pcb->readonly = PC_FALSE;
+		}
+	}
+	else
+	{
+		size_t sz = (size_t)s->size * maxpoints;
+		pb->data = pb->data ? pcrealloc(pb->data, sz) : pcalloc(sz);
+	}
+
+	pb->maxpoints = maxpoints;
+	return PC_SUCCESS;
+}
+
+/**
+* Make room for one more point, doubling the buffers
+* when they are full.
+*/
+static int
+pc_patch_builder_grow(PCPATCH_BUILDER *pb)
+{
+	if ( pb->npoints < pb->maxpoints )
+		return PC_SUCCESS;
+
+	return pc_patch_builder_reserve(pb, pb->maxpoints ? 2 * pb->maxpoints : 64);
+}
+
+/**
+* Fold the value of every dimension of the last point added
+* into the running bounds and stats.
+*/
+static void
+pc_patch_builder_update(PCPATCH_BUILDER *pb)
+{
+	uint32_t i;
+	const PCSCHEMA *s = pb->schema;
+	uint32_t n = pb->npoints - 1;
+
+	for ( i = 0; i < s->ndims; i++ )
+	{
+		PCDIMENSION *dim = s->dims[i];
+		uint8_t *ptr;
+		double val;
+
+		if ( pb->type == PC_DIMENSIONAL )
+			ptr = pb->bytes[i].bytes + dim->size * n;
+		else
+			ptr = pb->data + s->size * n + dim->byteoffset;
+
+		val = pc_value_scale_offset(pc_double_from_ptr(ptr, dim->interpretation), dim);
+
+		if ( val < pb->min[i] ) pb->min[i] = val;
+		if ( val > pb->max[i] ) pb->max[i] = val;
+		pb->sum[i] += val;
+
+		if ( dim == s->xdim )
+		{
+			if ( pb->bounds.xmin > val ) pb->bounds.xmin = val;
+			if ( pb->bounds.xmax < val ) pb->bounds.xmax = val;
+		}
+		if ( dim == s->ydim )
+		{
+			if ( pb->bounds.ymin > val ) pb->bounds.ymin = val;
+			if ( pb->bounds.ymax < val ) pb->bounds.ymax = val;
+		}
+	}
+}
+
+/**
+* Append a point given as raw bytes laid out according
+* to the builder schema.
+*/
+int
+pc_patch_builder_add_data(PCPATCH_BUILDER *pb, const uint8_t *data)
+{
+	uint32_t i;
+	const PCSCHEMA *s = pb->schema;
+
+	if ( PC_FAILURE == pc_patch_builder_grow(pb) )
+		return PC_FAILURE;
+
+	if ( pb->type == PC_DIMENSIONAL )
+	{
+		for ( i = 0; i < s->ndims; i++ )
+		{
+			PCDIMENSION *dim = s->dims[i];
+			memcpy(pb->bytes[i].bytes + dim->size * pb->npoints, data + dim->byteoffset, dim->size);
+		}
+	}
+	else
+	{
+		memcpy(pb->data + s->size * pb->npoints, data, s->size);
+	}
+
+	pb->npoints++;
+	pc_patch_builder_update(pb);
+	return PC_SUCCESS;
+}
+
+int
+pc_patch_builder_add_point(PCPATCH_BUILDER *pb, const PCPOINT *pt)
+{
+	if ( pt->schema->pcid != pb->schema->pcid )
+	{
+		pcerror("%s: pcids of point (%d) and patch (%d) not equal", __func__, pt->schema->pcid, pb->schema->pcid);
+		return PC_FAILURE;
+	}
+	return pc_patch_builder_add_data(pb, pt->data);
+}
+
+/**
+* Append a point given as one double per dimension, scale and
+* offset are removed before the values are stored.
+*/
+int
+pc_patch_builder_add_double_array(PCPATCH_BUILDER *pb, const double *vals, uint32_t nvals)
+{
+	uint32_t i;
+	const PCSCHEMA *s = pb->schema;
+
+	if ( nvals != s->ndims )
+	{
+		pcerror("%s: number of elements in schema (%d) and array (%d) differ", __func__, s->ndims, nvals);
+		return PC_FAILURE;
+	}
+
+	if ( PC_FAILURE == pc_patch_builder_grow(pb) )
+		return PC_FAILURE;
+
+	for ( i = 0; i < s->ndims; i++ )
+	{
+		PCDIMENSION *dim = s->dims[i];
+		uint8_t *ptr;
+
+		if ( pb->type == PC_DIMENSIONAL )
+			ptr = pb->bytes[i].bytes + dim->size * pb->npoints;
+		else
+			ptr = pb->data + s->size * pb->npoints + dim->byteoffset;
+
+		if ( PC_FAILURE == pc_double_to_ptr(ptr, dim->interpretation, pc_value_unscale_unoffset(vals[i], dim)) )
+		{
+			pcerror("%s: failed to write value for dimension \"%s\"", __func__, dim->name);
+			return PC_FAILURE;
+		}
+	}
+
+	pb->npoints++;
+	pc_patch_builder_update(pb);
+	return PC_SUCCESS;
+}
+
+/**
+* Hand the buffers over to a new patch, uncompressed, or dimensional
+* with each dimension compressed as its stats recommend, and free the
+* builder. Returns NULL if no point was added.
+*/
+PCPATCH *
+pc_patch_builder_finish(PCPATCH_BUILDER *pb)
+{
+	uint32_t i;
+	const PCSCHEMA *s = pb->schema;
+	uint32_t npoints = pb->npoints;
+	PCPATCH *pa;
+	PCSTATS *stats;
+
+	if ( ! npoints )
+	{
+		pc_patch_builder_free(pb);
+		return NULL;
+	}
+
+	stats = pc_stats_new(s);
+	for ( i = 0; i < s->ndims; i++ )
+	{
+		pc_point_set_double(&(stats->min), s->dims[i], pb->min[i]);
+		pc_point_set_double(&(stats->max), s->dims[i], pb->max[i]);
+		pc_point_set_double(&(stats->avg), s->dims[i], pb->sum[i] / npoints);
+	}
+
+	if ( pb->type == PC_DIMENSIONAL )
+	{
+		PCPATCH_DIMENSIONAL *pdl = pcalloc(sizeof(PCPATCH_DIMENSIONAL));
+		pdl->type = PC_DIMENSIONAL;
+		pdl->readonly = PC_FALSE;
+		pdl->bytes = pb->bytes;
+		for ( i = 0; i < s->ndims; i++ )
+		{
+			PCBYTES *pcb = &(pdl->bytes[i]);
+			pcb->npoints = npoints;
+			pcb->size = (size_t)s->dims[i]->size * npoints;
+			if ( npoints < pb->maxpoints )
+				pcb->bytes = pcrealloc(pcb->bytes, pcb->size);
+		}
+		pb->bytes = NULL;
+		pa = (PCPATCH*)pdl;
+	}
+	else
+	{
+		PCPATCH_UNCOMPRESSED *pu = pcalloc(sizeof(PCPATCH_UNCOMPRESSED));
+		pu->type = PC_NONE;
+		pu->readonly = PC_FALSE;
+		pu->maxpoints = npoints;
+		pu->datasize = (size_t)s->size * npoints;
+		pu->data = pb->data;
+		if ( npoints < pb->maxpoints )
+			pu->data = pcrealloc(pu->data, pu->datasize);
+		pb->data = NULL;
+		pa = (PCPATCH*)pu;
+	}
+
+	pa->schema = s;
+	pa->npoints = npoints;
+	pa->bounds = pb->bounds;
+	pa->stats = stats;
+	pc_patch_builder_free(pb);
+
+	/* The columns were built raw, encode them as pc_patch_compress would */
+	if ( pa->type == PC_DIMENSIONAL )
+	{
+		PCPATCH *pdl = (PCPATCH*)pc_patch_dimensional_compress((PCPATCH_DIMENSIONAL*)pa, NULL);
+		pc_patch_free(pa);
+		pa = pdl;
+	}
+
+	return pa;
+}
@@ -24,6 +24,7 @@ typedef struct
 	double xmin, xmax, ymin, ymax;
 	PCSTATS *stats;
 	PCBYTES *bytes;
+	PCBYTES *decoded;
 } PCPATCH_DIMENSIONAL;
 */
 
@@ -34,6 +35,7 @@ pc_patch_dimensional_clone(const PCPATCH_DIMENSIONAL *patch)
 	PCPATCH_DIMENSIONAL *pdl = pcalloc(sizeof(PCPATCH_DIMENSIONAL));
 	memcpy(pdl, patch, sizeof(PCPATCH_DIMENSIONAL));
 	pdl->bytes = pcalloc(patch->schema->ndims * sizeof(PCBYTES));
+	pdl->decoded = NULL;
 	pdl->npoints = 0;
 	pdl->stats = NULL;
 	return pdl;
@@ -56,9 +58,22 @@ pc_patch_dimensional_serialized_size(const PCPATCH_DIMENSIONAL *patch)
 char *
 pc_patch_dimensional_to_string(const PCPATCH_DIMENSIONAL *pa)
 {
-	PCPATCH_UNCOMPRESSED *patch = pc_patch_uncompressed_from_dimensional(pa);
-	char *str = pc_patch_uncompressed_to_string(patch);
-	pc_patch_free((PCPATCH*)patch);
+	const PCSCHEMA *s = pa->schema;
+	const uint8_t **cols = pcalloc(s->ndims * sizeof(uint8_t*));
+	size_t *strides = pcalloc(s->ndims * sizeof(size_t));
+	char *str;
+	int i;
+
+	/* Read the decoded columns in place, no need for an uncompressed copy */
+	for ( i = 0; i < s->ndims; i++ )
+	{
+		cols[i] = pc_patch_dimensional_get_bytes(pa, i)->bytes;
+		strides[i] = s->dims[i]->size;
+	}
+
+	str = pc_patch_columns_to_string(s, pa->npoints, cols, strides);
+	pcfree(cols);
+	pcfree(strides);
 	return str;
 }
 
@@ -122,6 +137,7 @@ pc_patch_dimensional_compress(const PCPATCH_DIMENSIONAL *pdl, PCDIMSTATS *pds_in
 	pdl_compressed = pcalloc(sizeof(PCPATCH_DIMENSIONAL));
 	memcpy(pdl_compressed, pdl, sizeof(PCPATCH_DIMENSIONAL));
 	pdl_compressed->bytes = pcalloc(ndims*sizeof(PCBYTES));
+	pdl_compressed->decoded = NULL;
 	pdl_compressed->stats = pc_stats_clone(pdl->stats);
 
 	/* Compress each dimension as dictated by stats */
@@ -148,11 +164,27 @@ pc_patch_dimensional_decompress(const PCPATCH_DIMENSIONAL *pdl)
 	pdl_decompressed = pcalloc(sizeof(PCPATCH_DIMENSIONAL));
 	memcpy(pdl_decompressed, pdl, sizeof(PCPATCH_DIMENSIONAL));
 	pdl_decompressed->bytes = pcalloc(ndims*sizeof(PCBYTES));
+	pdl_decompressed->decoded = NULL;
 
-	/* Compress each dimension as dictated by stats */
+	/* Decompress each dimension, reusing the already decoded ones */
 	for ( i = 0; i < ndims; i++ )
 	{
-		pdl_decompressed->bytes[i] = pc_bytes_decode(pdl->bytes[i]);
+		if ( pdl->decoded && pdl->decoded[i].bytes )
+		{
+			pdl_decompressed->bytes[i] = pc_bytes_clone(pdl->decoded[i]);
+			continue;
+		}
+		pdl_decompressed->bytes[i] = pc_bytes_make(pdl->schema->dims[i], pdl->npoints);
+		pdl_decompressed->bytes[i].zdict = pdl->bytes[i].zdict;
+		if ( PC_FAILURE == pc_bytes_decode_into(&(pdl->bytes[i]), pdl_decompressed->bytes[i].bytes, pdl_decompressed->bytes[i].size) )
+		{
+			pcerror("%s: failed to decode dimension %d", __func__, i);
+			for ( ; i >= 0; i-- )
+				pc_bytes_free(pdl_decompressed->bytes[i]);
+			pcfree(pdl_decompressed->bytes);
+			pcfree(pdl_decompressed);
+			return NULL;
+		}
 	}
 
 	return pdl_decompressed;
@@ -173,13 +205,57 @@ pc_patch_dimensional_free(PCPATCH_DIMENSIONAL *pdl)
 		pcfree(pdl->bytes);
 	}
 
+	if ( pdl->decoded )
+	{
+		for ( i = 0; i < pdl->schema->ndims; i++ )
+			if ( pdl->decoded[i].bytes )
+				pc_bytes_free(pdl->decoded[i]);
+
+		pcfree(pdl->decoded);
+	}
+
 	pcfree(pdl);
 }
 
+/**
+* Returns the uncompressed bytes of a dimension. Encoded dimensions are
+* decoded on first access and cached on the patch until it is freed, so
+* consumers only pay for the dimensions they actually read. NULL when
+* the dimension fails to decode.
+*/
+const PCBYTES *
+pc_patch_dimensional_get_bytes(const PCPATCH_DIMENSIONAL *pdl, uint32_t dimnum)
+{
+	PCPATCH_DIMENSIONAL *p = (PCPATCH_DIMENSIONAL*)pdl;
+
+	assert(pdl);
+	assert(dimnum < pdl->schema->ndims);
+
+	if ( pdl->bytes[dimnum].compression == PC_DIM_NONE )
+		return &(pdl->bytes[dimnum]);
+
+	if ( ! p->decoded )
+		p->decoded = pcalloc(pdl->schema->ndims * sizeof(PCBYTES));
+
+	if ( ! p->decoded[dimnum].bytes )
+	{
+		PCBYTES pcb = pc_bytes_make(pdl->schema->dims[dimnum], pdl->npoints);
+		pcb.zdict = pdl->bytes[dimnum].zdict;
+		if ( PC_FAILURE == pc_bytes_decode_into(&(pdl->bytes[dimnum]), pcb.bytes, pcb.size) )
+		{
+			pc_bytes_free(pcb);
+			return NULL;
+		}
+		p->decoded[dimnum] = pcb;
+	}
+
+	return &(p->decoded[dimnum]);
+}
+
 int
 pc_patch_dimensional_compute_extent(PCPATCH_DIMENSIONAL *pdl)
 {
-	double xmin, xmax, ymin, ymax, xavg, yavg;
+	double xmin, xmax, ymin, ymax;
 	int rv;
 	PCBYTES *pcb;
 
@@ -190,7 +266,7 @@ pc_patch_dimensional_compute_extent(PCPATCH_DIMENSIONAL *pdl)
 
 	/* Get x extremes */
 	pcb = &(pdl->bytes[pdl->schema->xdim->position]);
-	rv = pc_bytes_minmax(pcb, &xmin, &xmax, &xavg);
+	rv = pc_bytes_minmax(pcb, &xmin, &xmax, NULL);
 	if ( PC_FAILURE == rv ) return PC_FAILURE;
 	xmin = pc_value_scale_offset(xmin, pdl->schema->xdim);
 	xmax = pc_value_scale_offset(xmax, pdl->schema->xdim);
@@ -199,7 +275,7 @@ pc_patch_dimensional_compute_extent(PCPATCH_DIMENSIONAL *pdl)
 
 	/* Get y extremes */
 	pcb = &(pdl->bytes[pdl->schema->ydim->position]);
-	rv = pc_bytes_minmax(pcb, &ymin, &ymax, &yavg);
+	rv = pc_bytes_minmax(pcb, &ymin, &ymax, NULL);
 	if ( PC_FAILURE == rv ) return PC_FAILURE;
 	ymin = pc_value_scale_offset(ymin, pdl->schema->ydim);
 	ymax = pc_value_scale_offset(ymax, pdl->schema->ydim);
@@ -223,12 +299,57 @@ pc_patch_dimensional_to_wkb(const PCPATCH_DIMENSIONAL *patch, size_t *wkbsize)
 	int i;
 	uint8_t *buf;
 	char endian = machine_endian();
-	/* endian + pcid + compression + npoints + datasize */
-	size_t size = 1 + 4 + 4 + 4 + pc_patch_dimensional_serialized_size(patch);
-	uint8_t *wkb = pcalloc(size);
+	/* endian + pcid + compression + npoints */
+	size_t size = 1 + 4 + 4 + 4;
+	uint8_t *wkb;
 	uint32_t compression = patch->type;
 	uint32_t npoints = patch->npoints;
 	uint32_t pcid = patch->schema->pcid;
+	PCBYTES *cols = pcalloc(ndims * sizeof(PCBYTES));
+	PCSINK scratch;
+
+	/*
+	* Preset dictionaries only live in the pointcloud_dictionaries
+	* of this database, so wkb zlib streams are written without
+	*/
+	pc_sink_init(&scratch, 0);
+	for ( i = 0; i < ndims; i++ )
+	{
+		const PCBYTES *pcb = &(patch->bytes[i]);
+		uint32_t dictid;
+		PCBYTES dpcb;
+
+		cols[i] = *pcb;
+		if ( pcb->compression == PC_DIM_ZLIB && pc_bytes_zlib_dictid(pcb->bytes, pcb->size, &dictid) )
+		{
+			if ( PC_SUCCESS == pc_bytes_decode_scratch(pcb, &scratch, &dpcb) )
+			{
+				dpcb.zdict = NULL;
+				cols[i] = pc_bytes_encode(dpcb, PC_DIM_ZLIB);
+				cols[i].zdict = pcb->zdict;
+			}
+			else
+			{
+				cols[i].bytes = NULL;
+			}
+			if ( ! cols[i].bytes )
+			{
+				pcerror("%s: failed to recompress dimension %d", __func__, i);
+				while ( --i >= 0 )
+					if ( cols[i].bytes != patch->bytes[i].bytes )
+						pc_bytes_free(cols[i]);
+				pcfree(cols);
+				if ( scratch.bytes )
+					pcfree(scratch.bytes);
+				return NULL;
+			}
+		}
+		size += pc_bytes_serialized_size(&(cols[i]));
+	}
+	if ( scratch.bytes )
+		pcfree(scratch.bytes);
+
+	wkb = pcalloc(size);
 	wkb[0] = endian; /* Write endian flag */
 	memcpy(wkb + 1, &pcid,        4); /* Write PCID */
 	memcpy(wkb + 5, &compression, 4); /* Write compression */
@@ -238,12 +359,12 @@ pc_patch_dimensional_to_wkb(const PCPATCH_DIMENSIONAL *patch, size_t *wkbsize)
 	for ( i = 0; i < ndims; i++ )
 	{
 		size_t bsz;
-		PCBYTES *pcb = &(patch->bytes[i]);
-// XXX        printf("pcb->(size=%d, interp=%d, npoints=%d, compression=%d, readonly=%d)\n",pcb->size, pcb->interpretation, pcb->npoints, pcb->compression, pcb->readonly);
-
-		pc_bytes_serialize(pcb, buf, &bsz);
+		pc_bytes_serialize(&(cols[i]), buf, &bsz);
 		buf += bsz;
+		if ( cols[i].bytes != patch->bytes[i].bytes )
+			pc_bytes_free(cols[i]);
 	}
+	pcfree(cols);
 
 	if ( wkbsize ) *wkbsize = size;
 	return wkb;
@@ -251,7 +372,7 @@ pc_patch_dimensional_to_wkb(const PCPATCH_DIMENSIONAL *patch, size_t *wkbsize)
 
 
 PCPATCH *
-pc_patch_dimensional_from_wkb(const PCSCHEMA *schema, const uint8_t *wkb, size_t wkbsize)
+pc_patch_dimensional_from_wkb(const PCSCHEMA *schema, const uint8_t *wkb, size_t wkbsize, int readonly)
 {
 	/*
 	byte:     endianness (1 = NDR, 0 = XDR)
@@ -260,7 +381,7 @@ pc_patch_dimensional_from_wkb(const PCSCHEMA *schema, const uint8_t *wkb, size_t
 	uint32:   npoints
 	dimensions[]:  dims (interpret relative to pcid and compressions)
 	*/
-	static size_t hdrsz = 1+4+4+4; /* endian + pcid + compression + npoints */
+	size_t hdrsz = pc_patch_wkb_header_size(schema, wkb); /* endian + pcid + compression + npoints + blocks */
 	PCPATCH_DIMENSIONAL *patch;
 	uint8_t swap_endian = (wkb[0] != machine_endian());
 	uint32_t npoints, ndims;
@@ -288,7 +409,8 @@ pc_patch_dimensional_from_wkb(const PCSCHEMA *schema, const uint8_t *wkb, size_t
 	{
 		PCBYTES *pcb = &(patch->bytes[i]);
 		PCDIMENSION *dim = schema->dims[i];
-		pc_bytes_deserialize(buf, dim, pcb, PC_FALSE /*readonly*/, swap_endian);
+		/* Byte swapped input cannot be used in place */
+		pc_bytes_deserialize(buf, dim, pcb, readonly && ! swap_endian, swap_endian);
 		pcb->npoints = npoints;
 		buf += pc_bytes_serialized_size(pcb);
 	}
@@ -306,6 +428,71 @@ pc_patch_dimensional_from_pointlist(const PCPOINTLIST *pdl)
 	return dimpatch;
 }
 
+/**
+* Append the points of pa to a copy of pdl. The new points are
+* encoded on their own and spliced onto the existing columns,
+* which keep their compression and are not decoded unless they
+* are deflated. Bounds and stats are merged, not recomputed.
+*/
+PCPATCH_DIMENSIONAL *
+pc_patch_dimensional_append(const PCPATCH_DIMENSIONAL *pdl, const PCPATCH *pa)
+{
+	int i;
+	const PCSCHEMA *schema = pdl->schema;
+	PCPATCH_DIMENSIONAL *pdlout, *padl = NULL;
+	PCPATCH *pu = NULL;
+
+	assert(pdl);
+	assert(pa);
+
+	if ( pa->schema->pcid != schema->pcid )
+	{
+		pcerror("%s: pcids of patches (%d) and (%d) not equal", __func__, schema->pcid, pa->schema->pcid);
+		return NULL;
+	}
+
+	/* Get the new points as dimensions */
+	if ( pa->type == PC_DIMENSIONAL )
+	{
+		padl = (PCPATCH_DIMENSIONAL*)pa;
+	}
+	else if ( pa->npoints )
+	{
+		pu = pc_patch_uncompress(pa);
+		padl = pc_patch_dimensional_from_uncompressed((PCPATCH_UNCOMPRESSED*)pu);
+	}
+
+	pdlout = pc_patch_dimensional_clone(pdl);
+	pdlout->npoints = pdl->npoints + pa->npoints;
+	for ( i = 0; i < schema->ndims; i++ )
+	{
+		PCBYTES empty = pc_bytes_make(schema->dims[i], 0);
+		const PCBYTES *add = padl ? pc_patch_dimensional_get_bytes(padl, i) : &empty;
+		pdlout->bytes[i] = pc_bytes_append(&(pdl->bytes[i]), add);
+		pc_bytes_free(empty);
+	}
+
+	if ( pa->npoints )
+		pc_bounds_merge(&(pdlout->bounds), &(pa->bounds));
+
+	if ( pdl->stats && pa->stats )
+	{
+		pdlout->stats = pc_stats_clone(pdl->stats);
+		pc_stats_merge(pdlout->stats, pdl->npoints, pa->stats, pa->npoints);
+	}
+	else if ( PC_FAILURE == pc_patch_dimensional_compute_stats(pdlout) )
+	{
+		pcerror("%s: failed to compute patch stats", __func__);
+	}
+
+	if ( padl && padl != (PCPATCH_DIMENSIONAL*)pa )
+		pc_patch_free((PCPATCH*)padl);
+	if ( pu && pu != pa )
+		pc_patch_free(pu);
+
+	return pdlout;
+}
+
 /** get point n, 0-based, positive */
 PCPOINT *pc_patch_dimensional_pointn(const PCPATCH_DIMENSIONAL *pdl, int n)
 {
@@ -318,7 +505,16 @@ PCPOINT *pc_patch_dimensional_pointn(const PCPATCH_DIMENSIONAL *pdl, int n)
 	for ( i = 0; i < ndims; i++ )
 	{
 		PCDIMENSION *dim = pc_schema_get_dimension(pdl->schema, i);
-		pc_bytes_to_ptr(buf+dim->byteoffset,pdl->bytes[i], n);
+		const PCBYTES *pcb = &(pdl->bytes[i]);
+		/* Deflated dimensions cannot be read in place */
+		if ( pcb->compression == PC_DIM_ZLIB || (pdl->decoded && pdl->decoded[i].bytes) )
+			pcb = pc_patch_dimensional_get_bytes(pdl, i);
+		if ( ! pcb )
+		{
+			pc_point_free(pt);
+			return NULL;
+		}
+		pc_bytes_to_ptr(buf+dim->byteoffset, pcb, n);
 	}
 
 	return pt;
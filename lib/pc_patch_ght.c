@@ -96,6 +96,62 @@ ght_tree_from_pc_patch(const PCPATCH_GHT *paght)
 
 	return tree;
 }
+
+/**
+* Walk the nodes of a tree and rebuild its points as an uncompressed
+* patch. Bounds and stats are accumulated by the builder on the way,
+* so they describe the points of the tree.
+* Returns NULL if the tree has no point.
+*/
+static PCPATCH_UNCOMPRESSED *
+pc_patch_uncompressed_from_ght_tree(const PCSCHEMA *schema, GhtTreePtr tree)
+{
+	int i, npoints;
+	GhtNodeListPtr nodelist;
+	GhtNodePtr node;
+	GhtCoordinate coord;
+	GhtAttributePtr attr;
+	PCPATCH_BUILDER *pb;
+	double *vals = pcalloc(schema->ndims * sizeof(double));
+
+	ght_tree_get_numpoints(tree, &npoints);
+	ght_nodelist_new(npoints, &nodelist);
+	ght_tree_to_nodelist(tree, nodelist);
+	ght_nodelist_get_num_nodes(nodelist, &npoints);
+
+	pb = pc_patch_builder_make(schema, npoints);
+
+	for ( i = 0; i < npoints; i++ )
+	{
+		ght_nodelist_get_node(nodelist, i, &node);
+		ght_node_get_coordinate(node, &coord);
+		vals[schema->xdim->position] = coord.x;
+		vals[schema->ydim->position] = coord.y;
+
+		ght_node_get_attributes(node, &attr);
+		while ( attr )
+		{
+			GhtDimensionPtr ghtdim;
+			const PCDIMENSION *dim;
+			const char *name;
+			double val;
+			ght_attribute_get_value(attr, &val);
+			ght_attribute_get_dimension(attr, &ghtdim);
+			ght_dimension_get_name(ghtdim, &name);
+			dim = pc_schema_get_dimension_by_name(schema, name);
+			if ( dim )
+				vals[dim->position] = val;
+			ght_attribute_get_next(attr, &attr);
+		}
+
+		pc_patch_builder_add_double_array(pb, vals, schema->ndims);
+	}
+
+	ght_nodelist_free_deep(nodelist);
+	pcfree(vals);
+
+	return (PCPATCH_UNCOMPRESSED*)pc_patch_builder_finish(pb);
+}
 #endif /* HAVE_LIBGHT */
 
 PCPATCH_GHT *
@@ -125,6 +181,7 @@ pc_patch_ght_from_uncompressed(const PCPATCH_UNCOMPRESSED *pa)
 	PCDIMENSION *xdim, *ydim;
 	PCPATCH_GHT *paght = NULL;
 	size_t pt_size = pa->schema->size;
+	unsigned int resolution;
 
 	/* Cannot handle empty patches */
 	if ( ! pa || ! pa->npoints ) return NULL;
@@ -135,6 +192,10 @@ pc_patch_ght_from_uncompressed(const PCPATCH_UNCOMPRESSED *pa)
 	xdim = pa->schema->xdim;
 	ydim = pa->schema->ydim;
 
+	resolution = pa->schema->ghtkeylength;
+	if ( ! resolution || resolution > GHT_MAX_HASH_LENGTH )
+		resolution = GHT_MAX_HASH_LENGTH;
+
 	schema = ght_schema_from_pc_schema(pa->schema);
 	if ( ght_tree_new(schema, &tree) != GHT_OK ) {
 		pcerror("ght_tree_new failed");
@@ -149,8 +210,7 @@ pc_patch_ght_from_uncompressed(const PCPATCH_UNCOMPRESSED *pa)
 		pc_point_get_double(&pt, ydim, &(coord.y));
 
 		/* Build a node from the x/y information */
-		/* TODO, make resolution configurable from the schema */
-		if ( ght_node_new_from_coordinate(&coord, GHT_MAX_HASH_LENGTH, &node) == GHT_OK )
+		if ( ght_node_new_from_coordinate(&coord, resolution, &node) == GHT_OK )
 		{
 			unsigned int num_dims;
 			ght_schema_get_num_dimensions(schema, &num_dims);
@@ -343,7 +403,7 @@ pc_patch_ght_from_wkb(const PCSCHEMA *schema, const uint8_t *wkb, size_t wkbsize
 	uint32:   ghtsize
 	uint8[]:  ghtbuffer
 	*/
-	static size_t hdrsz = 1+4+4+4; /* endian + pcid + compression + npoints */
+	size_t hdrsz = pc_patch_wkb_header_size(schema, wkb); /* endian + pcid + compression + npoints + blocks */
 	PCPATCH_GHT *patch;
 	uint8_t swap_endian = (wkb[0] != machine_endian());
 	uint32_t npoints;
@@ -486,6 +546,7 @@ pc_patch_ght_filter(const PCPATCH_GHT *patch, uint32_t dimnum, PC_FILTERTYPE fil
 	const char *dimname;
 	const PCDIMENSION *dim;
 	PCPATCH_GHT *paght;
+	PCPATCH_UNCOMPRESSED *pu;
 	int npoints;
 
 	/* Echo null back */
@@ -551,8 +612,14 @@ pc_patch_ght_filter(const PCPATCH_GHT *patch, uint32_t dimnum, PC_FILTERTYPE fil
 		paght->bounds.ymin = area.y.min;
 		paght->bounds.ymax = area.y.max;
 
-		/* TODO: Replace this; need to update stats too */
-		paght->stats = pc_stats_clone(patch->stats);
+		/* The input stats no longer apply, take those of the points left */
+		pu = pc_patch_uncompressed_from_ght_tree(patch->schema, tree_filtered);
+		if ( pu )
+		{
+			paght->stats = pu->stats;
+			pu->stats = NULL;
+			pc_patch_free((PCPATCH*)pu);
+		}
 
 		/* Convert the tree to a memory buffer */
 		ght_writer_new_mem(&writer);
@@ -571,7 +638,6 @@ pc_patch_ght_filter(const PCPATCH_GHT *patch, uint32_t dimnum, PC_FILTERTYPE fil
 #endif
 }
 
-
 PCPOINTLIST *
 pc_pointlist_from_ght(const PCPATCH_GHT *pag)
 {
@@ -20,6 +20,41 @@ pc_patch_lazperf_free(PCPATCH_LAZPERF *pal)
 	pcfree(pal);
 }
 
+/**
+* LAZ data is stored without its record format byte when it is a
+* single dynamic stream, as LAZ patches always were, and flagged
+* with PC_WKB_LAZHEADER otherwise. Returns the data to store.
+*/
+const uint8_t *
+pc_patch_lazperf_stored(const PCPATCH_LAZPERF *pal, size_t *size, uint32_t *flags)
+{
+	if ( pal->lazperfsize && pal->lazperf[0] == LAZPERF_DYNAMIC )
+	{
+		*size = pal->lazperfsize - 1;
+		*flags = 0;
+		return pal->lazperf + 1;
+	}
+	*size = pal->lazperfsize;
+	*flags = PC_WKB_LAZHEADER;
+	return pal->lazperf;
+}
+
+/**
+* Copy stored LAZ data into the patch, putting the record format
+* byte back when flags do not have PC_WKB_LAZHEADER.
+*/
+void
+pc_patch_lazperf_set_stored(PCPATCH_LAZPERF *pal, const uint8_t *buf, size_t size, uint32_t flags)
+{
+	size_t hdrsize = ( flags & PC_WKB_LAZHEADER ) ? 0 : 1;
+
+	pal->lazperfsize = hdrsize + size;
+	pal->lazperf = pcalloc(pal->lazperfsize);
+	if ( hdrsize )
+		pal->lazperf[0] = LAZPERF_DYNAMIC;
+	memcpy(pal->lazperf + hdrsize, buf, size);
+}
+
 PCPATCH_LAZPERF *
 pc_patch_lazperf_from_pointlist(const PCPOINTLIST *pdl)
 {
@@ -30,42 +65,366 @@ pc_patch_lazperf_from_pointlist(const PCPOINTLIST *pdl)
 	return lazperfpatch;
 }
 
+#ifdef HAVE_LAZPERF
+/**
+* Chunks of the LAZ data. Unchunked data is a single stream of
+* all the points, chunked data has one independent stream for
+* every chunksize points, so points can be decoded without going
+* through the streams before them.
+*/
+typedef struct
+{
+	int format;
+	uint32_t chunksize;
+	uint32_t nchunks;
+	const uint8_t *ends;    /* end offsets of the streams, or NULL */
+	const uint8_t *bounds;  /* X/Y bounds of the chunks, or NULL */
+	const uint8_t *data;    /* start of the first stream */
+	size_t size;            /* size of all the streams */
+} PCLAZCHUNKS;
+
+/* The chunk table is little endian, as in LAZ files */
+static void
+lazperf_put_le(uint8_t *buf, const void *val, size_t size)
+{
+	memcpy(buf, val, size);
+	if ( machine_endian() == PC_XDR )
+		pc_flip_endian_strided(buf, size, size, 1);
+}
+
+static void
+lazperf_get_le(const uint8_t *buf, void *val, size_t size)
+{
+	memcpy(val, buf, size);
+	if ( machine_endian() == PC_XDR )
+		pc_flip_endian_strided(val, size, size, 1);
+}
+
+static int
+pc_patch_lazperf_chunks(const PCPATCH_LAZPERF *pal, PCLAZCHUNKS *lc)
+{
+	const uint8_t *ptr = pal->lazperf;
+	size_t hdrsize = 1;
+
+	if ( pal->lazperfsize < 1 )
+	{
+		pcerror("%s: empty LAZ data", __func__);
+		return PC_FAILURE;
+	}
+
+	lc->format = ptr[0] & LAZPERF_FORMAT_MASK;
+	lc->chunksize = pal->npoints;
+	lc->nchunks = 1;
+	lc->ends = lc->bounds = NULL;
+
+	if ( ptr[0] & LAZPERF_CHUNKED )
+	{
+		if ( pal->lazperfsize < 9 )
+		{
+			pcerror("%s: truncated LAZ chunk table", __func__);
+			return PC_FAILURE;
+		}
+		lazperf_get_le(ptr + 1, &(lc->chunksize), 4);
+		lazperf_get_le(ptr + 5, &(lc->nchunks), 4);
+		lc->ends = ptr + 9;
+		hdrsize = 9 + 4 * (size_t)lc->nchunks;
+		if ( ptr[0] & LAZPERF_CHUNK_BOUNDS )
+		{
+			lc->bounds = ptr + hdrsize;
+			hdrsize += 4 * sizeof(double) * lc->nchunks;
+		}
+		if ( ! lc->chunksize || hdrsize > pal->lazperfsize ||
+		     (uint64_t)lc->chunksize * lc->nchunks < pal->npoints )
+		{
+			pcerror("%s: invalid LAZ chunk table", __func__);
+			return PC_FAILURE;
+		}
+	}
+
+	lc->data = ptr + hdrsize;
+	lc->size = pal->lazperfsize - hdrsize;
+	return PC_SUCCESS;
+}
+#endif
+
 PCPATCH_LAZPERF*
 pc_patch_lazperf_from_uncompressed(const PCPATCH_UNCOMPRESSED *pa)
 {
 #ifndef HAVE_LAZPERF
 	pcerror("%s: lazperf support is not enabled", __func__);
 	return NULL;
-#endif
+#else
+	const PCSCHEMA *s = pa->schema;
+	PCPATCH_LAZPERF *palaz;
+	uint32_t chunksize = s->lazchunksize;
+	uint32_t nchunks = 1;
+	uint32_t i;
+	int format = lazperf_format(s, pa->data, pa->npoints);
+	int has_bounds = 0;
+	uint8_t **streams;
+	size_t *sizes;
+	size_t hdrsize = 1;
+	size_t size = 0;
+	uint8_t *ptr;
+
+	/* Patches that fit in a chunk are kept as a single stream */
+	if ( chunksize && chunksize < pa->npoints )
+	{
+		nchunks = (pa->npoints + chunksize - 1) / chunksize;
+		has_bounds = s->xdim && s->ydim;
+		hdrsize = 9 + 4 * (size_t)nchunks;
+		if ( has_bounds )
+			hdrsize += 4 * sizeof(double) * nchunks;
+	}
+	else
+		chunksize = pa->npoints;
 
-	PCPATCH_LAZPERF *palaz = NULL;
-	uint8_t *compressed;
+	streams = pcalloc(nchunks * sizeof(uint8_t*));
+	sizes = pcalloc(nchunks * sizeof(size_t));
+	for ( i = 0; i < nchunks; i++ )
+	{
+		uint32_t first = i * chunksize;
+		uint32_t n = pa->npoints - first < chunksize ? pa->npoints - first : chunksize;
+
+		// cpp call to get compressed data from the points of the chunk
+		sizes[i] = lazperf_compress(s, format, pa->data + s->size * first, n, &streams[i]);
+		if ( sizes[i] == -1 )
+		{
+			while ( i-- )
+				free(streams[i]);
+			pcfree(streams);
+			pcfree(sizes);
+			pcerror("%s: LAZ compressionf failed", __func__);
+			return NULL;
+		}
+		size += sizes[i];
+	}
 
-	// cpp call to get compressed data from pcpatch
-	size_t compressSize = lazperf_compress_from_uncompressed(pa, &compressed);
+	palaz = pcalloc(sizeof(PCPATCH_LAZPERF));
+	palaz->type = PC_LAZPERF;
+	palaz->readonly = PC_FALSE;
+	palaz->schema = s;
+	palaz->npoints = pa->npoints;
+	palaz->bounds = pa->bounds;
+	palaz->stats = pc_stats_clone(pa->stats);
+	palaz->lazperfsize = hdrsize + size;
+
+	// not optimal but we have to pass by the context manager otherwise
+	// a segfault happenned (sometimes) during a pcfree of lazperf field
+	palaz->lazperf = (uint8_t*) pcalloc(palaz->lazperfsize);
+	palaz->lazperf[0] = format;
+
+	if ( nchunks > 1 )
+	{
+		uint32_t end = 0;
+		palaz->lazperf[0] |= LAZPERF_CHUNKED | ( has_bounds ? LAZPERF_CHUNK_BOUNDS : 0 );
+		lazperf_put_le(palaz->lazperf + 1, &chunksize, 4);
+		lazperf_put_le(palaz->lazperf + 5, &nchunks, 4);
+		ptr = palaz->lazperf + 9;
+		for ( i = 0; i < nchunks; i++, ptr += 4 )
+		{
+			end += sizes[i];
+			lazperf_put_le(ptr, &end, 4);
+		}
+		for ( i = 0; has_bounds && i < nchunks; i++ )
+		{
+			PCBOUNDS b;
+			uint32_t j = i * chunksize;
+			uint32_t last = j + chunksize < pa->npoints ? j + chunksize : pa->npoints;
+			pc_bounds_init(&b);
+			for ( ; j < last; j++ )
+			{
+				const uint8_t *pt = pa->data + s->size * j;
+				double x = pc_value_scale_offset(pc_double_from_ptr(pt + s->xdim->byteoffset, s->xdim->interpretation), s->xdim);
+				double y = pc_value_scale_offset(pc_double_from_ptr(pt + s->ydim->byteoffset, s->ydim->interpretation), s->ydim);
+				if ( b.xmin > x ) b.xmin = x;
+				if ( b.xmax < x ) b.xmax = x;
+				if ( b.ymin > y ) b.ymin = y;
+				if ( b.ymax < y ) b.ymax = y;
+			}
+			lazperf_put_le(ptr, &(b.xmin), 8);
+			lazperf_put_le(ptr + 8, &(b.ymin), 8);
+			lazperf_put_le(ptr + 16, &(b.xmax), 8);
+			lazperf_put_le(ptr + 24, &(b.ymax), 8);
+			ptr += 32;
+		}
+	}
 
-	if (compressSize != -1)
+	ptr = palaz->lazperf + hdrsize;
+	for ( i = 0; i < nchunks; i++ )
 	{
-		palaz = pcalloc(sizeof(PCPATCH_LAZPERF));
-		palaz->type = PC_LAZPERF;
-		palaz->readonly = PC_FALSE;
-		palaz->schema = pa->schema;
-
-		// not optimal but we have to pass by the context manager otherwise
-		// a segfault happenned (sometimes) during a pcfree of lazperf field
-		palaz->lazperf = (uint8_t*) pcalloc(compressSize);
-		memcpy(palaz->lazperf, compressed, compressSize);
-		free(compressed);
-
-		palaz->npoints = pa->npoints;
-		palaz->bounds = pa->bounds;
-		palaz->stats = pc_stats_clone(pa->stats);
-		palaz->lazperfsize = compressSize;
+		memcpy(ptr, streams[i], sizes[i]);
+		ptr += sizes[i];
+		free(streams[i]);
 	}
-	else
-		pcerror("%s: LAZ compressionf failed", __func__);
+	pcfree(streams);
+	pcfree(sizes);
 
 	return palaz;
+#endif
+}
+
+/**
+* Decode points first to first + count - 1 into data, going through
+* the chunks holding them only. The decoding state is all local, so
+* distinct ranges, such as distinct chunks, can be decoded from
+* different threads.
+*/
+int
+pc_patch_lazperf_decode_range(const PCPATCH_LAZPERF *pal, uint32_t first, uint32_t count, uint8_t *data)
+{
+#ifndef HAVE_LAZPERF
+	pcerror("%s: lazperf support is not enabled", __func__);
+	return PC_FAILURE;
+#else
+	PCLAZCHUNKS lc;
+	size_t ptsize = pal->schema->size;
+	uint32_t end = first + count;
+	uint32_t c;
+
+	if ( first > pal->npoints || count > pal->npoints - first )
+	{
+		pcerror("%s: points %u to %u out of range", __func__, first, end);
+		return PC_FAILURE;
+	}
+
+	if ( ! count )
+		return PC_SUCCESS;
+
+	if ( PC_FAILURE == pc_patch_lazperf_chunks(pal, &lc) )
+		return PC_FAILURE;
+
+	for ( c = first / lc.chunksize; c < lc.nchunks && (uint64_t)c * lc.chunksize < end; c++ )
+	{
+		uint32_t cfirst = c * lc.chunksize;
+		uint32_t from = first > cfirst ? first : cfirst;
+		uint32_t to = end - cfirst < lc.chunksize ? end : cfirst + lc.chunksize;
+		uint32_t start = 0, stop = lc.size;
+		uint8_t *buf;
+
+		if ( lc.ends )
+		{
+			if ( c ) lazperf_get_le(lc.ends + 4 * (c - 1), &start, 4);
+			lazperf_get_le(lc.ends + 4 * c, &stop, 4);
+			if ( start > stop || stop > lc.size )
+			{
+				pcerror("%s: invalid LAZ chunk table", __func__);
+				return PC_FAILURE;
+			}
+		}
+
+		/* Streams are read from their start, up to the last point needed */
+		buf = from == cfirst ? data + ptsize * (from - first) : pcalloc(ptsize * (to - cfirst));
+		if ( lazperf_uncompress(pal->schema, lc.format, lc.data + start, stop - start, buf, to - cfirst) == -1 )
+		{
+			if ( from != cfirst ) pcfree(buf);
+			pcerror("%s: lazperf uncompression failed", __func__);
+			return PC_FAILURE;
+		}
+		if ( from != cfirst )
+		{
+			memcpy(data + ptsize * (from - first), buf + ptsize * (from - cfirst), ptsize * (to - from));
+			pcfree(buf);
+		}
+	}
+
+	return PC_SUCCESS;
+#endif
+}
+
+/**
+* Number of chunks of the LAZ data, 1 for a single stream, with
+* the number of points per chunk in chunksize. Returns 0 on error.
+*/
+uint32_t
+pc_patch_lazperf_nchunks(const PCPATCH_LAZPERF *pal, uint32_t *chunksize)
+{
+#ifndef HAVE_LAZPERF
+	pcerror("%s: lazperf support is not enabled", __func__);
+	return 0;
+#else
+	PCLAZCHUNKS lc;
+
+	if ( PC_FAILURE == pc_patch_lazperf_chunks(pal, &lc) )
+		return 0;
+
+	if ( chunksize )
+		*chunksize = lc.chunksize;
+	return lc.nchunks;
+#endif
+}
+
+/**
+* X/Y bounds of the points of a chunk. Returns PC_FAILURE if the
+* LAZ data has no chunk bounds.
+*/
+int
+pc_patch_lazperf_chunk_bounds(const PCPATCH_LAZPERF *pal, uint32_t chunk, PCBOUNDS *bounds)
+{
+#ifndef HAVE_LAZPERF
+	pcerror("%s: lazperf support is not enabled", __func__);
+	return PC_FAILURE;
+#else
+	PCLAZCHUNKS lc;
+	const uint8_t *ptr;
+
+	if ( PC_FAILURE == pc_patch_lazperf_chunks(pal, &lc) )
+		return PC_FAILURE;
+
+	if ( ! lc.bounds || chunk >= lc.nchunks )
+		return PC_FAILURE;
+
+	ptr = lc.bounds + 32 * chunk;
+	lazperf_get_le(ptr, &(bounds->xmin), 8);
+	lazperf_get_le(ptr + 8, &(bounds->ymin), 8);
+	lazperf_get_le(ptr + 16, &(bounds->xmax), 8);
+	lazperf_get_le(ptr + 24, &(bounds->ymax), 8);
+	return PC_SUCCESS;
+#endif
+}
+
+/**
+* Uncompressed patch of the points of the chunks whose bounds
+* intersect the box, so filters skip decoding the other chunks.
+* All the points are decoded when there are no chunk bounds.
+*/
+PCPATCH_UNCOMPRESSED*
+pc_patch_uncompressed_from_lazperf_box(const PCPATCH_LAZPERF *pal, const PCBOUNDS *box)
+{
+#ifndef HAVE_LAZPERF
+	pcerror("%s: lazperf support is not enabled", __func__);
+	return NULL;
+#else
+	PCPATCH_UNCOMPRESSED *pcu;
+	uint32_t chunksize, nchunks, c;
+	PCBOUNDS b;
+
+	nchunks = pc_patch_lazperf_nchunks(pal, &chunksize);
+	if ( nchunks < 2 || PC_FAILURE == pc_patch_lazperf_chunk_bounds(pal, 0, &b) )
+		return pc_patch_uncompressed_from_lazperf(pal);
+
+	pcu = pc_patch_uncompressed_make(pal->schema, pal->npoints);
+	for ( c = 0; c < nchunks; c++ )
+	{
+		uint32_t first = c * chunksize;
+		uint32_t n = pal->npoints - first < chunksize ? pal->npoints - first : chunksize;
+
+		pc_patch_lazperf_chunk_bounds(pal, c, &b);
+		if ( ! pc_bounds_intersects(&b, box) )
+			continue;
+
+		if ( PC_FAILURE == pc_patch_lazperf_decode_range(pal, first, n, pcu->data + pal->schema->size * pcu->npoints) )
+		{
+			pc_patch_free((PCPATCH*)pcu);
+			return NULL;
+		}
+		pcu->npoints += n;
+	}
+
+	pcu->datasize = pal->schema->size * pcu->npoints;
+	pcu->bounds = pal->bounds;
+	return pcu;
+#endif
 }
 
 PCPOINTLIST *
@@ -88,31 +447,24 @@ pc_patch_uncompressed_from_lazperf(const PCPATCH_LAZPERF *palaz)
 #endif
 
 	PCPATCH_UNCOMPRESSED *pcu = NULL;
-	uint8_t *decompressed;
-
-	// cpp call to uncompressed data
-	size_t size = lazperf_uncompress_from_compressed(palaz, &decompressed);
 
-	if (size != -1)
+	pcu = pcalloc(sizeof(PCPATCH_UNCOMPRESSED));
+	pcu->type = PC_NONE;
+	pcu->readonly = PC_FALSE;
+	pcu->schema = palaz->schema;
+	pcu->npoints = palaz->npoints;
+	pcu->bounds = palaz->bounds;
+	pcu->stats = pc_stats_clone(palaz->stats);
+	pcu->maxpoints = palaz->npoints;
+	pcu->datasize = palaz->schema->size * palaz->npoints;
+	pcu->data = (uint8_t*) pcalloc(pcu->datasize);
+
+	if ( PC_FAILURE == pc_patch_lazperf_decode_range(palaz, 0, palaz->npoints, pcu->data) )
 	{
-		pcu = pcalloc(sizeof(PCPATCH_UNCOMPRESSED));
-		pcu->type = PC_NONE;
-		pcu->readonly = PC_FALSE;
-		pcu->schema = palaz->schema;
-		pcu->npoints = palaz->npoints;
-		pcu->bounds = palaz->bounds;
-		pcu->stats = pc_stats_clone(palaz->stats);
-
-		// not optimal but we have to pass by the context manager otherwise
-		// a segfault happenned (sometimes) during a pcfree of lazperf field
-		pcu->data = (uint8_t*) pcalloc(palaz->schema->size * palaz->npoints);
-		memcpy(pcu->data, decompressed, palaz->schema->size * palaz->npoints);
-		free(decompressed);
-
-		pcu->maxpoints = palaz->npoints;
-	}
-	else
 		pcerror("%s: lazperf uncompression failed", __func__);
+		pc_patch_free((PCPATCH*)pcu);
+		return NULL;
+	}
 
 	return pcu;
 }
@@ -140,7 +492,7 @@ pc_patch_lazperf_to_wkb(const PCPATCH_LAZPERF *patch, size_t *wkbsize)
 	/*
 	byte:		 endianness (1 = NDR, 0 = XDR)
 	uint32:	 pcid (key to POINTCLOUD_SCHEMAS)
-	uint32:	 compression
+	uint32:	 compression (| PC_WKB_LAZHEADER)
 	uint32:	 npoints
 	uint32:	 lazperfsize
 	uint8[]:	lazperfbuffer
@@ -148,14 +500,17 @@ pc_patch_lazperf_to_wkb(const PCPATCH_LAZPERF *patch, size_t *wkbsize)
 
 	uint8_t *buf;
 	char endian = machine_endian();
+	size_t storedsize;
+	uint32_t flags;
+	const uint8_t *stored = pc_patch_lazperf_stored(patch, &storedsize, &flags);
 	/* endian + pcid + compression + npoints + lazperfsize + lazperf */
-	size_t size = 1 + 4 + 4 + 4 + 4 + patch->lazperfsize;
+	size_t size = 1 + 4 + 4 + 4 + 4 + storedsize;
 
 	uint8_t *wkb = pcalloc(size);
-	uint32_t compression = patch->type;
+	uint32_t compression = patch->type | flags;
 	uint32_t npoints = patch->npoints;
 	uint32_t pcid = patch->schema->pcid;
-	uint32_t lazperfsize = patch->lazperfsize;
+	uint32_t lazperfsize = storedsize;
 	wkb[0] = endian; /* Write endian flag */
 	memcpy(wkb +	1, &pcid,				4); /* Write PCID */
 	memcpy(wkb +	5, &compression, 4); /* Write compression */
@@ -163,7 +518,7 @@ pc_patch_lazperf_to_wkb(const PCPATCH_LAZPERF *patch, size_t *wkbsize)
 	memcpy(wkb + 13, &lazperfsize,		 4); /* Write lazperf buffer size */
 
 	buf = wkb + 17;
-	memcpy(buf, patch->lazperf, patch->lazperfsize);
+	memcpy(buf, stored, storedsize);
 	if (wkbsize)
 		*wkbsize = size;
 
@@ -186,7 +541,7 @@ pc_patch_lazperf_from_wkb(const PCSCHEMA *schema, const uint8_t *wkb, size_t wkb
 	uint32:	 lazperfsize
 	uint8[]:	lazerperfbuffer
 	*/
-	static size_t hdrsz = 1+4+4+4; /* endian + pcid + compression + npoints */
+	size_t hdrsz = pc_patch_wkb_header_size(schema, wkb); /* endian + pcid + compression + npoints + blocks */
 	PCPATCH_LAZPERF *patch;
 	uint8_t swap_endian = (wkb[0] != machine_endian());
 	uint32_t npoints;
@@ -213,9 +568,7 @@ pc_patch_lazperf_from_wkb(const PCSCHEMA *schema, const uint8_t *wkb, size_t wkb
 	buf += 4;
 
 	/* Copy in the tree buffer */
-	patch->lazperfsize = lazperfsize;
-	patch->lazperf = pcalloc(lazperfsize);
-	memcpy(patch->lazperf, buf, lazperfsize);
+	pc_patch_lazperf_set_stored(patch, buf, lazperfsize, wkb_get_flags(wkb));
 
 	return (PCPATCH*)patch;
 #endif
@@ -242,9 +595,12 @@ pc_patch_lazperf_pointn(const PCPATCH_LAZPERF *patch, int n)
 #endif
 
 	PCPOINT *pt = pc_point_make(patch->schema);
-	PCPATCH_UNCOMPRESSED *pau = pc_patch_uncompressed_from_lazperf(patch);
-	size_t size = patch->schema->size;
-	memcpy(pt->data, pau->data + n * size, size);
-	pc_patch_free((PCPATCH*) pau);
+
+	/* Only the chunk holding the point is decoded */
+	if ( PC_FAILURE == pc_patch_lazperf_decode_range(patch, n, 1, pt->data) )
+	{
+		pc_point_free(pt);
+		return NULL;
+	}
 	return pt;
 }
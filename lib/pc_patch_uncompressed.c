@@ -16,56 +16,71 @@
 /* TODO: expose to API ? Would require also exposing stringbuffer
 *  See https://github.com/pgpointcloud/pointcloud/issues/74
 */
-static int
-pc_patch_uncompressed_to_stringbuffer(const PCPATCH_UNCOMPRESSED *patch, stringbuffer_t *sb)
+static void
+pc_patch_columns_to_stringbuffer(const PCSCHEMA *s, uint32_t npoints, const uint8_t **cols, const size_t *strides, stringbuffer_t *sb)
 {
-	PCPOINTLIST *pl;
-	int i, j;
+	char buf[PC_VALUE_STRLEN+1];
+	int i, j, len;
 
 	/* { "pcid":1, "points":[[<dim1>, <dim2>, <dim3>, <dim4>],[<dim1>, <dim2>, <dim3>, <dim4>]] }*/
 
-	/* TODO: reserve space in buffer ? */
-
-	pl = pc_pointlist_from_uncompressed(patch);
-	stringbuffer_aprintf(sb, "{\"pcid\":%d,\"pts\":[", patch->schema->pcid);
-	for ( i = 0; i < pl->npoints; i++ )
+	stringbuffer_aprintf(sb, "{\"pcid\":%d,\"pts\":[", s->pcid);
+	for ( i = 0; i < npoints; i++ )
 	{
-		PCPOINT *pt = pc_pointlist_get_point(pl, i);
-		if ( i ) stringbuffer_append(sb, ",[");
-		else stringbuffer_append(sb, "[");
-		for ( j = 0; j < pt->schema->ndims; j++ )
+		if ( i ) stringbuffer_append_len(sb, ",[", 2);
+		else stringbuffer_append_len(sb, "[", 1);
+		for ( j = 0; j < s->ndims; j++ )
 		{
-			double d;
-			if ( ! pc_point_get_double_by_index(pt, j, &d))
-			{
-				pcerror("%s: unable to read double at index %d", __func__, j);
-				return PC_FAILURE;
-			}
-			if ( j ) stringbuffer_aprintf(sb, ",%g", d);
-			else stringbuffer_aprintf(sb, "%g", d);
+			/* Leading comma kept in the buffer, to append in one go */
+			buf[0] = ',';
+			len = pc_value_to_string(buf+1, cols[j] + i * strides[j], s->dims[j]);
+			if ( j ) stringbuffer_append_len(sb, buf, len+1);
+			else stringbuffer_append_len(sb, buf+1, len);
 		}
-		stringbuffer_append(sb, "]");
+		stringbuffer_append_len(sb, "]", 1);
 	}
 	stringbuffer_append(sb, "]}");
-
-	/* All done, copy and clean up */
-	pc_pointlist_free(pl);
-
-	return PC_SUCCESS;
 }
 
+/**
+* Text output of points read straight from their buffers, the values
+* of dimension j of point i being at cols[j] + i * strides[j]. This
+* covers both the rows of uncompressed patches and the columns of
+* dimensional patches.
+*/
 char *
-pc_patch_uncompressed_to_string(const PCPATCH_UNCOMPRESSED *patch)
+pc_patch_columns_to_string(const PCSCHEMA *s, uint32_t npoints, const uint8_t **cols, const size_t *strides)
 {
-	stringbuffer_t *sb = stringbuffer_create();
+	/* Room for a handful of characters per value */
+	stringbuffer_t *sb = stringbuffer_create_with_size(32 + (size_t)npoints * (s->ndims * 8 + 3));
 	char *str;
-	if ( PC_FAILURE == pc_patch_uncompressed_to_stringbuffer(patch, sb) )
-		return NULL;
+	pc_patch_columns_to_stringbuffer(s, npoints, cols, strides, sb);
 	str = stringbuffer_release_string(sb);
 	stringbuffer_destroy(sb);
 	return str;
 }
 
+char *
+pc_patch_uncompressed_to_string(const PCPATCH_UNCOMPRESSED *patch)
+{
+	const PCSCHEMA *s = patch->schema;
+	const uint8_t **cols = pcalloc(s->ndims * sizeof(uint8_t*));
+	size_t *strides = pcalloc(s->ndims * sizeof(size_t));
+	char *str;
+	int i;
+
+	for ( i = 0; i < s->ndims; i++ )
+	{
+		cols[i] = patch->data + s->dims[i]->byteoffset;
+		strides[i] = s->size;
+	}
+
+	str = pc_patch_columns_to_string(s, patch->npoints, cols, strides);
+	pcfree(cols);
+	pcfree(strides);
+	return str;
+}
+
 uint8_t *
 pc_patch_uncompressed_to_wkb(const PCPATCH_UNCOMPRESSED *patch, size_t *wkbsize)
 {
@@ -94,7 +109,7 @@ pc_patch_uncompressed_to_wkb(const PCPATCH_UNCOMPRESSED *patch, size_t *wkbsize)
 
 
 PCPATCH *
-pc_patch_uncompressed_from_wkb(const PCSCHEMA *s, const uint8_t *wkb, size_t wkbsize)
+pc_patch_uncompressed_from_wkb(const PCSCHEMA *s, const uint8_t *wkb, size_t wkbsize, int readonly)
 {
 	/*
 	byte:     endianness (1 = NDR, 0 = XDR)
@@ -103,7 +118,7 @@ pc_patch_uncompressed_from_wkb(const PCSCHEMA *s, const uint8_t *wkb, size_t wkb
 	uint32:   npoints
 	pcpoint[]:  data (interpret relative to pcid)
 	*/
-	static size_t hdrsz = 1+4+4+4; /* endian + pcid + compression + npoints */
+	size_t hdrsz = pc_patch_wkb_header_size(s, wkb); /* endian + pcid + compression + npoints + blocks */
 	PCPATCH_UNCOMPRESSED *patch;
 	uint8_t *data;
 	uint8_t swap_endian = (wkb[0] != machine_endian());
@@ -125,6 +140,12 @@ pc_patch_uncompressed_from_wkb(const PCSCHEMA *s, const uint8_t *wkb, size_t wkb
 	if ( swap_endian )
 	{
 		data = uncompressed_bytes_flip_endian(wkb+hdrsz, s, npoints);
+		readonly = PC_FALSE;
+	}
+	else if ( readonly )
+	{
+		/* Zero copy, point into the wkb */
+		data = (uint8_t*)(wkb+hdrsz);
 	}
 	else
 	{
@@ -134,10 +155,10 @@ pc_patch_uncompressed_from_wkb(const PCSCHEMA *s, const uint8_t *wkb, size_t wkb
 
 	patch = pcalloc(sizeof(PCPATCH_UNCOMPRESSED));
 	patch->type = PC_NONE;
-	patch->readonly = PC_FALSE;
+	patch->readonly = readonly;
 	patch->schema = s;
 	patch->npoints = npoints;
-	patch->maxpoints = npoints;
+	patch->maxpoints = readonly ? 0 : npoints;
 	patch->datasize = (wkbsize - hdrsz);
 	patch->data = data;
 
@@ -194,22 +194,20 @@ pc_point_to_string(const PCPOINT *pt)
 {
 	/* { "pcid":1, "values":[<dim1>, <dim2>, <dim3>, <dim4>] }*/
 	stringbuffer_t *sb = stringbuffer_create();
+	char buf[PC_VALUE_STRLEN];
 	char *str;
-	int i;
+	int i, len;
 
 	stringbuffer_aprintf(sb, "{\"pcid\":%d,\"pt\":[", pt->schema->pcid);
 	for ( i = 0; i < pt->schema->ndims; i++ )
 	{
-		double d;
-		if ( ! pc_point_get_double_by_index(pt, i, &d) )
-		{
-			pcerror("pc_point_to_string: unable to read double at position %d", i);
-		}
+		PCDIMENSION *dim = pt->schema->dims[i];
 		if ( i )
 		{
-			stringbuffer_append(sb, ",");
+			stringbuffer_append_len(sb, ",", 1);
 		}
-		stringbuffer_aprintf(sb, "%g", d);
+		len = pc_value_to_string(buf, pt->data + dim->byteoffset, dim);
+		stringbuffer_append_len(sb, buf, len);
 	}
 	stringbuffer_append(sb, "]}");
 	str = stringbuffer_getstringcopy(sb);
@@ -0,0 +1,613 @@
+/***********************************************************************
+* pc_polygon.c
+*
+*  Point location against many polygons at once. The polygons are
+*  read from OGC WKB, their bounds packed into an STR-tree, and the
+*  edges of every polygon bucketed into rows, so that locating a
+*  point only tests the edges of the row it falls in, for the few
+*  polygons whose bounds contain it.
+*
+*  PgSQL Pointcloud is free and open source software provided
+*  by the Government of Canada
+*  Copyright (c) 2013 Natural Resources Canada
+*
+***********************************************************************/
+
+#include "pc_api_internal.h"
+#include <math.h>
+
+/* Children per node of the STR-tree */
+#define PC_POLYINDEX_NODESIZE 8
+
+/* Deep enough for the tree of any uint32_t number of polygons */
+#define PC_POLYINDEX_MAXSTACK 256
+
+/* Rows of the edge grid, at most one per edge */
+#define PC_POLYGON_MAXROWS 1024
+
+#define WKB_POLYGON 3
+#define WKB_MULTIPOLYGON 6
+
+typedef struct
+{
+	const uint8_t *ptr;
+	const uint8_t *end;
+	int flip;
+} PCWKBREADER;
+
+static int
+pc_wkb_read_uint32(PCWKBREADER *r, uint32_t *val)
+{
+	if ( r->end - r->ptr < 4 )
+		return PC_FAILURE;
+	*val = (uint32_t)wkb_get_int32(r->ptr, r->flip);
+	r->ptr += 4;
+	return PC_SUCCESS;
+}
+
+static int
+pc_wkb_read_double(PCWKBREADER *r, double *val)
+{
+	uint8_t buf[8];
+
+	if ( r->end - r->ptr < 8 )
+		return PC_FAILURE;
+	memcpy(buf, r->ptr, 8);
+	if ( r->flip )
+		pc_flip_endian_strided(buf, 8, 8, 1);
+	memcpy(val, buf, 8);
+	r->ptr += 8;
+	return PC_SUCCESS;
+}
+
+/**
+* Read the endian flag and type of a geometry, EWKB or ISO,
+* and skip the SRID if there is one.
+*/
+static int
+pc_wkb_read_header(PCWKBREADER *r, uint32_t *type, uint32_t *ndims)
+{
+	uint32_t t;
+
+	if ( r->end - r->ptr < 1 )
+		return PC_FAILURE;
+	r->flip = ( *(r->ptr) != machine_endian() );
+	r->ptr++;
+
+	if ( PC_FAILURE == pc_wkb_read_uint32(r, &t) )
+		return PC_FAILURE;
+
+	*ndims = 2;
+	if ( t & 0x80000000 ) (*ndims)++; /* EWKB Z */
+	if ( t & 0x40000000 ) (*ndims)++; /* EWKB M */
+	if ( t & 0x20000000 ) /* EWKB SRID */
+	{
+		uint32_t srid;
+		if ( PC_FAILURE == pc_wkb_read_uint32(r, &srid) )
+			return PC_FAILURE;
+	}
+	t &= 0x0FFFFFFF;
+
+	/* ISO Z, M and ZM types */
+	if ( t >= 1000 )
+	{
+		*ndims += ( t / 1000 == 3 ) ? 2 : 1;
+		t %= 1000;
+	}
+
+	*type = t;
+	return PC_SUCCESS;
+}
+
+/**
+* Append the edges of the rings of a WKB polygon, closing rings that
+* are not, and grow the polygon bounds to their vertices.
+*/
+static int
+pc_polygon_read_rings(PCWKBREADER *r, uint32_t ndims, PCPOLYGON *poly, uint32_t *maxedges)
+{
+	uint32_t nrings, npoints, i, j, k;
+	double *ring;
+
+	if ( PC_FAILURE == pc_wkb_read_uint32(r, &nrings) )
+		return PC_FAILURE;
+
+	for ( i = 0; i < nrings; i++ )
+	{
+		if ( PC_FAILURE == pc_wkb_read_uint32(r, &npoints) )
+			return PC_FAILURE;
+		if ( ! npoints )
+			continue;
+		if ( (size_t)(r->end - r->ptr) < (size_t)npoints * ndims * 8 )
+			return PC_FAILURE;
+
+		ring = pcalloc(2 * npoints * sizeof(double));
+		for ( j = 0; j < npoints; j++ )
+		{
+			double unused;
+			pc_wkb_read_double(r, &(ring[2*j]));
+			pc_wkb_read_double(r, &(ring[2*j+1]));
+			for ( k = 2; k < ndims; k++ )
+				pc_wkb_read_double(r, &unused);
+
+			if ( ring[2*j] < poly->bounds.xmin ) poly->bounds.xmin = ring[2*j];
+			if ( ring[2*j] > poly->bounds.xmax ) poly->bounds.xmax = ring[2*j];
+			if ( ring[2*j+1] < poly->bounds.ymin ) poly->bounds.ymin = ring[2*j+1];
+			if ( ring[2*j+1] > poly->bounds.ymax ) poly->bounds.ymax = ring[2*j+1];
+		}
+
+		if ( poly->nedges + npoints > *maxedges )
+		{
+			while ( poly->nedges + npoints > *maxedges )
+				*maxedges = *maxedges ? 2 * *maxedges : 64;
+			poly->edges = poly->edges ? pcrealloc(poly->edges, 4 * *maxedges * sizeof(double)) : pcalloc(4 * *maxedges * sizeof(double));
+		}
+
+		/* A closed ring ends with a zero-length edge, which is harmless */
+		for ( j = 0; j < npoints; j++ )
+		{
+			double *e = poly->edges + 4 * poly->nedges++;
+			e[0] = ring[2*j];
+			e[1] = ring[2*j+1];
+			e[2] = ring[2*((j+1) % npoints)];
+			e[3] = ring[2*((j+1) % npoints)+1];
+		}
+		pcfree(ring);
+	}
+	return PC_SUCCESS;
+}
+
+static int
+pc_polygon_read_wkb(PCWKBREADER *r, PCPOLYGON *poly, uint32_t *maxedges, int multi)
+{
+	uint32_t type, ndims, ngeoms, i;
+
+	if ( PC_FAILURE == pc_wkb_read_header(r, &type, &ndims) )
+		return PC_FAILURE;
+
+	if ( type == WKB_POLYGON )
+		return pc_polygon_read_rings(r, ndims, poly, maxedges);
+
+	if ( type == WKB_MULTIPOLYGON && multi )
+	{
+		if ( PC_FAILURE == pc_wkb_read_uint32(r, &ngeoms) )
+			return PC_FAILURE;
+		for ( i = 0; i < ngeoms; i++ )
+			if ( PC_FAILURE == pc_polygon_read_wkb(r, poly, maxedges, PC_FALSE) )
+				return PC_FAILURE;
+		return PC_SUCCESS;
+	}
+
+	pcerror("%s: unsupported geometry type %u, polygons and multipolygons expected", __func__, type);
+	return PC_FAILURE;
+}
+
+static inline uint32_t
+pc_polygon_row(const PCPOLYGON *poly, double y)
+{
+	double row = poly->rowheight > 0 ? (y - poly->bounds.ymin) / poly->rowheight : 0;
+	if ( row < 0 ) return 0;
+	if ( row >= poly->nrows ) return poly->nrows - 1;
+	return (uint32_t)row;
+}
+
+/**
+* Bucket the edges into rows of equal height over the polygon
+* bounds, every edge going into all the rows its y range crosses.
+*/
+static void
+pc_polygon_grid_edges(PCPOLYGON *poly)
+{
+	uint32_t i, r, *fill;
+
+	poly->nrows = poly->nedges < PC_POLYGON_MAXROWS ? poly->nedges : PC_POLYGON_MAXROWS;
+	poly->rowheight = (poly->bounds.ymax - poly->bounds.ymin) / poly->nrows;
+	poly->rowstart = pcalloc((poly->nrows + 1) * sizeof(uint32_t));
+
+	/* Count, then fill */
+	for ( i = 0; i < poly->nedges; i++ )
+	{
+		const double *e = poly->edges + 4 * i;
+		uint32_t r0 = pc_polygon_row(poly, e[1] < e[3] ? e[1] : e[3]);
+		uint32_t r1 = pc_polygon_row(poly, e[1] < e[3] ? e[3] : e[1]);
+		for ( r = r0; r <= r1; r++ )
+			poly->rowstart[r + 1]++;
+	}
+	for ( r = 0; r < poly->nrows; r++ )
+		poly->rowstart[r + 1] += poly->rowstart[r];
+
+	poly->rowedges = pcalloc(poly->rowstart[poly->nrows] * sizeof(uint32_t));
+	fill = pcalloc(poly->nrows * sizeof(uint32_t));
+	memcpy(fill, poly->rowstart, poly->nrows * sizeof(uint32_t));
+	for ( i = 0; i < poly->nedges; i++ )
+	{
+		const double *e = poly->edges + 4 * i;
+		uint32_t r0 = pc_polygon_row(poly, e[1] < e[3] ? e[1] : e[3]);
+		uint32_t r1 = pc_polygon_row(poly, e[1] < e[3] ? e[3] : e[1]);
+		for ( r = r0; r <= r1; r++ )
+			poly->rowedges[fill[r]++] = i;
+	}
+	pcfree(fill);
+}
+
+static inline int
+pc_polygon_bounds_contains(const PCBOUNDS *b, double x, double y)
+{
+	return x >= b->xmin && x <= b->xmax && y >= b->ymin && y <= b->ymax;
+}
+
+/**
+* Even-odd crossing test over the edges of the row of the point,
+* all rings together, so holes and the parts of multipolygons need
+* no special handling. Points on an edge are inside.
+*/
+static int
+pc_polygon_contains(const PCPOLYGON *poly, double x, double y)
+{
+	uint32_t k, row;
+	int inside = 0;
+
+	if ( ! poly->nedges || ! pc_polygon_bounds_contains(&(poly->bounds), x, y) )
+		return 0;
+
+	row = pc_polygon_row(poly, y);
+	for ( k = poly->rowstart[row]; k < poly->rowstart[row + 1]; k++ )
+	{
+		const double *e = poly->edges + 4 * poly->rowedges[k];
+		double x0 = e[0], y0 = e[1], x1 = e[2], y1 = e[3];
+
+		if ( y0 == y1 )
+		{
+			/* Horizontal edges only matter when the point is on them */
+			if ( y == y0 && x >= ( x0 < x1 ? x0 : x1 ) && x <= ( x0 < x1 ? x1 : x0 ) )
+				return 1;
+			continue;
+		}
+
+		if ( ( y0 > y ) != ( y1 > y ) )
+		{
+			double xint = x0 + (y - y0) * (x1 - x0) / (y1 - y0);
+			if ( xint == x )
+				return 1;
+			if ( xint > x )
+				inside = ! inside;
+		}
+		else if ( ( x == x0 && y == y0 ) || ( x == x1 && y == y1 ) )
+		{
+			return 1;
+		}
+	}
+	return inside;
+}
+
+/* A box to pack into the STR-tree, and the polygon or node it stands for */
+typedef struct
+{
+	PCBOUNDS bounds;
+	uint32_t id;
+} PCPOLYENTRY;
+
+static int
+pc_polyentry_cmp_x(const void *a, const void *b)
+{
+	double xa = ((const PCPOLYENTRY*)a)->bounds.xmin + ((const PCPOLYENTRY*)a)->bounds.xmax;
+	double xb = ((const PCPOLYENTRY*)b)->bounds.xmin + ((const PCPOLYENTRY*)b)->bounds.xmax;
+	return xa < xb ? -1 : xa > xb;
+}
+
+static int
+pc_polyentry_cmp_y(const void *a, const void *b)
+{
+	double ya = ((const PCPOLYENTRY*)a)->bounds.ymin + ((const PCPOLYENTRY*)a)->bounds.ymax;
+	double yb = ((const PCPOLYENTRY*)b)->bounds.ymin + ((const PCPOLYENTRY*)b)->bounds.ymax;
+	return ya < yb ? -1 : ya > yb;
+}
+
+/**
+* Pack one level of the STR-tree: sort the entries by x, cut them in
+* vertical slices, sort each slice by y, and group runs of entries
+* into nodes. The entries are replaced by the new nodes, ready for
+* the level above, and their number is returned.
+*/
+static uint32_t
+pc_polyindex_pack(PCPOLYINDEX *idx, PCPOLYENTRY *entries, uint32_t n, uint32_t leaf, uint32_t *nchildren)
+{
+	uint32_t nnodes = (n + PC_POLYINDEX_NODESIZE - 1) / PC_POLYINDEX_NODESIZE;
+	uint32_t slicesize = (uint32_t)ceil(sqrt(nnodes)) * PC_POLYINDEX_NODESIZE;
+	uint32_t first = idx->nnodes;
+	uint32_t i, j;
+
+	qsort(entries, n, sizeof(PCPOLYENTRY), pc_polyentry_cmp_x);
+	for ( i = 0; i < n; i += slicesize )
+		qsort(entries + i, n - i < slicesize ? n - i : slicesize, sizeof(PCPOLYENTRY), pc_polyentry_cmp_y);
+
+	for ( i = 0; i < n; i += PC_POLYINDEX_NODESIZE )
+	{
+		PCPOLYNODE *node = &(idx->nodes[idx->nnodes++]);
+		node->first = *nchildren;
+		node->count = n - i < PC_POLYINDEX_NODESIZE ? n - i : PC_POLYINDEX_NODESIZE;
+		node->leaf = leaf;
+		pc_bounds_init(&(node->bounds));
+		for ( j = 0; j < node->count; j++ )
+		{
+			const PCBOUNDS *b = &(entries[i + j].bounds);
+			if ( b->xmin < node->bounds.xmin ) node->bounds.xmin = b->xmin;
+			if ( b->xmax > node->bounds.xmax ) node->bounds.xmax = b->xmax;
+			if ( b->ymin < node->bounds.ymin ) node->bounds.ymin = b->ymin;
+			if ( b->ymax > node->bounds.ymax ) node->bounds.ymax = b->ymax;
+			idx->children[(*nchildren)++] = entries[i + j].id;
+		}
+	}
+
+	for ( i = 0; i < nnodes; i++ )
+	{
+		entries[i].bounds = idx->nodes[first + i].bounds;
+		entries[i].id = first + i;
+	}
+	return nnodes;
+}
+
+/**
+* Read the polygons and build the index. Entries that are NULL or
+* empty are kept, so that polygon numbers match the input, but
+* never contain anything. Returns NULL on invalid WKB.
+*/
+PCPOLYINDEX *
+pc_polyindex_from_wkb(const uint8_t **wkbs, const size_t *wkbsizes, uint32_t npolys)
+{
+	PCPOLYINDEX *idx;
+	PCPOLYENTRY *entries;
+	uint32_t i, n = 0, nchildren = 0;
+
+	idx = pcalloc(sizeof(PCPOLYINDEX));
+	idx->npolys = npolys;
+	idx->polys = pcalloc((npolys ? npolys : 1) * sizeof(PCPOLYGON));
+	entries = pcalloc((npolys ? npolys : 1) * sizeof(PCPOLYENTRY));
+
+	for ( i = 0; i < npolys; i++ )
+	{
+		PCPOLYGON *poly = &(idx->polys[i]);
+		uint32_t maxedges = 0;
+		PCWKBREADER r;
+
+		pc_bounds_init(&(poly->bounds));
+		if ( ! wkbs[i] )
+			continue;
+
+		r.ptr = wkbs[i];
+		r.end = wkbs[i] + wkbsizes[i];
+		if ( PC_FAILURE == pc_polygon_read_wkb(&r, poly, &maxedges, PC_TRUE) )
+		{
+			pcerror("%s: invalid polygon WKB at position %u", __func__, i);
+			idx->npolys = i + 1;
+			pcfree(entries);
+			pc_polyindex_free(idx);
+			return NULL;
+		}
+
+		if ( poly->nedges )
+		{
+			pc_polygon_grid_edges(poly);
+			entries[n].bounds = poly->bounds;
+			entries[n].id = i;
+			n++;
+		}
+	}
+
+	/* At most n leaves, n/2 nodes above them, and so on */
+	if ( n )
+	{
+		idx->nodes = pcalloc(n * sizeof(PCPOLYNODE));
+		idx->children = pcalloc(2 * n * sizeof(uint32_t));
+		n = pc_polyindex_pack(idx, entries, n, PC_TRUE, &nchildren);
+		while ( n > 1 )
+			n = pc_polyindex_pack(idx, entries, n, PC_FALSE, &nchildren);
+	}
+
+	pcfree(entries);
+	return idx;
+}
+
+void
+pc_polyindex_free(PCPOLYINDEX *idx)
+{
+	uint32_t i;
+
+	if ( ! idx ) return;
+
+	for ( i = 0; i < idx->npolys; i++ )
+	{
+		PCPOLYGON *poly = &(idx->polys[i]);
+		if ( poly->edges ) pcfree(poly->edges);
+		if ( poly->rowstart ) pcfree(poly->rowstart);
+		if ( poly->rowedges ) pcfree(poly->rowedges);
+	}
+	pcfree(idx->polys);
+	if ( idx->nodes ) pcfree(idx->nodes);
+	if ( idx->children ) pcfree(idx->children);
+	pcfree(idx);
+}
+
+/**
+* Walk down the nodes whose bounds contain the point. When polygons
+* overlap, the one that comes first in the input wins.
+*/
+int32_t
+pc_polyindex_locate(const PCPOLYINDEX *idx, double x, double y)
+{
+	uint32_t stack[PC_POLYINDEX_MAXSTACK];
+	uint32_t nstack = 0, j;
+	int32_t found = -1;
+
+	if ( ! idx->nnodes )
+		return -1;
+
+	stack[nstack++] = idx->nnodes - 1;
+	while ( nstack )
+	{
+		const PCPOLYNODE *node = &(idx->nodes[stack[--nstack]]);
+
+		if ( ! pc_polygon_bounds_contains(&(node->bounds), x, y) )
+			continue;
+
+		for ( j = 0; j < node->count; j++ )
+		{
+			uint32_t c = idx->children[node->first + j];
+			if ( ! node->leaf )
+				stack[nstack++] = c;
+			else if ( ( found < 0 || c < (uint32_t)found ) && pc_polygon_contains(&(idx->polys[c]), x, y) )
+				found = c;
+		}
+	}
+	return found;
+}
+
+/**
+* Locate every point of the patch. Only the X and Y columns of
+* dimensional patches are decoded, and patches outside of all the
+* polygons are rejected from their bounds.
+*/
+int32_t *
+pc_patch_polygon_classify(const PCPATCH *pa, const PCPOLYINDEX *idx)
+{
+	const PCSCHEMA *s = pa->schema;
+	const PCPATCH *pu;
+	int32_t *classes;
+	double *x, *y;
+	uint32_t i;
+
+	if ( ! s->xdim || ! s->ydim )
+	{
+		pcerror("%s: schema has no X/Y dimensions", __func__);
+		return NULL;
+	}
+
+	classes = pcalloc((pa->npoints ? pa->npoints : 1) * sizeof(int32_t));
+	if ( ! idx->nnodes || ! pc_bounds_intersects(&(pa->bounds), &(idx->nodes[idx->nnodes - 1].bounds)) )
+	{
+		for ( i = 0; i < pa->npoints; i++ )
+			classes[i] = -1;
+		return classes;
+	}
+
+	pu = pa->type == PC_DIMENSIONAL ? pa : pc_patch_uncompress(pa);
+	x = pc_patch_dimension_to_double_array(pu, s->xdim->position);
+	y = pc_patch_dimension_to_double_array(pu, s->ydim->position);
+	if ( pu != pa )
+		pc_patch_free((PCPATCH*)pu);
+
+	for ( i = 0; i < pa->npoints; i++ )
+		classes[i] = pc_polyindex_locate(idx, x[i], y[i]);
+
+	pcfree(x);
+	pcfree(y);
+	return classes;
+}
+
+/**
+* Gather the points of every polygon into a patch of its own,
+* in one pass over the points. Returns npolys patches, NULL for
+* the polygons no point falls in.
+*/
+PCPATCH **
+pc_patch_polygon_split(const PCPATCH *pa, const PCPOLYINDEX *idx)
+{
+	const PCSCHEMA *s = pa->schema;
+	PCPATCH_UNCOMPRESSED **patches, *pu;
+	uint32_t *counts;
+	int32_t *classes;
+	uint32_t i;
+
+	classes = pc_patch_polygon_classify(pa, idx);
+	if ( ! classes )
+		return NULL;
+
+	patches = pcalloc((idx->npolys ? idx->npolys : 1) * sizeof(PCPATCH_UNCOMPRESSED*));
+	counts = pcalloc((idx->npolys ? idx->npolys : 1) * sizeof(uint32_t));
+	for ( i = 0; i < pa->npoints; i++ )
+		if ( classes[i] >= 0 )
+			counts[classes[i]]++;
+
+	for ( i = 0; i < idx->npolys; i++ )
+		if ( counts[i] )
+			patches[i] = pc_patch_uncompressed_make(s, counts[i]);
+
+	pu = (PCPATCH_UNCOMPRESSED*)pc_patch_uncompress(pa);
+	for ( i = 0; i < pa->npoints; i++ )
+	{
+		PCPATCH_UNCOMPRESSED *pk;
+		if ( classes[i] < 0 )
+			continue;
+		pk = patches[classes[i]];
+		memcpy(pk->data + (size_t)pk->npoints * s->size, pu->data + (size_t)i * s->size, s->size);
+		pk->npoints++;
+	}
+	if ( (PCPATCH*)pu != pa )
+		pc_patch_free((PCPATCH*)pu);
+
+	for ( i = 0; i < idx->npolys; i++ )
+	{
+		if ( ! patches[i] )
+			continue;
+		if ( PC_FAILURE == pc_patch_uncompressed_compute_extent(patches[i]) ||
+		     PC_FAILURE == pc_patch_uncompressed_compute_stats(patches[i]) )
+		{
+			pcerror("%s: failed to compute patch extent and stats", __func__);
+		}
+	}
+
+	pcfree(counts);
+	pcfree(classes);
+	return (PCPATCH**)patches;
+}
+
+/**
+* Transform the patch to a schema with a dimension for the polygon
+* numbers, and fill it: 1 for points in the first polygon, 2 for the
+* second, and so on, 0 for points in none.
+*/
+PCPATCH *
+pc_patch_polygon_tag(const PCPATCH *pa, const PCPOLYINDEX *idx, const PCSCHEMA *schema, const char *name)
+{
+	PCDIMENSION *dim = pc_schema_get_dimension_by_name(schema, name);
+	PCPATCH_UNCOMPRESSED *pu;
+	int32_t *classes;
+	uint32_t i;
+
+	if ( ! dim )
+	{
+		pcerror("%s: dimension \"%s\" does not exist", __func__, name);
+		return NULL;
+	}
+	if ( dim == schema->xdim || dim == schema->ydim )
+	{
+		pcerror("%s: dimension \"%s\" holds the point coordinates", __func__, name);
+		return NULL;
+	}
+
+	classes = pc_patch_polygon_classify(pa, idx);
+	if ( ! classes )
+		return NULL;
+
+	pu = (PCPATCH_UNCOMPRESSED*)pc_patch_transform(pa, schema, 0);
+	if ( ! pu )
+	{
+		pcfree(classes);
+		return NULL;
+	}
+
+	for ( i = 0; i < pu->npoints; i++ )
+	{
+		uint8_t *ptr = pu->data + (size_t)i * schema->size + dim->byteoffset;
+		pc_double_to_ptr(ptr, dim->interpretation, pc_value_unscale_unoffset(classes[i] + 1, dim));
+	}
+	pcfree(classes);
+
+	if ( PC_FAILURE == pc_patch_uncompressed_compute_stats(pu) )
+	{
+		pcerror("%s: failed to compute patch stats", __func__);
+		pc_patch_free((PCPATCH*)pu);
+		return NULL;
+	}
+	return (PCPATCH*)pu;
+}
@@ -174,6 +174,7 @@ pc_dimension_clone(const PCDIMENSION *dim)
 	/* Copy the referenced data */
 	if ( dim->name ) pcd->name = pcstrdup(dim->name);
 	if ( dim->description ) pcd->description = pcstrdup(dim->description);
+	if ( dim->zdict ) pcd->zdict = pc_zdict_clone(dim->zdict);
 	return pcd;
 }
 
@@ -186,6 +187,8 @@ pc_dimension_free(PCDIMENSION *pcd)
 		pcfree(pcd->description);
 	if ( pcd->name )
 		pcfree(pcd->name);
+	if ( pcd->zdict )
+		pc_zdict_free(pcd->zdict);
 	pcfree(pcd);
 }
 
@@ -235,6 +238,8 @@ pc_schema_clone(const PCSCHEMA *s)
 	pcs->pcid = s->pcid;
 	pcs->srid = s->srid;
 	pcs->compression = s->compression;
+	pcs->lazchunksize = s->lazchunksize;
+	pcs->ghtkeylength = s->ghtkeylength;
 	for ( i = 0; i < pcs->ndims; i++ )
 	{
 		if ( s->dims[i] )
@@ -554,6 +559,16 @@ pc_schema_from_xml(const char *xml_str)
 					s->compression = compression;
 				}
 			}
+			/* And the number of points per LAZ chunk */
+			else if ( strcmp(metadata_name, "lazchunksize") == 0 )
+			{
+				s->lazchunksize = strtoul(metadata_value, NULL, 10);
+			}
+			/* And the resolution of GHT hashes */
+			else if ( strcmp(metadata_name, "ght_keylength") == 0 )
+			{
+				s->ghtkeylength = strtoul(metadata_value, NULL, 10);
+			}
 			xmlFree(metadata_name);
 		}
 	}
@@ -576,6 +591,126 @@ cleanup:
 	return s;
 }
 
+/**
+* XML of the schema reduced to the named dimensions, and to X and Y
+* that every schema needs, numbered in their order in the schema.
+* The metadata are kept. NULL if a dimension does not exist.
+*/
+char *
+pc_schema_xml_subset(const char *xml_str, const char **names, int nnames)
+{
+	PCSCHEMA *s = pc_schema_from_xml(xml_str);
+	xmlDocPtr xml_doc = NULL;
+	xmlNsPtr xml_ns = NULL;
+	xmlXPathContextPtr xpath_ctx = NULL;
+	xmlXPathObjectPtr xpath_obj = NULL;
+	xmlNodeSetPtr nodes;
+	xmlChar *xml_out = NULL;
+	int xml_outsize;
+	int *newpos = NULL;
+	char *str = NULL;
+	const char *xml_ptr = xml_str;
+	int i, n;
+
+	if ( ! s )
+	{
+		pcerror("%s: invalid schema XML", __func__);
+		return NULL;
+	}
+
+	/* New positions of the dimensions kept, -1 for the others */
+	newpos = pcalloc(s->ndims * sizeof(int));
+	for ( i = 0; i < s->ndims; i++ )
+		newpos[i] = -1;
+	newpos[s->xdim->position] = 0;
+	newpos[s->ydim->position] = 0;
+	for ( i = 0; i < nnames; i++ )
+	{
+		PCDIMENSION *d = pc_schema_get_dimension_by_name(s, names[i]);
+		if ( ! d )
+		{
+			pcerror("%s: dimension \"%s\" does not exist", __func__, names[i]);
+			goto cleanup;
+		}
+		newpos[d->position] = 0;
+	}
+	for ( i = 0, n = 0; i < s->ndims; i++ )
+		if ( newpos[i] >= 0 )
+			newpos[i] = ++n;
+
+	while( (*xml_ptr != '\0') && (*xml_ptr != '<') )
+	{
+		xml_ptr++;
+	}
+
+	xmlInitParser();
+	xml_doc = xmlReadMemory(xml_ptr, strlen(xml_ptr), NULL, NULL, 0);
+	if ( xml_doc )
+		xml_ns = xmlDocGetRootElement(xml_doc)->ns;
+	xpath_ctx = xml_doc ? xmlXPathNewContext(xml_doc) : NULL;
+	if ( xpath_ctx && xml_ns )
+		xmlXPathRegisterNs(xpath_ctx, (xmlChar*)"pc", xml_ns->href);
+	if ( xpath_ctx )
+		xpath_obj = xmlXPathEvalExpression((xmlChar*)"/pc:PointCloudSchema/pc:dimension", xpath_ctx);
+	if ( ! xpath_obj )
+	{
+		pcerror("%s: unable to read the dimensions of the schema XML", __func__);
+		goto cleanup;
+	}
+
+	/* Drop the dimensions left out, renumber the others */
+	nodes = xpath_obj->nodesetval;
+	for ( i = 0; nodes && i < nodes->nodeNr; i++ )
+	{
+		xmlNodePtr cur = nodes->nodeTab[i];
+		xmlNodePtr child, position = NULL;
+
+		for ( child = cur->children; child; child = child->next )
+			if ( child->type == XML_ELEMENT_NODE && strcmp((char*)(child->name), "position") == 0 )
+				position = child;
+		if ( ! position )
+			continue;
+
+		n = newpos[atoi(xml_node_get_content(position)) - 1];
+		if ( n < 0 )
+		{
+			xmlNodePtr prev = cur->prev;
+			/* Take the indentation before the dimension along */
+			if ( prev && prev->type == XML_TEXT_NODE )
+			{
+				xmlUnlinkNode(prev);
+				xmlFreeNode(prev);
+			}
+			xmlUnlinkNode(cur);
+			xmlFreeNode(cur);
+		}
+		else
+		{
+			char buf[16];
+			snprintf(buf, sizeof(buf), "%d", n);
+			xmlNodeSetContent(position, (xmlChar*)buf);
+		}
+	}
+	xmlDocDumpMemory(xml_doc, &xml_out, &xml_outsize);
+	if ( xml_out )
+	{
+		str = pcstrdup((char*)xml_out);
+		xmlFree(xml_out);
+	}
+
+cleanup:
+	if ( xpath_obj )
+		xmlXPathFreeObject(xpath_obj);
+	if ( xpath_ctx )
+		xmlXPathFreeContext(xpath_ctx);
+	if ( xml_doc )
+		xmlFreeDoc(xml_doc);
+	xmlCleanupParser();
+	pcfree(newpos);
+	pc_schema_free(s);
+	return str;
+}
+
 uint32_t
 pc_schema_is_valid(const PCSCHEMA *s)
 {
@@ -701,3 +836,18 @@ pc_schema_same_interpretations(const PCSCHEMA *s1, const PCSCHEMA *s2)
 
 	return PC_TRUE;
 }
+
+int
+pc_schema_set_zdict(PCSCHEMA *s, uint32_t dim, PCZDICT *zdict)
+{
+	PCDIMENSION *d = pc_schema_get_dimension(s, dim);
+	if ( ! d )
+	{
+		pcerror("%s: invalid dimension number %d", __func__, dim);
+		return PC_FAILURE;
+	}
+	if ( d->zdict )
+		pc_zdict_free(d->zdict);
+	d->zdict = zdict;
+	return PC_SUCCESS;
+}
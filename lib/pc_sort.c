@@ -40,6 +40,29 @@ pc_compare_pcb (const void *a, const void *b, const void *arg)
 	return ((da > db) - (da < db));
 }
 
+/* Compare two point indexes, on a NULL terminated array of uncompressed PCBYTES */
+static int
+pc_compare_pcb_index (const void *a, const void *b, void *arg)
+{
+	const PCBYTES **pcb = (const PCBYTES **)arg;
+	uint32_t ia = *((const uint32_t *)a);
+	uint32_t ib = *((const uint32_t *)b);
+	size_t size = pc_interpretation_size(pcb[0]->interpretation);
+	double da = pc_double_from_ptr(pcb[0]->bytes + ia*size, pcb[0]->interpretation);
+	double db = pc_double_from_ptr(pcb[0]->bytes + ib*size, pcb[0]->interpretation);
+	int cmp = ((da > db) - (da < db));
+	return ( cmp == 0 && pcb[1] ) ? pc_compare_pcb_index(a, b, pcb+1) : cmp;
+}
+
+/* Same as pc_compare_pcb_index, ties are broken on the index to keep sorting stable */
+static int
+pc_compare_pcb_index_stable (const void *a, const void *b, void *arg)
+{
+	int cmp = pc_compare_pcb_index(a, b, arg);
+	if ( cmp ) return cmp;
+	return ( *((const uint32_t *)a) > *((const uint32_t *)b) ) - ( *((const uint32_t *)a) < *((const uint32_t *)b) );
+}
+
 
 /**
 * Sort
@@ -60,6 +83,97 @@ pc_patch_uncompressed_sort(const PCPATCH_UNCOMPRESSED *pu, PCDIMENSION_LIST dim)
 	return spu;
 }
 
+/* NULL terminated array of the uncompressed bytes of the dimensions */
+static const PCBYTES **
+pc_patch_dimensional_get_bytes_list(const PCPATCH_DIMENSIONAL *pdl, PCDIMENSION_LIST dim)
+{
+	int i, ndims = 0;
+	const PCBYTES **pcb;
+
+	while ( dim[ndims] ) ndims++;
+	pcb = pcalloc((ndims+1) * sizeof(PCBYTES *));
+	for ( i = 0; i < ndims; i++ )
+	{
+		pcb[i] = pc_patch_dimensional_get_bytes(pdl, dim[i]->position);
+		if ( ! pcb[i] )
+		{
+			pcfree(pcb);
+			return NULL;
+		}
+	}
+	pcb[ndims] = NULL;
+	return pcb;
+}
+
+/**
+* Only the sort dimensions are decoded to order the points, the
+* other dimensions are then decoded one at a time into a shared
+* scratch buffer and gathered once, in that order.
+*/
+PCPATCH_UNCOMPRESSED *
+pc_patch_dimensional_sort(const PCPATCH_DIMENSIONAL *pdl, PCDIMENSION_LIST dim)
+{
+	int i;
+	uint32_t j;
+	PCSINK scratch;
+	PCBYTES dpcb;
+	const PCSCHEMA *schema = pdl->schema;
+	PCPATCH_UNCOMPRESSED *spu;
+	const PCBYTES **keys = pc_patch_dimensional_get_bytes_list(pdl, dim);
+	uint32_t *order;
+
+	if ( ! keys )
+		return NULL;
+
+	spu = pc_patch_uncompressed_make(schema, pdl->npoints);
+	order = pcalloc(pdl->npoints * sizeof(uint32_t));
+	for ( j = 0; j < pdl->npoints; j++ )
+		order[j] = j;
+
+	sort_r(order, pdl->npoints, sizeof(uint32_t), pc_compare_pcb_index_stable, keys);
+
+	pc_sink_init(&scratch, 0);
+	for ( i = 0; i < schema->ndims; i++ )
+	{
+		PCDIMENSION *d = schema->dims[i];
+		const PCBYTES *pcb = &(pdl->bytes[i]);
+		uint8_t *buf = spu->data + d->byteoffset;
+
+		if ( pdl->decoded && pdl->decoded[i].bytes )
+		{
+			pcb = &(pdl->decoded[i]);
+		}
+		else if ( pcb->compression != PC_DIM_NONE )
+		{
+			if ( PC_FAILURE == pc_bytes_decode_scratch(pcb, &scratch, &dpcb) )
+			{
+				pcerror("%s: failed to decode dimension \"%s\"", __func__, d->name);
+				pc_patch_free((PCPATCH *)spu);
+				spu = NULL;
+				break;
+			}
+			pcb = &dpcb;
+		}
+		for ( j = 0; j < pdl->npoints; j++ )
+		{
+			memcpy(buf, pcb->bytes + order[j] * d->size, d->size);
+			buf += schema->size;
+		}
+	}
+
+	if ( scratch.bytes )
+		pcfree(scratch.bytes);
+	pcfree(order);
+	pcfree(keys);
+	if ( ! spu )
+		return NULL;
+
+	spu->npoints = pdl->npoints;
+	spu->bounds  = pdl->bounds;
+	spu->stats   = pc_stats_clone(pdl->stats);
+	return spu;
+}
+
 PCDIMENSION_LIST pc_schema_get_dimensions_by_name(const PCSCHEMA *schema, const char ** name, int ndims)
 {
 	PCDIMENSION_LIST dim = pcalloc( (ndims+1) * sizeof(PCDIMENSION *));
@@ -81,7 +195,16 @@ PCPATCH *
 pc_patch_sort(const PCPATCH *pa, const char ** name, int ndims)
 {
 	PCDIMENSION_LIST dim = pc_schema_get_dimensions_by_name(pa->schema, name, ndims);
-	PCPATCH *pu = pc_patch_uncompress(pa);
+	PCPATCH *pu;
+
+	if ( pa->type == PC_DIMENSIONAL )
+	{
+		PCPATCH_UNCOMPRESSED *ps = pc_patch_dimensional_sort((PCPATCH_DIMENSIONAL *)pa, dim);
+		pcfree(dim);
+		return (PCPATCH *) ps;
+	}
+
+	pu = pc_patch_uncompress(pa);
 	if ( !pu ) {
 		pcfree(dim);
 		pcerror("Patch uncompression failed");
@@ -130,16 +253,28 @@ pc_bytes_uncompressed_is_sorted(const PCBYTES *pcb, char strict)
 	return PC_TRUE;
 }
 
+/** Decode an encoded column into a scratch buffer and test it */
+static uint32_t
+pc_bytes_decoded_is_sorted(const PCBYTES *pcb, char strict)
+{
+	PCSINK scratch;
+	PCBYTES dpcb;
+	uint32_t is_sorted = PC_FALSE;
+
+	pc_sink_init(&scratch, 0);
+	if ( PC_SUCCESS == pc_bytes_decode_scratch(pcb, &scratch, &dpcb) )
+		is_sorted = pc_bytes_uncompressed_is_sorted(&dpcb, strict);
+	if ( scratch.bytes )
+		pcfree(scratch.bytes);
+	return is_sorted;
+}
 
 uint32_t
 pc_bytes_sigbits_is_sorted(const PCBYTES *pcb, char strict)
 {
 	assert(pcb->compression == PC_DIM_SIGBITS);
 	pcinfo("%s not implemented, decoding",__func__);
-	PCBYTES dpcb = pc_bytes_decode(*pcb);
-	uint32_t is_sorted = pc_bytes_uncompressed_is_sorted(&dpcb,strict);
-	pc_bytes_free(dpcb);
-	return is_sorted;
+	return pc_bytes_decoded_is_sorted(pcb, strict);
 }
 
 uint32_t
@@ -147,10 +282,15 @@ pc_bytes_zlib_is_sorted(const PCBYTES *pcb, char strict)
 {
 	assert(pcb->compression == PC_DIM_ZLIB);
 	pcinfo("%s not implemented, decoding",__func__);
-	PCBYTES dpcb = pc_bytes_decode(*pcb);
-	uint32_t is_sorted = pc_bytes_uncompressed_is_sorted(&dpcb,strict);
-	pc_bytes_free(dpcb);
-	return is_sorted;
+	return pc_bytes_decoded_is_sorted(pcb, strict);
+}
+
+static uint32_t
+pc_bytes_pfor_is_sorted(const PCBYTES *pcb, char strict)
+{
+	assert(pcb->compression == PC_DIM_PFOR);
+	pcinfo("%s not implemented, decoding",__func__);
+	return pc_bytes_decoded_is_sorted(pcb, strict);
 }
 
 
@@ -183,20 +323,29 @@ pc_patch_dimensional_is_sorted(const PCPATCH_DIMENSIONAL *pdl, PCDIMENSION_LIST
 	assert(pdl);
 	assert(pdl->schema);
 
-	// uncompress when checking multiple dimensions
+	// decode the checked dimensions only when checking multiple dimensions
 	if(dim[1])
 	{
-		PCPATCH_UNCOMPRESSED *pu = pc_patch_uncompressed_from_dimensional(pdl);
-		if ( !pu ) {
-			pcerror("Patch uncompression failed");
-			return PC_FAILURE - 1; // aliasing issue : PC_FALSE == PC_FAILURE...
+		const PCBYTES **keys = pc_patch_dimensional_get_bytes_list(pdl, dim);
+		uint32_t is_sorted = PC_TRUE;
+		uint32_t i, j;
+		if ( ! keys )
+			return PC_FALSE;
+		for ( i = 0, j = 1; j < pdl->npoints; i++, j++ )
+		{
+			if ( pc_compare_pcb_index(&i, &j, keys) >= strict )
+			{
+				is_sorted = PC_FALSE;
+				break;
+			}
 		}
-		uint32_t is_sorted = pc_patch_uncompressed_is_sorted(pu,dim,strict);
-		pc_patch_free((PCPATCH *)pu);
+		pcfree(keys);
 		return is_sorted;
 	}
 
 	PCBYTES *pcb = pdl->bytes + dim[0]->position;
+	if ( pdl->decoded && pdl->decoded[dim[0]->position].bytes )
+		return pc_bytes_uncompressed_is_sorted(pdl->decoded + dim[0]->position, strict);
 	switch ( pcb->compression )
 	{
 	case PC_DIM_RLE:
@@ -211,6 +360,10 @@ pc_patch_dimensional_is_sorted(const PCPATCH_DIMENSIONAL *pdl, PCDIMENSION_LIST
 	{
 		return pc_bytes_zlib_is_sorted(pcb,strict);
 	}
+	case PC_DIM_PFOR:
+	{
+		return pc_bytes_pfor_is_sorted(pcb,strict);
+	}
 	case PC_DIM_NONE:
 	{
 		return pc_bytes_uncompressed_is_sorted(pcb,strict);
@@ -278,3 +431,258 @@ pc_patch_is_sorted(const PCPATCH *pa, const char **name, int ndims, char strict)
 	pcfree(dim);
 	return is_sorted;
 }
+
+
+/**
+* Slice and merge
+*/
+
+/* Value of point n in a column of the given stride, as stored */
+static inline double
+pc_column_value(const uint8_t *ptr, size_t stride, uint32_t interpretation, uint32_t n)
+{
+	return pc_double_from_ptr(ptr + n * stride, interpretation);
+}
+
+/**
+* First point of a sorted column with a value, scaled, greater than v,
+* or not less than v when inclusive. npoints when there is none.
+*/
+static uint32_t
+pc_column_search(const uint8_t *ptr, size_t stride, const PCDIMENSION *dim, uint32_t npoints, double v, char inclusive)
+{
+	uint32_t lo = 0, hi = npoints;
+
+	while ( lo < hi )
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		double d = pc_value_scale_offset(pc_column_value(ptr, stride, dim->interpretation, mid), dim);
+		if ( inclusive ? d < v : d <= v )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Uncompressed copy of count points of a patch, from first */
+static PCPATCH *
+pc_patch_slice_range(const PCPATCH *pa, uint32_t first, uint32_t count)
+{
+	const PCSCHEMA *s = pa->schema;
+	PCPATCH_UNCOMPRESSED *pu = pc_patch_uncompressed_make(s, count);
+	int i;
+	uint32_t j;
+
+	pu->npoints = count;
+	if ( ! count )
+		return (PCPATCH*)pu;
+
+	if ( pa->type == PC_DIMENSIONAL )
+	{
+		for ( i = 0; i < s->ndims; i++ )
+		{
+			const PCDIMENSION *d = s->dims[i];
+			const PCBYTES *pcb = pc_patch_dimensional_get_bytes((const PCPATCH_DIMENSIONAL*)pa, i);
+			const uint8_t *src = pcb->bytes + (size_t)first * d->size;
+			uint8_t *buf = pu->data + d->byteoffset;
+			for ( j = 0; j < count; j++ )
+			{
+				memcpy(buf, src, d->size);
+				buf += s->size;
+				src += d->size;
+			}
+		}
+	}
+	else
+	{
+		const PCPATCH_UNCOMPRESSED *pul = (const PCPATCH_UNCOMPRESSED*)pa;
+		memcpy(pu->data, pul->data + (size_t)first * s->size, (size_t)count * s->size);
+	}
+
+	if ( PC_FAILURE == pc_patch_compute_extent((PCPATCH*)pu) ||
+	     PC_FAILURE == pc_patch_compute_stats((PCPATCH*)pu) )
+	{
+		pcerror("%s: failed to compute patch stats", __func__);
+		pc_patch_free((PCPATCH*)pu);
+		return NULL;
+	}
+	return (PCPATCH*)pu;
+}
+
+PCPATCH *
+pc_patch_slice_sorted(const PCPATCH *pa, const char *name, double t1, double t2)
+{
+	const char *names[1] = { name };
+	const PCDIMENSION *dim = pc_schema_get_dimension_by_name(pa->schema, name);
+	const PCPATCH *pu;
+	PCPATCH *paout;
+	const uint8_t *ptr;
+	size_t stride;
+	uint32_t first, last;
+
+	if ( ! dim )
+	{
+		pcerror("%s: dimension \"%s\" does not exist", __func__, name);
+		return NULL;
+	}
+
+	/* Nothing to decode when the stats rule the window out */
+	if ( ! pa->npoints || t1 >= t2 )
+		return (PCPATCH*)pc_patch_uncompressed_make(pa->schema, 0);
+	if ( pa->stats )
+	{
+		double min, max;
+		pc_point_get_double_by_index(&(pa->stats->min), dim->position, &min);
+		pc_point_get_double_by_index(&(pa->stats->max), dim->position, &max);
+		if ( max <= t1 || min >= t2 )
+			return (PCPATCH*)pc_patch_uncompressed_make(pa->schema, 0);
+	}
+
+	/* Unsorted patches are filtered on their encoded form, then the points left are sorted */
+	if ( pc_patch_is_sorted(pa, names, 1, PC_FALSE) != PC_TRUE )
+	{
+		PCPATCH *pf = pc_patch_filter(pa, dim->position, PC_BETWEEN, t1, t2);
+		if ( ! pf || ! pf->npoints )
+			return pf;
+		paout = pc_patch_sort(pf, names, 1);
+		pc_patch_free(pf);
+		return paout;
+	}
+
+	/* Sorted patches are cut where a binary search on the column finds the window */
+	pu = ( pa->type == PC_NONE || pa->type == PC_DIMENSIONAL ) ? pa : pc_patch_uncompress(pa);
+	if ( pu->type == PC_DIMENSIONAL )
+	{
+		ptr = pc_patch_dimensional_get_bytes((const PCPATCH_DIMENSIONAL*)pu, dim->position)->bytes;
+		stride = dim->size;
+	}
+	else
+	{
+		ptr = ((const PCPATCH_UNCOMPRESSED*)pu)->data + dim->byteoffset;
+		stride = pu->schema->size;
+	}
+
+	first = pc_column_search(ptr, stride, dim, pu->npoints, t1, PC_FALSE);
+	last = pc_column_search(ptr, stride, dim, pu->npoints, t2, PC_TRUE);
+	paout = pc_patch_slice_range(pu, first, last > first ? last - first : 0);
+
+	if ( pu != pa )
+		pc_patch_free((PCPATCH*)pu);
+	return paout;
+}
+
+/* Order of the next points of two patches in a merge, ties go to the first patch */
+static inline int
+pc_merge_before(const double *keys, uint32_t a, uint32_t b)
+{
+	return keys[a] < keys[b] || ( keys[a] == keys[b] && a < b );
+}
+
+static void
+pc_merge_sift_down(uint32_t *heap, uint32_t nheap, const double *keys, uint32_t i)
+{
+	for ( ;; )
+	{
+		uint32_t l = 2 * i + 1, r = l + 1, m = i, tmp;
+		if ( l < nheap && pc_merge_before(keys, heap[l], heap[m]) ) m = l;
+		if ( r < nheap && pc_merge_before(keys, heap[r], heap[m]) ) m = r;
+		if ( m == i )
+			return;
+		tmp = heap[i];
+		heap[i] = heap[m];
+		heap[m] = tmp;
+		i = m;
+	}
+}
+
+/**
+* K-way merge through a binary heap of the patches, keyed on the
+* value of their next point, so that the merged patch needs no sort.
+*/
+PCPATCH *
+pc_patch_merge_sorted(PCPATCH * const *pas, uint32_t npatches, const char *name)
+{
+	const PCSCHEMA *s;
+	const PCDIMENSION *dim;
+	const PCPATCH_UNCOMPRESSED **pus;
+	PCPATCH_UNCOMPRESSED *paout;
+	uint32_t *heap, *next;
+	double *keys;
+	uint32_t i, nheap = 0, npoints = 0;
+	uint8_t *buf;
+
+	if ( ! npatches )
+	{
+		pcerror("%s: no patches to merge", __func__);
+		return NULL;
+	}
+
+	s = pas[0]->schema;
+	dim = pc_schema_get_dimension_by_name(s, name);
+	if ( ! dim )
+	{
+		pcerror("%s: dimension \"%s\" does not exist", __func__, name);
+		return NULL;
+	}
+
+	for ( i = 0; i < npatches; i++ )
+	{
+		if ( pas[i]->schema->pcid != s->pcid )
+		{
+			pcerror("%s: patches have mixed pcids %u and %u", __func__, s->pcid, pas[i]->schema->pcid);
+			return NULL;
+		}
+		npoints += pas[i]->npoints;
+	}
+
+	pus = pcalloc(npatches * sizeof(PCPATCH_UNCOMPRESSED*));
+	heap = pcalloc(npatches * sizeof(uint32_t));
+	next = pcalloc(npatches * sizeof(uint32_t));
+	keys = pcalloc(npatches * sizeof(double));
+
+	for ( i = 0; i < npatches; i++ )
+	{
+		pus[i] = (const PCPATCH_UNCOMPRESSED*)pc_patch_uncompress(pas[i]);
+		if ( pus[i]->npoints )
+		{
+			keys[i] = pc_column_value(pus[i]->data + dim->byteoffset, s->size, dim->interpretation, 0);
+			heap[nheap++] = i;
+		}
+	}
+	for ( i = nheap / 2; i-- > 0; )
+		pc_merge_sift_down(heap, nheap, keys, i);
+
+	paout = pc_patch_uncompressed_make(s, npoints);
+	paout->npoints = npoints;
+	buf = paout->data;
+	while ( nheap )
+	{
+		uint32_t p = heap[0];
+		memcpy(buf, pus[p]->data + (size_t)next[p] * s->size, s->size);
+		buf += s->size;
+
+		if ( ++next[p] < pus[p]->npoints )
+			keys[p] = pc_column_value(pus[p]->data + dim->byteoffset, s->size, dim->interpretation, next[p]);
+		else
+			heap[0] = heap[--nheap];
+		pc_merge_sift_down(heap, nheap, keys, 0);
+	}
+
+	for ( i = 0; i < npatches; i++ )
+		if ( (const PCPATCH*)pus[i] != pas[i] )
+			pc_patch_free((PCPATCH*)pus[i]);
+	pcfree(pus);
+	pcfree(heap);
+	pcfree(next);
+	pcfree(keys);
+
+	if ( npoints && ( PC_FAILURE == pc_patch_compute_extent((PCPATCH*)paout) ||
+	                  PC_FAILURE == pc_patch_compute_stats((PCPATCH*)paout) ) )
+	{
+		pcerror("%s: failed to compute patch stats", __func__);
+		pc_patch_free((PCPATCH*)paout);
+		return NULL;
+	}
+	return (PCPATCH*)paout;
+}
@@ -144,6 +144,34 @@ pc_stats_clone(const PCSTATS *stats)
 	return s;
 }
 
+/**
+* Fold the stats of n2 points into the stats of n1 points, the
+* average is weighted by the number of points on each side.
+*/
+void
+pc_stats_merge(PCSTATS *s1, uint32_t n1, const PCSTATS *s2, uint32_t n2)
+{
+	int i;
+	const PCSCHEMA *schema = s1->min.schema;
+
+	for ( i = 0; i < schema->ndims; i++ )
+	{
+		double min1, max1, avg1, min2, max2, avg2;
+		pc_point_get_double_by_index(&(s1->min), i, &min1);
+		pc_point_get_double_by_index(&(s1->max), i, &max1);
+		pc_point_get_double_by_index(&(s1->avg), i, &avg1);
+		pc_point_get_double_by_index(&(s2->min), i, &min2);
+		pc_point_get_double_by_index(&(s2->max), i, &max2);
+		pc_point_get_double_by_index(&(s2->avg), i, &avg2);
+
+		if ( min2 < min1 )
+			pc_point_set_double_by_index(&(s1->min), i, min2);
+		if ( max2 > max1 )
+			pc_point_set_double_by_index(&(s1->max), i, max2);
+		pc_point_set_double_by_index(&(s1->avg), i, (avg1 * n1 + avg2 * n2) / (n1 + n2));
+	}
+}
+
 int
 pc_patch_uncompressed_compute_stats(PCPATCH_UNCOMPRESSED *pa)
 {
@@ -187,6 +215,58 @@ pc_patch_uncompressed_compute_stats(PCPATCH_UNCOMPRESSED *pa)
 	return PC_SUCCESS;
 }
 
+/**
+* Dimensional stats are computed one dimension at a time, straight
+* from the (possibly encoded) dimension bytes, without rebuilding
+* the points.
+*/
+int
+pc_patch_dimensional_compute_stats(PCPATCH_DIMENSIONAL *pdl)
+{
+	int i;
+	const PCSCHEMA *schema = pdl->schema;
+	double min, max, avg;
+	PCSINK scratch;
+	PCDOUBLESTATS *dstats = pc_dstats_new(pdl->schema->ndims);
+
+	if ( pdl->stats )
+		pc_stats_free(pdl->stats);
+
+	dstats->npoints = pdl->npoints;
+	pc_sink_init(&scratch, 0);
+
+	for ( i = 0; i < schema->ndims; i++ )
+	{
+		PCDIMENSION *dim = schema->dims[i];
+		const PCBYTES *pcb = &(pdl->bytes[i]);
+
+		/* Skip decoding if the dimension has already been decoded */
+		if ( pdl->decoded && pdl->decoded[i].bytes )
+			pcb = &(pdl->decoded[i]);
+
+		if ( PC_FAILURE == pc_bytes_minmax_scratch(pcb, &min, &max, &avg, &scratch) )
+		{
+			if ( scratch.bytes )
+				pcfree(scratch.bytes);
+			pc_dstats_free(dstats);
+			pdl->stats = NULL;
+			return PC_FAILURE;
+		}
+
+		/* Scale and offset are linear, so they apply to the average too */
+		dstats->dims[i].min = pc_value_scale_offset(min, dim);
+		dstats->dims[i].max = pc_value_scale_offset(max, dim);
+		dstats->dims[i].sum = pc_value_scale_offset(avg, dim) * pdl->npoints;
+	}
+
+	if ( scratch.bytes )
+		pcfree(scratch.bytes);
+
+	pdl->stats = pc_stats_new_from_dstats(pdl->schema, dstats);
+	pc_dstats_free(dstats);
+	return PC_SUCCESS;
+}
+
 size_t
 pc_stats_size(const PCSCHEMA *schema)
 {
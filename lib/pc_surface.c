@@ -0,0 +1,304 @@
+/***********************************************************************
+* pc_surface.c
+*
+*  Elevation surfaces, DEM or DSM: the points of many patches are
+*  binned into a grid, keeping the lowest, highest, mean or inverse
+*  distance weighted Z of each cell, and the cells no point fell in
+*  are then filled from the cells around them. Only the X, Y and Z
+*  columns of the patches are decoded, and the grid is all that is
+*  kept between patches, so a grid sized as a tile bounds memory use
+*  whatever the number of points.
+*
+*  PgSQL Pointcloud is free and open source software provided
+*  by the Government of Canada
+*  Copyright (c) 2013 Natural Resources Canada
+*
+***********************************************************************/
+
+#include "pc_api_internal.h"
+#include <math.h>
+#include <float.h>
+
+/* Points per binning batch */
+#define PC_SURFACE_BATCH 256
+
+/* Largest grid, margin included, 256MB of cells */
+#define PC_SURFACE_MAXCELLS (1 << 24)
+
+PCSURFACE *
+pc_surface_new(double xmin, double ymax, double cellsize, uint32_t ncols, uint32_t nrows, double radius, PC_SURFACEMETHOD method)
+{
+	PCSURFACE *s;
+	double margin;
+	uint64_t ncells;
+
+	if ( ! ( cellsize > 0 ) || ! isfinite(cellsize) )
+	{
+		pcerror("%s: cell size must be positive, got %g", __func__, cellsize);
+		return NULL;
+	}
+	if ( ! ncols || ! nrows )
+	{
+		pcerror("%s: empty grid", __func__);
+		return NULL;
+	}
+	if ( ! ( radius >= 0 ) )
+	{
+		pcerror("%s: search radius must not be negative, got %g", __func__, radius);
+		return NULL;
+	}
+
+	margin = ceil(radius / cellsize);
+	ncells = margin < PC_SURFACE_MAXCELLS ? (ncols + 2 * (uint64_t)margin) * (nrows + 2 * (uint64_t)margin) : UINT64_MAX;
+	if ( ncells > PC_SURFACE_MAXCELLS )
+	{
+		pcerror("%s: grid of %u x %u cells with a margin of %g is too large, split it into tiles", __func__, ncols, nrows, margin);
+		return NULL;
+	}
+
+	s = pcalloc(sizeof(PCSURFACE));
+	s->xmin = xmin;
+	s->ymax = ymax;
+	s->cellsize = cellsize;
+	s->ncols = ncols;
+	s->nrows = nrows;
+	s->margin = margin;
+	s->radius = radius;
+	s->method = method;
+	s->value = pcalloc(ncells * sizeof(double));
+	s->weight = pcalloc(ncells * sizeof(double));
+	return s;
+}
+
+void
+pc_surface_free(PCSURFACE *s)
+{
+	pcfree(s->value);
+	pcfree(s->weight);
+	pcfree(s);
+}
+
+/**
+* Cell of every point of a batch in the grid, margin included,
+* -1 for the points outside of it.
+*/
+static void
+pc_surface_cells(const PCSURFACE *s, const double *x, const double *y, uint32_t n, int64_t *cells)
+{
+	uint32_t gcols = s->ncols + 2 * s->margin;
+	uint32_t grows = s->nrows + 2 * s->margin;
+	double x0 = s->xmin - s->margin * s->cellsize;
+	double y0 = s->ymax + s->margin * s->cellsize;
+	uint32_t i;
+
+	for ( i = 0; i < n; i++ )
+	{
+		double col = floor((x[i] - x0) / s->cellsize);
+		double row = floor((y0 - y[i]) / s->cellsize);
+		if ( col >= 0 && col < gcols && row >= 0 && row < grows )
+			cells[i] = (int64_t)row * gcols + (int64_t)col;
+		else
+			cells[i] = -1;
+	}
+}
+
+/**
+* Weight of a point for its cell, the inverse of its squared
+* distance to the cell center, bounded for points on the center.
+*/
+static inline double
+pc_surface_idw_weight(const PCSURFACE *s, int64_t cell, double x, double y)
+{
+	uint32_t gcols = s->ncols + 2 * s->margin;
+	double cs = s->cellsize;
+	double cx = s->xmin + ((cell % gcols) - (double)s->margin + 0.5) * cs;
+	double cy = s->ymax - ((cell / gcols) - (double)s->margin + 0.5) * cs;
+	double d2 = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+	double tiny = 1e-6 * cs * cs;
+	return 1.0 / ( d2 > tiny ? d2 : tiny );
+}
+
+int
+pc_surface_add_patch(PCSURFACE *s, const PCPATCH *pa)
+{
+	const PCSCHEMA *schema = pa->schema;
+	const PCPATCH *pu;
+	int64_t cells[PC_SURFACE_BATCH];
+	double *x, *y, *z;
+	uint32_t i, j, n;
+
+	if ( ! schema->xdim || ! schema->ydim || ! schema->zdim )
+	{
+		pcerror("%s: schema has no X/Y/Z dimensions", __func__);
+		return PC_FAILURE;
+	}
+	if ( ! pa->npoints )
+		return PC_SUCCESS;
+
+	/* Patches entirely outside of the grid need not be decoded */
+	if ( pa->bounds.xmax < s->xmin - s->margin * s->cellsize ||
+	     pa->bounds.xmin > s->xmin + (s->ncols + s->margin) * s->cellsize ||
+	     pa->bounds.ymax < s->ymax - (s->nrows + s->margin) * s->cellsize ||
+	     pa->bounds.ymin > s->ymax + s->margin * s->cellsize )
+	{
+		return PC_SUCCESS;
+	}
+
+	/* Only the X, Y and Z columns of dimensional patches are decoded */
+	pu = pa->type == PC_DIMENSIONAL ? pa : pc_patch_uncompress(pa);
+	x = pc_patch_dimension_to_double_array(pu, schema->xdim->position);
+	y = pc_patch_dimension_to_double_array(pu, schema->ydim->position);
+	z = pc_patch_dimension_to_double_array(pu, schema->zdim->position);
+
+	for ( i = 0; i < pa->npoints; i += n )
+	{
+		n = pa->npoints - i < PC_SURFACE_BATCH ? pa->npoints - i : PC_SURFACE_BATCH;
+		pc_surface_cells(s, x + i, y + i, n, cells);
+
+		switch ( s->method )
+		{
+		case PC_SURFACE_MIN:
+			for ( j = 0; j < n; j++ )
+			{
+				int64_t c = cells[j];
+				if ( c < 0 ) continue;
+				if ( ! s->weight[c] || z[i+j] < s->value[c] )
+					s->value[c] = z[i+j];
+				s->weight[c] += 1;
+			}
+			break;
+		case PC_SURFACE_MAX:
+			for ( j = 0; j < n; j++ )
+			{
+				int64_t c = cells[j];
+				if ( c < 0 ) continue;
+				if ( ! s->weight[c] || z[i+j] > s->value[c] )
+					s->value[c] = z[i+j];
+				s->weight[c] += 1;
+			}
+			break;
+		case PC_SURFACE_MEAN:
+			for ( j = 0; j < n; j++ )
+			{
+				int64_t c = cells[j];
+				if ( c < 0 ) continue;
+				s->value[c] += z[i+j];
+				s->weight[c] += 1;
+			}
+			break;
+		case PC_SURFACE_IDW:
+			for ( j = 0; j < n; j++ )
+			{
+				int64_t c = cells[j];
+				double w;
+				if ( c < 0 ) continue;
+				w = pc_surface_idw_weight(s, c, x[i+j], y[i+j]);
+				s->value[c] += w * z[i+j];
+				s->weight[c] += w;
+			}
+			break;
+		}
+	}
+
+	if ( pu != pa )
+		pc_patch_free((PCPATCH*)pu);
+	pcfree(x);
+	pcfree(y);
+	pcfree(z);
+	return PC_SUCCESS;
+}
+
+/**
+* Fill a hole from the cells with data within the search radius,
+* looking in rings of cells around it. Nearest neighbour stops at
+* the first ring that cannot hold a closer cell. Returns NaN when
+* there is no cell with data in reach.
+*/
+static double
+pc_surface_fill(const PCSURFACE *s, const double *vals, int64_t row, int64_t col, PC_FILLMETHOD fill)
+{
+	int64_t gcols = s->ncols + 2 * s->margin;
+	int64_t grows = s->nrows + 2 * s->margin;
+	double cs2 = s->cellsize * s->cellsize;
+	double r2 = s->radius * s->radius;
+	double best = NAN, bestd2 = DBL_MAX, sum = 0, wsum = 0;
+	int64_t k, dr, dc;
+
+	for ( k = 1; k <= s->margin; k++ )
+	{
+		for ( dr = -k; dr <= k; dr++ )
+		{
+			/* Inner rows of the ring only have their two ends */
+			int64_t step = ( dr == -k || dr == k ) ? 1 : 2 * k;
+			for ( dc = -k; dc <= k; dc += step )
+			{
+				int64_t r = row + dr, c = col + dc;
+				double v, d2;
+
+				if ( r < 0 || r >= grows || c < 0 || c >= gcols )
+					continue;
+				v = vals[r * gcols + c];
+				d2 = (double)(dr * dr + dc * dc) * cs2;
+				if ( isnan(v) || d2 > r2 )
+					continue;
+
+				if ( fill == PC_FILL_NEAREST )
+				{
+					if ( d2 < bestd2 )
+					{
+						bestd2 = d2;
+						best = v;
+					}
+				}
+				else
+				{
+					sum += v / d2;
+					wsum += 1 / d2;
+				}
+			}
+		}
+
+		if ( fill == PC_FILL_NEAREST && bestd2 <= (k + 1) * (k + 1) * cs2 )
+			break;
+	}
+
+	if ( fill == PC_FILL_NEAREST )
+		return best;
+	return wsum > 0 ? sum / wsum : NAN;
+}
+
+double *
+pc_surface_finish(const PCSURFACE *s, PC_FILLMETHOD fill)
+{
+	int64_t gcols = s->ncols + 2 * s->margin;
+	int64_t grows = s->nrows + 2 * s->margin;
+	int64_t i, row, col;
+	double *vals = pcalloc(gcols * grows * sizeof(double));
+	double *out = pcalloc((size_t)s->ncols * s->nrows * sizeof(double));
+
+	for ( i = 0; i < gcols * grows; i++ )
+	{
+		if ( ! s->weight[i] )
+			vals[i] = NAN;
+		else if ( s->method == PC_SURFACE_MEAN || s->method == PC_SURFACE_IDW )
+			vals[i] = s->value[i] / s->weight[i];
+		else
+			vals[i] = s->value[i];
+	}
+
+	/* Holes are filled from the cells with data only, not from filled ones */
+	for ( row = 0; row < s->nrows; row++ )
+	{
+		for ( col = 0; col < s->ncols; col++ )
+		{
+			int64_t grow = row + s->margin, gcol = col + s->margin;
+			double v = vals[grow * gcols + gcol];
+			if ( isnan(v) && fill != PC_FILL_NONE )
+				v = pc_surface_fill(s, vals, grow, gcol, fill);
+			out[row * s->ncols + col] = v;
+		}
+	}
+
+	pcfree(vals);
+	return out;
+}
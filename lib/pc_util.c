@@ -208,7 +208,20 @@ wkb_get_compression(const uint8_t *wkb)
 	{
 		compression = int32_flip_endian(compression);
 	}
-	return compression;
+	return compression & ~PC_WKB_FLAGS;
+}
+
+uint32_t
+wkb_get_flags(const uint8_t *wkb)
+{
+	/* Optional blocks are flagged along with the compression */
+	uint32_t compression;
+	memcpy(&compression, wkb+1+4, 4);
+	if ( wkb[0] != machine_endian() )
+	{
+		compression = int32_flip_endian(compression);
+	}
+	return compression & PC_WKB_FLAGS;
 }
 
 uint32_t
@@ -229,30 +242,106 @@ wkb_get_npoints(const uint8_t *wkb)
 	return npoints;
 }
 
+/* Compilers turn these into a single byte swap instruction */
+#if defined(__GNUC__) || defined(__clang__)
+#define pc_bswap16(v) __builtin_bswap16(v)
+#define pc_bswap32(v) __builtin_bswap32(v)
+#define pc_bswap64(v) __builtin_bswap64(v)
+#else
+static inline uint16_t pc_bswap16(uint16_t v)
+{
+	return (v >> 8) | (v << 8);
+}
+static inline uint32_t pc_bswap32(uint32_t v)
+{
+	return ((uint32_t)pc_bswap16(v) << 16) | pc_bswap16(v >> 16);
+}
+static inline uint64_t pc_bswap64(uint64_t v)
+{
+	return ((uint64_t)pc_bswap32(v) << 32) | pc_bswap32(v >> 32);
+}
+#endif
+
+/**
+* Flip the endianness of npoints values of size bytes, laid out
+* every stride bytes, in place. With stride == size this works on
+* a dimension column, and with stride == schema size on one
+* dimension of a row buffer. There is one loop per value size,
+* contiguous columns get vectorized by the compiler.
+*/
+void
+pc_flip_endian_strided(uint8_t *ptr, size_t size, size_t stride, uint32_t npoints)
+{
+	uint32_t i;
+
+	switch ( size )
+	{
+	case 1:
+		return;
+	case 2:
+	{
+		uint16_t v;
+		for ( i = 0; i < npoints; i++, ptr += stride )
+		{
+			memcpy(&v, ptr, 2);
+			v = pc_bswap16(v);
+			memcpy(ptr, &v, 2);
+		}
+		return;
+	}
+	case 4:
+	{
+		uint32_t v;
+		for ( i = 0; i < npoints; i++, ptr += stride )
+		{
+			memcpy(&v, ptr, 4);
+			v = pc_bswap32(v);
+			memcpy(ptr, &v, 4);
+		}
+		return;
+	}
+	case 8:
+	{
+		uint64_t v;
+		for ( i = 0; i < npoints; i++, ptr += stride )
+		{
+			memcpy(&v, ptr, 8);
+			v = pc_bswap64(v);
+			memcpy(ptr, &v, 8);
+		}
+		return;
+	}
+	default:
+	{
+		size_t k;
+		for ( i = 0; i < npoints; i++, ptr += stride )
+		{
+			for ( k = 0; k < size/2; k++ )
+			{
+				uint8_t tmp = ptr[k];
+				ptr[k] = ptr[size - k - 1];
+				ptr[size - k - 1] = tmp;
+			}
+		}
+		return;
+	}
+	}
+}
+
 uint8_t*
 uncompressed_bytes_flip_endian(const uint8_t *bytebuf, const PCSCHEMA *schema, uint32_t npoints)
 {
-	int i, j, k;
+	int i;
 	size_t bufsize = schema->size * npoints;
 	uint8_t *buf = pcalloc(bufsize);
 
 	memcpy(buf, bytebuf, bufsize);
 
-	for ( i = 0; i < npoints ; i++ )
+	/* One dimension at a time, across the whole buffer */
+	for ( i = 0; i < schema->ndims; i++ )
 	{
-		for ( j = 0; j < schema->ndims; j++ )
-		{
-			PCDIMENSION *dimension = schema->dims[j];
-			uint8_t *ptr = buf + i * schema->size + dimension->byteoffset;
-
-			for ( k = 0; k < ((dimension->size)/2); k++ )
-			{
-				int l = dimension->size - k - 1;
-				uint8_t tmp = ptr[k];
-				ptr[k] = ptr[l];
-				ptr[l] = tmp;
-			}
-		}
+		PCDIMENSION *dimension = schema->dims[i];
+		pc_flip_endian_strided(buf + dimension->byteoffset, dimension->size, schema->size, npoints);
 	}
 
 	return buf;
@@ -286,6 +375,46 @@ void pc_bounds_merge(PCBOUNDS *b1, const PCBOUNDS *b2)
 	if ( b2->ymax > b1->ymax ) b1->ymax = b2->ymax;
 }
 
+/**
+* Upper 32 bits of a double, flipped so that they sort
+* like the double itself.
+*/
+static uint32_t
+pc_double_sortable_bits(double d)
+{
+	uint64_t bits;
+	memcpy(&bits, &d, sizeof(double));
+	bits = ( bits >> 63 ) ? ~bits : bits | ((uint64_t)1 << 63);
+	return (uint32_t)(bits >> 32);
+}
+
+/** Spread the 32 bits of v over the even bits of a 64 bit integer */
+static uint64_t
+pc_morton_spread(uint32_t v)
+{
+	uint64_t x = v;
+	x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+	x = (x | (x << 8)) & 0x00FF00FF00FF00FFULL;
+	x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	x = (x | (x << 2)) & 0x3333333333333333ULL;
+	x = (x | (x << 1)) & 0x5555555555555555ULL;
+	return x;
+}
+
+/**
+* Z-order key of the center of the bounds. The coordinates are
+* taken as their sortable bit patterns, so that no common extent
+* is needed: nearby centers get nearby keys at any scale.
+*/
+uint64_t
+pc_bounds_morton(const PCBOUNDS *b)
+{
+	double x = b->xmin / 2 + b->xmax / 2;
+	double y = b->ymin / 2 + b->ymax / 2;
+	return pc_morton_spread(pc_double_sortable_bits(x)) |
+	       (pc_morton_spread(pc_double_sortable_bits(y)) << 1);
+}
+
 static uint32_t srid_mask = 0x20000000;
 static uint32_t m_mask = 0x40000000;
 static uint32_t z_mask = 0x80000000;
@@ -221,3 +221,160 @@ pc_double_to_ptr(uint8_t *ptr, uint32_t interpretation, double val)
 
 	return PC_SUCCESS;
 }
+
+/* Powers of ten, all exactly representable as doubles */
+static const double pc_pow10[] =
+{
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8,
+	1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17
+};
+
+/* Largest integer below which all integers are exact doubles */
+#define PC_DOUBLE_MAXINT 9007199254740992.0
+
+/**
+* Write v / 10^decimals as a decimal number, without trailing
+* zeroes in the fractional part. Returns the string length.
+*/
+static int
+pc_uint64_to_string(char *buf, uint64_t v, int negative, int decimals)
+{
+	char digits[24];
+	int n = 0, len = 0;
+	int zero;
+
+	while ( decimals > 0 && v && v % 10 == 0 )
+	{
+		v /= 10;
+		decimals--;
+	}
+	zero = ! v;
+	if ( zero ) decimals = 0;
+
+	/* Digits, least significant first, padded for numbers below one */
+	do
+	{
+		digits[n++] = '0' + v % 10;
+		v /= 10;
+	}
+	while ( v );
+	while ( n <= decimals )
+		digits[n++] = '0';
+
+	if ( negative && ! zero )
+		buf[len++] = '-';
+	while ( n > decimals )
+		buf[len++] = digits[--n];
+	if ( decimals )
+	{
+		buf[len++] = '.';
+		while ( n )
+			buf[len++] = digits[--n];
+	}
+	buf[len] = '\0';
+	return len;
+}
+
+/**
+* Write the shortest decimal string that reads back as exactly
+* the same double. Values that can be written without exponent
+* are found by looking for the smallest power of ten turning them
+* into an integer, others go through printf with increasing
+* precision. Returns the string length.
+*/
+int
+pc_double_to_string(char *buf, double d)
+{
+	int i;
+
+	if ( d == 0 )
+	{
+		return sprintf(buf, signbit(d) ? "-0" : "0");
+	}
+
+	if ( isfinite(d) )
+	{
+		for ( i = 0; i < sizeof(pc_pow10) / sizeof(double); i++ )
+		{
+			double m = d * pc_pow10[i];
+			if ( fabs(m) >= PC_DOUBLE_MAXINT )
+				break;
+			m = nearbyint(m);
+			/* Division is correctly rounded, just like strtod */
+			if ( m / pc_pow10[i] == d )
+				return pc_uint64_to_string(buf, (uint64_t)fabs(m), d < 0, i);
+		}
+
+		for ( i = 15; i < 17; i++ )
+		{
+			int len = sprintf(buf, "%.*g", i, d);
+			if ( strtod(buf, NULL) == d )
+				return len;
+		}
+	}
+
+	return sprintf(buf, "%.17g", d);
+}
+
+/**
+* Number of decimals of a 10^-n scale, or -1 if the
+* scale is not a power of ten.
+*/
+static int
+pc_scale_decimals(double scale)
+{
+	int i;
+	for ( i = 0; i < 10; i++ )
+	{
+		if ( scale == 1.0 / pc_pow10[i] )
+			return i;
+	}
+	return -1;
+}
+
+/**
+* Write the scaled value of a dimension read from a buffer.
+* Integral values with a decimal scale and no offset are written
+* digit by digit from the integer, without double formatting.
+* Returns the string length.
+*/
+int
+pc_value_to_string(char *buf, const uint8_t *ptr, const PCDIMENSION *dim)
+{
+	int decimals = pc_scale_decimals(dim->scale);
+
+	if ( decimals >= 0 && ! dim->offset )
+	{
+		switch( dim->interpretation )
+		{
+		case PC_INT64:
+		{
+			int64_t v;
+			memcpy(&(v), ptr, sizeof(int64_t));
+			return pc_uint64_to_string(buf, v < 0 ? -(uint64_t)v : (uint64_t)v, v < 0, decimals);
+		}
+		case PC_UINT64:
+		{
+			uint64_t v;
+			memcpy(&(v), ptr, sizeof(uint64_t));
+			return pc_uint64_to_string(buf, v, PC_FALSE, decimals);
+		}
+		case PC_DOUBLE:
+		case PC_FLOAT:
+		{
+			double v = pc_double_from_ptr(ptr, dim->interpretation);
+			if ( v == floor(v) && fabs(v) < PC_DOUBLE_MAXINT )
+				return pc_uint64_to_string(buf, (uint64_t)fabs(v), v < 0, decimals);
+			break;
+		}
+		default:
+		{
+			/* Integers up to 32 bits are exact doubles */
+			double v = pc_double_from_ptr(ptr, dim->interpretation);
+			return pc_uint64_to_string(buf, (uint64_t)fabs(v), v < 0, decimals);
+		}
+		}
+	}
+
+	return pc_double_to_string(buf, pc_value_from_ptr(ptr, dim));
+}
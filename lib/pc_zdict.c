@@ -0,0 +1,210 @@
+/***********************************************************************
+* pc_zdict.c
+*
+*  Preset dictionaries for the zlib dimensional compression. Small
+*  patches barely compress with zlib on their own, since the stream
+*  has nothing to refer back to; priming it with content typical of
+*  the dimension fixes that.
+*
+*  PgSQL Pointcloud is free and open source software provided
+*  by the Government of Canada
+*  Copyright (c) 2013 Natural Resources Canada
+*
+***********************************************************************/
+
+#include "pc_api_internal.h"
+#include "zlib.h"
+
+/* zlib never looks further back than its 32KB window */
+#define PC_ZDICT_MAXSIZE 32768
+
+/* Dictionaries are built from runs of this many values */
+#define PC_ZDICT_SEGMENT_VALUES 8
+
+PCZDICT *
+pc_zdict_make(const uint8_t *bytes, uint32_t size)
+{
+	PCZDICT *zdict;
+
+	if ( ! bytes || ! size )
+	{
+		pcerror("%s: empty dictionary", __func__);
+		return NULL;
+	}
+
+	zdict = pcalloc(sizeof(PCZDICT));
+	zdict->size = size;
+	zdict->bytes = pcalloc(size);
+	memcpy(zdict->bytes, bytes, size);
+	zdict->id = adler32(adler32(0L, Z_NULL, 0), bytes, size);
+	return zdict;
+}
+
+PCZDICT *
+pc_zdict_clone(const PCZDICT *zdict)
+{
+	return pc_zdict_make(zdict->bytes, zdict->size);
+}
+
+void
+pc_zdict_free(PCZDICT *zdict)
+{
+	if ( ! zdict ) return;
+	if ( zdict->bytes )
+		pcfree(zdict->bytes);
+	pcfree(zdict);
+}
+
+/* A distinct segment of the samples, and how often it occurs */
+typedef struct
+{
+	const uint8_t *ptr;
+	uint32_t hash;
+	uint32_t count;
+	uint32_t first;
+} PCZSEGMENT;
+
+static uint32_t
+pc_zdict_hash(const uint8_t *ptr, size_t size)
+{
+	/* FNV-1a */
+	uint32_t h = 2166136261u;
+	size_t i;
+	for ( i = 0; i < size; i++ )
+	{
+		h ^= ptr[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/* Most frequent first, then in order of appearance */
+static int
+pc_zdict_segment_cmp(const void *a, const void *b)
+{
+	const PCZSEGMENT *sa = a;
+	const PCZSEGMENT *sb = b;
+	if ( sa->count != sb->count )
+		return sa->count > sb->count ? -1 : 1;
+	return sa->first < sb->first ? -1 : sa->first > sb->first;
+}
+
+/**
+* Cut the uncompressed samples into segments of a few values, and
+* fill the dictionary with the most frequent ones. zlib codes short
+* distances cheaper, so the most frequent segments go last. When
+* nothing repeats this amounts to concatenating the samples, which
+* still primes the stream with representative content.
+* Returns NULL if the samples are too short to cut a segment.
+*/
+PCZDICT *
+pc_zdict_train(const PCBYTES *samples, uint32_t nsamples, uint32_t maxsize)
+{
+	int i, j;
+	size_t segsize, nsegs = 0, nslots, ndistinct = 0, nkept;
+	PCZSEGMENT *slots, *segs;
+	PCBYTES *decoded;
+	uint8_t *buf, *ptr, *raw, *rawptr;
+	size_t rawsize = 0;
+	uint32_t order = 0;
+	PCZDICT *zdict = NULL;
+
+	if ( ! nsamples )
+		return NULL;
+
+	if ( ! maxsize || maxsize > PC_ZDICT_MAXSIZE )
+		maxsize = PC_ZDICT_MAXSIZE;
+
+	segsize = pc_interpretation_size(samples[0].interpretation) * PC_ZDICT_SEGMENT_VALUES;
+
+	for ( i = 0; i < nsamples; i++ )
+	{
+		if ( samples[i].interpretation != samples[0].interpretation )
+		{
+			pcerror("%s: samples have different interpretations", __func__);
+			return NULL;
+		}
+	}
+
+	/* Training works on the raw values, decoded side by side in one buffer */
+	for ( i = 0; i < nsamples; i++ )
+		if ( samples[i].compression != PC_DIM_NONE )
+			rawsize += pc_interpretation_size(samples[i].interpretation) * samples[i].npoints;
+	raw = rawptr = pcalloc(rawsize);
+	decoded = pcalloc(nsamples * sizeof(PCBYTES));
+	for ( i = 0; i < nsamples; i++ )
+	{
+		decoded[i] = samples[i];
+		if ( samples[i].compression != PC_DIM_NONE )
+		{
+			decoded[i].size = pc_interpretation_size(samples[i].interpretation) * samples[i].npoints;
+			decoded[i].bytes = rawptr;
+			decoded[i].compression = PC_DIM_NONE;
+			decoded[i].readonly = PC_TRUE;
+			pc_bytes_decode_into(&(samples[i]), rawptr, decoded[i].size);
+			rawptr += decoded[i].size;
+		}
+		nsegs += decoded[i].size / segsize;
+	}
+
+	/* Count the distinct segments in an open addressing table */
+	nslots = 64;
+	while ( nslots < 2 * nsegs )
+		nslots *= 2;
+	slots = pcalloc(nslots * sizeof(PCZSEGMENT));
+	for ( i = 0; i < nsamples; i++ )
+	{
+		for ( j = 0; j + segsize <= decoded[i].size; j += segsize )
+		{
+			const uint8_t *seg = decoded[i].bytes + j;
+			uint32_t h = pc_zdict_hash(seg, segsize);
+			size_t slot = h & (nslots - 1);
+
+			while ( slots[slot].ptr &&
+			        ( slots[slot].hash != h || memcmp(slots[slot].ptr, seg, segsize) ) )
+			{
+				slot = (slot + 1) & (nslots - 1);
+			}
+
+			if ( ! slots[slot].ptr )
+			{
+				slots[slot].ptr = seg;
+				slots[slot].hash = h;
+				slots[slot].first = order;
+				ndistinct++;
+			}
+			slots[slot].count++;
+			order++;
+		}
+	}
+
+	/* Rank them */
+	segs = pcalloc((ndistinct ? ndistinct : 1) * sizeof(PCZSEGMENT));
+	for ( i = 0, j = 0; i < nslots; i++ )
+		if ( slots[i].ptr )
+			segs[j++] = slots[i];
+	qsort(segs, ndistinct, sizeof(PCZSEGMENT), pc_zdict_segment_cmp);
+
+	/* Keep what fits, most frequent at the end */
+	nkept = maxsize / segsize;
+	if ( nkept > ndistinct ) nkept = ndistinct;
+	if ( nkept )
+	{
+		buf = pcalloc(nkept * segsize);
+		ptr = buf + nkept * segsize;
+		for ( i = 0; i < nkept; i++ )
+		{
+			ptr -= segsize;
+			memcpy(ptr, segs[i].ptr, segsize);
+		}
+		zdict = pc_zdict_make(buf, nkept * segsize);
+		pcfree(buf);
+	}
+
+	pcfree(segs);
+	pcfree(slots);
+	pcfree(decoded);
+	if ( raw )
+		pcfree(raw);
+	return zdict;
+}
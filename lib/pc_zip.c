@@ -0,0 +1,232 @@
+/***********************************************************************
+* pc_zip.c
+*
+*  Column groups: the dimensions of a wide schema split over several
+*  schemas, each group stored as a patch of its own with the points
+*  in the same order. Patches of groups are zipped back column by
+*  column into a patch of any schema made of their dimensions, and a
+*  patch is split into a group the same way. Dimensional columns are
+*  copied as they are encoded, stats are carried over from the group
+*  patches, so nothing is decoded unless a zlib dictionary differs.
+*
+*  PgSQL Pointcloud is free and open source software provided
+*  by the Government of Canada
+*  Copyright (c) 2013 Natural Resources Canada
+*
+***********************************************************************/
+
+#include "pc_api_internal.h"
+
+/**
+* Find the patch holding every dimension of the schema, the first
+* one with a dimension of that name, which must be stored the same.
+*/
+static int
+pc_zip_sources(PCPATCH * const *pas, uint32_t npatches, const PCSCHEMA *s, uint32_t *src, const PCDIMENSION **srcdims)
+{
+	int i;
+	uint32_t j;
+
+	for ( i = 0; i < s->ndims; i++ )
+	{
+		const PCDIMENSION *dim = s->dims[i];
+		const PCDIMENSION *sdim = NULL;
+
+		for ( j = 0; j < npatches && ! sdim; j++ )
+		{
+			sdim = pc_schema_get_dimension_by_name(pas[j]->schema, dim->name);
+			src[i] = j;
+		}
+
+		if ( ! sdim )
+		{
+			pcerror("%s: dimension \"%s\" is in none of the patches", __func__, dim->name);
+			return PC_FAILURE;
+		}
+		if ( sdim->interpretation != dim->interpretation || sdim->scale != dim->scale || sdim->offset != dim->offset )
+		{
+			pcerror("%s: dimension \"%s\" is not stored the same way in pcid %u and %u",
+			        __func__, dim->name, pas[src[i]]->schema->pcid, s->pcid);
+			return PC_FAILURE;
+		}
+		srcdims[i] = sdim;
+	}
+	return PC_SUCCESS;
+}
+
+static inline int
+pc_zip_same_zdict(const PCZDICT *a, const PCZDICT *b)
+{
+	if ( ! a || ! b )
+		return a == b;
+	return a->id == b->id && a->size == b->size && memcmp(a->bytes, b->bytes, a->size) == 0;
+}
+
+/**
+* Copy of an encoded column for a dimension of another schema. Only
+* zlib columns primed with another dictionary than the one of the
+* new dimension have to be decoded, through the scratch buffer, and
+* compressed again.
+*/
+static int
+pc_zip_column(const PCBYTES *pcb, const PCDIMENSION *dim, PCSINK *scratch, PCBYTES *out)
+{
+	if ( pcb->compression == PC_DIM_ZLIB && ! pc_zip_same_zdict(pcb->zdict, dim->zdict) )
+	{
+		PCBYTES dec;
+		if ( PC_FAILURE == pc_bytes_decode_scratch(pcb, scratch, &dec) )
+			return PC_FAILURE;
+		dec.zdict = dim->zdict;
+		*out = pc_bytes_encode(dec, PC_DIM_ZLIB);
+		if ( ! out->bytes )
+			return PC_FAILURE;
+	}
+	else
+	{
+		*out = pc_bytes_clone(*pcb);
+	}
+	out->zdict = dim->zdict;
+	return PC_SUCCESS;
+}
+
+PCPATCH *
+pc_patch_zip(PCPATCH * const *pas, uint32_t npatches, const PCSCHEMA *schema)
+{
+	const PCDIMENSION **srcdims;
+	const PCPATCH **pus;
+	uint32_t *src;
+	PCPATCH *paout = NULL;
+	uint32_t j, npoints;
+	int i, dimensional = PC_TRUE, stats = PC_TRUE;
+
+	if ( ! npatches )
+	{
+		pcerror("%s: no patches to zip", __func__);
+		return NULL;
+	}
+
+	npoints = pas[0]->npoints;
+	for ( j = 0; j < npatches; j++ )
+	{
+		if ( pas[j]->npoints != npoints )
+		{
+			pcerror("%s: patches have different numbers of points, %u and %u", __func__, npoints, pas[j]->npoints);
+			return NULL;
+		}
+		if ( pas[j]->schema->srid != schema->srid )
+		{
+			pcerror("%s: patches have mixed srids %u and %u", __func__, schema->srid, pas[j]->schema->srid);
+			return NULL;
+		}
+	}
+
+	src = pcalloc(schema->ndims * sizeof(uint32_t));
+	srcdims = pcalloc(schema->ndims * sizeof(PCDIMENSION*));
+	pus = pcalloc(npatches * sizeof(PCPATCH*));
+	if ( PC_FAILURE == pc_zip_sources(pas, npatches, schema, src, srcdims) )
+		goto cleanup;
+
+	for ( j = 0; j < npatches; j++ )
+	{
+		if ( pas[j]->type != PC_DIMENSIONAL )
+			dimensional = PC_FALSE;
+		if ( ! pas[j]->stats )
+			stats = PC_FALSE;
+	}
+
+	/* Dimensional columns are zipped as they are encoded, anything else goes through uncompressed points */
+	if ( dimensional )
+	{
+		PCPATCH_DIMENSIONAL *pdl = pcalloc(sizeof(PCPATCH_DIMENSIONAL));
+		pdl->type = PC_DIMENSIONAL;
+		pdl->readonly = PC_FALSE;
+		pdl->schema = schema;
+		pdl->npoints = npoints;
+		PCSINK scratch;
+		pdl->bytes = pcalloc(schema->ndims * sizeof(PCBYTES));
+		pc_sink_init(&scratch, 0);
+		for ( i = 0; i < schema->ndims; i++ )
+		{
+			const PCPATCH_DIMENSIONAL *spdl = (const PCPATCH_DIMENSIONAL*)pas[src[i]];
+			if ( PC_FAILURE == pc_zip_column(&(spdl->bytes[srcdims[i]->position]), schema->dims[i], &scratch, &(pdl->bytes[i])) )
+			{
+				pcerror("%s: failed to recompress dimension \"%s\"", __func__, schema->dims[i]->name);
+				while ( --i >= 0 )
+					pc_bytes_free(pdl->bytes[i]);
+				pcfree(pdl->bytes);
+				pcfree(pdl);
+				pdl = NULL;
+				break;
+			}
+		}
+		if ( scratch.bytes )
+			pcfree(scratch.bytes);
+		if ( ! pdl )
+			goto cleanup;
+		paout = (PCPATCH*)pdl;
+	}
+	else
+	{
+		PCPATCH_UNCOMPRESSED *pu = pc_patch_uncompressed_make(schema, npoints);
+		pu->npoints = npoints;
+		for ( j = 0; j < npatches; j++ )
+			pus[j] = pc_patch_uncompress(pas[j]);
+
+		for ( i = 0; i < schema->ndims; i++ )
+		{
+			const PCPATCH_UNCOMPRESSED *spu = (const PCPATCH_UNCOMPRESSED*)pus[src[i]];
+			const uint8_t *sptr = spu->data + srcdims[i]->byteoffset;
+			uint8_t *ptr = pu->data + schema->dims[i]->byteoffset;
+			for ( j = 0; j < npoints; j++ )
+			{
+				memcpy(ptr, sptr, schema->dims[i]->size);
+				ptr += schema->size;
+				sptr += spu->schema->size;
+			}
+		}
+		paout = (PCPATCH*)pu;
+	}
+
+	if ( ! npoints )
+		goto cleanup;
+
+	/* X/Y bounds come along when both come from the same patch */
+	if ( src[schema->xdim->position] == src[schema->ydim->position] )
+		paout->bounds = pas[src[schema->xdim->position]]->bounds;
+	else if ( PC_FAILURE == pc_patch_compute_extent(paout) )
+	{
+		pcerror("%s: failed to compute patch extent", __func__);
+		pc_patch_free(paout);
+		paout = NULL;
+		goto cleanup;
+	}
+
+	/* Stats are taken from the patches, the values being stored the same way */
+	if ( stats )
+	{
+		paout->stats = pc_stats_new(schema);
+		for ( i = 0; i < schema->ndims; i++ )
+		{
+			const PCSTATS *sstats = pas[src[i]]->stats;
+			size_t off = schema->dims[i]->byteoffset, soff = srcdims[i]->byteoffset;
+			memcpy(paout->stats->min.data + off, sstats->min.data + soff, schema->dims[i]->size);
+			memcpy(paout->stats->max.data + off, sstats->max.data + soff, schema->dims[i]->size);
+			memcpy(paout->stats->avg.data + off, sstats->avg.data + soff, schema->dims[i]->size);
+		}
+	}
+	else if ( PC_FAILURE == pc_patch_compute_stats(paout) )
+	{
+		pcerror("%s: failed to compute patch stats", __func__);
+		pc_patch_free(paout);
+		paout = NULL;
+	}
+
+cleanup:
+	for ( j = 0; j < npatches; j++ )
+		if ( pus[j] && pus[j] != pas[j] )
+			pc_patch_free((PCPATCH*)pus[j]);
+	pcfree(pus);
+	pcfree(src);
+	pcfree(srcdims);
+	return paout;
+}
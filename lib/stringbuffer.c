@@ -132,6 +132,19 @@ stringbuffer_append(stringbuffer_t *s, const char *a)
 	s->str_end += alen;
 }
 
+/**
+* Append the first alen characters of the specified string to the
+* stringbuffer_t, for callers that already know the length.
+*/
+void
+stringbuffer_append_len(stringbuffer_t *s, const char *a, size_t alen)
+{
+	stringbuffer_makeroom(s, alen + 1);
+	memcpy(s->str_end, a, alen);
+	s->str_end += alen;
+	*(s->str_end) = '\0';
+}
+
 /**
 * Returns a reference to the internal string being managed by
 * the stringbuffer. The current string will be null-terminated
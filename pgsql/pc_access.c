@@ -12,8 +12,10 @@
 #include "pc_pgsql.h"      /* Common PgSQL support for our type */
 #include "utils/numeric.h"
 #include "funcapi.h"
+#include "utils/lsyscache.h"
 #include "lib/stringinfo.h"
 #include "pc_api_internal.h" /* for pcpatch_summary */
+#include <math.h>
 
 /* cstring array utility functions */
 const char **array_to_cstring_array(ArrayType *array, int *size);
@@ -22,8 +24,10 @@ void pc_cstring_array_free(const char **array, int nelems);
 /* General SQL functions */
 Datum pcpoint_get_value(PG_FUNCTION_ARGS);
 Datum pcpoint_get_values(PG_FUNCTION_ARGS);
+Datum pcpatch_get_values(PG_FUNCTION_ARGS);
 Datum pcpatch_from_pcpoint_array(PG_FUNCTION_ARGS);
 Datum pcpatch_from_pcpatch_array(PG_FUNCTION_ARGS);
+Datum pcpatch_zip(PG_FUNCTION_ARGS);
 Datum pcpatch_uncompress(PG_FUNCTION_ARGS);
 Datum pcpatch_compress(PG_FUNCTION_ARGS);
 Datum pcpatch_numpoints(PG_FUNCTION_ARGS);
@@ -33,8 +37,12 @@ Datum pcpatch_pcid(PG_FUNCTION_ARGS);
 Datum pcpatch_summary(PG_FUNCTION_ARGS);
 Datum pcpatch_compression(PG_FUNCTION_ARGS);
 Datum pcpatch_intersects(PG_FUNCTION_ARGS);
+Datum pcpatch_morton_key(PG_FUNCTION_ARGS);
 Datum pcpatch_get_stat(PG_FUNCTION_ARGS);
 Datum pcpatch_filter(PG_FUNCTION_ARGS);
+Datum pcpatch_filter_box(PG_FUNCTION_ARGS);
+Datum pcpatch_split_by_polygons(PG_FUNCTION_ARGS);
+Datum pcpatch_classify_by_polygons(PG_FUNCTION_ARGS);
 Datum pcpatch_sort(PG_FUNCTION_ARGS);
 Datum pcpatch_is_sorted(PG_FUNCTION_ARGS);
 Datum pcpatch_size(PG_FUNCTION_ARGS);
@@ -55,6 +63,14 @@ Datum pcpoint_agg_final_array(PG_FUNCTION_ARGS);
 Datum pcpatch_agg_final_array(PG_FUNCTION_ARGS);
 Datum pcpatch_agg_final_pcpatch(PG_FUNCTION_ARGS);
 
+/* Elevation surfaces */
+Datum pcpatch_surface_transfn(PG_FUNCTION_ARGS);
+Datum pcpatch_surface_final(PG_FUNCTION_ARGS);
+
+/* Time slices */
+Datum pcpatch_timeslice_transfn(PG_FUNCTION_ARGS);
+Datum pcpatch_timeslice_final(PG_FUNCTION_ARGS);
+
 /* Deaggregation functions */
 Datum pcpatch_unnest(PG_FUNCTION_ARGS);
 
@@ -118,6 +134,42 @@ Datum pcpoint_get_values(PG_FUNCTION_ARGS)
 	PG_RETURN_ARRAYTYPE_P(result);
 }
 
+/**
+* Returns the values of a dimension for all the points of a patch
+* PC_Get(patch pcpatch, dimname text) returns Float8[]
+*/
+PG_FUNCTION_INFO_V1(pcpatch_get_values);
+Datum pcpatch_get_values(PG_FUNCTION_ARGS)
+{
+	SERIALIZED_PATCH *serpa = PG_GETARG_SERPATCH_P(0);
+	char *dim_str = text_to_cstring(PG_GETARG_TEXT_P(1));
+	PCSCHEMA *schema = pc_schema_from_pcid(serpa->pcid, fcinfo);
+	PCDIMENSION *dim = pc_schema_get_dimension_by_name(schema, dim_str);
+	ArrayType *result;
+	PCPATCH *patch;
+	Datum *elems;
+	double *vals;
+	int i;
+
+	if ( ! dim )
+		elog(ERROR, "dimension \"%s\" does not exist in schema", dim_str);
+	pfree(dim_str);
+
+	patch = pc_patch_deserialize(serpa, schema);
+	if ( ! patch ) PG_RETURN_NULL();
+
+	vals = pc_patch_dimension_to_double_array(patch, dim->position);
+	elems = (Datum * )palloc(patch->npoints * sizeof(Datum) );
+	i = patch->npoints;
+	while (i--) elems[i] = Float8GetDatum(vals[i]);
+	pcfree(vals);
+	result = construct_array(elems, patch->npoints, FLOAT8OID,
+		sizeof(float8), FLOAT8PASSBYVAL, 'd');
+
+	pc_patch_free(patch);
+	PG_RETURN_ARRAYTYPE_P(result);
+}
+
 
 static inline bool
 array_get_isnull(const bits8 *nullbitmap, int offset)
@@ -141,8 +193,7 @@ pcpatch_from_point_array(ArrayType *array, FunctionCallInfoData *fcinfo)
 	size_t offset = 0;
 	int i;
 	uint32 pcid = 0;
-	PCPATCH *pa;
-	PCPOINTLIST *pl;
+	PCPATCH_BUILDER *pb = NULL;
 	PCSCHEMA *schema = 0;
 
 	/* How many things in our array? */
@@ -155,9 +206,6 @@ pcpatch_from_point_array(ArrayType *array, FunctionCallInfoData *fcinfo)
 	if ( nelems == 0 )
 		return NULL;
 
-	/* Make our holder */
-	pl = pc_pointlist_make(nelems);
-
 	offset = 0;
 	bitmap = ARR_NULLBITMAP(array);
 	for ( i = 0; i < nelems; i++ )
@@ -166,11 +214,12 @@ pcpatch_from_point_array(ArrayType *array, FunctionCallInfoData *fcinfo)
 		if ( ! array_get_isnull(bitmap, i) )
 		{
 			SERIALIZED_POINT *serpt = (SERIALIZED_POINT *)(ARR_DATA_PTR(array)+offset);
-			PCPOINT *pt;
 
 			if ( ! schema )
 			{
 				schema = pc_schema_from_pcid(serpt->pcid, fcinfo);
+				/* Room for all the points, NULL entries aside */
+				pb = pc_patch_builder_make(schema, nelems);
 			}
 
 			if ( ! pcid )
@@ -182,25 +231,27 @@ pcpatch_from_point_array(ArrayType *array, FunctionCallInfoData *fcinfo)
 				elog(ERROR, "pcpatch_from_point_array: pcid mismatch (%d != %d)", serpt->pcid, pcid);
 			}
 
-			pt = pc_point_deserialize(serpt, schema);
-			if ( ! pt )
+			/* Copy the point data straight into the patch buffers */
+			if ( VARSIZE(serpt) + 1 - sizeof(SERIALIZED_POINT) != schema->size )
 			{
-				elog(ERROR, "pcpatch_from_point_array: point deserialization failed");
+				elog(ERROR, "schema size and disk size mismatch, repair the schema");
 			}
 
-			pc_pointlist_add_point(pl, pt);
+			if ( PC_FAILURE == pc_patch_builder_add_data(pb, serpt->data) )
+			{
+				pc_patch_builder_free(pb);
+				elog(ERROR, "pcpatch_from_point_array: failed to add point");
+			}
 
 			offset += INTALIGN(VARSIZE(serpt));
 		}
 
 	}
 
-	if ( pl->npoints == 0 )
+	if ( ! pb )
 		return NULL;
 
-	pa = pc_patch_from_pointlist(pl);
-	pc_pointlist_free(pl);
-	return pa;
+	return pc_patch_builder_finish(pb);
 }
 
 
@@ -305,6 +356,64 @@ Datum pcpatch_from_pcpatch_array(PG_FUNCTION_ARGS)
 	PG_RETURN_POINTER(serpa);
 }
 
+/**
+* PC_Zip(p pcpatch[], pcid integer) returns pcpatch
+* Patch of pcid with each dimension taken by name from the patches,
+* column groups holding the same points in the same order.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_zip);
+Datum pcpatch_zip(PG_FUNCTION_ARGS)
+{
+	ArrayType *array = PG_GETARG_ARRAYTYPE_P(0);
+	uint32 pcid = PG_GETARG_INT32(1);
+	PCSCHEMA *schema = pc_schema_from_pcid(pcid, fcinfo);
+	bits8 *bitmap = ARR_NULLBITMAP(array);
+	SERIALIZED_PATCH *serpa;
+	PCPATCH **palist;
+	PCPATCH *pa;
+	size_t offset = 0;
+	int i, nelems;
+
+	nelems = ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array));
+	if ( nelems == 0 )
+		PG_RETURN_NULL();
+
+	/* A missing group leaves the points incomplete */
+	for ( i = 0; i < nelems; i++ )
+	{
+		if ( array_get_isnull(bitmap, i) )
+			PG_RETURN_NULL();
+	}
+
+	palist = pcalloc(nelems * sizeof(PCPATCH*));
+	for ( i = 0; i < nelems; i++ )
+	{
+		SERIALIZED_PATCH *serpatch = (SERIALIZED_PATCH *)(ARR_DATA_PTR(array)+offset);
+		palist[i] = pc_patch_deserialize(serpatch, pc_schema_from_pcid(serpatch->pcid, fcinfo));
+		if ( ! palist[i] )
+			elog(ERROR, "%s: patch deserialization failed", __func__);
+		offset += INTALIGN(VARSIZE(serpatch));
+	}
+
+	pa = pc_patch_zip(palist, nelems, schema);
+
+	for ( i = 0; i < nelems; i++ )
+		pc_patch_free(palist[i]);
+	pcfree(palist);
+
+	if ( ! pa )
+		PG_RETURN_NULL();
+	if ( ! pa->npoints )
+	{
+		pc_patch_free(pa);
+		PG_RETURN_NULL();
+	}
+
+	serpa = pc_patch_serialize(pa, NULL);
+	pc_patch_free(pa);
+	PG_RETURN_POINTER(serpa);
+}
+
 PG_FUNCTION_INFO_V1(pcpatch_from_pcpoint_array);
 Datum pcpatch_from_pcpoint_array(PG_FUNCTION_ARGS)
 {
@@ -484,6 +593,256 @@ Datum pcpatch_agg_final_pcpatch(PG_FUNCTION_ARGS)
 }
 
 
+typedef struct
+{
+	PCSURFACE *surface;
+	PC_FILLMETHOD fill;
+} surface_trans;
+
+/**
+* Bin the points of the patches into a grid of cellsize cells,
+* ncols by nrows from xmin/ymax, for PC_Surface. The grid and the
+* methods are read from the first row, the patches of later rows
+* only add to the cells.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_surface_transfn);
+Datum pcpatch_surface_transfn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext, oldcontext;
+	surface_trans *a;
+
+	if ( ! AggCheckCallContext(fcinfo, &aggcontext) )
+	{
+		/* cannot be called directly because of dummy-type argument */
+		elog(ERROR, "pcpatch_surface_transfn called in non-aggregate context");
+		aggcontext = NULL;  /* keep compiler quiet */
+	}
+
+	if ( PG_ARGISNULL(0) )
+	{
+		double xmin, ymax, cellsize, radius;
+		int32 ncols, nrows;
+		char *method_str, *fill_str;
+		PC_SURFACEMETHOD method;
+
+		if ( PG_ARGISNULL(2) || PG_ARGISNULL(3) || PG_ARGISNULL(4) || PG_ARGISNULL(5) ||
+		     PG_ARGISNULL(6) || PG_ARGISNULL(7) || PG_ARGISNULL(8) || PG_ARGISNULL(9) )
+			elog(ERROR, "grid arguments must not be null");
+
+		xmin = PG_GETARG_FLOAT8(2);
+		ymax = PG_GETARG_FLOAT8(3);
+		cellsize = PG_GETARG_FLOAT8(4);
+		ncols = PG_GETARG_INT32(5);
+		nrows = PG_GETARG_INT32(6);
+		method_str = text_to_cstring(PG_GETARG_TEXT_P(7));
+		fill_str = text_to_cstring(PG_GETARG_TEXT_P(8));
+		radius = PG_GETARG_FLOAT8(9);
+
+		if ( ncols <= 0 || nrows <= 0 )
+			elog(ERROR, "grid must have a positive number of columns and rows, got %d x %d", ncols, nrows);
+
+		if ( strcasecmp(method_str, "min") == 0 )
+			method = PC_SURFACE_MIN;
+		else if ( strcasecmp(method_str, "max") == 0 )
+			method = PC_SURFACE_MAX;
+		else if ( strcasecmp(method_str, "mean") == 0 )
+			method = PC_SURFACE_MEAN;
+		else if ( strcasecmp(method_str, "idw") == 0 )
+			method = PC_SURFACE_IDW;
+		else
+			elog(ERROR, "unknown surface method \"%s\", use \"min\", \"max\", \"mean\" or \"idw\"", method_str);
+
+		oldcontext = MemoryContextSwitchTo(aggcontext);
+		a = (surface_trans*) palloc(sizeof(surface_trans));
+		if ( strcasecmp(fill_str, "none") == 0 )
+			a->fill = PC_FILL_NONE;
+		else if ( strcasecmp(fill_str, "nearest") == 0 )
+			a->fill = PC_FILL_NEAREST;
+		else if ( strcasecmp(fill_str, "idw") == 0 )
+			a->fill = PC_FILL_IDW;
+		else
+			elog(ERROR, "unknown fill method \"%s\", use \"none\", \"nearest\" or \"idw\"", fill_str);
+		a->surface = pc_surface_new(xmin, ymax, cellsize, ncols, nrows, radius, method);
+		MemoryContextSwitchTo(oldcontext);
+	}
+	else
+	{
+		a = (surface_trans*) PG_GETARG_POINTER(0);
+	}
+
+	if ( ! PG_ARGISNULL(1) )
+	{
+		SERIALIZED_PATCH *serpa = PG_GETARG_SERPATCH_P(1);
+		PCSCHEMA *schema = pc_schema_from_pcid(serpa->pcid, fcinfo);
+		PCPATCH *patch = pc_patch_deserialize(serpa, schema);
+
+		if ( ! patch )
+			elog(ERROR, "failed to deserialize patch");
+
+		pc_surface_add_patch(a->surface, patch);
+		pc_patch_free(patch);
+		PG_FREE_IF_COPY(serpa, 1);
+	}
+
+	PG_RETURN_POINTER(a);
+}
+
+/**
+* Cell values of PC_Surface, nrows arrays of ncols values from
+* the north-west corner, NULL for the cells left without a value.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_surface_final);
+Datum pcpatch_surface_final(PG_FUNCTION_ARGS)
+{
+	surface_trans *a;
+	const PCSURFACE *s;
+	ArrayType *arr;
+	Datum *elems;
+	bool *nulls;
+	double *vals;
+	int dims[2], lbs[2];
+	int i, n;
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();   /* returns null iff no input values */
+
+	a = (surface_trans*) PG_GETARG_POINTER(0);
+	s = a->surface;
+	vals = pc_surface_finish(s, a->fill);
+
+	n = s->ncols * s->nrows;
+	elems = palloc(n * sizeof(Datum));
+	nulls = palloc(n * sizeof(bool));
+	for ( i = 0; i < n; i++ )
+	{
+		nulls[i] = isnan(vals[i]);
+		elems[i] = nulls[i] ? (Datum) 0 : Float8GetDatum(vals[i]);
+	}
+
+	dims[0] = s->nrows;
+	dims[1] = s->ncols;
+	lbs[0] = lbs[1] = 1;
+	arr = construct_md_array(elems, nulls, 2, dims, lbs, FLOAT8OID, sizeof(float8), FLOAT8PASSBYVAL, 'd');
+
+	pcfree(vals);
+	pfree(elems);
+	pfree(nulls);
+	PG_RETURN_ARRAYTYPE_P(arr);
+}
+
+
+typedef struct
+{
+	char *dimname;
+	double t1;
+	double t2;
+	PCPATCH **slices;
+	uint32_t nslices;
+	uint32_t maxslices;
+} timeslice_trans;
+
+/**
+* Keep the points of the patches with dimname between t1 and t2,
+* ordered on it, for PC_TimeSlice. Only the slices are kept, in
+* the aggregate memory context, the patches themselves are not.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_timeslice_transfn);
+Datum pcpatch_timeslice_transfn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext, oldcontext;
+	timeslice_trans *a;
+	SERIALIZED_PATCH *serpa;
+	PCSCHEMA *schema;
+	PCPATCH *patch, *slice;
+
+	if ( ! AggCheckCallContext(fcinfo, &aggcontext) )
+	{
+		/* cannot be called directly because of dummy-type argument */
+		elog(ERROR, "pcpatch_timeslice_transfn called in non-aggregate context");
+		aggcontext = NULL;  /* keep compiler quiet */
+	}
+
+	if ( PG_ARGISNULL(0) )
+	{
+		if ( PG_ARGISNULL(2) || PG_ARGISNULL(3) || PG_ARGISNULL(4) )
+			elog(ERROR, "dimension and time window must not be null");
+
+		oldcontext = MemoryContextSwitchTo(aggcontext);
+		a = (timeslice_trans*) palloc0(sizeof(timeslice_trans));
+		a->dimname = text_to_cstring(PG_GETARG_TEXT_P(2));
+		a->t1 = PG_GETARG_FLOAT8(3);
+		a->t2 = PG_GETARG_FLOAT8(4);
+		a->maxslices = 8;
+		a->slices = palloc(a->maxslices * sizeof(PCPATCH*));
+		MemoryContextSwitchTo(oldcontext);
+	}
+	else
+	{
+		a = (timeslice_trans*) PG_GETARG_POINTER(0);
+	}
+
+	if ( PG_ARGISNULL(1) )
+		PG_RETURN_POINTER(a);
+
+	serpa = PG_GETARG_SERPATCH_P(1);
+	schema = pc_schema_from_pcid(serpa->pcid, fcinfo);
+	if ( a->nslices && a->slices[0]->schema->pcid != serpa->pcid )
+		elog(ERROR, "patches have mixed pcids %u and %u", a->slices[0]->schema->pcid, serpa->pcid);
+
+	patch = pc_patch_deserialize(serpa, schema);
+	if ( ! patch )
+		elog(ERROR, "failed to deserialize patch");
+
+	oldcontext = MemoryContextSwitchTo(aggcontext);
+	slice = pc_patch_slice_sorted(patch, a->dimname, a->t1, a->t2);
+	if ( slice && slice->npoints )
+	{
+		if ( a->nslices == a->maxslices )
+		{
+			a->maxslices *= 2;
+			a->slices = repalloc(a->slices, a->maxslices * sizeof(PCPATCH*));
+		}
+		a->slices[a->nslices++] = slice;
+	}
+	else if ( slice )
+	{
+		pc_patch_free(slice);
+	}
+	MemoryContextSwitchTo(oldcontext);
+
+	pc_patch_free(patch);
+	PG_FREE_IF_COPY(serpa, 1);
+	PG_RETURN_POINTER(a);
+}
+
+/**
+* Merge the slices of PC_TimeSlice in time order. Returns NULL
+* when no point fell in the window.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_timeslice_final);
+Datum pcpatch_timeslice_final(PG_FUNCTION_ARGS)
+{
+	timeslice_trans *a;
+	PCPATCH *pa;
+	SERIALIZED_PATCH *serpa;
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();   /* returns null iff no input values */
+
+	a = (timeslice_trans*) PG_GETARG_POINTER(0);
+	if ( ! a->nslices )
+		PG_RETURN_NULL();
+
+	pa = pc_patch_merge_sorted(a->slices, a->nslices, a->dimname);
+	if ( ! pa )
+		PG_RETURN_NULL();
+
+	serpa = pc_patch_serialize(pa, NULL);
+	pc_patch_free(pa);
+	PG_RETURN_POINTER(serpa);
+}
+
+
 PG_FUNCTION_INFO_V1(pcpatch_unnest);
 Datum pcpatch_unnest(PG_FUNCTION_ARGS)
 {
@@ -610,6 +969,9 @@ Datum pcpatch_compress(PG_FUNCTION_ARGS)
 			if ( *ptr == ',' || strncmp(ptr, "auto", strlen("auto")) == 0 ) {
 				/* leave auto-determined compression */
 			}
+			else if ( strncmp(ptr, "none", strlen("none")) == 0 ) {
+				stat->recommended_compression = PC_DIM_NONE;
+			}
 			else if ( strncmp(ptr, "rle", strlen("rle")) == 0 ) {
 				stat->recommended_compression = PC_DIM_RLE;
 			}
@@ -619,8 +981,11 @@ Datum pcpatch_compress(PG_FUNCTION_ARGS)
 			else if ( strncmp(ptr, "zlib", strlen("zlib")) == 0 ) {
 				stat->recommended_compression = PC_DIM_ZLIB;
 			}
+			else if ( strncmp(ptr, "pfor", strlen("pfor")) == 0 ) {
+				stat->recommended_compression = PC_DIM_PFOR;
+			}
 			else {
-				elog(ERROR, "Unrecognized dimensional compression '%s'. Please specify 'auto', 'rle', 'sigbits' or 'zlib'", ptr);
+				elog(ERROR, "Unrecognized dimensional compression '%s'. Please specify 'auto', 'none', 'rle', 'sigbits', 'zlib' or 'pfor'", ptr);
 			}
 			while (*ptr && *ptr != ',') ++ptr;
 			if ( ! *ptr ) break;
@@ -631,14 +996,23 @@ Datum pcpatch_compress(PG_FUNCTION_ARGS)
 		pa = (PCPATCH*)pc_patch_dimensional_compress(pdl, stats);
 		pc_patch_dimensional_free(pdl);
 	}}
+	else if ( strcmp(compr_in, "none") == 0 ) {
+		schema->compression = PC_NONE;
+	}
 	else if ( strcmp(compr_in, "ght") == 0 ) {
 		schema->compression = PC_GHT;
+		/* Optional hash resolution */
+		if ( *config_in >= '0' && *config_in <= '9' )
+			schema->ghtkeylength = strtoul(config_in, NULL, 10);
 	}
 	else if ( strcmp(compr_in, "laz") == 0 ) {
 		schema->compression = PC_LAZPERF;
+		/* Optional number of points per chunk */
+		if ( *config_in >= '0' && *config_in <= '9' )
+			schema->lazchunksize = strtoul(config_in, NULL, 10);
 	}
 	else {
-		elog(ERROR, "Unrecognized compression '%s'. Please specify 'auto','dimensional' or 'ght'", compr_in);
+		elog(ERROR, "Unrecognized compression '%s'. Please specify 'auto','none','dimensional','ght' or 'laz'", compr_in);
 	}
 
 	pa->schema = schema; /* install overridden schema */
@@ -748,7 +1122,7 @@ Datum pcpatch_summary(PG_FUNCTION_ARGS)
 		"\"pcid\":%d, \"npts\":%d, \"srid\":%d, "
 		"\"compr\":\"%s\",\"dims\":[",
 		serpa->pcid, serpa->npoints, schema->srid,
-		pc_compression_name(serpa->compression));
+		pc_compression_name(serpa->compression & ~PC_WKB_FLAGS));
 
 	for (i=0; i<schema->ndims; ++i)
 	{
@@ -776,6 +1150,9 @@ Datum pcpatch_summary(PG_FUNCTION_ARGS)
 			case PC_DIM_ZLIB:
 				appendStringInfoString(&strdata,",\"compr\":\"zlib\"");
 				break;
+			case PC_DIM_PFOR:
+				appendStringInfoString(&strdata,",\"compr\":\"pfor\"");
+				break;
 			case PC_DIM_NONE:
 				appendStringInfoString(&strdata,",\"compr\":\"none\"");
 				break;
@@ -810,7 +1187,7 @@ PG_FUNCTION_INFO_V1(pcpatch_compression);
 Datum pcpatch_compression(PG_FUNCTION_ARGS)
 {
 	SERIALIZED_PATCH *serpa = PG_GETHEADER_SERPATCH_P(0);
-	PG_RETURN_INT32(serpa->compression);
+	PG_RETURN_INT32(serpa->compression & ~PC_WKB_FLAGS);
 }
 
 PG_FUNCTION_INFO_V1(pcpatch_intersects);
@@ -829,6 +1206,19 @@ Datum pcpatch_intersects(PG_FUNCTION_ARGS)
 	PG_RETURN_BOOL(FALSE);
 }
 
+/**
+* PC_MortonKey(p pcpatch) returns int8
+* Z-order key of the center of the patch bounds, read from the
+* header only, shifted so that it sorts as a signed integer.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_morton_key);
+Datum pcpatch_morton_key(PG_FUNCTION_ARGS)
+{
+	SERIALIZED_PATCH *serpa = PG_GETHEADER_SERPATCH_P(0);
+	uint64_t key = pc_bounds_morton(&(serpa->bounds));
+	PG_RETURN_INT64((int64)(key ^ ((uint64_t)1 << 63)));
+}
+
 PG_FUNCTION_INFO_V1(pcpatch_size);
 Datum pcpatch_size(PG_FUNCTION_ARGS)
 {
@@ -999,6 +1389,144 @@ Datum pcpatch_filter(PG_FUNCTION_ARGS)
 	PG_RETURN_POINTER(serpatch_filtered);
 }
 
+/**
+* PC_FilterBox(patch pcpatch, xmin float8, ymin float8, xmax float8, ymax float8) returns PcPatch
+* Patches entirely outside or inside the box are dealt with from
+* their header alone, without being read.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_filter_box);
+Datum pcpatch_filter_box(PG_FUNCTION_ARGS)
+{
+	SERIALIZED_PATCH *serpatch = PG_GETHEADER_SERPATCH_P(0);
+	float8 xmin = PG_GETARG_FLOAT8(1);
+	float8 ymin = PG_GETARG_FLOAT8(2);
+	float8 xmax = PG_GETARG_FLOAT8(3);
+	float8 ymax = PG_GETARG_FLOAT8(4);
+	PCSCHEMA *schema;
+	PCPATCH *patch;
+	PCPATCH *patch_filtered;
+	SERIALIZED_PATCH *serpatch_filtered;
+	PCBOUNDS box;
+
+	box.xmin = Min(xmin, xmax);
+	box.xmax = Max(xmin, xmax);
+	box.ymin = Min(ymin, ymax);
+	box.ymax = Max(ymin, ymax);
+
+	if ( ! pc_bounds_intersects(&(serpatch->bounds), &box) )
+		PG_RETURN_NULL();
+
+	if ( serpatch->bounds.xmin >= box.xmin && serpatch->bounds.xmax <= box.xmax &&
+	     serpatch->bounds.ymin >= box.ymin && serpatch->bounds.ymax <= box.ymax )
+		PG_RETURN_DATUM(PG_GETARG_DATUM(0));
+
+	serpatch = PG_GETARG_SERPATCH_P(0);
+	schema = pc_schema_from_pcid(serpatch->pcid, fcinfo);
+	patch = pc_patch_deserialize(serpatch, schema);
+	if ( ! patch )
+	{
+		elog(ERROR, "failed to deserialize patch");
+		PG_RETURN_NULL();
+	}
+
+	patch_filtered = pc_patch_filter_box(patch, box.xmin, box.ymin, box.xmax, box.ymax);
+	pc_patch_free(patch);
+	PG_FREE_IF_COPY(serpatch, 0);
+
+	/* Always treat zero-point patches as SQL NULL */
+	if ( patch_filtered->npoints <= 0 )
+	{
+		pc_patch_free(patch_filtered);
+		PG_RETURN_NULL();
+	}
+
+	serpatch_filtered = pc_patch_serialize(patch_filtered, NULL);
+	pc_patch_free(patch_filtered);
+
+	PG_RETURN_POINTER(serpatch_filtered);
+}
+
+/**
+* Split a patch by the polygons its points fall in, in one pass
+* PC_SplitByPolygons(p pcpatch, polys bytea[]) returns pcpatch[]
+* Element n holds the points of polygon n, NULL if there are none.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_split_by_polygons);
+Datum pcpatch_split_by_polygons(PG_FUNCTION_ARGS)
+{
+	SERIALIZED_PATCH *serpatch = PG_GETARG_SERPATCH_P(0);
+	ArrayType *polys = PG_GETARG_ARRAYTYPE_P(1);
+	Oid elemtype = get_fn_expr_argtype(fcinfo->flinfo, 0);
+	PCSCHEMA *schema = pc_schema_from_pcid(serpatch->pcid, fcinfo);
+	PCPOLYINDEX *idx = pc_polyindex_from_array(polys, fcinfo);
+	PCPATCH *patch, **patches;
+	Datum *elems;
+	bool *nulls;
+	int dims[1], lbs[1];
+	int16 typlen;
+	bool typbyval;
+	char typalign;
+	uint32_t i;
+
+	patch = pc_patch_deserialize(serpatch, schema);
+	if ( ! patch )
+		elog(ERROR, "failed to deserialize patch");
+
+	patches = pc_patch_polygon_split(patch, idx);
+	pc_patch_free(patch);
+	if ( ! patches )
+		PG_RETURN_NULL();
+
+	elems = palloc0((idx->npolys ? idx->npolys : 1) * sizeof(Datum));
+	nulls = palloc0((idx->npolys ? idx->npolys : 1) * sizeof(bool));
+	for ( i = 0; i < idx->npolys; i++ )
+	{
+		nulls[i] = ( patches[i] == NULL );
+		if ( nulls[i] )
+			continue;
+		elems[i] = PointerGetDatum(pc_patch_serialize(patches[i], NULL));
+		pc_patch_free(patches[i]);
+	}
+	pcfree(patches);
+
+	dims[0] = idx->npolys;
+	lbs[0] = 1;
+	get_typlenbyvalalign(elemtype, &typlen, &typbyval, &typalign);
+	PG_RETURN_ARRAYTYPE_P(construct_md_array(elems, nulls, 1, dims, lbs, elemtype, typlen, typbyval, typalign));
+}
+
+/**
+* Transform a patch to a pcid with a dimension for the polygon
+* numbers, and set it for every point, 0 for points in no polygon
+* PC_ClassifyByPolygons(p pcpatch, polys bytea[], pcid int4, dimension text) returns pcpatch
+*/
+PG_FUNCTION_INFO_V1(pcpatch_classify_by_polygons);
+Datum pcpatch_classify_by_polygons(PG_FUNCTION_ARGS)
+{
+	SERIALIZED_PATCH *serpatch = PG_GETARG_SERPATCH_P(0);
+	ArrayType *polys = PG_GETARG_ARRAYTYPE_P(1);
+	int32 pcid = PG_GETARG_INT32(2);
+	char *dimname = text_to_cstring(PG_GETARG_TEXT_P(3));
+	PCSCHEMA *oschema = pc_schema_from_pcid(serpatch->pcid, fcinfo);
+	PCSCHEMA *nschema = pc_schema_from_pcid(pcid, fcinfo);
+	PCPOLYINDEX *idx = pc_polyindex_from_array(polys, fcinfo);
+	PCPATCH *patch, *paout;
+	SERIALIZED_PATCH *serpaout;
+
+	patch = pc_patch_deserialize(serpatch, oschema);
+	if ( ! patch )
+		elog(ERROR, "failed to deserialize patch");
+
+	paout = pc_patch_polygon_tag(patch, idx, nschema, dimname);
+	pc_patch_free(patch);
+	if ( ! paout )
+		PG_RETURN_NULL();
+
+	serpaout = pc_patch_serialize(paout, NULL);
+	pc_patch_free(paout);
+	PG_RETURN_POINTER(serpaout);
+}
+
 const char **array_to_cstring_array(ArrayType *array, int *size)
 {
 	int i, j, offset = 0;
@@ -0,0 +1,459 @@
+/***********************************************************************
+* pc_advisor.c
+*
+*  PC_CompressionAdvisor, trials every available patch compression
+*  (and every dimensional codec, per dimension) against a sample of
+*  a pcpatch column, and ranks the candidates.
+*
+*  PgSQL Pointcloud is free and open source software provided
+*  by the Government of Canada
+*  Copyright (c) 2013 Natural Resources Canada
+*
+***********************************************************************/
+
+#include "pc_pgsql.h"      /* Common PgSQL support for our type */
+#include "funcapi.h"
+#include "executor/spi.h"
+#include "access/htup_details.h"
+#include "portability/instr_time.h"
+#include "utils/memutils.h"
+#include "pc_api_internal.h" /* for dimensional patches and PCBYTES */
+
+Datum pc_compression_advisor(PG_FUNCTION_ARGS);
+
+/* Codecs trialled on every dimension, in PC_Compress config order */
+static const int advisor_dimcodecs[] = { PC_DIM_NONE, PC_DIM_RLE, PC_DIM_SIGBITS, PC_DIM_ZLIB, PC_DIM_PFOR };
+static const char *advisor_dimcodec_names[] = { "none", "rle", "sigbits", "zlib", "pfor" };
+#define ADVISOR_NUM_DIMCODECS 5
+
+/* none, dimensional (auto), dimensional (tuned), ght, laz */
+#define ADVISOR_MAX_CANDIDATES 5
+
+/* Number of columns of the PC_CompressionAdvisor record */
+#define ADVISOR_NATTS 8
+
+/* Accumulated cost of one codec on one dimension */
+typedef struct
+{
+	double size;
+	double encode_ms;
+	double decode_ms;
+} ADVISOR_DIMTRIAL;
+
+/* Accumulated cost of one patch compression */
+typedef struct
+{
+	const char *compression;
+	char *config;
+	PCSCHEMA *schema;
+	PCDIMSTATS *dimstats;
+	double size;
+	double encode_ms;
+	double decode_ms;
+	double filter_ms;
+	double cost;
+} ADVISOR_CANDIDATE;
+
+typedef struct
+{
+	int ncandidates;
+	int nextelem;
+	double raw_size;
+	ADVISOR_CANDIDATE *candidates[ADVISOR_MAX_CANDIDATES];
+} pc_advisor_fctx;
+
+
+static double
+advisor_elapsed_ms(instr_time start)
+{
+	instr_time now;
+	INSTR_TIME_SET_CURRENT(now);
+	INSTR_TIME_SUBTRACT(now, start);
+	return INSTR_TIME_GET_MILLISEC(now);
+}
+
+/**
+* Read cost: the stored size, penalized by up to 2x for being the
+* slowest candidate to read back (decode + filter).
+*/
+static double
+advisor_cost(double size, double raw_size, double read_ms, double max_read_ms)
+{
+	double penalty = max_read_ms > 0 ? read_ms / max_read_ms : 0;
+	return (size / raw_size) * (1.0 + penalty);
+}
+
+/**
+* Encode and decode every dimension of an uncompressed dimensional
+* patch with every codec, accumulating sizes and timings. Codecs
+* work in the scratch buffer, which grows in the given memory
+* context to fit the largest patch and is reused for all of them.
+*/
+static void
+advisor_trial_dimensions(const PCPATCH_DIMENSIONAL *pdl, ADVISOR_DIMTRIAL *trials, PCSINK *scratch, MemoryContext context)
+{
+	int i, j;
+	instr_time start;
+	size_t bound = 0, rawsize = 0;
+	uint8_t *ebuf, *dbuf;
+	MemoryContext oldcontext;
+
+	for ( i = 0; i < pdl->schema->ndims; i++ )
+	{
+		rawsize = Max(rawsize, pdl->bytes[i].size);
+		for ( j = 0; j < ADVISOR_NUM_DIMCODECS; j++ )
+			bound = Max(bound, pc_bytes_encoded_size_bound(&(pdl->bytes[i]), advisor_dimcodecs[j]));
+	}
+
+	oldcontext = MemoryContextSwitchTo(context);
+	scratch->size = 0;
+	ebuf = pc_sink_reserve(scratch, bound + rawsize);
+	dbuf = ebuf + bound;
+	MemoryContextSwitchTo(oldcontext);
+
+	for ( i = 0; i < pdl->schema->ndims; i++ )
+	{
+		for ( j = 0; j < ADVISOR_NUM_DIMCODECS; j++ )
+		{
+			ADVISOR_DIMTRIAL *trial = &(trials[i*ADVISOR_NUM_DIMCODECS + j]);
+			PCBYTES epcb = pdl->bytes[i];
+
+			epcb.bytes = ebuf;
+			epcb.compression = advisor_dimcodecs[j];
+
+			INSTR_TIME_SET_CURRENT(start);
+			pc_bytes_encode_into(&(pdl->bytes[i]), advisor_dimcodecs[j], ebuf, bound, &(epcb.size));
+			trial->encode_ms += advisor_elapsed_ms(start);
+			trial->size += pc_bytes_serialized_size(&epcb);
+
+			INSTR_TIME_SET_CURRENT(start);
+			pc_bytes_decode_into(&epcb, dbuf, rawsize);
+			trial->decode_ms += advisor_elapsed_ms(start);
+		}
+	}
+}
+
+/**
+* Compress, decompress and filter an uncompressed patch with a
+* candidate, accumulating sizes and timings.
+*/
+static void
+advisor_trial_candidate(PCPATCH *pu, ADVISOR_CANDIDATE *cand)
+{
+	const PCSCHEMA *schema = pu->schema;
+	PCDIMENSION *dim = schema->xdim ? schema->xdim : schema->dims[0];
+	PCPATCH *pa, *pa_decoded, *pa_filtered;
+	double vmin, vmax;
+	instr_time start;
+
+	/* Filter on the lower half of the X range */
+	pc_point_get_double(&(pu->stats->min), dim, &vmin);
+	pc_point_get_double(&(pu->stats->max), dim, &vmax);
+
+	/* Compress as dictated by the candidate schema */
+	pu->schema = cand->schema;
+	INSTR_TIME_SET_CURRENT(start);
+	pa = pc_patch_compress(pu, cand->dimstats);
+	cand->encode_ms += advisor_elapsed_ms(start);
+	pu->schema = schema;
+
+	if ( ! pa )
+		elog(ERROR, "%s: '%s' compression failed", __func__, cand->compression);
+
+	cand->size += pc_patch_serialized_size(pa);
+
+	INSTR_TIME_SET_CURRENT(start);
+	pa_decoded = pc_patch_uncompress(pa);
+	cand->decode_ms += advisor_elapsed_ms(start);
+
+	INSTR_TIME_SET_CURRENT(start);
+	pa_filtered = pc_patch_filter(pa, dim->position, PC_BETWEEN, vmin, (vmin + vmax) / 2);
+	cand->filter_ms += advisor_elapsed_ms(start);
+
+	if ( pa_filtered )
+		pc_patch_free(pa_filtered);
+	if ( pa_decoded != pa )
+		pc_patch_free(pa_decoded);
+	if ( pa != pu )
+		pc_patch_free(pa);
+}
+
+static ADVISOR_CANDIDATE *
+advisor_candidate_make(const PCSCHEMA *schema, uint32_t compression, const char *config, PCDIMSTATS *dimstats)
+{
+	ADVISOR_CANDIDATE *cand = palloc0(sizeof(ADVISOR_CANDIDATE));
+	cand->compression = pc_compression_name(compression);
+	cand->config = pstrdup(config);
+	cand->schema = pc_schema_clone(schema);
+	cand->schema->compression = compression;
+	cand->dimstats = dimstats;
+	return cand;
+}
+
+/**
+* Pick the cheapest codec for each dimension, and return the matching
+* PC_Compress 'dimensional' config string along with the dimstats
+* that force those codecs.
+*/
+static char *
+advisor_tune_dimensions(const PCSCHEMA *schema, const ADVISOR_DIMTRIAL *trials, PCDIMSTATS **dimstats)
+{
+	StringInfoData config;
+	PCDIMSTATS *pds = pc_dimstats_make(schema);
+	int i, j;
+
+	initStringInfo(&config);
+
+	/* Make sure the recommendations are not recomputed */
+	pds->total_points = PCDIMSTATS_MIN_SAMPLE + 1;
+
+	for ( i = 0; i < schema->ndims; i++ )
+	{
+		const ADVISOR_DIMTRIAL *dt = &(trials[i*ADVISOR_NUM_DIMCODECS]);
+		double raw_size = dt[0].size;
+		double max_read_ms = 0;
+		double best_cost = 0;
+		int best = 0;
+
+		for ( j = 0; j < ADVISOR_NUM_DIMCODECS; j++ )
+			max_read_ms = Max(max_read_ms, dt[j].decode_ms);
+
+		for ( j = 0; j < ADVISOR_NUM_DIMCODECS; j++ )
+		{
+			double cost = advisor_cost(dt[j].size, raw_size, dt[j].decode_ms, max_read_ms);
+			if ( j == 0 || cost < best_cost )
+			{
+				best_cost = cost;
+				best = j;
+			}
+		}
+
+		pds->stats[i].recommended_compression = advisor_dimcodecs[best];
+		if ( i ) appendStringInfoChar(&config, ',');
+		appendStringInfoString(&config, advisor_dimcodec_names[best]);
+	}
+
+	*dimstats = pds;
+	return config.data;
+}
+
+static int
+advisor_candidate_cmp(const void *a, const void *b)
+{
+	const ADVISOR_CANDIDATE *ca = *((const ADVISOR_CANDIDATE **)a);
+	const ADVISOR_CANDIDATE *cb = *((const ADVISOR_CANDIDATE **)b);
+	if ( ca->cost < cb->cost ) return -1;
+	if ( ca->cost > cb->cost ) return 1;
+	return 0;
+}
+
+/**
+* Read the sampled patches, run the per-dimension trials on a first
+* pass, and the whole-patch candidates on a second pass.
+*/
+static void
+advisor_run(pc_advisor_fctx *fctx, const char *sql, FunctionCallInfoData *fcinfo)
+{
+	MemoryContext oldcontext = CurrentMemoryContext;
+	MemoryContext tmpcontext;
+	PCSCHEMA *schema = NULL;
+	ADVISOR_DIMTRIAL *trials = NULL;
+	ADVISOR_CANDIDATE **cands = fctx->candidates;
+	PCSINK scratch;
+	double max_read_ms = 0;
+	uint64 nrows, row;
+	int pass, i, err;
+
+	if ( SPI_OK_CONNECT != SPI_connect() )
+	{
+		SPI_finish();
+		elog(ERROR, "%s: could not connect to SPI manager", __func__);
+	}
+
+	err = SPI_execute(sql, true, 0);
+	if ( err != SPI_OK_SELECT )
+	{
+		SPI_finish();
+		elog(ERROR, "%s: error (%d) executing query: %s", __func__, err, sql);
+	}
+
+	if ( strcmp(SPI_gettype(SPI_tuptable->tupdesc, 1), "pcpatch") != 0 )
+	{
+		SPI_finish();
+		elog(ERROR, "%s: column is not of type pcpatch", __func__);
+	}
+
+	nrows = SPI_processed;
+	pc_sink_init(&scratch, 0);
+	tmpcontext = AllocSetContextCreate(CurrentMemoryContext,
+		"PC_CompressionAdvisor", ALLOCSET_DEFAULT_MINSIZE,
+		ALLOCSET_DEFAULT_INITSIZE, ALLOCSET_DEFAULT_MAXSIZE);
+
+	for ( pass = 0; pass < 2; pass++ )
+	{
+		for ( row = 0; row < nrows; row++ )
+		{
+			bool isnull;
+			Datum d = SPI_getbinval(SPI_tuptable->vals[row], SPI_tuptable->tupdesc, 1, &isnull);
+			SERIALIZED_PATCH *serpa;
+			PCPATCH *patch, *pu;
+
+			if ( isnull )
+				continue;
+
+			MemoryContextSwitchTo(tmpcontext);
+			serpa = (SERIALIZED_PATCH*)PG_DETOAST_DATUM(d);
+
+			if ( ! schema )
+			{
+				/* Candidates and trials must outlive the SPI connection */
+				MemoryContextSwitchTo(oldcontext);
+				schema = pc_schema_from_pcid(serpa->pcid, fcinfo);
+				trials = palloc0(schema->ndims * ADVISOR_NUM_DIMCODECS * sizeof(ADVISOR_DIMTRIAL));
+				MemoryContextSwitchTo(tmpcontext);
+			}
+			else if ( serpa->pcid != schema->pcid )
+			{
+				elog(ERROR, "%s: sampled patches have mixed pcids %u and %u", __func__, schema->pcid, serpa->pcid);
+			}
+
+			patch = pc_patch_deserialize(serpa, schema);
+			pu = pc_patch_uncompress(patch);
+			if ( ! pu->stats )
+				pc_patch_compute_stats(pu);
+
+			if ( pass == 0 )
+			{
+				PCPATCH_DIMENSIONAL *pdl = pc_patch_dimensional_from_uncompressed((PCPATCH_UNCOMPRESSED*)pu);
+				advisor_trial_dimensions(pdl, trials, &scratch, oldcontext);
+				fctx->raw_size += pc_patch_serialized_size(pu);
+			}
+			else
+			{
+				for ( i = 0; i < fctx->ncandidates; i++ )
+					advisor_trial_candidate(pu, cands[i]);
+			}
+
+			MemoryContextSwitchTo(oldcontext);
+			MemoryContextReset(tmpcontext);
+		}
+
+		/* Set up the candidates once the dimensions are known */
+		if ( pass == 0 )
+		{
+			PCDIMSTATS *dimstats;
+			char *config;
+
+			if ( ! schema )
+				break;
+
+			config = advisor_tune_dimensions(schema, trials, &dimstats);
+			cands[fctx->ncandidates++] = advisor_candidate_make(schema, PC_NONE, "", NULL);
+			cands[fctx->ncandidates++] = advisor_candidate_make(schema, PC_DIMENSIONAL, "", NULL);
+			cands[fctx->ncandidates++] = advisor_candidate_make(schema, PC_DIMENSIONAL, config, dimstats);
+#ifdef HAVE_LIBGHT
+			if ( schema->xdim && schema->ydim )
+				cands[fctx->ncandidates++] = advisor_candidate_make(schema, PC_GHT, "", NULL);
+#endif
+#ifdef HAVE_LAZPERF
+			cands[fctx->ncandidates++] = advisor_candidate_make(schema, PC_LAZPERF, "", NULL);
+#endif
+		}
+	}
+
+	MemoryContextDelete(tmpcontext);
+	if ( scratch.bytes )
+		pfree(scratch.bytes);
+	SPI_finish();
+
+	/* Rank */
+	for ( i = 0; i < fctx->ncandidates; i++ )
+		max_read_ms = Max(max_read_ms, cands[i]->decode_ms + cands[i]->filter_ms);
+
+	for ( i = 0; i < fctx->ncandidates; i++ )
+		cands[i]->cost = advisor_cost(cands[i]->size, fctx->raw_size, cands[i]->decode_ms + cands[i]->filter_ms, max_read_ms);
+
+	qsort(cands, fctx->ncandidates, sizeof(ADVISOR_CANDIDATE*), advisor_candidate_cmp);
+}
+
+/**
+* Benchmark the available compressions on a sample of a pcpatch column
+* PC_CompressionAdvisor(tbl regclass, col name, sample_pct float8)
+* returns setof (rank, compression, config, size, ratio, encode_ms, decode_ms, filter_ms)
+* The first row holds the PC_Compress arguments with the best size/speed tradeoff.
+*/
+PG_FUNCTION_INFO_V1(pc_compression_advisor);
+Datum pc_compression_advisor(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	pc_advisor_fctx *fctx;
+	MemoryContext oldcontext;
+
+	/* stuff done only on the first call of the function */
+	if (SRF_IS_FIRSTCALL())
+	{
+		Oid relid = PG_GETARG_OID(0);
+		char *colname = NameStr(*PG_GETARG_NAME(1));
+		float8 sample_pct = PG_GETARG_FLOAT8(2);
+		char *relname;
+		StringInfoData sql;
+		TupleDesc tupdesc;
+
+		if ( sample_pct <= 0 || sample_pct > 100 )
+			elog(ERROR, "sample percentage must be in (0, 100], got %g", sample_pct);
+
+		/* create a function context for cross-call persistence */
+		funcctx = SRF_FIRSTCALL_INIT();
+
+		/* switch to memory context appropriate for multiple function calls */
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if ( get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE )
+			elog(ERROR, "%s: return type must be a row type", __func__);
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+		relname = DatumGetCString(DirectFunctionCall1(regclassout, ObjectIdGetDatum(relid)));
+		initStringInfo(&sql);
+		appendStringInfo(&sql, "SELECT %s FROM %s", quote_identifier(colname), relname);
+		if ( sample_pct < 100 )
+			appendStringInfo(&sql, " WHERE random() < %g", sample_pct / 100.0);
+
+		fctx = palloc0(sizeof(pc_advisor_fctx));
+		advisor_run(fctx, sql.data, fcinfo);
+
+		/* save user context, switch back to function context */
+		funcctx->user_fctx = fctx;
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	/* stuff done on every call of the function */
+	funcctx = SRF_PERCALL_SETUP();
+	fctx = funcctx->user_fctx;
+
+	if ( fctx->nextelem < fctx->ncandidates )
+	{
+		ADVISOR_CANDIDATE *cand = fctx->candidates[fctx->nextelem];
+		Datum values[ADVISOR_NATTS];
+		bool nulls[ADVISOR_NATTS];
+		HeapTuple tuple;
+
+		memset(nulls, 0, sizeof(nulls));
+		values[0] = Int32GetDatum(fctx->nextelem + 1);
+		values[1] = CStringGetTextDatum(cand->compression);
+		values[2] = CStringGetTextDatum(cand->config);
+		values[3] = Int64GetDatum((int64)cand->size);
+		values[4] = Float8GetDatum(cand->size > 0 ? fctx->raw_size / cand->size : 0);
+		values[5] = Float8GetDatum(cand->encode_ms);
+		values[6] = Float8GetDatum(cand->decode_ms);
+		values[7] = Float8GetDatum(cand->filter_ms);
+
+		fctx->nextelem++;
+		tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+	}
+	else
+	{
+		/* do when there is no more left */
+		SRF_RETURN_DONE(funcctx);
+	}
+}
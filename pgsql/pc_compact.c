@@ -0,0 +1,278 @@
+/***********************************************************************
+* pc_compact.c
+*
+*  PC_Compact, merges the small patches of a pcpatch column, taken
+*  in Morton order of their bounds, into patches of about a target
+*  number of points. The column is read through a cursor and one
+*  patch is built at a time, so memory use does not depend on the
+*  size of the table.
+*
+*  PgSQL Pointcloud is free and open source software provided
+*  by the Government of Canada
+*  Copyright (c) 2013 Natural Resources Canada
+*
+***********************************************************************/
+
+#include "pc_pgsql.h"      /* Common PgSQL support for our type */
+#include "funcapi.h"
+#include "executor/spi.h"
+
+Datum pc_compact(PG_FUNCTION_ARGS);
+
+typedef struct
+{
+	SERIALIZED_PATCH **sers;  /* Copies of the patches of the group */
+	int nsers;
+	int maxsers;
+	uint32 npoints;
+} pc_compact_group;
+
+typedef struct
+{
+	char *portalname;
+	PCSCHEMA *schema;
+	int32 target;
+	bool done;
+	pc_compact_group acc;     /* Patches being gathered */
+	pc_compact_group out;     /* Patches to merge and hand out */
+} pc_compact_fctx;
+
+/**
+* Add a copy of a patch to the ones being gathered, to be called
+* in the multi-call memory context.
+*/
+static void
+pc_compact_add(pc_compact_fctx *fctx, const SERIALIZED_PATCH *serpa)
+{
+	pc_compact_group *acc = &(fctx->acc);
+
+	if ( acc->nsers == acc->maxsers )
+	{
+		acc->maxsers = acc->maxsers ? 2 * acc->maxsers : 16;
+		if ( acc->sers )
+			acc->sers = repalloc(acc->sers, acc->maxsers * sizeof(SERIALIZED_PATCH*));
+		else
+			acc->sers = palloc(acc->maxsers * sizeof(SERIALIZED_PATCH*));
+	}
+	acc->sers[acc->nsers] = palloc(VARSIZE(serpa));
+	memcpy(acc->sers[acc->nsers], serpa, VARSIZE(serpa));
+	acc->nsers++;
+	acc->npoints += serpa->npoints;
+}
+
+/** Hand the gathered patches out, gathering starts again empty */
+static void
+pc_compact_take(pc_compact_fctx *fctx)
+{
+	fctx->out = fctx->acc;
+	memset(&(fctx->acc), 0, sizeof(pc_compact_group));
+}
+
+/**
+* Merge a group of patches at once, rather than appending them one
+* by one, which would go over the gathered points again for every
+* patch, and serialize the result with the schema compression.
+* The group is emptied.
+*/
+static SERIALIZED_PATCH *
+pc_compact_merge(pc_compact_group *group, const PCSCHEMA *schema)
+{
+	SERIALIZED_PATCH *serout;
+	int i;
+
+	/* A lone patch is handed out as it is */
+	if ( group->nsers == 1 )
+	{
+		serout = palloc(VARSIZE(group->sers[0]));
+		memcpy(serout, group->sers[0], VARSIZE(group->sers[0]));
+	}
+	else
+	{
+		PCPATCH **palist = palloc(group->nsers * sizeof(PCPATCH*));
+		PCPATCH *paout;
+
+		for ( i = 0; i < group->nsers; i++ )
+			palist[i] = pc_patch_deserialize(group->sers[i], schema);
+		paout = pc_patch_from_patchlist(palist, group->nsers);
+		for ( i = 0; i < group->nsers; i++ )
+			pc_patch_free(palist[i]);
+		pfree(palist);
+
+		if ( ! paout )
+			elog(ERROR, "%s: failed to merge patches", __func__);
+
+		serout = pc_patch_serialize(paout, NULL);
+		pc_patch_free(paout);
+	}
+
+	for ( i = 0; i < group->nsers; i++ )
+		pfree(group->sers[i]);
+	pfree(group->sers);
+	memset(group, 0, sizeof(pc_compact_group));
+	return serout;
+}
+
+/**
+* Merge the small patches of a pcpatch column into larger ones
+* PC_Compact(tbl regclass, col name, target int4)
+* returns setof pcpatch, every patch of the column once merged.
+* Patches of target points or more are returned as they are.
+*/
+PG_FUNCTION_INFO_V1(pc_compact);
+Datum pc_compact(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	pc_compact_fctx *fctx;
+	MemoryContext oldcontext;
+	SERIALIZED_PATCH *serout = NULL;
+
+	/* stuff done only on the first call of the function */
+	if (SRF_IS_FIRSTCALL())
+	{
+		Oid relid = PG_GETARG_OID(0);
+		char *colname = NameStr(*PG_GETARG_NAME(1));
+		int32 target = PG_GETARG_INT32(2);
+		char *relname, *colquoted;
+		StringInfoData sql;
+		SPIPlanPtr plan;
+		Portal portal;
+
+		if ( target <= 0 )
+			elog(ERROR, "target number of points must be positive, got %d", target);
+
+		/* create a function context for cross-call persistence */
+		funcctx = SRF_FIRSTCALL_INIT();
+
+		/* switch to memory context appropriate for multiple function calls */
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		fctx = palloc0(sizeof(pc_compact_fctx));
+		fctx->target = target;
+
+		relname = DatumGetCString(DirectFunctionCall1(regclassout, ObjectIdGetDatum(relid)));
+		colquoted = (char*)quote_identifier(colname);
+		initStringInfo(&sql);
+		appendStringInfo(&sql, "SELECT %s FROM %s WHERE %s IS NOT NULL ORDER BY PC_MortonKey(%s)",
+		                 colquoted, relname, colquoted, colquoted);
+
+		/* The cursor outlives the SPI connection, until the end of the scan */
+		if ( SPI_OK_CONNECT != SPI_connect() )
+		{
+			SPI_finish();
+			elog(ERROR, "%s: could not connect to SPI manager", __func__);
+		}
+
+		plan = SPI_prepare(sql.data, 0, NULL);
+		if ( ! plan )
+		{
+			SPI_finish();
+			elog(ERROR, "%s: error (%d) preparing query: %s", __func__, SPI_result, sql.data);
+		}
+
+		portal = SPI_cursor_open(NULL, plan, NULL, NULL, true);
+		fctx->portalname = MemoryContextStrdup(funcctx->multi_call_memory_ctx, portal->name);
+		SPI_finish();
+
+		/* save user context, switch back to function context */
+		funcctx->user_fctx = fctx;
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	/* stuff done on every call of the function */
+	funcctx = SRF_PERCALL_SETUP();
+	fctx = funcctx->user_fctx;
+
+	if ( ! fctx->done )
+	{
+		Portal portal;
+
+		if ( SPI_OK_CONNECT != SPI_connect() )
+		{
+			SPI_finish();
+			elog(ERROR, "%s: could not connect to SPI manager", __func__);
+		}
+
+		portal = SPI_cursor_find(fctx->portalname);
+		if ( ! portal )
+		{
+			SPI_finish();
+			elog(ERROR, "%s: cursor \"%s\" is gone", __func__, fctx->portalname);
+		}
+
+		while ( ! serout && ! fctx->out.nsers )
+		{
+			bool isnull;
+			Datum d;
+			SERIALIZED_PATCH *serpa;
+
+			SPI_cursor_fetch(portal, true, 1);
+			if ( SPI_processed == 0 )
+			{
+				SPI_cursor_close(portal);
+				fctx->done = true;
+				break;
+			}
+
+			d = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull);
+			serpa = (SERIALIZED_PATCH*)PG_DETOAST_DATUM(d);
+
+			if ( ! fctx->schema )
+			{
+				if ( strcmp(SPI_gettype(SPI_tuptable->tupdesc, 1), "pcpatch") != 0 )
+				{
+					SPI_finish();
+					elog(ERROR, "%s: column is not of type pcpatch", __func__);
+				}
+				oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+				fctx->schema = pc_schema_from_pcid_uncached(serpa->pcid);
+				MemoryContextSwitchTo(oldcontext);
+			}
+			else if ( serpa->pcid != fctx->schema->pcid )
+			{
+				SPI_finish();
+				elog(ERROR, "%s: patches have mixed pcids %u and %u", __func__, fctx->schema->pcid, serpa->pcid);
+			}
+
+			/* Patches big enough already are passed through */
+			if ( serpa->npoints >= fctx->target )
+			{
+				serout = SPI_palloc(VARSIZE(serpa));
+				memcpy(serout, serpa, VARSIZE(serpa));
+				break;
+			}
+
+			oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+			/* No room left for this patch, hand out the gathered ones */
+			if ( fctx->acc.nsers && fctx->acc.npoints + serpa->npoints > fctx->target )
+				pc_compact_take(fctx);
+
+			pc_compact_add(fctx, serpa);
+
+			if ( ! fctx->out.nsers && fctx->acc.npoints >= fctx->target )
+				pc_compact_take(fctx);
+
+			MemoryContextSwitchTo(oldcontext);
+
+			/* Keep the memory of the connection to one row */
+			if ( (Pointer)serpa != DatumGetPointer(d) )
+				pfree(serpa);
+			SPI_freetuptable(SPI_tuptable);
+		}
+
+		SPI_finish();
+	}
+
+	/* Hand out what is left once the cursor is exhausted */
+	if ( ! serout && ! fctx->out.nsers && fctx->acc.nsers )
+		pc_compact_take(fctx);
+
+	if ( fctx->out.nsers )
+		serout = pc_compact_merge(&(fctx->out), fctx->schema);
+
+	if ( serout )
+		SRF_RETURN_NEXT(funcctx, PointerGetDatum(serout));
+
+	/* do when there is no more left */
+	SRF_RETURN_DONE(funcctx);
+}
@@ -0,0 +1,155 @@
+/***********************************************************************
+* pc_dictionary.c
+*
+*  PC_TrainDictionaries, builds zlib preset dictionaries for the
+*  dimensions of a pcid from a sample of a pcpatch column, and
+*  stores them in pointcloud_dictionaries.
+*
+*  PgSQL Pointcloud is free and open source software provided
+*  by the Government of Canada
+*  Copyright (c) 2013 Natural Resources Canada
+*
+***********************************************************************/
+
+#include "pc_pgsql.h"      /* Common PgSQL support for our type */
+#include "executor/spi.h"
+#include "utils/memutils.h"
+#include "pc_api_internal.h" /* for dimensional patches and PCBYTES */
+
+Datum pc_train_dictionaries(PG_FUNCTION_ARGS);
+
+/**
+* Train and store a dictionary for every dimension of the sampled
+* pcid that does not have one yet. Existing dictionaries are never
+* replaced, since the patches compressed with them depend on them.
+* PC_TrainDictionaries(tbl regclass, col name, sample_pct float8, maxsize integer)
+* returns the number of dictionaries added.
+*/
+PG_FUNCTION_INFO_V1(pc_train_dictionaries);
+Datum pc_train_dictionaries(PG_FUNCTION_ARGS)
+{
+	Oid relid = PG_GETARG_OID(0);
+	char *colname = NameStr(*PG_GETARG_NAME(1));
+	float8 sample_pct = PG_GETARG_FLOAT8(2);
+	int32 maxsize = PG_GETARG_INT32(3);
+	char *relname;
+	StringInfoData sql;
+	MemoryContext oldcontext = CurrentMemoryContext;
+	PCSCHEMA *schema = NULL;
+	PCBYTES **samples = NULL;
+	SPITupleTable *tuptable;
+	uint64 nrows, row, nsamples = 0;
+	int i, err, ndicts = 0;
+
+	if ( sample_pct <= 0 || sample_pct > 100 )
+		elog(ERROR, "sample percentage must be in (0, 100], got %g", sample_pct);
+
+	if ( maxsize <= 0 || maxsize > 32768 )
+		elog(ERROR, "dictionary size must be in (0, 32768], got %d", maxsize);
+
+	relname = DatumGetCString(DirectFunctionCall1(regclassout, ObjectIdGetDatum(relid)));
+	initStringInfo(&sql);
+	appendStringInfo(&sql, "SELECT %s FROM %s", quote_identifier(colname), relname);
+	if ( sample_pct < 100 )
+		appendStringInfo(&sql, " WHERE random() < %g", sample_pct / 100.0);
+
+	if ( SPI_OK_CONNECT != SPI_connect() )
+	{
+		SPI_finish();
+		elog(ERROR, "%s: could not connect to SPI manager", __func__);
+	}
+
+	err = SPI_execute(sql.data, true, 0);
+	if ( err != SPI_OK_SELECT )
+	{
+		SPI_finish();
+		elog(ERROR, "%s: error (%d) executing query: %s", __func__, err, sql.data);
+	}
+
+	if ( strcmp(SPI_gettype(SPI_tuptable->tupdesc, 1), "pcpatch") != 0 )
+	{
+		SPI_finish();
+		elog(ERROR, "%s: column is not of type pcpatch", __func__);
+	}
+
+	/* The schema and samples must outlive the SPI connection */
+	MemoryContextSwitchTo(oldcontext);
+
+	/* Loading the schema runs a query of its own */
+	tuptable = SPI_tuptable;
+	nrows = SPI_processed;
+
+	/* Collect the uncompressed columns of every sampled patch */
+	for ( row = 0; row < nrows; row++ )
+	{
+		bool isnull;
+		Datum d = SPI_getbinval(tuptable->vals[row], tuptable->tupdesc, 1, &isnull);
+		SERIALIZED_PATCH *serpa;
+		PCPATCH *patch, *pu;
+		PCPATCH_DIMENSIONAL *pdl;
+
+		if ( isnull )
+			continue;
+
+		serpa = (SERIALIZED_PATCH*)PG_DETOAST_DATUM(d);
+
+		if ( ! schema )
+		{
+			schema = pc_schema_from_pcid(serpa->pcid, fcinfo);
+			samples = palloc0(schema->ndims * sizeof(PCBYTES*));
+			for ( i = 0; i < schema->ndims; i++ )
+				samples[i] = palloc(nrows * sizeof(PCBYTES));
+		}
+		else if ( serpa->pcid != schema->pcid )
+		{
+			SPI_finish();
+			elog(ERROR, "%s: sampled patches have mixed pcids %u and %u", __func__, schema->pcid, serpa->pcid);
+		}
+
+		patch = pc_patch_deserialize(serpa, schema);
+		pu = pc_patch_uncompress(patch);
+		pdl = pc_patch_dimensional_from_uncompressed((PCPATCH_UNCOMPRESSED*)pu);
+		for ( i = 0; i < schema->ndims; i++ )
+			samples[i][nsamples] = pdl->bytes[i];
+		nsamples++;
+	}
+
+	/* Train and store the missing dictionaries */
+	for ( i = 0; schema && i < schema->ndims; i++ )
+	{
+		PCZDICT *zdict;
+		bytea *dict;
+		Oid argtypes[3] = { INT4OID, INT4OID, BYTEAOID };
+		Datum values[3];
+
+		if ( schema->dims[i]->zdict )
+			continue;
+
+		zdict = pc_zdict_train(samples[i], nsamples, maxsize);
+		if ( ! zdict )
+			continue;
+
+		dict = palloc(VARHDRSZ + zdict->size);
+		SET_VARSIZE(dict, VARHDRSZ + zdict->size);
+		memcpy(VARDATA(dict), zdict->bytes, zdict->size);
+		pc_zdict_free(zdict);
+
+		values[0] = Int32GetDatum(schema->pcid);
+		values[1] = Int32GetDatum(i + 1);
+		values[2] = PointerGetDatum(dict);
+
+		err = SPI_execute_with_args("INSERT INTO " POINTCLOUD_DICTIONARIES " (pcid, "
+			POINTCLOUD_DICTIONARIES_DIMENSION ", " POINTCLOUD_DICTIONARIES_DICTIONARY
+			") VALUES ($1, $2, $3)", 3, argtypes, values, NULL, false, 0);
+		if ( err != SPI_OK_INSERT )
+		{
+			SPI_finish();
+			elog(ERROR, "%s: error (%d) inserting dictionary for dimension \"%s\"", __func__, err, schema->dims[i]->name);
+		}
+		pfree(dict);
+		ndicts++;
+	}
+
+	SPI_finish();
+	PG_RETURN_INT32(ndicts);
+}
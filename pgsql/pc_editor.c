@@ -8,9 +8,14 @@
 ***********************************************************************/
 
 #include "pc_pgsql.h"	   /* Common PgSQL support for our type */
+#include <math.h>
 
 Datum pcpatch_setpcid(PG_FUNCTION_ARGS);
 Datum pcpatch_transform(PG_FUNCTION_ARGS);
+Datum pcpatch_append(PG_FUNCTION_ARGS);
+Datum pcpatch_delete_points(PG_FUNCTION_ARGS);
+Datum pcpatch_sample_grid(PG_FUNCTION_ARGS);
+Datum pcpatch_affine(PG_FUNCTION_ARGS);
 
 
 static SERIALIZED_PATCH *
@@ -124,3 +129,209 @@ Datum pcpatch_transform(PG_FUNCTION_ARGS)
 		PG_RETURN_POINTER(serpatch);
 	}
 }
+
+/**
+* PC_Append(p pcpatch, other pcpatch) returns pcpatch
+* Dimensional patches get the new points encoded on their own and
+* spliced onto their columns, which are stored without a rewrite.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_append);
+Datum pcpatch_append(PG_FUNCTION_ARGS)
+{
+	SERIALIZED_PATCH *serpatch;
+	SERIALIZED_PATCH *serpa = PG_GETARG_SERPATCH_P(0);
+	SERIALIZED_PATCH *serpb = PG_GETARG_SERPATCH_P(1);
+	PCSCHEMA *schema;
+	PCPATCH *pa, *pb, *paout;
+
+	if ( serpa->pcid != serpb->pcid )
+		elog(ERROR, "pcids of patches (%u) and (%u) not equal", serpa->pcid, serpb->pcid);
+
+	schema = pc_schema_from_pcid(serpa->pcid, fcinfo);
+	pa = pc_patch_deserialize(serpa, schema);
+	pb = pc_patch_deserialize(serpb, schema);
+	if ( ! pa || ! pb )
+		elog(ERROR, "failed to deserialize patch");
+
+	paout = pc_patch_append(pa, pb);
+
+	pc_patch_free(pa);
+	pc_patch_free(pb);
+
+	if ( ! paout )
+		PG_RETURN_NULL();
+
+	serpatch = pc_patch_serialize(paout, NULL);
+	pc_patch_free(paout);
+
+	PG_RETURN_POINTER(serpatch);
+}
+
+
+/**
+* PC_DeletePoints(p pcpatch, n int4[]) returns pcpatch
+* Drops the points at the given 1-based indexes, in one pass over
+* the patch whatever the number of points deleted.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_delete_points);
+Datum pcpatch_delete_points(PG_FUNCTION_ARGS)
+{
+	SERIALIZED_PATCH *serpatch;
+	SERIALIZED_PATCH *serpa = PG_GETARG_SERPATCH_P(0);
+	ArrayType *arrptr = PG_GETARG_ARRAYTYPE_P(1);
+	PCSCHEMA *schema = pc_schema_from_pcid(serpa->pcid, fcinfo);
+	PCPATCH *patch, *paout;
+	PCTOMBSTONES *ts;
+	int32 *vals;
+	int nelems, i;
+
+	if ( ARR_ELEMTYPE(arrptr) != INT4OID )
+		elog(ERROR, "array must be of int4[]");
+
+	if ( ARR_NDIM(arrptr) > 1 )
+		elog(ERROR, "int4[] must have only one dimension");
+
+	if ( ARR_HASNULL(arrptr) )
+		elog(ERROR, "int4[] must not have null elements");
+
+	patch = pc_patch_deserialize(serpa, schema);
+	if ( ! patch )
+		elog(ERROR, "failed to deserialize patch");
+
+	nelems = ArrayGetNItems(ARR_NDIM(arrptr), ARR_DIMS(arrptr));
+	vals = (int32*) ARR_DATA_PTR(arrptr);
+	ts = pc_tombstones_new(patch->npoints);
+	for ( i = 0; i < nelems; i++ )
+	{
+		if ( vals[i] < 1 || vals[i] > patch->npoints )
+			elog(ERROR, "point %d is out of range, patch has %u points", vals[i], patch->npoints);
+		pc_tombstones_set(ts, vals[i] - 1);
+	}
+
+	paout = pc_patch_compact(patch, ts);
+	pc_tombstones_free(ts);
+
+	if ( paout == patch )
+	{
+		pc_patch_free(patch);
+		PG_RETURN_POINTER(serpa);
+	}
+	pc_patch_free(patch);
+
+	/* Always treat zero-point patches as SQL NULL */
+	if ( ! paout || paout->npoints == 0 )
+	{
+		if ( paout )
+			pc_patch_free(paout);
+		PG_RETURN_NULL();
+	}
+
+	serpatch = pc_patch_serialize(paout, NULL);
+	pc_patch_free(paout);
+
+	PG_RETURN_POINTER(serpatch);
+}
+
+
+/**
+* PC_SampleGrid(p pcpatch, grid float8[], geotransform float8[],
+*               dimension text, method text) returns pcpatch
+* Sets the dimension from a 2D grid of values (rows of columns,
+* as returned by ST_DumpValues), placed by a GDAL geotransform.
+* NULL cells leave the points on them unchanged.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_sample_grid);
+Datum pcpatch_sample_grid(PG_FUNCTION_ARGS)
+{
+	SERIALIZED_PATCH *serpatch;
+	SERIALIZED_PATCH *serpa = PG_GETARG_SERPATCH_P(0);
+	ArrayType *gridarr = PG_GETARG_ARRAYTYPE_P(1);
+	ArrayType *gtarr = PG_GETARG_ARRAYTYPE_P(2);
+	char *dim_name = text_to_cstring(PG_GETARG_TEXT_P(3));
+	char *method_str = text_to_cstring(PG_GETARG_TEXT_P(4));
+	PCSCHEMA *schema = pc_schema_from_pcid(serpa->pcid, fcinfo);
+	PC_SAMPLEMETHOD method;
+	PCPATCH *patch, *paout;
+	Datum *elems;
+	bool *nulls;
+	double *grid, *gt;
+	int nelems, i;
+
+	if ( strcasecmp(method_str, "nearest") == 0 )
+		method = PC_SAMPLE_NEAREST;
+	else if ( strcasecmp(method_str, "bilinear") == 0 )
+		method = PC_SAMPLE_BILINEAR;
+	else
+		elog(ERROR, "unknown sampling method \"%s\", use \"nearest\" or \"bilinear\"", method_str);
+
+	if ( ARR_ELEMTYPE(gridarr) != FLOAT8OID || ARR_ELEMTYPE(gtarr) != FLOAT8OID )
+		elog(ERROR, "arrays must be of float8[]");
+
+	if ( ARR_NDIM(gridarr) != 2 )
+		elog(ERROR, "grid must have two dimensions");
+
+	if ( ARR_NDIM(gtarr) != 1 || ARR_DIMS(gtarr)[0] != 6 || ARR_HASNULL(gtarr) )
+		elog(ERROR, "geotransform must have six non-null elements");
+
+	gt = (double*) ARR_DATA_PTR(gtarr);
+
+	deconstruct_array(gridarr, FLOAT8OID, sizeof(float8), FLOAT8PASSBYVAL, 'd', &elems, &nulls, &nelems);
+	grid = palloc(nelems * sizeof(double));
+	for ( i = 0; i < nelems; i++ )
+		grid[i] = nulls[i] ? NAN : DatumGetFloat8(elems[i]);
+
+	patch = pc_patch_deserialize(serpa, schema);
+	if ( ! patch )
+		elog(ERROR, "failed to deserialize patch");
+
+	paout = pc_patch_sample_grid(patch, grid, ARR_DIMS(gridarr)[0], ARR_DIMS(gridarr)[1], gt, dim_name, method);
+
+	pc_patch_free(patch);
+	pfree(grid);
+	pfree(elems);
+	pfree(nulls);
+
+	if ( ! paout )
+		PG_RETURN_NULL();
+
+	serpatch = pc_patch_serialize(paout, NULL);
+	pc_patch_free(paout);
+
+	PG_RETURN_POINTER(serpatch);
+}
+
+
+/**
+* PC_Affine(p pcpatch, matrix float8[]) returns pcpatch
+* Transforms X/Y/Z by a 4x4 affine matrix, given row by row.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_affine);
+Datum pcpatch_affine(PG_FUNCTION_ARGS)
+{
+	SERIALIZED_PATCH *serpatch;
+	SERIALIZED_PATCH *serpa = PG_GETARG_SERPATCH_P(0);
+	ArrayType *arrptr = PG_GETARG_ARRAYTYPE_P(1);
+	PCSCHEMA *schema = pc_schema_from_pcid(serpa->pcid, fcinfo);
+	PCPATCH *patch, *paout;
+
+	if ( ARR_ELEMTYPE(arrptr) != FLOAT8OID )
+		elog(ERROR, "array must be of float8[]");
+
+	if ( ArrayGetNItems(ARR_NDIM(arrptr), ARR_DIMS(arrptr)) != 16 || ARR_HASNULL(arrptr) )
+		elog(ERROR, "matrix must have 16 non-null elements");
+
+	patch = pc_patch_deserialize(serpa, schema);
+	if ( ! patch )
+		elog(ERROR, "failed to deserialize patch");
+
+	paout = pc_patch_affine(patch, (double*) ARR_DATA_PTR(arrptr));
+	pc_patch_free(patch);
+
+	if ( ! paout )
+		PG_RETURN_NULL();
+
+	serpatch = pc_patch_serialize(paout, NULL);
+	pc_patch_free(paout);
+
+	PG_RETURN_POINTER(serpatch);
+}
@@ -11,6 +11,10 @@
 
 #include "pc_pgsql.h"      /* Common PgSQL support for our type */
 
+/* cstring array utility functions */
+const char **array_to_cstring_array(ArrayType *array, int *size);
+void pc_cstring_array_free(const char **array, int nelems);
+
 /* In/out functions */
 Datum pcpoint_in(PG_FUNCTION_ARGS);
 Datum pcpoint_out(PG_FUNCTION_ARGS);
@@ -27,11 +31,14 @@ Datum pcpoint_enforce_typmod(PG_FUNCTION_ARGS);
 /* Other SQL functions */
 Datum pcschema_is_valid(PG_FUNCTION_ARGS);
 Datum pcschema_get_ndims(PG_FUNCTION_ARGS);
+Datum pcschema_subset(PG_FUNCTION_ARGS);
 Datum pcpoint_from_double_array(PG_FUNCTION_ARGS);
+Datum pcpatch_from_double_array(PG_FUNCTION_ARGS);
 Datum pcpoint_as_text(PG_FUNCTION_ARGS);
 Datum pcpatch_as_text(PG_FUNCTION_ARGS);
 Datum pcpoint_as_bytea(PG_FUNCTION_ARGS);
 Datum pcpatch_envelope_as_bytea(PG_FUNCTION_ARGS);
+Datum pcpatch_as_multipoint(PG_FUNCTION_ARGS);
 Datum pcpatch_bounding_diagonal_as_bytea(PG_FUNCTION_ARGS);
 
 
@@ -111,7 +118,6 @@ Datum pcpatch_in(PG_FUNCTION_ARGS)
 	char *str = PG_GETARG_CSTRING(0);
 	/* Datum geog_oid = PG_GETARG_OID(1); Not needed. */
 	uint32 typmod = 0, pcid = 0;
-	PCPATCH *patch;
 	SERIALIZED_PATCH *serpatch = NULL;
 
 	if ( (PG_NARGS()>2) && (!PG_ARGISNULL(2)) )
@@ -130,10 +136,8 @@ Datum pcpatch_in(PG_FUNCTION_ARGS)
 	if ( str[0] == '0' )
 	{
 		/* Hex-encoded binary */
-		patch = pc_patch_from_hexwkb(str, strlen(str), fcinfo);
-		pcid_consistent(patch->schema->pcid, pcid);
-		serpatch = pc_patch_serialize(patch, NULL);
-		pc_patch_free(patch);
+		serpatch = pc_patch_serialize_from_hexwkb(str, strlen(str), fcinfo);
+		pcid_consistent(serpatch->pcid, pcid);
 	}
 	else
 	{
@@ -193,6 +197,33 @@ Datum pcschema_get_ndims(PG_FUNCTION_ARGS)
 	PG_RETURN_INT32(ndims);
 }
 
+/**
+* PC_SchemaSubset(schemaxml text, dims text[]) returns text
+* Schema reduced to the named dimensions, along with X and Y.
+*/
+PG_FUNCTION_INFO_V1(pcschema_subset);
+Datum pcschema_subset(PG_FUNCTION_ARGS)
+{
+	char *xmlstr = text_to_cstring(PG_GETARG_TEXT_P(0));
+	ArrayType *array = PG_GETARG_ARRAYTYPE_P(1);
+	const char **names;
+	char *subset;
+	text *result;
+	int nnames;
+
+	names = array_to_cstring_array(array, &nnames);
+	subset = pc_schema_xml_subset(xmlstr, names, nnames);
+	pc_cstring_array_free(names, nnames);
+	pfree(xmlstr);
+
+	if ( ! subset )
+		elog(ERROR, "unable to build the schema subset");
+
+	result = cstring_to_text(subset);
+	pcfree(subset);
+	PG_RETURN_TEXT_P(result);
+}
+
 /**
 * pcpoint_from_double_array(integer pcid, float8[] returns PcPoint
 */
@@ -231,6 +262,60 @@ Datum pcpoint_from_double_array(PG_FUNCTION_ARGS)
 	PG_RETURN_POINTER(serpt);
 }
 
+/**
+* pcpatch_from_double_array(integer pcid, float8[]) returns PcPatch
+* The array holds the values of each point in turn, in schema order.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_from_double_array);
+Datum pcpatch_from_double_array(PG_FUNCTION_ARGS)
+{
+	uint32 pcid = PG_GETARG_INT32(0);
+	ArrayType *arrptr = PG_GETARG_ARRAYTYPE_P(1);
+	int nelems, npoints, i;
+	float8 *vals;
+	PCPATCH *pa;
+	PCPATCH_BUILDER *pb;
+	PCSCHEMA *schema = pc_schema_from_pcid(pcid, fcinfo);
+	SERIALIZED_PATCH *serpa;
+
+	if ( ! schema )
+		elog(ERROR, "unable to load schema for pcid = %d", pcid);
+
+	if ( ARR_ELEMTYPE(arrptr) != FLOAT8OID )
+		elog(ERROR, "array must be of float8[]");
+
+	if ( ARR_NDIM(arrptr) != 1 )
+		elog(ERROR, "float8[] must have only one dimension");
+
+	if ( ARR_HASNULL(arrptr) )
+		elog(ERROR, "float8[] must not have null elements");
+
+	nelems = ARR_DIMS(arrptr)[0];
+	if ( nelems % schema->ndims || ARR_LBOUND(arrptr)[0] > 1 )
+		elog(ERROR, "array size is not a multiple of the schema dimensions of pcid = %d", pcid);
+
+	npoints = nelems / schema->ndims;
+	if ( ! npoints )
+		PG_RETURN_NULL();
+
+	/* One pass over the values, straight into the patch buffers */
+	vals = (float8*) ARR_DATA_PTR(arrptr);
+	pb = pc_patch_builder_make(schema, npoints);
+	for ( i = 0; i < npoints; i++ )
+	{
+		if ( PC_FAILURE == pc_patch_builder_add_double_array(pb, vals + i * schema->ndims, schema->ndims) )
+		{
+			pc_patch_builder_free(pb);
+			elog(ERROR, "failed to add point %d to patch", i + 1);
+		}
+	}
+	pa = pc_patch_builder_finish(pb);
+
+	serpa = pc_patch_serialize(pa, NULL);
+	pc_patch_free(pa);
+	PG_RETURN_POINTER(serpa);
+}
+
 PG_FUNCTION_INFO_V1(pcpoint_as_text);
 Datum pcpoint_as_text(PG_FUNCTION_ARGS)
 {
@@ -314,6 +399,35 @@ Datum pcpatch_envelope_as_bytea(PG_FUNCTION_ARGS)
 	PG_RETURN_BYTEA_P(wkb);
 }
 
+PG_FUNCTION_INFO_V1(pcpatch_as_multipoint);
+Datum pcpatch_as_multipoint(PG_FUNCTION_ARGS)
+{
+	uint8 *bytes;
+	size_t bytes_size;
+	bytea *wkb;
+	size_t wkb_size;
+	SERIALIZED_PATCH *serpatch = PG_GETARG_SERPATCH_P(0);
+	PCSCHEMA *schema = pc_schema_from_pcid(serpatch->pcid, fcinfo);
+	PCPATCH *patch = pc_patch_deserialize(serpatch, schema);
+
+	if ( ! patch )
+		PG_RETURN_NULL();
+
+	bytes = pc_patch_to_geometry_wkb_multipoint(patch, &bytes_size);
+	pc_patch_free(patch);
+	if ( ! bytes )
+		PG_RETURN_NULL();
+
+	wkb_size = VARHDRSZ + bytes_size;
+	wkb = palloc(wkb_size);
+	memcpy(VARDATA(wkb), bytes, bytes_size);
+	SET_VARSIZE(wkb, wkb_size);
+
+	pfree(bytes);
+
+	PG_RETURN_BYTEA_P(wkb);
+}
+
 PG_FUNCTION_INFO_V1(pcpatch_bounding_diagonal_as_bytea);
 Datum pcpatch_bounding_diagonal_as_bytea(PG_FUNCTION_ARGS)
 {
@@ -440,7 +554,8 @@ Datum pc_typmod_pcid(PG_FUNCTION_ARGS)
 PG_FUNCTION_INFO_V1(pcpatch_enforce_typmod);
 Datum pcpatch_enforce_typmod(PG_FUNCTION_ARGS)
 {
-	SERIALIZED_PATCH *arg = PG_GETARG_SERPATCH_P(0);
+	/* Only the header is needed to check the pcid */
+	SERIALIZED_PATCH *arg = PG_GETHEADER_SERPATCH_P(0);
 	uint32 typmod = PG_GETARG_INT32(1);
 	uint32 pcid = pcid_from_typmod(typmod);
 	/* We don't need to have different behavior based on explicitness. */
@@ -450,7 +565,8 @@ Datum pcpatch_enforce_typmod(PG_FUNCTION_ARGS)
 	if ( pcid != arg->pcid )
 		elog(ERROR, "column pcid (%d) and patch pcid (%d) are not consistent", pcid, arg->pcid);
 
-	PG_RETURN_POINTER(arg);
+	/* Hand the datum back as it came, still toasted */
+	PG_RETURN_DATUM(PG_GETARG_DATUM(0));
 }
 
 PG_FUNCTION_INFO_V1(pcpoint_enforce_typmod);
@@ -15,6 +15,7 @@
 #include "executor/spi.h"
 #include "access/hash.h"
 #include "utils/hsearch.h"
+#include "pc_api_internal.h" /* for dimensional patches and PCDIMSTATS */
 
 PG_MODULE_MAGIC;
 
@@ -119,6 +120,7 @@ _PG_init(void)
 		pgsql_info, pgsql_warn
 	);
 
+	pc_recompress_worker_init();
 }
 
 /* Module unload callback */
@@ -191,8 +193,8 @@ pc_patch_from_hexwkb(const char *hexwkb, size_t hexlen, FunctionCallInfoData *fc
 	if ( ! schema )
 		elog(ERROR, "%s: unable to look up schema entry", __func__);
 
-	patch = pc_patch_from_wkb(schema, wkb, wkblen);
-	pfree(wkb);
+	/* The patch may point into wkb, leave it to the memory context */
+	patch = pc_patch_from_wkb_readonly(schema, wkb, wkblen);
 	return patch;
 }
 
@@ -230,9 +232,12 @@ pc_schema_from_pcid_uncached(uint32 pcid)
 {
 	char sql[256];
 	char *xml, *xml_spi, *srid_spi;
-	int err, srid;
+	int err, srid, i;
 	size_t size;
 	PCSCHEMA *schema;
+	uint64 ndicts;
+	int32 *dictdims = NULL;
+	bytea **dicts = NULL;
 
 	if (SPI_OK_CONNECT != SPI_connect ())
 	{
@@ -280,6 +285,34 @@ pc_schema_from_pcid_uncached(uint32 pcid)
 	/* Parse the SRID string into the function stack */
 	srid = atoi(srid_spi);
 
+	/* Copy the zlib dictionaries too */
+	sprintf(sql, "select %s, %s from %s where pcid = %d",
+		POINTCLOUD_DICTIONARIES_DIMENSION, POINTCLOUD_DICTIONARIES_DICTIONARY, POINTCLOUD_DICTIONARIES, pcid);
+	err = SPI_exec(sql, 0);
+
+	if ( err < 0 )
+	{
+		SPI_finish();
+		elog(ERROR, "%s: error (%d) executing query: %s", __func__, err, sql);
+		return NULL;
+	}
+
+	ndicts = SPI_processed;
+	if ( ndicts )
+	{
+		dictdims = SPI_palloc(ndicts * sizeof(int32));
+		dicts = SPI_palloc(ndicts * sizeof(bytea*));
+	}
+	for ( i = 0; i < ndicts; i++ )
+	{
+		bool isnull;
+		bytea *dict;
+		dictdims[i] = DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1, &isnull));
+		dict = DatumGetByteaP(SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 2, &isnull));
+		dicts[i] = SPI_palloc(VARSIZE(dict));
+		memcpy(dicts[i], dict, VARSIZE(dict));
+	}
+
 	/* Disconnect from SPI, losing all our SPI-allocated memory now... */
 	SPI_finish();
 
@@ -296,6 +329,18 @@ pc_schema_from_pcid_uncached(uint32 pcid)
 	schema->pcid = pcid;
 	schema->srid = srid;
 
+	for ( i = 0; i < ndicts; i++ )
+	{
+		PCZDICT *zdict = pc_zdict_make((uint8_t*)VARDATA(dicts[i]), VARSIZE(dicts[i]) - VARHDRSZ);
+		if ( PC_FAILURE == pc_schema_set_zdict(schema, dictdims[i] - 1, zdict) )
+		{
+			ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				errmsg("invalid dimension %d in \"%s\" for pcid = %d", dictdims[i], POINTCLOUD_DICTIONARIES, pcid)));
+		}
+		pfree(dicts[i]);
+	}
+
 	return schema;
 }
 
@@ -336,6 +381,7 @@ typedef struct
 
 #define PC_SCHEMA_CACHE 10
 #define PC_STATS_CACHE  11
+#define PC_POLYINDEX_CACHE 12
 
 /**
 * Get the generic collection off the statement, allocate a
@@ -423,6 +469,92 @@ pc_schema_from_pcid(uint32 pcid, FunctionCallInfoData *fcinfo)
 	return schema;
 }
 
+/**
+* The polygon array of the last call, and its index. The same
+* array usually comes with every row of a statement, so the index
+* is only built once.
+*/
+typedef struct
+{
+	int type;
+	ArrayType *array;
+	PCPOLYINDEX *idx;
+} PolyIndexCache;
+
+static PCPOLYINDEX *
+pc_polyindex_from_array_uncached(ArrayType *array)
+{
+	Datum *elems;
+	bool *nulls;
+	int nelems, i;
+	const uint8_t **wkbs;
+	size_t *wkbsizes;
+	PCPOLYINDEX *idx;
+
+	deconstruct_array(array, BYTEAOID, -1, false, 'i', &elems, &nulls, &nelems);
+
+	wkbs = palloc0((nelems ? nelems : 1) * sizeof(uint8_t*));
+	wkbsizes = palloc0((nelems ? nelems : 1) * sizeof(size_t));
+	for ( i = 0; i < nelems; i++ )
+	{
+		bytea *wkb;
+		if ( nulls[i] )
+			continue;
+		wkb = DatumGetByteaPP(elems[i]);
+		wkbs[i] = (uint8_t*)VARDATA_ANY(wkb);
+		wkbsizes[i] = VARSIZE_ANY_EXHDR(wkb);
+	}
+
+	idx = pc_polyindex_from_wkb(wkbs, wkbsizes, nelems);
+	pfree(wkbs);
+	pfree(wkbsizes);
+	return idx;
+}
+
+PCPOLYINDEX *
+pc_polyindex_from_array(ArrayType *array, FunctionCallInfoData *fcinfo)
+{
+	GenericCacheCollection *generic_cache = GetGenericCacheCollection(fcinfo);
+	PolyIndexCache *cache = (PolyIndexCache*)(generic_cache->entry[PC_POLYINDEX_CACHE]);
+	MemoryContext oldcontext;
+	PCPOLYINDEX *idx;
+
+	if ( ! cache )
+	{
+		/* Allocate in the upper context */
+		cache = MemoryContextAlloc(fcinfo->flinfo->fn_mcxt, sizeof(PolyIndexCache));
+		memset(cache, 0, sizeof(PolyIndexCache));
+		cache->type = PC_POLYINDEX_CACHE;
+		generic_cache->entry[PC_POLYINDEX_CACHE] = (GenericCache*)cache;
+	}
+
+	if ( cache->array && VARSIZE(cache->array) == VARSIZE(array) &&
+	     memcmp(cache->array, array, VARSIZE(array)) == 0 )
+	{
+		return cache->idx;
+	}
+
+	oldcontext = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+	idx = pc_polyindex_from_array_uncached(array);
+	if ( idx )
+	{
+		if ( cache->array )
+		{
+			pfree(cache->array);
+			pc_polyindex_free(cache->idx);
+		}
+		cache->array = palloc(VARSIZE(array));
+		memcpy(cache->array, array, VARSIZE(array));
+		cache->idx = idx;
+	}
+	MemoryContextSwitchTo(oldcontext);
+
+	if ( ! idx )
+		elog(ERROR, "%s: failed to index polygons", __func__);
+
+	return idx;
+}
+
 
 
 /**********************************************************************************
@@ -484,8 +616,10 @@ pc_patch_serialized_size(const PCPATCH *patch)
 	case PC_LAZPERF:
 	{
 		static size_t lazsize_size = 4;
-		PCPATCH_LAZPERF *pg = (PCPATCH_LAZPERF*)patch;
-		return common_size + stats_size + lazsize_size + pg->lazperfsize;
+		size_t storedsize;
+		uint32_t flags;
+		pc_patch_lazperf_stored((PCPATCH_LAZPERF*)patch, &storedsize, &flags);
+		return common_size + stats_size + lazsize_size + storedsize;
 	}
 	default:
 	{
@@ -525,8 +659,15 @@ pc_patch_stats_deserialize(const PCSCHEMA *schema, const uint8_t *buf)
 	return pc_stats_new_from_data(schema, buf_min, buf_max, buf_avg);
 }
 
+/**
+* Serialize a dimensional patch, encoding each dimension as
+* recommended by the PCDIMSTATS straight into the output, or
+* keeping the encodings it already has when there are no stats.
+* The output is sized from the worst case of every encoding, so
+* each serialized byte is only written once.
+*/
 static SERIALIZED_PATCH *
-pc_patch_dimensional_serialize(const PCPATCH *patch_in)
+pc_patch_dimensional_serialize(const PCPATCH *patch_in, const PCDIMSTATS *pds)
 {
 	//  uint32_t size;
 	//  uint32_t pcid;
@@ -538,43 +679,73 @@ pc_patch_dimensional_serialize(const PCPATCH *patch_in)
 	//    serialized_pcbytes[ndims] dimensions;
 
 	int i;
-	uint8_t *buf;
-	size_t serpch_size = pc_patch_serialized_size(patch_in);
-	SERIALIZED_PATCH *serpch = pcalloc(serpch_size);
+	PCSINK sink;
+	size_t serpch_size = sizeof(SERIALIZED_PATCH) - 1 + pc_stats_size(patch_in->schema);
+	SERIALIZED_PATCH *serpch;
 	const PCPATCH_DIMENSIONAL *patch = (PCPATCH_DIMENSIONAL*)patch_in;
 
 	assert(patch_in);
 	assert(patch_in->type == PC_DIMENSIONAL);
 
+	if ( ! patch->stats )
+		pcerror("%s: stats missing!", __func__);
+
+	for ( i = 0; i < patch->schema->ndims; i++ )
+	{
+		const PCBYTES *pcb = &(patch->bytes[i]);
+		int compression = pds ? pds->stats[i].recommended_compression : pcb->compression;
+		serpch_size += pc_bytes_serialized_size_bound(pcb, compression);
+	}
+	pc_sink_init(&sink, serpch_size);
+
 	/* Copy basics */
+	serpch = (SERIALIZED_PATCH*)pc_sink_reserve(&sink, sizeof(SERIALIZED_PATCH) - 1);
 	serpch->pcid = patch->schema->pcid;
 	serpch->npoints = patch->npoints;
 	serpch->bounds = patch->bounds;
 	serpch->compression = patch->type;
-
-	/* Get a pointer to the data area */
-	buf = serpch->data;
+	sink.size += sizeof(SERIALIZED_PATCH) - 1;
 
 	/* Write stats into the buffer */
-	if ( patch->stats )
-	{
-		buf += pc_patch_stats_serialize(buf, patch->schema, patch->stats);
-	}
-	else
-	{
-		pcerror("%s: stats missing!", __func__);
-	}
+	sink.size += pc_patch_stats_serialize(pc_sink_reserve(&sink, pc_stats_size(patch->schema)), patch->schema, patch->stats);
 
 	/* Write each dimension in after the stats */
 	for ( i = 0; i < patch->schema->ndims; i++ )
 	{
-		size_t bsize = 0;
-		PCBYTES *pcb = &(patch->bytes[i]);
-		pc_bytes_serialize(pcb, buf, &bsize);
-		buf += bsize;
+		const PCBYTES *pcb = &(patch->bytes[i]);
+		int compression = pds ? pds->stats[i].recommended_compression : pcb->compression;
+		pc_bytes_serialize_to_sink(pcb, compression, &sink);
 	}
 
-	SET_VARSIZE(serpch, serpch_size);
+	/* The sink may have moved while growing */
+	serpch = (SERIALIZED_PATCH*)sink.bytes;
+	SET_VARSIZE(serpch, sink.size);
+	return serpch;
+}
+
+/**
+* Serialize an uncompressed patch into a dimensional one. The
+* points are only transposed into columns, which are then encoded
+* straight into the output.
+*/
+static SERIALIZED_PATCH *
+pc_patch_dimensional_serialize_uncompressed(const PCPATCH *patch_in, PCDIMSTATS *pds_in)
+{
+	SERIALIZED_PATCH *serpch;
+	PCDIMSTATS *pds = pds_in;
+	PCPATCH_DIMENSIONAL *pdl = pc_patch_dimensional_from_uncompressed((PCPATCH_UNCOMPRESSED*)patch_in);
+
+	if ( ! pds )
+		pds = pc_dimstats_make(patch_in->schema);
+
+	/* Still sampling, update stats */
+	if ( pds->total_points < PCDIMSTATS_MIN_SAMPLE )
+		pc_dimstats_update(pds, pdl);
+
+	serpch = pc_patch_dimensional_serialize((PCPATCH*)pdl, pds);
+
+	if ( pds != pds_in ) pc_dimstats_free(pds);
+	pc_patch_free((PCPATCH*)pdl);
 	return serpch;
 }
 
@@ -633,7 +804,10 @@ pc_patch_lazperf_serialize(const PCPATCH *patch_in)
 	size_t serpch_size = pc_patch_serialized_size(patch_in);
 	SERIALIZED_PATCH *serpch = pcalloc(serpch_size);
 	const PCPATCH_LAZPERF *patch = (PCPATCH_LAZPERF*)patch_in;
-	uint32_t lazsize = patch->lazperfsize;
+	size_t storedsize;
+	uint32_t flags;
+	const uint8_t *stored = pc_patch_lazperf_stored(patch, &storedsize, &flags);
+	uint32_t lazsize = storedsize;
 	uint8_t *buf = serpch->data;
 
 	assert(patch);
@@ -643,7 +817,8 @@ pc_patch_lazperf_serialize(const PCPATCH *patch_in)
 	serpch->pcid = patch->schema->pcid;
 	serpch->npoints = patch->npoints;
 	serpch->bounds = patch->bounds;
-	serpch->compression = patch->type;
+	/* Flagged as in wkb when the data keeps its format byte */
+	serpch->compression = patch->type | flags;
 
 	/* Write stats into the buffer first */
 	if ( patch->stats )
@@ -660,7 +835,7 @@ pc_patch_lazperf_serialize(const PCPATCH *patch_in)
 	buf += 4;
 
 	/* Write buffer */
-	memcpy(buf, patch->lazperf, patch->lazperfsize);
+	memcpy(buf, stored, storedsize);
 	SET_VARSIZE(serpch, serpch_size);
 
 	return serpch;
@@ -731,7 +906,12 @@ pc_patch_serialize(const PCPATCH *patch_in, void *userdata)
 	* Convert the patch to the final target compression,
 	* which is the one in the schema.
 	*/
-	if ( patch->type != patch->schema->compression )
+	if ( patch->type == PC_NONE && patch->npoints &&
+	     patch->schema->compression == PC_DIMENSIONAL )
+	{
+		return pc_patch_dimensional_serialize_uncompressed(patch, userdata);
+	}
+	else if ( patch->type != patch->schema->compression )
 	{
 		patch = pc_patch_compress(patch_in, userdata);
 	}
@@ -745,7 +925,7 @@ pc_patch_serialize(const PCPATCH *patch_in, void *userdata)
 	}
 	case PC_DIMENSIONAL:
 	{
-		serpatch = pc_patch_dimensional_serialize(patch);
+		serpatch = pc_patch_dimensional_serialize(patch, NULL);
 		break;
 	}
 	case PC_GHT:
@@ -770,6 +950,72 @@ pc_patch_serialize(const PCPATCH *patch_in, void *userdata)
 	return serpatch;
 }
 
+/**
+* Serialize a hex-encoded patch WKB. When the WKB is in the machine
+* endianness and already in the compression of the schema, its
+* payload is laid out exactly as the serialized data that follows
+* the stats, so after checking its structure it is adopted as it
+* is, and only the stats and bounds the WKB does not carry are
+* computed. Anything else is parsed and goes through
+* pc_patch_serialize().
+*/
+SERIALIZED_PATCH *
+pc_patch_serialize_from_hexwkb(const char *hexwkb, size_t hexlen, FunctionCallInfoData *fcinfo)
+{
+	size_t hdrsz = 1+4+4+4; /* endian + pcid + compression + npoints */
+	PCPATCH *patch;
+	PCSCHEMA *schema;
+	SERIALIZED_PATCH *serpatch;
+	size_t stats_size, serpatch_size;
+	uint32 pcid;
+	uint8 *wkb = pc_bytes_from_hexbytes(hexwkb, hexlen);
+	size_t wkblen = hexlen/2;
+
+	if ( wkblen < hdrsz )
+		elog(ERROR, "%s: wkb is too short for a patch header", __func__);
+
+	pcid = pc_wkb_get_pcid(wkb);
+	if ( ! pcid )
+		elog(ERROR, "%s: pcid is zero", __func__);
+
+	schema = pc_schema_from_pcid(pcid, fcinfo);
+	if ( ! schema )
+		elog(ERROR, "%s: unable to look up schema entry", __func__);
+
+	if ( wkb[0] != machine_endian() ||
+	     wkb_get_compression(wkb) != schema->compression ||
+	     ! wkb_get_npoints(wkb) )
+	{
+		patch = pc_patch_from_wkb_readonly(schema, wkb, wkblen);
+		serpatch = pc_patch_serialize(patch, NULL);
+		pc_patch_free(patch);
+		pfree(wkb);
+		return serpatch;
+	}
+
+	patch = pc_patch_from_wkb_stats(schema, wkb, wkblen);
+	if ( ! patch )
+		elog(ERROR, "%s: invalid patch wkb", __func__);
+
+	/* Skip the bounds and stats blocks too */
+	hdrsz = pc_patch_wkb_header_size(schema, wkb);
+	stats_size = pc_stats_size(schema);
+	serpatch_size = sizeof(SERIALIZED_PATCH) - 1 + stats_size + wkblen - hdrsz;
+	serpatch = palloc(serpatch_size);
+	serpatch->pcid = pcid;
+	/* The payload is copied as is, along with its LAZ flag */
+	serpatch->compression = patch->type | (wkb_get_flags(wkb) & PC_WKB_LAZHEADER);
+	serpatch->npoints = patch->npoints;
+	serpatch->bounds = patch->bounds;
+	pc_patch_stats_serialize(serpatch->data, schema, patch->stats);
+	memcpy(serpatch->data + stats_size, wkb + hdrsz, wkblen - hdrsz);
+	SET_VARSIZE(serpatch, serpatch_size);
+
+	pc_patch_free(patch);
+	pfree(wkb);
+	return serpatch;
+}
+
 
 
 
@@ -958,7 +1204,7 @@ pc_patch_lazperf_deserialize(const SERIALIZED_PATCH *serpatch, const PCSCHEMA *s
 	patch = pcalloc(sizeof(PCPATCH_LAZPERF));
 
 	/* Set up basic info */
-	patch->type = serpatch->compression;
+	patch->type = PC_LAZPERF;
 	patch->schema = schema;
 	patch->readonly = true;
 	patch->npoints = npoints;
@@ -969,11 +1215,9 @@ pc_patch_lazperf_deserialize(const SERIALIZED_PATCH *serpatch, const PCSCHEMA *s
 
 	/* Set up buffer */
 	memcpy(&lazperfsize, buf, 4);
-	patch->lazperfsize = lazperfsize;
 	buf += 4;
 
-	patch->lazperf = pcalloc( patch->lazperfsize );
-	memcpy(patch->lazperf, buf, patch->lazperfsize);
+	pc_patch_lazperf_set_stored(patch, buf, lazperfsize, serpatch->compression);
 
 	return (PCPATCH*)patch;
 }
@@ -981,7 +1225,7 @@ pc_patch_lazperf_deserialize(const SERIALIZED_PATCH *serpatch, const PCSCHEMA *s
 PCPATCH *
 pc_patch_deserialize(const SERIALIZED_PATCH *serpatch, const PCSCHEMA *schema)
 {
-	switch(serpatch->compression)
+	switch(serpatch->compression & ~PC_WKB_FLAGS)
 	{
 	case PC_NONE:
 		return pc_patch_uncompressed_deserialize(serpatch, schema);
@@ -24,6 +24,10 @@
 #define POINTCLOUD_FORMATS_XML "schema"
 #define POINTCLOUD_FORMATS_SRID "srid"
 
+#define POINTCLOUD_DICTIONARIES "pointcloud_dictionaries"
+#define POINTCLOUD_DICTIONARIES_DIMENSION "dimension"
+#define POINTCLOUD_DICTIONARIES_DICTIONARY "dictionary"
+
 #define PG_GETARG_SERPOINT_P(argnum) (SERIALIZED_POINT*)PG_DETOAST_DATUM(PG_GETARG_DATUM(argnum))
 #define PG_GETARG_SERPATCH_P(argnum) (SERIALIZED_PATCH*)PG_DETOAST_DATUM(PG_GETARG_DATUM(argnum))
 
@@ -66,7 +70,7 @@ typedef struct
 {
 	uint32_t size;
 	uint32_t pcid;
-	uint32_t compression;
+	uint32_t compression; /* | PC_WKB_LAZHEADER, as in wkb */
 	uint32_t npoints;
 	PCBOUNDS bounds;
 	uint8_t data[1];
@@ -83,6 +87,12 @@ PCSCHEMA* pc_schema_from_pcid(uint32_t pcid, FunctionCallInfoData *fcinfo);
 /** Look-up the PCID in the POINTCLOUD_FORMATS table, and construct a PC_SCHEMA from the XML therein */
 PCSCHEMA* pc_schema_from_pcid_uncached(uint32 pcid);
 
+/** Define the recompression worker GUCs, and register the worker when preloaded */
+void pc_recompress_worker_init(void);
+
+/** Index a bytea[] of WKB polygons, the index of the previous call is reused if the array is the same */
+PCPOLYINDEX* pc_polyindex_from_array(ArrayType *array, FunctionCallInfoData *fcinfo);
+
 /** Turn a PCPOINT into a byte buffer suitable for saving in PgSQL */
 SERIALIZED_POINT* pc_point_serialize(const PCPOINT *pcpt);
 
@@ -107,6 +117,9 @@ SERIALIZED_PATCH* pc_patch_serialize_to_uncompressed(const PCPATCH *patch);
 /** Turn a byte buffer into a PCPATCH for processing */
 PCPATCH* pc_patch_deserialize(const SERIALIZED_PATCH *serpatch, const PCSCHEMA *schema);
 
+/** Turn a hex string straight into a byte buffer suitable for saving in PgSQL */
+SERIALIZED_PATCH* pc_patch_serialize_from_hexwkb(const char *hexwkb, size_t hexlen, FunctionCallInfoData *fcinfo);
+
 /** Create a new readwrite PCPATCH from a hex string */
 PCPATCH* pc_patch_from_hexwkb(const char *hexwkb, size_t hexlen, FunctionCallInfoData *fcinfo);
 
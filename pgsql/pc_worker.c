@@ -0,0 +1,319 @@
+/***********************************************************************
+* pc_worker.c
+*
+*  Background worker recompressing the tables registered in
+*  pointcloud_recompress, by running PC_RecompressStep one batch per
+*  transaction and sleeping between batches to stay within a CPU and
+*  an I/O budget. Progress is kept in pointcloud_recompress, so the
+*  worker picks up where it left off after a restart, and a table a
+*  batch fails on is left aside with its error. The worker is
+*  only started when the library is in shared_preload_libraries and
+*  pointcloud.recompress_database is set.
+*
+*  PgSQL Pointcloud is free and open source software provided
+*  by the Government of Canada
+*  Copyright (c) 2013 Natural Resources Canada
+*
+***********************************************************************/
+
+#include "pc_pgsql.h"      /* Common PgSQL support for our type */
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "access/xact.h"
+#include "executor/spi.h"
+#include "postmaster/bgworker.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/proc.h"
+#include "utils/guc.h"
+#include "utils/snapmgr.h"
+#include "portability/instr_time.h"
+
+void pc_recompress_worker_main(Datum arg);
+
+/* GUCs */
+static char *recompress_database = NULL;
+static int recompress_naptime = 60;
+static int recompress_cpu_limit = 10;
+static int recompress_io_limit = 1024;
+
+static volatile sig_atomic_t got_sighup = false;
+static volatile sig_atomic_t got_sigterm = false;
+
+static void
+pc_recompress_sigterm(SIGNAL_ARGS)
+{
+	int save_errno = errno;
+	got_sigterm = true;
+	SetLatch(MyLatch);
+	errno = save_errno;
+}
+
+static void
+pc_recompress_sighup(SIGNAL_ARGS)
+{
+	int save_errno = errno;
+	got_sighup = true;
+	SetLatch(MyLatch);
+	errno = save_errno;
+}
+
+/**
+* Point the search path of the transaction to the extension schema,
+* returns false when the extension is not installed.
+*/
+static bool
+pc_recompress_search_path(void)
+{
+	/* The extension may not be installed, or be in any schema */
+	int err = SPI_execute("SELECT set_config('search_path', quote_ident(n.nspname), true) "
+	                      "FROM pg_catalog.pg_extension e JOIN pg_catalog.pg_namespace n "
+	                      "ON n.oid = e.extnamespace WHERE e.extname = 'pointcloud'", false, 1);
+	if ( err != SPI_OK_SELECT )
+		elog(ERROR, "%s: error (%d) looking up the pointcloud extension", __func__, err);
+	return SPI_processed > 0;
+}
+
+/**
+* Give up on a table the worker failed to recompress, so that the
+* other ones still get their turn, keeping the error to be looked at.
+*/
+static void
+pc_recompress_fail(Oid relid, const char *message)
+{
+	MemoryContext oldcontext = CurrentMemoryContext;
+
+	PG_TRY();
+	{
+		Oid argtypes[2] = { OIDOID, TEXTOID };
+		Datum args[2];
+		int err;
+
+		SetCurrentStatementStartTimestamp();
+		StartTransactionCommand();
+		SPI_connect();
+		PushActiveSnapshot(GetTransactionSnapshot());
+
+		if ( pc_recompress_search_path() )
+		{
+			args[0] = ObjectIdGetDatum(relid);
+			args[1] = CStringGetTextDatum(message);
+			err = SPI_execute_with_args("UPDATE pointcloud_recompress SET done = true, last_error = $2 "
+			                            "WHERE tbl = $1", 2, argtypes, args, NULL, false, 0);
+			if ( err != SPI_OK_UPDATE )
+				elog(ERROR, "%s: error (%d) recording the failure", __func__, err);
+		}
+
+		SPI_finish();
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+	}
+	PG_CATCH();
+	{
+		MemoryContextSwitchTo(oldcontext);
+		EmitErrorReport();
+		FlushErrorState();
+		AbortCurrentTransaction();
+	}
+	PG_END_TRY();
+}
+
+/**
+* Run one PC_RecompressStep in a transaction of its own, with the
+* extension schema as search path. Returns the number of bytes
+* written, or -1 when there is nothing to do or the step failed.
+* A table the step fails on is marked done, with the error.
+*/
+static int64
+pc_recompress_step(void)
+{
+	volatile int64 bytes = -1;
+	volatile Oid relid = InvalidOid;
+	MemoryContext oldcontext = CurrentMemoryContext;
+
+	PG_TRY();
+	{
+		int err;
+
+		SetCurrentStatementStartTimestamp();
+		StartTransactionCommand();
+		SPI_connect();
+		PushActiveSnapshot(GetTransactionSnapshot());
+		pgstat_report_activity(STATE_RUNNING, "SELECT PC_RecompressStep()");
+
+		if ( pc_recompress_search_path() )
+		{
+			/* Pick the table first, to know which one to give up on */
+			err = SPI_execute("SELECT r.tbl FROM pointcloud_recompress r WHERE NOT r.done "
+			                  "AND EXISTS (SELECT 1 FROM pg_catalog.pg_class c WHERE c.oid = r.tbl) "
+			                  "ORDER BY r.tbl LIMIT 1", false, 1);
+			if ( err != SPI_OK_SELECT )
+				elog(ERROR, "%s: error (%d) looking up the tables to recompress", __func__, err);
+
+			if ( SPI_processed > 0 )
+			{
+				bool isnull;
+				Oid argtypes[1] = { REGCLASSOID };
+				Datum args[1];
+
+				relid = DatumGetObjectId(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
+				args[0] = ObjectIdGetDatum(relid);
+				err = SPI_execute_with_args("SELECT PC_RecompressStep($1)", 1, argtypes, args, NULL, false, 1);
+				if ( err != SPI_OK_SELECT )
+					elog(ERROR, "%s: error (%d) running PC_RecompressStep", __func__, err);
+
+				if ( SPI_processed > 0 )
+				{
+					Datum d = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull);
+					if ( ! isnull )
+						bytes = DatumGetInt64(d);
+				}
+			}
+		}
+
+		SPI_finish();
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+	}
+	PG_CATCH();
+	{
+		ErrorData *edata;
+
+		/* Report and keep the error out of the aborted transaction */
+		MemoryContextSwitchTo(oldcontext);
+		EmitErrorReport();
+		edata = CopyErrorData();
+		FlushErrorState();
+		AbortCurrentTransaction();
+
+		if ( OidIsValid(relid) )
+			pc_recompress_fail(relid, edata->message);
+		FreeErrorData(edata);
+		bytes = -1;
+	}
+	PG_END_TRY();
+
+	pgstat_report_stat(false);
+	pgstat_report_activity(STATE_IDLE, NULL);
+
+	return bytes;
+}
+
+/**
+* Time to sleep after a batch that took elapsed_ms and wrote bytes,
+* the longest of what the CPU and the I/O budgets call for.
+*/
+static long
+pc_recompress_delay(double elapsed_ms, int64 bytes)
+{
+	double cpu_ms = elapsed_ms * (100 - recompress_cpu_limit) / recompress_cpu_limit;
+	double io_ms = recompress_io_limit > 0 ? 1000.0 * bytes / 1024 / recompress_io_limit : 0;
+	return (long)(cpu_ms > io_ms ? cpu_ms : io_ms);
+}
+
+void
+pc_recompress_worker_main(Datum arg)
+{
+	pqsignal(SIGHUP, pc_recompress_sighup);
+	pqsignal(SIGTERM, pc_recompress_sigterm);
+	BackgroundWorkerUnblockSignals();
+
+#if PG_VERSION_NUM >= 110000
+	BackgroundWorkerInitializeConnection(recompress_database, NULL, 0);
+#else
+	BackgroundWorkerInitializeConnection(recompress_database, NULL);
+#endif
+
+	elog(LOG, "pointcloud recompression worker started on database \"%s\"", recompress_database);
+
+	while ( ! got_sigterm )
+	{
+		instr_time start, elapsed;
+		int64 bytes;
+		long delay;
+		int rc;
+
+		INSTR_TIME_SET_CURRENT(start);
+		bytes = pc_recompress_step();
+		INSTR_TIME_SET_CURRENT(elapsed);
+		INSTR_TIME_SUBTRACT(elapsed, start);
+
+		if ( bytes < 0 )
+			delay = recompress_naptime * 1000L;
+		else
+			delay = pc_recompress_delay(INSTR_TIME_GET_MILLISEC(elapsed), bytes);
+
+#if PG_VERSION_NUM >= 100000
+		rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, delay, PG_WAIT_EXTENSION);
+#else
+		rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, delay);
+#endif
+		ResetLatch(MyLatch);
+
+		if ( rc & WL_POSTMASTER_DEATH )
+			proc_exit(1);
+
+		CHECK_FOR_INTERRUPTS();
+
+		if ( got_sighup )
+		{
+			got_sighup = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+	}
+
+	proc_exit(0);
+}
+
+/**
+* Define the GUCs of the worker, and register it when the library
+* is preloaded and a database is configured.
+*/
+void
+pc_recompress_worker_init(void)
+{
+	BackgroundWorker worker;
+	char major[BGW_MAXLEN], *dot;
+
+	if ( ! process_shared_preload_libraries_in_progress )
+		return;
+
+	DefineCustomStringVariable("pointcloud.recompress_database",
+		"Database the recompression worker connects to.",
+		"The worker is not started when empty.",
+		&recompress_database, NULL, PGC_POSTMASTER, 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pointcloud.recompress_naptime",
+		"Time to sleep when there is nothing to recompress.",
+		NULL, &recompress_naptime, 60, 1, INT_MAX / 1000,
+		PGC_SIGHUP, GUC_UNIT_S, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pointcloud.recompress_cpu_limit",
+		"Share of the time, in percent, the recompression worker spends working.",
+		NULL, &recompress_cpu_limit, 10, 1, 100,
+		PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pointcloud.recompress_io_limit",
+		"Rate at which the recompression worker writes patches, in kB per second.",
+		"Zero means no limit.", &recompress_io_limit, 1024, 0, INT_MAX,
+		PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+	if ( ! recompress_database || ! *recompress_database )
+		return;
+
+	memset(&worker, 0, sizeof(worker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+	worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+	worker.bgw_restart_time = 60;
+	snprintf(worker.bgw_name, BGW_MAXLEN, "pointcloud recompression worker");
+
+	/* The library is named after the major version, see MODULE_big */
+	strlcpy(major, POINTCLOUD_VERSION, BGW_MAXLEN);
+	dot = strrchr(major, '.');
+	if ( dot )
+		*dot = '\0';
+	snprintf(worker.bgw_library_name, BGW_MAXLEN, "pointcloud-%s", major);
+	snprintf(worker.bgw_function_name, BGW_MAXLEN, "pc_recompress_worker_main");
+	worker.bgw_main_arg = (Datum) 0;
+	RegisterBackgroundWorker(&worker);
+}
@@ -89,6 +89,11 @@ SELECT pc_astext(PC_FilterGreaterThan(pa, 'z', 1595)) FROM pa_test_laz;
 SELECT pc_astext(PC_FilterEquals(pa, 'z', 500)) FROM pa_test_laz;
 SELECT pc_astext(PC_FilterBetween(pa, 'z', 500, 505)) FROM pa_test_laz;
 
+-- chunked patches
+SELECT PC_AsText(PC_Range(PC_Compress(pa, 'laz', '100'), 98, 4)) = PC_AsText(PC_Range(pa, 98, 4)) FROM pa_test_laz WHERE PC_NumPoints(pa) > 1;
+SELECT PC_AsText(PC_PointN(PC_Compress(pa, 'laz', '100'), 250)) = PC_AsText(PC_PointN(pa, 250)) FROM pa_test_laz WHERE PC_NumPoints(pa) > 1;
+SELECT Sum(PC_NumPoints(PC_FilterBox(PC_Compress(pa, 'laz', '100'), -126.005, 40, -125.495, 50))) FROM pa_test_laz;
+
 DELETE FROM pa_test_laz;
 INSERT INTO pa_test_laz( pa ) VALUES ('01050000000300000004000000210000000000000000000000000000000a004417593a34c1c5f74f83179fc2448960000000');
 
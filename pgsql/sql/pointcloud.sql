@@ -329,10 +329,119 @@ SELECT Min(PC_PatchMin(pa,'z')) FROM pa_test_dim;
 SELECT PC_Get(PC_PatchMax(pa)) FROM pa_test_dim order by 1 limit 1;
 SELECT PC_Get(PC_PatchMin(pa)) FROM pa_test_dim order by 1 limit 1;
 SELECT PC_Get(PC_PatchAvg(pa)) FROM pa_test_dim order by 1 limit 1;
-
+SELECT count(*), sum(z) FROM (SELECT unnest(PC_Get(pa, 'z')) z FROM pa_test_dim) s;
+
+SELECT sum(PC_NumPoints(PC_FilterBox(pa, -126.505, 45.495, -125.495, 46.505))) FROM pa_test_dim;
+SELECT count(PC_FilterBox(pa, -126.505, 45.495, -125.495, 46.505)) FROM pa_test_dim;
+SELECT min(PC_PatchMin(f,'x')) xmin, max(PC_PatchMax(f,'x')) xmax, max(PC_PatchMax(f,'z')) zmax
+FROM (SELECT PC_FilterBox(pa, -126.505, 45.495, -125.495, 46.505) f FROM pa_test_dim) s;
+SELECT sum(PC_NumPoints(PC_FilterBox(pa, -180, -90, 180, 90))) FROM pa_test_dim;
+SELECT count(PC_FilterBox(pa, 0, 0, 1, 1)) FROM pa_test_dim;
+
+-- Dimensional WKB in the schema compression is adopted as it is
+SELECT count(*) FROM pa_test_dim
+WHERE PC_AsText(pa::text::pcpatch) = PC_AsText(pa)
+AND PC_MemSize(pa::text::pcpatch) = PC_MemSize(pa)
+AND PC_EnvelopeAsBinary(pa::text::pcpatch) = PC_EnvelopeAsBinary(pa)
+AND PC_AsText(PC_PatchMax(pa::text::pcpatch)) = PC_AsText(PC_PatchMax(pa));
+SELECT substr(pa::text, 1, length(pa::text) - 2)::pcpatch FROM pa_test_dim LIMIT 1;
+
+-- Patch WKB carrying its bounds and stats
+SELECT PC_AsText(pa), PC_PatchMax(pa, 'z'), PC_PatchAvg(pa, 'intensity')
+FROM (SELECT '01030000000203000002000000000000000000F03F00000000000014400000000000000040000000000000184064000000C80000002C0100000400F401000058020000BC02000008002C01000090010000F40100000600000800000064000000F40100000008000000C80000005802000000080000002C010000BC020000000400000004000800'::pcpatch(3) pa) s;
+
+-- Append and delete points
+SELECT PC_AsText(p), PC_PatchMax(p, 'x'), PC_PatchAvg(p, 'intensity')
+FROM (SELECT PC_Append(PC_MakePatch(3, ARRAY[1, 2, 3.0, 4, 5, 6, 7.0, 8]),
+                       PC_MakePatch(3, ARRAY[9, 10, 11.0, 12])) p) s;
+SELECT PC_AsText(PC_DeletePoints(p, ARRAY[1, 3, 3])) kept,
+  PC_PatchMin(PC_DeletePoints(p, ARRAY[1, 3, 3]), 'x') xmin,
+  PC_DeletePoints(p, ARRAY[1, 2, 3]) IS NULL all_deleted
+FROM (SELECT PC_MakePatch(3, ARRAY[1, 2, 3.0, 4, 5, 6, 7.0, 8, 9, 10, 11.0, 12]) p) s;
+SELECT PC_DeletePoints(PC_MakePatch(3, ARRAY[1, 2, 3.0, 4]), ARRAY[2]);
+
+-- Sample a grid into a dimension
+SELECT PC_AsText(PC_SampleGrid(p, g, gt, 'z')) nearest,
+  PC_AsText(PC_SampleGrid(p, g, gt, 'z', 'bilinear')) bilinear,
+  PC_PatchMax(PC_SampleGrid(p, g, gt, 'z'), 'z') zmax
+FROM (SELECT PC_MakePatch(3, ARRAY[0.5, 2.5, 0, 7, 1, 2, 0, 7, 5, 5, 0, 7]) p,
+  ARRAY[[10, 20, 30], [40, 50, 60], [70, 80, NULL]]::float8[] g,
+  ARRAY[0, 1, 0, 3, 0, -1]::float8[] gt) s;
+SELECT PC_SampleGrid(PC_MakePatch(3, ARRAY[1, 2, 3.0, 4]), ARRAY[[1.0]], ARRAY[0, 1, 0, 0, 0, -1.0], 'z', 'cubic');
+
+-- Affine transform
+SELECT PC_AsText(PC_Affine(p, m)) affine, PC_PatchMin(PC_Affine(p, m), 'x') xmin,
+  PC_PatchMax(PC_Affine(p, m), 'intensity') imax
+FROM (SELECT PC_MakePatch(3, ARRAY[1, 2, 3.0, 4, 5, 6, 7.0, 8]) p,
+  ARRAY[[0, -1, 0, 10], [1, 0, 0, 20], [0, 0, 1, 1], [0, 0, 0, 1]]::float8[] m) s;
+SELECT PC_Affine(PC_MakePatch(3, ARRAY[1, 2, 3.0, 4]), ARRAY[1, 0, 0, 1e8, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1]);
+
+-- Elevation surface
+SELECT PC_Surface(p, 0, 3, 1, 4, 3, 'mean', 'none', 0) mean,
+  PC_Surface(p, 0, 3, 1, 4, 3, 'max', 'idw', 1) filled
+FROM (VALUES (PC_MakePatch(3, ARRAY[0.5, 2.5, 1, 0, 0.25, 2.25, 3, 0, 2.5, 0.5, 5, 0])),
+  (PC_Compress(PC_MakePatch(3, ARRAY[3.5, 2.5, 9, 0, 4.5, 1.5, 21, 0]), 'dimensional')),
+  (NULL)) v(p);
+SELECT PC_Surface(PC_MakePatch(3, ARRAY[1, 2, 3.0, 4]), 0, 3, 1, 4, 3, 'median', 'none', 0);
+
+-- Time slice
+SELECT PC_AsText(PC_TimeSlice(p, 'intensity', 2, 9)) slice,
+  PC_TimeSlice(p, 'intensity', 20, 30) IS NULL empty
+FROM (VALUES (PC_MakePatch(3, ARRAY[1, 0, 0, 1, 3, 0, 0, 3, 5, 0, 0, 5, 7, 0, 0, 7, 9, 0, 0, 9])),
+  (PC_MakePatch(3, ARRAY[2, 0, 0, 2, 4, 0, 0, 4, 6, 0, 0, 6, 8, 0, 0, 8, 10, 0, 0, 10])),
+  (PC_MakePatch(3, ARRAY[6.5, 0, 0, 6, 1.5, 0, 0, 1, 11, 0, 0, 11, 4.5, 0, 0, 4])),
+  (NULL)) v(p);
+
+-- Column groups
+SELECT PC_AddColumnGroup(3, 30, ARRAY['z']) hot, PC_AddColumnGroup(3, 31, ARRAY['intensity']) cold;
+SELECT PC_AsText(PC_ColumnGroup(p, 30)) hot, PC_AsText(PC_ColumnGroup(p, 31)) cold,
+  PC_AsText(PC_Zip(PC_ColumnGroup(p, 31), PC_ColumnGroup(p, 30), 3)) = PC_AsText(p) zipped
+FROM (SELECT PC_MakePatch(3, ARRAY[1, 2, 3.0, 4, 5, 6, 7.0, 8]) p) s;
+SELECT PC_Zip(ARRAY[PC_ColumnGroup(PC_MakePatch(3, ARRAY[1, 2, 3.0, 4]), 30), PC_ColumnGroup(PC_MakePatch(3, ARRAY[1, 2, 3.0, 4, 5, 6, 7.0, 8]), 31)], 3);
+SELECT PC_SchemaSubset(schema, ARRAY['w']) FROM pointcloud_formats WHERE pcid = 3;
 
 SELECT PC_Summary(pa) summary FROM pa_test_dim order by 1 limit 1;
 
+SELECT compression, size > 0 AS sized, ratio > 0 AS ratioed
+FROM PC_CompressionAdvisor('pa_test_dim', 'pa', 100)
+WHERE compression IN ('none', 'dimensional')
+ORDER BY compression, config;
+
+SELECT count(DISTINCT rank) = count(*) AS ranked
+FROM PC_CompressionAdvisor('pa_test_dim', 'pa', 100);
+
+SELECT PC_TrainDictionaries('pa_test_dim', 'pa', 100);
+SELECT PC_TrainDictionaries('pa_test_dim', 'pa', 100);
+SELECT pcid, dimension, length(dictionary) > 0 AS trained
+FROM pointcloud_dictionaries ORDER BY dimension;
+SELECT count(*) FROM pa_test_dim
+WHERE PC_AsText(PC_Compress(pa, 'dimensional', 'zlib,zlib,zlib,zlib')) <> PC_AsText(pa);
+DELETE FROM pointcloud_dictionaries;
+
+-- Compact small patches, in Morton order
+CREATE TABLE pa_test_compact (pa pcpatch(3));
+INSERT INTO pa_test_compact
+SELECT PC_MakePatch(3, ARRAY[i, i, i, i]::float8[]) FROM generate_series(10, 1, -1) i;
+INSERT INTO pa_test_compact
+SELECT PC_MakePatch(3, ARRAY[100, 100, 1, 1, 101, 101, 1, 1, 102, 102, 1, 1, 103, 103, 1, 1, 104, 104, 1, 1]);
+SELECT PC_AsText(pa) FROM PC_Compact('pa_test_compact', 'pa', 4) pa ORDER BY PC_MortonKey(pa);
+SELECT count(*), sum(PC_NumPoints(pa)) FROM PC_Compact('pa_test_compact', 'pa') pa;
+SELECT PC_Compact('pa_test_compact', 'pa', 0);
+DROP TABLE pa_test_compact;
+
+-- Recompress a registered table one batch at a time
+CREATE TABLE pa_test_recompress (pa pcpatch(3));
+INSERT INTO pa_test_recompress
+SELECT PC_MakePatch(3, ARRAY[2, 2, i, i, 1, 1, i, i]::float8[]) FROM generate_series(1, 5) i;
+SELECT PC_RecompressTable('pa_test_recompress', 'pa', 'dimensional', '', ARRAY['x'], 2);
+SELECT PC_RecompressStep('pa_test_recompress') > 0 AS wrote;
+SELECT PC_RecompressStep();
+SELECT patches, done FROM pointcloud_recompress;
+SELECT PC_RecompressStep() IS NULL AS idle;
+SELECT count(*) FROM pa_test_recompress WHERE PC_Compression(pa) = 2;
+SELECT PC_AsText(pa) FROM pa_test_recompress WHERE PC_PatchMin(pa, 'z') = 5;
+DELETE FROM pointcloud_recompress;
+DROP TABLE pa_test_recompress;
 
 --DROP TABLE pts_collection;
 DROP TABLE pt_test;
@@ -345,6 +454,16 @@ SELECT PC_AsText(PC_Patch(ARRAY[PC_MakePoint(3, ARRAY[-127, 45, 124.0, 4.0])]::p
 SELECT 'pc_id1', PC_PCId(PC_Patch(PC_MakePoint(3, ARRAY[-1,-2,-3,-4])));
 SELECT 'pc_id2', PC_PCId(PC_MakePoint(3, ARRAY[-1,-2,-3,-4]));
 
+SELECT PC_AsText(PC_MakePatch(3, ARRAY[-127, 45, 124.0, 4.0, -126, 46, 125.0, 5.0]));
+SELECT PC_MakePatch(3, ARRAY[-127, 45, 124.0]);
+
+-- Built patches are compressed as the schema says
+SELECT (SELECT string_agg(d->>'compr', ',') FROM json_array_elements(PC_Summary(p)::json->'dims') d) compr,
+  PC_MemSize(p) < PC_MemSize(PC_Uncompress(p)) smaller
+FROM (SELECT PC_Patch(PC_MakePoint(3, ARRAY[i, 1, 2, 10])) p FROM generate_series(1, 100) i
+  UNION ALL
+  SELECT PC_MakePatch(3, array_agg(v)) FROM generate_series(1, 100) i, unnest(ARRAY[i, 1, 2, 10]) v) s;
+
 -- Test PC_Compress
 -- Also regression tests for
 -- https://github.com/pgpointcloud/pointcloud/issues/69
@@ -376,6 +495,7 @@ FROM p1, ( values
   ('dimensional','rle'),
   ('dimensional','zlib'),
   ('dimensional','sigbits'),
+  ('dimensional','pfor'),
   ('dimensional','auto'),
   ('laz','null')
   -- ,('ght',null) -- fails due to https://github.com/pgpointcloud/pointcloud/issues/35
@@ -415,6 +535,37 @@ SELECT PC_BoundingDiagonalAsBinary(
 		PC_MakePoint(1, ARRAY[1.,1.,1.,10.]),
 		PC_MakePoint(1, ARRAY[10.,10.,10.,10.])]));
 
+-- test for PC_AsMultiPoint
+SELECT PC_AsMultiPoint(
+	PC_Patch(ARRAY[
+		PC_MakePoint(1, ARRAY[0.,0.,0.,10.]),
+		PC_MakePoint(1, ARRAY[1.,1.,1.,10.]),
+		PC_MakePoint(1, ARRAY[10.,10.,10.,10.])]));
+
+-- test for PC_SplitByPolygons and PC_ClassifyByPolygons
+-- polygon 1 is the 0,0 5,5 box, 2 is NULL, 3 is the 5,5 20,20 box
+WITH p AS (SELECT
+	PC_Patch(ARRAY[
+		PC_MakePoint(1, ARRAY[0.,0.,0.,10.]),
+		PC_MakePoint(1, ARRAY[1.,1.,1.,10.]),
+		PC_MakePoint(1, ARRAY[10.,10.,10.,10.]),
+		PC_MakePoint(1, ARRAY[30.,30.,30.,10.])]) pa,
+	ARRAY['\x010300000001000000050000000000000000000000000000000000000000000000000014400000000000000000000000000000144000000000000014400000000000000000000000000000144000000000000000000000000000000000'::bytea,
+		NULL,
+		'\x010300000001000000050000000000000000001440000000000000144000000000000034400000000000001440000000000000344000000000000034400000000000001440000000000000344000000000000014400000000000001440'::bytea] polys)
+SELECT n, PC_AsText(sub)
+FROM p, unnest(PC_SplitByPolygons(pa, polys)) WITH ORDINALITY AS u(sub, n);
+WITH p AS (SELECT
+	PC_Patch(ARRAY[
+		PC_MakePoint(1, ARRAY[0.,0.,0.,10.]),
+		PC_MakePoint(1, ARRAY[1.,1.,1.,10.]),
+		PC_MakePoint(1, ARRAY[10.,10.,10.,10.]),
+		PC_MakePoint(1, ARRAY[30.,30.,30.,10.])]) pa,
+	ARRAY['\x010300000001000000050000000000000000000000000000000000000000000000000014400000000000000000000000000000144000000000000014400000000000000000000000000000144000000000000000000000000000000000'::bytea,
+		NULL,
+		'\x010300000001000000050000000000000000001440000000000000144000000000000034400000000000001440000000000000344000000000000034400000000000001440000000000000344000000000000014400000000000001440'::bytea] polys)
+SELECT PC_AsText(PC_ClassifyByPolygons(pa, polys, 1, 'intensity')) FROM p;
+
 -- test PC_SetPCId
 -- from pcid 1 to 1 (same dimensions, same positions, same compressions)
 -- pcid 1: (X,Y,Z,I), scaled, uncompressed
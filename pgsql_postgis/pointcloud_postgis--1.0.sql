@@ -13,6 +13,23 @@ CREATE OR REPLACE FUNCTION PC_Intersection(pcpatch, geometry)
 	$$
 	LANGUAGE 'sql';
 
+-----------------------------------------------------------------------------
+-- Functions to classify the points of a patch against many polygons
+--
+CREATE OR REPLACE FUNCTION PC_SplitByPolygons(pcpatch, geometry[])
+	RETURNS pcpatch[] AS
+	$$
+		SELECT PC_SplitByPolygons($1, ARRAY(SELECT ST_AsBinary(g) FROM unnest($2) WITH ORDINALITY AS u(g, n) ORDER BY n))
+	$$
+	LANGUAGE 'sql';
+
+CREATE OR REPLACE FUNCTION PC_ClassifyByPolygons(pcpatch, geometry[], int4, text)
+	RETURNS pcpatch AS
+	$$
+		SELECT PC_ClassifyByPolygons($1, ARRAY(SELECT ST_AsBinary(g) FROM unnest($2) WITH ORDINALITY AS u(g, n) ORDER BY n), $3, $4)
+	$$
+	LANGUAGE 'sql';
+
 -----------------------------------------------------------------------------
 -- Cast from pcpatch to polygon
 --
@@ -32,6 +49,16 @@ CREATE OR REPLACE FUNCTION geometry(pcpatch)
 
 CREATE CAST (pcpatch AS geometry) WITH FUNCTION PC_EnvelopeGeometry(pcpatch);
 
+-----------------------------------------------------------------------------
+-- Function from pcpatch to MultiPoint
+--
+CREATE OR REPLACE FUNCTION PC_MultiPointGeometry(pcpatch)
+	RETURNS geometry AS
+	$$
+		SELECT ST_GeomFromEWKB(PC_AsMultiPoint($1))
+	$$
+	LANGUAGE 'sql';
+
 
 -----------------------------------------------------------------------------
 -- Cast from pcpoint to point